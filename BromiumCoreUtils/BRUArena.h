@@ -0,0 +1,92 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "BRUBaseDefines.h"
+#import "BRUMemoryRegion.h"
+
+/**
+ * A position in a `BRUArena` to reset it to, see `-[BRUArena mark]`.
+ */
+typedef struct {
+    size_t chunkCount;
+    size_t used; /* bytes used in the last chunk */
+} BRUArenaMark;
+
+BRU_assume_nonnull_begin
+
+/**
+ * A `BRUArena` is a bump allocator: it hands out regions of large chunks of memory, one after the other, and frees them
+ * all at once when it's reset or deallocated. Allocating is a pointer bump (plus a chunk allocation every
+ * `chunkSize` bytes), there's no per-region free.
+ *
+ * Allocations larger than a chunk get a chunk of their own. With `usesThreadLocalFreeList`, released chunks are kept
+ * in a small per-thread cache and reused by the next arena on that thread instead of going back to `malloc`.
+ *
+ * Arenas aren't thread-safe. Regions are valid until the arena is reset past them or deallocated.
+ */
+BRU_restrict_subclassing @interface BRUArena : NSObject
+
+BRU_DEFAULT_INIT_UNAVAILABLE(null_unspecified)
+
+@property (nonatomic, readonly, assign) size_t chunkSize;
+@property (nonatomic, readonly, assign) BOOL usesThreadLocalFreeList;
+
+/**
+ * The bytes of all chunks the arena holds.
+ */
+@property (nonatomic, readonly, assign) size_t bytesReserved;
+
+/**
+ * Create an arena with 64 KiB chunks, using the thread-local free list.
+ */
++ (instancetype)arena;
+
+/**
+ * Initialise an arena.
+ *
+ * @param chunkSize The usable size of the chunks, must be positive.
+ * @param usesThreadLocalFreeList Whether to take chunks from (and return them to) the current thread's free list.
+ */
+- (instancetype)initWithChunkSize:(size_t)chunkSize
+          usesThreadLocalFreeList:(BOOL)usesThreadLocalFreeList NS_DESIGNATED_INITIALIZER;
+
+/**
+ * Allocate an uninitialised region.
+ *
+ * @param length The length of the region.
+ * @param alignment The alignment of the region's base address, must be a power of two.
+ *
+ * @return The region or, if the length is too large to be allocated (or memory runs out), `BRUMemoryRegionNull`.
+ */
+- (BRUMemoryRegion)allocateRegionWithLength:(size_t)length alignment:(size_t)alignment;
+
+/**
+ * Allocate an uninitialised region aligned for any type, see `allocateRegionWithLength:alignment:`.
+ */
+- (BRUMemoryRegion)allocateRegionWithLength:(size_t)length;
+
+/**
+ * Returns the current position, to free everything allocated after it with `resetToMark:`.
+ */
+- (BRUArenaMark)mark;
+
+/**
+ * Free everything allocated since `mark` was taken. The mark (and any mark taken after it) can't be used after an
+ * earlier mark was reset to.
+ */
+- (void)resetToMark:(BRUArenaMark)mark;
+
+/**
+ * Free everything.
+ */
+- (void)reset;
+
+@end
+
+BRU_assume_nonnull_end
@@ -0,0 +1,268 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#import "BRUArena.h"
+#import "BRUArithmetic.h"
+#import "BRUAsserts.h"
+
+/* the number of chunks each thread's free list keeps at most, the rest goes back to malloc */
+#define BRU_ARENA_FREE_LIST_MAX_CHUNKS 16
+
+static const size_t BRUArenaDefaultChunkSize = 64 * 1024;
+
+/* enough for any scalar type */
+static const size_t BRUArenaDefaultAlignment = 16;
+
+/**
+ * The header of a malloc'ed chunk, its usable bytes follow.
+ */
+typedef struct BRUArenaChunk {
+    struct BRUArenaChunk *next; /* in a free list */
+    size_t size;
+} BRUArenaChunk;
+
+typedef struct {
+    BRUArenaChunk *head;
+    size_t count;
+} BRUArenaFreeList;
+
+static uint8_t *chunkBytes(BRUArenaChunk *chunk)
+{
+    return (uint8_t *)(chunk + 1);
+}
+
+#pragma mark - Helpers
+
+static pthread_key_t freeListKey;
+
+static void destroyFreeList(void *value)
+{
+    BRUArenaFreeList *freeList = value;
+    while (freeList->head) {
+        BRUArenaChunk *chunk = freeList->head;
+        freeList->head = chunk->next;
+        free(chunk);
+    }
+    free(freeList);
+}
+
+/**
+ * Returns the current thread's free list, creating it if needed.
+ */
+static BRUArenaFreeList *threadFreeList(void)
+{
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        int err = pthread_key_create(&freeListKey, destroyFreeList);
+        BRUAssertAlwaysFatal(0 == err, @"pthread_key_create failed: %d", err);
+    });
+    BRUArenaFreeList *freeList = pthread_getspecific(freeListKey);
+    if (NULL == freeList) {
+        freeList = calloc(1, sizeof(*freeList));
+        BRUAssertAlwaysFatal(freeList, @"out of memory");
+        pthread_setspecific(freeListKey, freeList);
+    }
+    return freeList;
+}
+
+static BRUArenaChunk *newChunk(size_t size, BOOL useFreeList)
+{
+    if (useFreeList) {
+        BRUArenaFreeList *freeList = threadFreeList();
+        for (BRUArenaChunk **link = &freeList->head; *link; link = &(*link)->next) {
+            BRUArenaChunk *chunk = *link;
+            if (chunk->size == size) {
+                *link = chunk->next;
+                freeList->count--;
+                return chunk;
+            }
+        }
+    }
+    size_t mallocSize = 0;
+    if (!bru_size_add_2(sizeof(BRUArenaChunk), size, &mallocSize)) {
+        return NULL;
+    }
+    BRUArenaChunk *chunk = malloc(mallocSize);
+    if (NULL == chunk) {
+        /* the length may well come from untrusted input, that's no reason to abort */
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->size = size;
+    return chunk;
+}
+
+static void releaseChunk(BRUArenaChunk *chunk, BOOL useFreeList)
+{
+    if (useFreeList) {
+        BRUArenaFreeList *freeList = threadFreeList();
+        if (freeList->count < BRU_ARENA_FREE_LIST_MAX_CHUNKS) {
+            chunk->next = freeList->head;
+            freeList->head = chunk;
+            freeList->count++;
+            return;
+        }
+    }
+    free(chunk);
+}
+
+/**
+ * Carves a region out of `chunk` after its first `*used` bytes, bumping `*used`.
+ *
+ * @return false if the region doesn't fit.
+ */
+static bool bumpChunk(BRUArenaChunk *chunk, size_t *used, size_t length, size_t alignment, uint8_t **result)
+{
+    uintptr_t next = (uintptr_t)chunkBytes(chunk) + *used;
+    size_t padding = (alignment - (next & (alignment - 1))) & (alignment - 1);
+    size_t start = 0;
+    size_t end = 0;
+    if (!bru_size_add_2(*used, padding, &start) || !bru_size_add_2(start, length, &end) || end > chunk->size) {
+        return false;
+    }
+    *result = chunkBytes(chunk) + start;
+    *used = end;
+    return true;
+}
+
+@interface BRUArena ()
+
+/* the chunks in allocation order, only the last one is allocated from */
+@property (nonatomic, readwrite, assign) BRUArenaChunk **chunks;
+@property (nonatomic, readwrite, assign) size_t chunkCount;
+@property (nonatomic, readwrite, assign) size_t chunkCapacity;
+@property (nonatomic, readwrite, assign) size_t used; /* bytes used in the last chunk */
+@property (nonatomic, readwrite, assign) size_t bytesReserved;
+
+@end
+
+@implementation BRUArena
+
+BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
+
++ (instancetype)arena
+{
+    return [[self alloc] initWithChunkSize:BRUArenaDefaultChunkSize usesThreadLocalFreeList:YES];
+}
+
+- (instancetype)initWithChunkSize:(size_t)chunkSize usesThreadLocalFreeList:(BOOL)usesThreadLocalFreeList
+{
+    BRUParameterAssert(chunkSize > 0);
+
+    if ((self = [super init])) {
+        self->_chunkSize = chunkSize;
+        self->_usesThreadLocalFreeList = usesThreadLocalFreeList;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self resetToMark:(BRUArenaMark){ 0, 0 }];
+    free(self->_chunks);
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"BRUArena {chunkSize=%zu, chunkCount=%zu, bytesReserved=%zu}",
+            self.chunkSize, self.chunkCount, self.bytesReserved];
+}
+
+#pragma mark - Helpers
+
+/**
+ * Appends a new chunk of `size` bytes, it becomes the one to allocate from.
+ */
+- (BOOL)appendChunkWithSize:(size_t)size
+{
+    if (self->_chunkCount == self->_chunkCapacity) {
+        size_t capacity = 0;
+        size_t bytes = 0;
+        if (!bru_size_multiply_2(MAX(self->_chunkCapacity, (size_t)4), 2, &capacity) ||
+            !bru_size_multiply_2(capacity, sizeof(BRUArenaChunk *), &bytes)) {
+            return NO;
+        }
+        BRUArenaChunk **chunks = realloc(self->_chunks, bytes);
+        if (NULL == chunks) {
+            return NO;
+        }
+        self->_chunks = chunks;
+        self->_chunkCapacity = capacity;
+    }
+    /* only chunks of the regular size are worth caching */
+    BRUArenaChunk *chunk = newChunk(size, self->_usesThreadLocalFreeList && size == self->_chunkSize);
+    if (NULL == chunk) {
+        return NO;
+    }
+    self->_chunks[self->_chunkCount++] = chunk;
+    self->_used = 0;
+    self->_bytesReserved += size;
+    return YES;
+}
+
+#pragma mark - Public API
+
+/* the allocation and reset paths access the ivars directly, they're hot */
+
+- (BRUMemoryRegion)allocateRegionWithLength:(size_t)length alignment:(size_t)alignment
+{
+    BRUParameterAssert(alignment > 0 && 0 == (alignment & (alignment - 1)));
+
+    uint8_t *bytes = NULL;
+    if (BRU_likely(self->_chunkCount > 0) &&
+        bumpChunk(self->_chunks[self->_chunkCount - 1], &self->_used, length, alignment, &bytes)) {
+        return BRUMemoryRegionMake(bytes, length);
+    }
+
+    /*
+     * a fresh chunk, one of its own if the region doesn't fit a regular one. The chunk's bytes follow its header so
+     * whatever malloc aligns them to, the padding is less than `alignment`.
+     */
+    size_t worstCase = 0;
+    if (!bru_size_add_2(length, alignment - 1, &worstCase)) {
+        return BRUMemoryRegionNull;
+    }
+    if (![self appendChunkWithSize:MAX(worstCase, self->_chunkSize)]) {
+        return BRUMemoryRegionNull;
+    }
+    BOOL fits = bumpChunk(self->_chunks[self->_chunkCount - 1], &self->_used, length, alignment, &bytes);
+    BRUAssert(fits, @"region doesn't fit a fresh chunk");
+    return BRUMemoryRegionMake(bytes, length);
+}
+
+- (BRUMemoryRegion)allocateRegionWithLength:(size_t)length
+{
+    return [self allocateRegionWithLength:length alignment:BRUArenaDefaultAlignment];
+}
+
+- (BRUArenaMark)mark
+{
+    return (BRUArenaMark){ self->_chunkCount, self->_used };
+}
+
+- (void)resetToMark:(BRUArenaMark)mark
+{
+    BRUParameterAssert(mark.chunkCount <= self->_chunkCount);
+    BRUParameterAssert(mark.chunkCount < self->_chunkCount || mark.used <= self->_used);
+
+    while (self->_chunkCount > mark.chunkCount) {
+        BRUArenaChunk *chunk = self->_chunks[--self->_chunkCount];
+        self->_bytesReserved -= chunk->size;
+        releaseChunk(chunk, self->_usesThreadLocalFreeList && chunk->size == self->_chunkSize);
+    }
+    self->_used = mark.used;
+}
+
+- (void)reset
+{
+    [self resetToMark:(BRUArenaMark){ 0, 0 }];
+}
+
+@end
@@ -16,6 +16,15 @@
 #define BRU_likely(x) __builtin_expect((x),1)
 #define BRU_unlikely(x) __builtin_expect((x),0)
 
+/* Hint to the CPU that we're in a spin-wait loop. */
+#if defined(__x86_64__) || defined(__i386__)
+#define BRU_cpu_relax() __builtin_ia32_pause()
+#elif defined(__arm64__) || defined(__aarch64__)
+#define BRU_cpu_relax() __asm__ __volatile__("yield")
+#else
+#define BRU_cpu_relax() do {} while (0)
+#endif
+
 #define BRU_restrict_subclassing __attribute__((objc_subclassing_restricted))
 
 typedef NSError * _Nullable __autoreleasing * _Nullable BRUOutError;
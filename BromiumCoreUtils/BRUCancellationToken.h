@@ -0,0 +1,64 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "BRUBaseDefines.h"
+
+BRU_assume_nonnull_begin
+
+/**
+ * A `BRUCancellationToken` signals that the work it was handed to is no longer wanted. The same token can be passed to
+ * any number of `BRUDeferred`, `BRURetry` and `BRUTimer` APIs; cancelling it tears down everything it was handed to.
+ *
+ * Work is registered with a token as a cancellation handler which runs (exactly once) when the token is cancelled.
+ * Handlers run synchronously on the thread calling `cancel` so they must be quick and must not block. Once the work
+ * is done, it should remove its handler again so the token doesn't keep it alive.
+ *
+ * A token can only be cancelled once, there's no way to 'uncancel' it.
+ */
+BRU_restrict_subclassing @interface BRUCancellationToken : NSObject
+
+/**
+ * Whether the token has been cancelled. Cheap (lock-free) to call.
+ */
+@property (nonatomic, readonly, assign, getter = isCancelled) BOOL cancelled;
+
+/**
+ * Create a new token which is not cancelled.
+ */
++ (instancetype)token;
+
+/**
+ * Cancel the token, running all registered cancellation handlers.
+ *
+ * @return `YES` if this call cancelled the token, `NO` if it had already been cancelled.
+ */
+- (BOOL)cancel;
+
+/**
+ * Register a block to be run when the token gets cancelled. If the token is already cancelled, `handler` is run
+ * synchronously and `nil` is returned.
+ *
+ * @param handler The block to run on cancellation.
+ *
+ * @return An opaque registration which can be passed to `removeCancellationHandler:` or `nil` if the token is
+ *         already cancelled.
+ */
+- (nullable id)addCancellationHandler:(dispatch_block_t)handler;
+
+/**
+ * Unregister a cancellation handler, releasing it. Removing a handler which already ran (or was already removed) is
+ * a no-op.
+ *
+ * @param registration The registration returned by `addCancellationHandler:`, `nil` is ignored.
+ */
+- (void)removeCancellationHandler:(nullable id)registration;
+
+@end
+
+BRU_assume_nonnull_end
@@ -0,0 +1,117 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#import "BRUAsserts.h"
+#import "BRUCancellationToken.h"
+
+@interface BRUCancellationToken () {
+    _Atomic(uintptr_t) _cancelled;
+    pthread_mutex_t _lock;
+
+    /* protected by _lock, nil once cancelled */
+    NSMutableDictionary<NSNumber *, dispatch_block_t> *_handlers;
+    uint64_t _nextRegistration;
+}
+
+@end
+
+@implementation BRUCancellationToken
+
++ (instancetype)token
+{
+    return [self new];
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        atomic_init(&self->_cancelled, 0);
+        int err = pthread_mutex_init(&self->_lock, NULL);
+        BRUAssertAlwaysFatal(0 == err, @"pthread_mutex_init failed: %d", err);
+        self->_handlers = [NSMutableDictionary new];
+        self->_nextRegistration = 0;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&self->_lock);
+}
+
+#pragma mark - Public API
+
+- (BOOL)isCancelled
+{
+    return atomic_load_explicit(&self->_cancelled, memory_order_acquire) != 0;
+}
+
+- (BOOL)cancel
+{
+    NSDictionary<NSNumber *, dispatch_block_t> *handlers = nil;
+
+    pthread_mutex_lock(&self->_lock);
+    if (!self.isCancelled) {
+        atomic_store_explicit(&self->_cancelled, 1, memory_order_release);
+        handlers = self->_handlers;
+        self->_handlers = nil;
+    }
+    pthread_mutex_unlock(&self->_lock);
+
+    if (!handlers) {
+        return NO;
+    }
+
+    /* run in registration order */
+    NSArray<NSNumber *> *registrations = [handlers.allKeys sortedArrayUsingSelector:@selector(compare:)];
+    for (NSNumber *registration in registrations) {
+        handlers[registration]();
+    }
+    return YES;
+}
+
+- (nullable id)addCancellationHandler:(dispatch_block_t)handler
+{
+    BRUParameterAssert(handler);
+
+    NSNumber *registration = nil;
+    if (!self.isCancelled) {
+        pthread_mutex_lock(&self->_lock);
+        if (self->_handlers) {
+            registration = @(self->_nextRegistration++);
+            self->_handlers[registration] = [handler copy];
+        }
+        pthread_mutex_unlock(&self->_lock);
+    }
+
+    if (!registration) {
+        handler();
+    }
+    return registration;
+}
+
+- (void)removeCancellationHandler:(nullable id)registration
+{
+    if (!registration || self.isCancelled) {
+        return;
+    }
+
+    dispatch_block_t handler = nil;
+    pthread_mutex_lock(&self->_lock);
+    handler = self->_handlers[registration];
+    [self->_handlers removeObjectForKey:registration];
+    pthread_mutex_unlock(&self->_lock);
+
+    /* release the handler (and whatever it captured) outside of the lock */
+    handler = nil;
+}
+
+@end
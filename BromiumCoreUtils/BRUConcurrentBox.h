@@ -19,6 +19,10 @@ BRU_assume_nonnull_begin
  *
  * It's modeled after Haskell's STM TMVar
  * http://hackage.haskell.org/package/stm-2.4.2/docs/Control-Concurrent-STM-TMVar.html
+ *
+ * Blocking operations spin for a short, adaptive while before parking so that quick hand-offs between threads don't
+ * pay for a context switch. Putters and takers park on separate conditions and every state change wakes at most one
+ * waiter that can make progress.
  */
 BRU_restrict_subclassing @interface BRUConcurrentBox<T> : NSObject
 
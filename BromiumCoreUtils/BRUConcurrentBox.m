@@ -9,14 +9,34 @@
 
 /* Standard Library */
 #import <assert.h>
+#import <math.h>
+#import <pthread.h>
+#import <stdatomic.h>
 
 /* Local Imports */
 #import "BRUAsserts.h"
 #import "BRUConcurrentBox.h"
 
-@interface BRUConcurrentBox<T> ()
+/**
+ * Bounds for the adaptive number of spin iterations before a blocking operation parks on a condition variable. The
+ * upper bound is a few microseconds on current hardware, roughly the cost of a park/unpark round trip.
+ */
+static const uint32_t BRUConcurrentBoxMinSpins = 16;
+static const uint32_t BRUConcurrentBoxMaxSpins = 4096;
 
-@property (nonatomic, strong, readonly, nonnull) NSCondition *cond;
+@interface BRUConcurrentBox<T> () {
+    pthread_mutex_t _lock;
+    pthread_cond_t _notEmpty; /* waited on by take and swap */
+    pthread_cond_t _notFull; /* waited on by put */
+    NSUInteger _waitingTakers; /* protected by _lock */
+    NSUInteger _waitingPutters; /* protected by _lock */
+    _Atomic(uint32_t) _full; /* mirrors `value != nil`, written under _lock, read lock-free when spinning */
+    _Atomic(uint32_t) _spinLimit;
+}
+
+/**
+ * Protected by _lock.
+ */
 @property (nonatomic, strong) T value;
 
 @end
@@ -41,26 +61,117 @@
 - (instancetype)init
 {
     if ((self = [super init])) {
-        self->_cond = [[NSCondition alloc] init];
+        pthread_mutex_init(&self->_lock, NULL);
+        pthread_cond_init(&self->_notEmpty, NULL);
+        pthread_cond_init(&self->_notFull, NULL);
+        self->_waitingTakers = 0;
+        self->_waitingPutters = 0;
+        atomic_init(&self->_full, 0);
+        atomic_init(&self->_spinLimit, BRUConcurrentBoxMinSpins);
         self->_value = nil;
     }
     return self;
 }
 
+- (void)dealloc
+{
+    pthread_cond_destroy(&self->_notFull);
+    pthread_cond_destroy(&self->_notEmpty);
+    pthread_mutex_destroy(&self->_lock);
+}
+
+#pragma mark - Helpers
+
+/**
+ * Spins (without holding the lock) until the box is full (`wantFull`) or empty (`!wantFull`) for a bounded number of
+ * iterations. The bound adapts: It grows when spinning pays off and shrinks when we end up parking anyway.
+ *
+ * @return Whether the wanted state was observed. The state might of course have changed again before we lock.
+ */
+- (BOOL)spinUntilFull:(BOOL)wantFull
+{
+    const uint32_t want = wantFull ? 1 : 0;
+    const uint32_t limit = atomic_load_explicit(&self->_spinLimit, memory_order_relaxed);
+    for (uint32_t i = 0; i < limit; i++) {
+        if (atomic_load_explicit(&self->_full, memory_order_relaxed) == want) {
+            if (limit < BRUConcurrentBoxMaxSpins) {
+                atomic_store_explicit(&self->_spinLimit, MIN(BRUConcurrentBoxMaxSpins, 2 * limit),
+                                      memory_order_relaxed);
+            }
+            return YES;
+        }
+        BRU_cpu_relax();
+    }
+    if (limit > BRUConcurrentBoxMinSpins) {
+        atomic_store_explicit(&self->_spinLimit, MAX(BRUConcurrentBoxMinSpins, limit / 2), memory_order_relaxed);
+    }
+    return NO;
+}
+
+- (void)setValueLocked:(id)value
+{
+    self.value = value;
+    atomic_store_explicit(&self->_full, value ? 1 : 0, memory_order_release);
+}
+
+- (void)signalOneTakerLocked
+{
+    if (self->_waitingTakers > 0) {
+        pthread_cond_signal(&self->_notEmpty);
+    }
+}
+
+- (void)signalOnePutterLocked
+{
+    if (self->_waitingPutters > 0) {
+        pthread_cond_signal(&self->_notFull);
+    }
+}
+
+/**
+ * Waits until the box is full. `deadline` may be `NULL` to wait forever.
+ *
+ * @return `NO` if the deadline passed before the box became full.
+ */
+- (BOOL)waitUntilFullLocked:(const struct timespec *)deadline
+{
+    while (self.value == nil) {
+        self->_waitingTakers++;
+        int err = deadline ? pthread_cond_timedwait(&self->_notEmpty, &self->_lock, deadline)
+                           : pthread_cond_wait(&self->_notEmpty, &self->_lock);
+        self->_waitingTakers--;
+        /* we might have consumed a wake-up whilst timing out, so re-check the state before giving up */
+        if (ETIMEDOUT == err && self.value == nil) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+- (void)waitUntilEmptyLocked
+{
+    while (self.value != nil) {
+        self->_waitingPutters++;
+        pthread_cond_wait(&self->_notFull, &self->_lock);
+        self->_waitingPutters--;
+    }
+}
+
+#pragma mark - Public API
+
 - (void)put:(id)value
 {
     BRUParameterAssert(value);
+    [self spinUntilFull:NO];
     @try
     {
-        [self.cond lock];
-        while (self.value != nil) {
-            [self.cond wait];
-        }
-        self.value = value;
-        [self.cond broadcast];
+        pthread_mutex_lock(&self->_lock);
+        [self waitUntilEmptyLocked];
+        [self setValueLocked:value];
+        [self signalOneTakerLocked];
     }
     @finally {
-        [self.cond unlock];
+        pthread_mutex_unlock(&self->_lock);
     }
 }
 
@@ -69,49 +180,69 @@
     BRUParameterAssert(value);
     @try
     {
-        [self.cond lock];
+        pthread_mutex_lock(&self->_lock);
         if (self.value != nil) {
             return NO;
         }
-        self.value = value;
-        [self.cond broadcast];
+        [self setValueLocked:value];
+        [self signalOneTakerLocked];
 
         return YES;
     }
     @finally {
-        [self.cond unlock];
+        pthread_mutex_unlock(&self->_lock);
     }
 }
 
 - (id)take
 {
-    id thing = [self tryTakeUntil:[NSDate distantFuture]];
-    assert(thing);
-    return thing;
+    [self spinUntilFull:YES];
+    @try
+    {
+        id value = nil;
+        pthread_mutex_lock(&self->_lock);
+        [self waitUntilFullLocked:NULL];
+        value = self.value;
+        [self setValueLocked:nil];
+        [self signalOnePutterLocked];
+
+        assert(value);
+        return value;
+    }
+    @finally {
+        pthread_mutex_unlock(&self->_lock);
+    }
 }
 
 - (id)tryTakeUntil:(NSDate *)date
 {
     BRUParameterAssert(date);
+    NSTimeInterval secondsSince1970 = [date timeIntervalSince1970];
+    double wholeSeconds = floor(secondsSince1970);
+    struct timespec deadline = {
+        .tv_sec = (time_t)wholeSeconds,
+        .tv_nsec = (long)((secondsSince1970 - wholeSeconds) * 1e9)
+    };
+
+    if ([date timeIntervalSinceNow] > 0) {
+        [self spinUntilFull:YES];
+    }
     @try
     {
         id value = nil;
-        [self.cond lock];
-        while (self.value == nil) {
-            BOOL signalled = [self.cond waitUntilDate:date];
-            if (!signalled) {
-                return nil;
-            }
+        pthread_mutex_lock(&self->_lock);
+        if (![self waitUntilFullLocked:&deadline]) {
+            return nil;
         }
         value = self.value;
-        self.value = nil;
-        [self.cond broadcast];
+        [self setValueLocked:nil];
+        [self signalOnePutterLocked];
 
         assert(value);
         return value;
     }
     @finally {
-        [self.cond unlock];
+        pthread_mutex_unlock(&self->_lock);
     }
 }
 
@@ -120,41 +251,41 @@
     @try
     {
         id value = nil;
-        [self.cond lock];
+        pthread_mutex_lock(&self->_lock);
         if (self.value == nil) {
             return nil;
         }
         value = self.value;
-        self.value = nil;
-        [self.cond broadcast];
+        [self setValueLocked:nil];
+        [self signalOnePutterLocked];
 
         assert(value);
         return value;
     }
     @finally {
-        [self.cond unlock];
+        pthread_mutex_unlock(&self->_lock);
     }
 }
 
 - (id)swapWithValue:(id)newValue
 {
     BRUParameterAssert(newValue);
+    [self spinUntilFull:YES];
     @try
     {
         id oldValue = nil;
-        [self.cond lock];
-        while (self.value == nil) {
-            [self.cond wait];
-        }
+        pthread_mutex_lock(&self->_lock);
+        [self waitUntilFullLocked:NULL];
         oldValue = self.value;
-        self.value = newValue;
-        [self.cond broadcast];
+        [self setValueLocked:newValue];
+        /* the box is still full, pass on a wake-up we might have consumed from a putter */
+        [self signalOneTakerLocked];
 
         assert(oldValue);
         return oldValue;
     }
     @finally {
-        [self.cond unlock];
+        pthread_mutex_unlock(&self->_lock);
     }
 }
 
@@ -164,29 +295,23 @@
     @try
     {
         id oldValue = nil;
-        [self.cond lock];
+        pthread_mutex_lock(&self->_lock);
         oldValue = self.value;
-        self.value = newValue;
-        [self.cond broadcast];
+        [self setValueLocked:newValue];
+        if (!oldValue) {
+            [self signalOneTakerLocked];
+        }
 
         return oldValue;
     }
     @finally {
-        [self.cond unlock];
+        pthread_mutex_unlock(&self->_lock);
     }
 }
 
 - (BOOL)isEmpty
 {
-    @try
-    {
-        [self.cond lock];
-
-        return self.value == nil;
-    }
-    @finally {
-        [self.cond unlock];
-    }
+    return 0 == atomic_load_explicit(&self->_full, memory_order_acquire);
 }
 
 @end
@@ -0,0 +1,109 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "BRUBaseDefines.h"
+
+BRU_assume_nonnull_begin
+
+/**
+ * A `BRUConcurrentChannel` is a bounded multi-producer/multi-consumer FIFO queue, used for communication between
+ * concurrent threads. Its API follows `BRUConcurrentBox`; a channel with a capacity of 1 behaves like a
+ * `BRUConcurrentBox`.
+ *
+ * The values are kept in a ring buffer. Producers and consumers wait on separate conditions and every state change
+ * wakes at most as many waiters as can make progress (usually one) instead of broadcasting to all of them.
+ *
+ * It's modeled after Haskell's STM TBQueue
+ * http://hackage.haskell.org/package/stm-2.4.4/docs/Control-Concurrent-STM-TBQueue.html
+ */
+BRU_restrict_subclassing @interface BRUConcurrentChannel<T> : NSObject
+
+BRU_DEFAULT_INIT_UNAVAILABLE(null_unspecified)
+
+/**
+ * The maximum number of values the channel holds before `put:` blocks.
+ */
+@property (nonatomic, readonly, assign) NSUInteger capacity;
+
+/**
+ * Create an empty `BRUConcurrentChannel`.
+ *
+ * @param capacity The maximum number of values the channel can hold, must be greater than 0.
+ */
++ (instancetype)channelWithCapacity:(NSUInteger)capacity;
+
+/**
+ * Put a value into the channel. If the channel is currently full, `put:` blocks until there's space again.
+ *
+ * @param value The value to put into the channel.
+ */
+- (void)put:(T)value;
+
+/**
+ * Try to put a value into the channel. If the channel is currently full, `NO` is returned, otherwise `value` is
+ * appended and `YES` is returned.
+ *
+ * @param value The value to put into the channel.
+ */
+- (BOOL)tryPut:(T)value;
+
+/**
+ * Put all `values` (in order) into the channel, blocking whenever it's full until all of them have been put. Values
+ * are inserted in batches of as many as currently fit which is cheaper than calling `put:` for each of them. Values
+ * of concurrent producers may be interleaved with `values`.
+ *
+ * @param values The values to put into the channel.
+ */
+- (void)putAll:(NSArray<T> *)values;
+
+/**
+ * Takes the oldest value out of the channel. If the channel is currently empty, `take` blocks until a value arrives.
+ *
+ * @return The oldest value in the channel.
+ */
+- (T)take;
+
+/**
+ * Tries to take the oldest value out of the channel. If the channel is currently empty `nil` is returned.
+ *
+ * @return The oldest value in the channel or `nil`.
+ */
+- (nullable T)tryTake;
+
+/**
+ * Tries to take the oldest value out of the channel. This method blocks until a value is available or until `date` is
+ * reached (whichever happens first).
+ *
+ * @param date Date until which to block maximally.
+ *
+ * @return The oldest value or `nil` if the timeout hit.
+ */
+- (nullable T)tryTakeUntil:(NSDate *)date;
+
+/**
+ * Takes up to `maxCount` values (oldest first) out of the channel. Blocks until at least one value is available.
+ *
+ * @param maxCount The maximum number of values to take, must be greater than 0.
+ * @return Between 1 and `maxCount` values in FIFO order.
+ */
+- (NSArray<T> *)takeUpTo:(NSUInteger)maxCount;
+
+/**
+ * Returns the number of values currently in the channel.
+ */
+- (NSUInteger)count;
+
+/**
+ * Returns whether the channel is currently empty.
+ */
+- (BOOL)isEmpty;
+
+@end
+
+BRU_assume_nonnull_end
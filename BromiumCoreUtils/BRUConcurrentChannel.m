@@ -0,0 +1,261 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+/* Standard Library */
+#include <pthread.h>
+#include <math.h>
+
+/* Local Imports */
+#import "BRUAsserts.h"
+#import "BRUConcurrentChannel.h"
+
+@interface BRUConcurrentChannel () {
+    pthread_mutex_t _lock;
+    pthread_cond_t _notEmpty;
+    pthread_cond_t _notFull;
+
+    /* all protected by _lock */
+    __strong id *_buffer;
+    NSUInteger _head;
+    NSUInteger _count;
+    NSUInteger _waitingTakers;
+    NSUInteger _waitingPutters;
+}
+
+@end
+
+@implementation BRUConcurrentChannel
+
+BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity
+{
+    BRUParameterAssert(capacity > 0);
+
+    if ((self = [super init])) {
+        self->_capacity = capacity;
+        self->_buffer = (__strong id *)calloc(capacity, sizeof(id));
+        BRUAssertAlwaysFatal(self->_buffer, @"out of memory allocating channel of capacity %lu",
+                             (unsigned long)capacity);
+        self->_head = 0;
+        self->_count = 0;
+        self->_waitingTakers = 0;
+        self->_waitingPutters = 0;
+        pthread_mutex_init(&self->_lock, NULL);
+        pthread_cond_init(&self->_notEmpty, NULL);
+        pthread_cond_init(&self->_notFull, NULL);
+    }
+    return self;
+}
+
++ (instancetype)channelWithCapacity:(NSUInteger)capacity
+{
+    return [[BRUConcurrentChannel alloc] initWithCapacity:capacity];
+}
+
+- (void)dealloc
+{
+    for (NSUInteger i = 0; i < self->_capacity; i++) {
+        self->_buffer[i] = nil;
+    }
+    free(self->_buffer);
+    pthread_cond_destroy(&self->_notFull);
+    pthread_cond_destroy(&self->_notEmpty);
+    pthread_mutex_destroy(&self->_lock);
+}
+
+#pragma mark - Helpers (lock must be held)
+
+- (void)enqueueLocked:(id)value
+{
+    BRUAssert(self->_count < self->_capacity, @"enqueue into full channel");
+    self->_buffer[(self->_head + self->_count) % self->_capacity] = value;
+    self->_count++;
+}
+
+- (id)dequeueLocked
+{
+    BRUAssert(self->_count > 0, @"dequeue from empty channel");
+    id value = self->_buffer[self->_head];
+    self->_buffer[self->_head] = nil;
+    self->_head = (self->_head + 1) % self->_capacity;
+    self->_count--;
+    return value;
+}
+
+/**
+ * Wakes up as many waiting takers as there are values for them (at most `n`).
+ */
+- (void)wakeTakersLocked:(NSUInteger)n
+{
+    NSUInteger wakeups = MIN(MIN(n, self->_count), self->_waitingTakers);
+    for (NSUInteger i = 0; i < wakeups; i++) {
+        pthread_cond_signal(&self->_notEmpty);
+    }
+}
+
+/**
+ * Wakes up as many waiting putters as there are free slots for them (at most `n`).
+ */
+- (void)wakePuttersLocked:(NSUInteger)n
+{
+    NSUInteger wakeups = MIN(MIN(n, self->_capacity - self->_count), self->_waitingPutters);
+    for (NSUInteger i = 0; i < wakeups; i++) {
+        pthread_cond_signal(&self->_notFull);
+    }
+}
+
+- (void)waitUntilNotFullLocked
+{
+    while (self->_count == self->_capacity) {
+        self->_waitingPutters++;
+        pthread_cond_wait(&self->_notFull, &self->_lock);
+        self->_waitingPutters--;
+    }
+}
+
+/**
+ * Returns `NO` if `deadline` passed before the channel became non-empty. `deadline` may be `NULL` for no timeout.
+ */
+- (BOOL)waitUntilNotEmptyLocked:(const struct timespec *)deadline
+{
+    while (self->_count == 0) {
+        self->_waitingTakers++;
+        int err = deadline ? pthread_cond_timedwait(&self->_notEmpty, &self->_lock, deadline)
+                           : pthread_cond_wait(&self->_notEmpty, &self->_lock);
+        self->_waitingTakers--;
+        /* we might have consumed a wake-up whilst timing out, so re-check the state before giving up */
+        if (ETIMEDOUT == err && self->_count == 0) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+#pragma mark - Public API
+
+- (void)put:(id)value
+{
+    BRUParameterAssert(value);
+    pthread_mutex_lock(&self->_lock);
+    [self waitUntilNotFullLocked];
+    [self enqueueLocked:value];
+    [self wakeTakersLocked:1];
+    [self wakePuttersLocked:1]; /* pass on a wake-up we might have consumed from a concurrent taker */
+    pthread_mutex_unlock(&self->_lock);
+}
+
+- (BOOL)tryPut:(id)value
+{
+    BRUParameterAssert(value);
+    BOOL success = NO;
+    pthread_mutex_lock(&self->_lock);
+    if (self->_count < self->_capacity) {
+        [self enqueueLocked:value];
+        [self wakeTakersLocked:1];
+        success = YES;
+    }
+    pthread_mutex_unlock(&self->_lock);
+    return success;
+}
+
+- (void)putAll:(NSArray *)values
+{
+    BRUParameterAssert(values);
+    NSUInteger total = [values count];
+    NSUInteger done = 0;
+    pthread_mutex_lock(&self->_lock);
+    while (done < total) {
+        [self waitUntilNotFullLocked];
+        NSUInteger batch = MIN(total - done, self->_capacity - self->_count);
+        for (NSUInteger i = 0; i < batch; i++) {
+            id value = values[done + i];
+            BRUParameterAssert(value);
+            [self enqueueLocked:value];
+        }
+        done += batch;
+        [self wakeTakersLocked:batch];
+    }
+    [self wakePuttersLocked:1];
+    pthread_mutex_unlock(&self->_lock);
+}
+
+- (id)take
+{
+    pthread_mutex_lock(&self->_lock);
+    [self waitUntilNotEmptyLocked:NULL];
+    id value = [self dequeueLocked];
+    [self wakePuttersLocked:1];
+    [self wakeTakersLocked:1]; /* pass on a wake-up we might have consumed from a concurrent putter */
+    pthread_mutex_unlock(&self->_lock);
+    BRUAssert(value, @"took nil out of channel");
+    return value;
+}
+
+- (id)tryTake
+{
+    id value = nil;
+    pthread_mutex_lock(&self->_lock);
+    if (self->_count > 0) {
+        value = [self dequeueLocked];
+        [self wakePuttersLocked:1];
+    }
+    pthread_mutex_unlock(&self->_lock);
+    return value;
+}
+
+- (id)tryTakeUntil:(NSDate *)date
+{
+    BRUParameterAssert(date);
+    NSTimeInterval secondsSince1970 = [date timeIntervalSince1970];
+    double wholeSeconds = floor(secondsSince1970);
+    struct timespec deadline = {
+        .tv_sec = (time_t)wholeSeconds,
+        .tv_nsec = (long)((secondsSince1970 - wholeSeconds) * 1e9)
+    };
+
+    id value = nil;
+    pthread_mutex_lock(&self->_lock);
+    if ([self waitUntilNotEmptyLocked:&deadline]) {
+        value = [self dequeueLocked];
+        [self wakePuttersLocked:1];
+        [self wakeTakersLocked:1];
+    }
+    pthread_mutex_unlock(&self->_lock);
+    return value;
+}
+
+- (NSArray *)takeUpTo:(NSUInteger)maxCount
+{
+    BRUParameterAssert(maxCount > 0);
+    pthread_mutex_lock(&self->_lock);
+    [self waitUntilNotEmptyLocked:NULL];
+    NSUInteger batch = MIN(maxCount, self->_count);
+    NSMutableArray *values = [NSMutableArray arrayWithCapacity:batch];
+    for (NSUInteger i = 0; i < batch; i++) {
+        [values addObject:[self dequeueLocked]];
+    }
+    [self wakePuttersLocked:batch];
+    [self wakeTakersLocked:1];
+    pthread_mutex_unlock(&self->_lock);
+    return values;
+}
+
+- (NSUInteger)count
+{
+    pthread_mutex_lock(&self->_lock);
+    NSUInteger count = self->_count;
+    pthread_mutex_unlock(&self->_lock);
+    return count;
+}
+
+- (BOOL)isEmpty
+{
+    return [self count] == 0;
+}
+
+@end
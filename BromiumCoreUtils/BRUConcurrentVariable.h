@@ -19,6 +19,12 @@ BRU_assume_nonnull_begin
  * `@property (nonnull, atomic, readwrite, strong)` in Objective-C.
  *
  * This class is modelled after Haskell STM's TVar (https://hackage.haskell.org/package/stm-2.4.4/docs/Control-Concurrent-STM-TVar.html)
+ *
+ * For values that are read very often but written rarely (configuration objects for example), use a variable created
+ * with `newReadMostlyWithValue:`. In read-mostly mode `readVariable` never takes a lock or crosses a queue, it's a
+ * couple of atomic loads and stores to thread-local memory. Writes are still linearizable (they are serialised with
+ * respect to each other) but more expensive: Replaced values are only released once no reader can observe them anymore
+ * (epoch based reclamation).
  */
 BRU_restrict_subclassing @interface BRUConcurrentVariable<T> : NSObject
 
@@ -32,6 +38,15 @@ BRU_DEFAULT_INIT_UNAVAILABLE()
  */
 + (instancetype)newWithValue:(T)value;
 
+/**
+ * Create a new BRUConcurrentVariable in read-mostly mode with a value which cannot be `nil`. See the class description
+ * for the differences to `newWithValue:`.
+ *
+ * @param value The value to initialise the variable with.
+ * @return A new read-mostly BRUConcurrentVariable instance set to `value`.
+ */
++ (instancetype)newReadMostlyWithValue:(T)value;
+
 /**
  * Read the stored value.
  *
@@ -7,14 +7,121 @@
 //  Created by Johannes Weiß on 25/03/2015.
 //
 
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CoreFoundation/CoreFoundation.h>
+
 #import "BRUAsserts.h"
 #import "BRUDispatchUtils.h"
 #import "BRUConcurrentVariable.h"
 
-@interface BRUConcurrentVariable<T> ()
+/*
+ * Epoch based reclamation for the read-mostly mode.
+ *
+ * Every thread that ever read a read-mostly variable owns a reader record (found through a pthread key). Whilst a
+ * reader loads and retains the current value, its record carries the global epoch it observed. A writer swaps the
+ * value, advances the global epoch and retires the replaced value tagged with the new epoch. A retired value is only
+ * released once every active reader is in an epoch at least as new as the tag because only readers that started
+ * before the swap can have seen the replaced value.
+ *
+ * Reader records are never freed, the record of an exited thread is reused by the next thread that starts reading.
+ * Every read writes its record's epoch twice, so each record has a cache line of its own lest readers on different
+ * cores false-share.
+ */
+#define BRU_READER_RECORD_SIZE 64 /* a cache line */
+
+typedef struct ReaderRecord {
+    _Atomic(uint64_t) epoch; /* 0 means the thread is currently not reading */
+    _Atomic(uint64_t) inUse; /* 0 or 1, 64 bit wide to avoid padding */
+    struct ReaderRecord *next; /* immutable once published */
+    uint8_t padding[BRU_READER_RECORD_SIZE - 2 * sizeof(uint64_t) - sizeof(struct ReaderRecord *)];
+} __attribute__((aligned(BRU_READER_RECORD_SIZE))) ReaderRecord;
+
+typedef struct {
+    void *value; /* retained */
+    uint64_t epoch;
+} RetiredValue;
+
+static _Atomic(uint64_t) globalEpoch = 1;
+static _Atomic(ReaderRecord *) readerRecords = NULL;
+static pthread_key_t readerRecordKey;
 
-@property (nonatomic, strong, readwrite, nonnull) T currentValue;
+static void relinquishReaderRecord(void *ctx)
+{
+    ReaderRecord *rec = ctx;
+    atomic_store(&rec->epoch, 0);
+    atomic_store(&rec->inUse, 0);
+}
+
+static void createReaderRecordKey(void)
+{
+    int err = pthread_key_create(&readerRecordKey, relinquishReaderRecord);
+    BRUAssertAlwaysFatal(0 == err, @"pthread_key_create failed (err=%d)", err);
+}
+
+static ReaderRecord *readerRecordForCurrentThread(void)
+{
+    static pthread_once_t onceToken = PTHREAD_ONCE_INIT;
+    pthread_once(&onceToken, createReaderRecordKey);
+
+    ReaderRecord *rec = pthread_getspecific(readerRecordKey);
+    if (BRU_likely(rec != NULL)) {
+        return rec;
+    }
+
+    /* first read on this thread, try to reuse the record of a thread that exited */
+    for (rec = atomic_load(&readerRecords); rec; rec = rec->next) {
+        uint64_t expected = 0;
+        if (atomic_compare_exchange_strong(&rec->inUse, &expected, 1)) {
+            break;
+        }
+    }
+    if (!rec) {
+        void *mem = NULL;
+        int err = posix_memalign(&mem, BRU_READER_RECORD_SIZE, sizeof(*rec));
+        BRUAssertAlwaysFatal(0 == err, @"out of memory allocating reader record (err=%d)", err);
+        rec = memset(mem, 0, sizeof(*rec));
+        atomic_init(&rec->epoch, 0);
+        atomic_init(&rec->inUse, 1);
+        ReaderRecord *head = atomic_load(&readerRecords);
+        do {
+            rec->next = head;
+        } while (!atomic_compare_exchange_weak(&readerRecords, &head, rec));
+    }
+    pthread_setspecific(readerRecordKey, rec);
+    return rec;
+}
+
+/**
+ * Returns the oldest epoch an active reader is in or `UINT64_MAX` if nobody is reading.
+ */
+static uint64_t oldestActiveReaderEpoch(void)
+{
+    uint64_t oldest = UINT64_MAX;
+    for (ReaderRecord *rec = atomic_load(&readerRecords); rec; rec = rec->next) {
+        uint64_t epoch = atomic_load(&rec->epoch);
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+    return oldest;
+}
+
+@interface BRUConcurrentVariable<T> () {
+    _Atomic(void *) _readMostlyValue; /* retained, only used in read-mostly mode */
+    RetiredValue *_retiredValues; /* accessed on syncQ */
+    size_t _retiredValuesCount; /* accessed on syncQ */
+    size_t _retiredValuesCapacity; /* accessed on syncQ */
+}
+
+/**
+ * Not used in read-mostly mode (always `nil` then). Accessed on syncQ.
+ */
+@property (nonatomic, strong, readwrite, nullable) T currentValue;
 @property (nonatomic, strong, readonly, nonnull) dispatch_queue_t syncQ;
+@property (nonatomic, assign, readonly) BOOL readMostly;
 
 @end
 
@@ -22,14 +129,24 @@
 
 BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
 
-- (instancetype)initWithValue:(id)value
+- (instancetype)initWithValue:(id)value readMostly:(BOOL)readMostly
 {
     BRUParameterAssert(value);
 
     if ((self = [super init])) {
         self->_syncQ = bru_dispatch_queue_create("com.bromium.BRUConcurrentVariable.SyncQ",
                                                  DISPATCH_QUEUE_SERIAL);
-        self->_currentValue = value;
+        self->_readMostly = readMostly;
+        self->_retiredValues = NULL;
+        self->_retiredValuesCount = 0;
+        self->_retiredValuesCapacity = 0;
+        if (readMostly) {
+            self->_currentValue = nil;
+            atomic_init(&self->_readMostlyValue, (__bridge_retained void *)value);
+        } else {
+            self->_currentValue = value;
+            atomic_init(&self->_readMostlyValue, NULL);
+        }
     }
 
     return self;
@@ -39,11 +156,95 @@ BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
 {
     BRUParameterAssert(value);
 
-    return [[BRUConcurrentVariable alloc] initWithValue:value];
+    return [[BRUConcurrentVariable alloc] initWithValue:value readMostly:NO];
+}
+
++ (instancetype)newReadMostlyWithValue:(id)value
+{
+    BRUParameterAssert(value);
+
+    return [[BRUConcurrentVariable alloc] initWithValue:value readMostly:YES];
 }
 
+- (void)dealloc
+{
+    /* nobody can be reading, every reader holds a strong reference to us */
+    void *value = atomic_load(&self->_readMostlyValue);
+    if (value) {
+        CFRelease(value);
+    }
+    for (size_t i = 0; i < self->_retiredValuesCount; i++) {
+        CFRelease(self->_retiredValues[i].value);
+    }
+    free(self->_retiredValues);
+}
+
+#pragma mark - Read-mostly helpers
+
+- (id)readVariableLockFree
+{
+    ReaderRecord *rec = readerRecordForCurrentThread();
+
+    /* announce the epoch we're reading in before loading the value (both sequentially consistent) */
+    atomic_store(&rec->epoch, atomic_load(&globalEpoch));
+    CFTypeRef value = CFRetain(atomic_load(&self->_readMostlyValue));
+    atomic_store_explicit(&rec->epoch, 0, memory_order_release);
+
+    return CFBridgingRelease(value);
+}
+
+- (id)readMostlyValueUnsynchronized
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQ);
+    return (__bridge id)atomic_load(&self->_readMostlyValue);
+}
+
+- (void)publishReadMostlyValueUnsynchronized:(id)newValue
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQ);
+
+    void *oldValue = atomic_exchange(&self->_readMostlyValue, (__bridge_retained void *)newValue);
+    uint64_t retireEpoch = atomic_fetch_add(&globalEpoch, 1) + 1;
+
+    if (self->_retiredValuesCount == self->_retiredValuesCapacity) {
+        size_t newCapacity = self->_retiredValuesCapacity ? 2 * self->_retiredValuesCapacity : 4;
+        RetiredValue *newRetiredValues = realloc(self->_retiredValues, newCapacity * sizeof(RetiredValue));
+        BRUAssertAlwaysFatal(newRetiredValues, @"out of memory growing retired values");
+        self->_retiredValues = newRetiredValues;
+        self->_retiredValuesCapacity = newCapacity;
+    }
+    self->_retiredValues[self->_retiredValuesCount++] = (RetiredValue){ .value = oldValue, .epoch = retireEpoch };
+
+    [self releaseUnobservableRetiredValuesUnsynchronized];
+}
+
+- (void)releaseUnobservableRetiredValuesUnsynchronized
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQ);
+
+    uint64_t oldestEpoch = oldestActiveReaderEpoch();
+    size_t kept = 0;
+    for (size_t i = 0; i < self->_retiredValuesCount; i++) {
+        RetiredValue retired = self->_retiredValues[i];
+        if (retired.epoch <= oldestEpoch) {
+            CFRelease(retired.value);
+        } else {
+            self->_retiredValues[kept++] = retired;
+        }
+    }
+    self->_retiredValuesCount = kept;
+}
+
+#pragma mark - Public API
+
 - (id)readVariable
 {
+    if (self.readMostly) {
+        id value = [self readVariableLockFree];
+        BRUAssertAlwaysFatal(value, @"BRUConcurrentVariable consistency error: stored value nil");
+        return value;
+    }
+
     __block id value = nil;
     dispatch_sync(self.syncQ, ^{
         value = self.currentValue;
@@ -56,7 +257,11 @@ BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
 {
     BRUParameterAssert(newValue);
     dispatch_sync(self.syncQ, ^{
-        self.currentValue = newValue;
+        if (self.readMostly) {
+            [self publishReadMostlyValueUnsynchronized:newValue];
+        } else {
+            self.currentValue = newValue;
+        }
     });
 }
 
@@ -72,10 +277,14 @@ BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
 {
     __block id oldValue = nil;
     dispatch_sync(self.syncQ, ^{
-        oldValue = self.currentValue;
+        oldValue = self.readMostly ? [self readMostlyValueUnsynchronized] : self.currentValue;
         id newValue = modifyBlock(oldValue);
         BRUAssertAlwaysFatal(newValue, @"programmer error: value returned from modifyBlock nil");
-        self.currentValue = newValue;
+        if (self.readMostly) {
+            [self publishReadMostlyValueUnsynchronized:newValue];
+        } else {
+            self.currentValue = newValue;
+        }
     });
     BRUAssertAlwaysFatal(oldValue, @"BRUConcurrentVariable consistency error: stored value nil");
     return oldValue;
@@ -9,20 +9,102 @@
 
 #import <Foundation/Foundation.h>
 
+@class BRUCancellationToken;
+@protocol BRUPromise;
+
 typedef void (^BRUPromiseThenBlock)(id __nullable value);
+typedef id __nullable (^BRUPromiseMapBlock)(id __nullable value);
+typedef id<BRUPromise> __nonnull (^BRUPromiseFlatMapBlock)(id __nullable value);
 
+/**
+ * Promises signal failure by resolving with an unsuccessful `BRUEitherErrorOrSuccess`. The combinators below
+ * (`map:`, `flatMap:`, `+[BRUDeferred all:]` and `+[BRUDeferred any:]`) propagate such a failure instead of treating
+ * it like a value. Any other value (including successful `BRUEitherErrorOrSuccess` objects) is passed on unchanged,
+ * the combinators never wrap values.
+ */
 @protocol BRUPromise <NSObject>
 
+/**
+ * Run `block` with the value once the promise is resolved. The block is always dispatched asynchronously to the
+ * deferred's target queue (or a global concurrent queue if there is none), even if the promise is already resolved.
+ */
 - (void)then:(nonnull BRUPromiseThenBlock)block;
 
+/*
+ * The methods below are optional so that existing conformers keep compiling, the promises of `BRUDeferred` implement
+ * them all. Code handed an arbitrary promise must check `respondsToSelector:` first.
+ */
+@optional
+
+/**
+ * Like `then:` but cancelling `cancellationToken` before the promise is resolved drops `block` (and releases
+ * everything it captured) without ever running it. If the token is already cancelled, `block` is dropped right away.
+ */
+- (void)then:(nonnull BRUPromiseThenBlock)block cancellationToken:(nullable BRUCancellationToken *)cancellationToken;
+
+/**
+ * Returns a new promise which resolves with the value returned by `block` when run with this promise's value. If this
+ * promise fails, `block` is not run and the returned promise fails with the same `BRUEitherErrorOrSuccess`.
+ *
+ * Like those of `flatMap:` and `timeoutAfter:`, the returned promise runs its `then:` blocks on the same target queue
+ * as this one.
+ */
+- (nonnull id<BRUPromise>)map:(nonnull BRUPromiseMapBlock)block;
+
+/**
+ * Returns a new promise which resolves with the value of the promise returned by `block` when run with this promise's
+ * value. If this promise fails, `block` is not run and the returned promise fails with the same
+ * `BRUEitherErrorOrSuccess`.
+ */
+- (nonnull id<BRUPromise>)flatMap:(nonnull BRUPromiseFlatMapBlock)block;
+
+/**
+ * Returns a new promise which resolves with this promise's value or, if this promise doesn't resolve within `timeout`
+ * seconds, fails with an unsuccessful `BRUEitherErrorOrSuccess` (domain `NSPOSIXErrorDomain`, code `ETIMEDOUT`).
+ */
+- (nonnull id<BRUPromise>)timeoutAfter:(NSTimeInterval)timeout;
+
 @end
 
+/**
+ * A deferred value which can be resolved exactly once, handing out the value to its promise's `then:` blocks.
+ *
+ * The state of a deferred is a single atomic word, the first few `then:` blocks are stored inline and no dispatch
+ * queue is ever created, so deferreds are cheap enough to create one per operation.
+ */
 @interface BRUDeferred : NSObject
 
 + (nonnull instancetype)deferred;
 + (nonnull instancetype)deferredWithTargetQueue:(nullable dispatch_queue_t)targetQueue;
 - (nonnull instancetype)initWithTargetQueue:(nullable dispatch_queue_t)targetQueue;
 - (void)resolve:(nullable id)value;
+
+/**
+ * Resolves the deferred unless it's already resolved.
+ *
+ * @return `YES` if the deferred got resolved with `value`, `NO` if it had already been resolved.
+ */
+- (BOOL)tryResolve:(nullable id)value;
+
 - (nonnull id<BRUPromise>)promise;
 
+/**
+ * Returns a promise which, once all `promises` have resolved successfully, resolves with the array of their values (in
+ * order, `NSNull` for `nil`). As soon as one of the `promises` fails, the returned promise fails with the same
+ * `BRUEitherErrorOrSuccess`.
+ */
++ (nonnull id<BRUPromise>)all:(nonnull NSArray<id<BRUPromise>> *)promises;
+
+/**
+ * Returns a promise which resolves with the value of the first of `promises` to resolve successfully. If all of them
+ * fail (or `promises` is empty), the returned promise fails with the failure of the last one to resolve (or `EINVAL`).
+ */
++ (nonnull id<BRUPromise>)any:(nonnull NSArray<id<BRUPromise>> *)promises;
+
+/**
+ * Returns a promise which resolves with the value of the first of `promises` to resolve, successful or not.
+ * `promises` must not be empty.
+ */
++ (nonnull id<BRUPromise>)race:(nonnull NSArray<id<BRUPromise>> *)promises;
+
 @end
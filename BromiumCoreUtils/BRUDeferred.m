@@ -7,34 +7,37 @@
 //  Created by Jason Morley on 19/02/2015.
 //
 
+#include <stdatomic.h>
+
 #import "BRUDispatchUtils.h"
 #import "BRUAsserts.h"
+#import "BRUEitherErrorOrSuccess.h"
+#import "BRUBaseDefines.h"
+#import "BRUCancellationToken.h"
 #import "BRUDeferred.h"
 
-typedef NS_ENUM(NSUInteger, BRUPromiseState) {
-    BRUPromiseStatePending = 1,
-    BRUPromiseStateResolved = 2,
+/**
+ * Bits of the deferred's state word. `Locked` protects the pending then blocks, it's only ever held for a few
+ * instructions. Once `Resolved` is set, the value is immutable and the state word never changes again.
+ */
+typedef NS_OPTIONS(uintptr_t, BRUPromiseState) {
+    BRUPromiseStateResolved = 1 << 0,
+    BRUPromiseStateLocked = 1 << 1,
 };
 
-@interface BRUDeferred () <BRUPromise>
+#define BRU_DEFERRED_INLINE_THEN_BLOCKS 4
 
-@property (nonatomic, strong, readonly) dispatch_queue_t syncQueue;
-@property (nonatomic, strong, readonly) dispatch_queue_t completionQueue;
-
-/**
- * Accessed on syncQueue.
- */
-@property (nonatomic, strong, readonly) NSMutableArray *thenBlocks;
+@interface BRUDeferred () <BRUPromise> {
+    _Atomic(uintptr_t) _state;
 
-/**
- * Accessed on syncQueue.
- */
-@property (nonatomic, strong, readwrite) id value;
+    /* protected by BRUPromiseStateLocked until resolved */
+    id _value;
+    BRUPromiseThenBlock _inlineThenBlocks[BRU_DEFERRED_INLINE_THEN_BLOCKS];
+    NSUInteger _inlineThenBlocksCount;
+    NSMutableArray<BRUPromiseThenBlock> *_moreThenBlocks;
+}
 
-/**
- * Accessed on syncQueue.
- */
-@property (nonatomic, assign, readwrite) BRUPromiseState state;
+@property (nonatomic, strong, readonly) dispatch_queue_t targetQueue;
 
 @end
 
@@ -59,45 +62,128 @@ typedef NS_ENUM(NSUInteger, BRUPromiseState) {
 {
     self = [super init];
     if (self) {
-
-        _syncQueue = bru_dispatch_queue_create("com.bromium.BromiumUtils.BRUPromise.syncQueue",
-                                               DISPATCH_QUEUE_SERIAL);
-        if (targetQueue) {
-            _completionQueue = targetQueue;
-        } else {
-            _completionQueue = bru_dispatch_queue_create("com.bromium.BromiumUtils.BRUPromise.completionQueue",
-                                                         DISPATCH_QUEUE_CONCURRENT);
-        }
-        _thenBlocks = [NSMutableArray array];
+        atomic_init(&_state, 0);
+        _targetQueue = targetQueue;
         _value = nil;
-        _state = BRUPromiseStatePending;
+        _inlineThenBlocksCount = 0;
+        _moreThenBlocks = nil;
     }
     return self;
 }
 
-+ (NSString *)stringForState:(BRUPromiseState)state
+#pragma mark - Helpers
+
+/**
+ * Takes the lock unless the deferred is already resolved.
+ *
+ * @return The state before locking, if it has `BRUPromiseStateResolved` set, the lock has not been taken.
+ */
+- (uintptr_t)lockUnlessResolved
 {
-    if (state == BRUPromiseStatePending) {
-        return @"pending";
-    } else if (state == BRUPromiseStateResolved) {
-        return @"resolved";
-    } else {
-        return @"unknown";
+    uintptr_t state = atomic_load_explicit(&_state, memory_order_acquire);
+    while (true) {
+        if (state & BRUPromiseStateResolved) {
+            return state;
+        } else if (state & BRUPromiseStateLocked) {
+            BRU_cpu_relax();
+            state = atomic_load_explicit(&_state, memory_order_acquire);
+        } else if (atomic_compare_exchange_weak_explicit(&_state, &state, state | BRUPromiseStateLocked,
+                                                         memory_order_acquire, memory_order_acquire)) {
+            return state;
+        }
     }
 }
 
+- (void)dispatchThenBlock:(BRUPromiseThenBlock)block value:(id)value
+{
+    dispatch_queue_t queue = self.targetQueue ?: dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+    dispatch_async(queue, ^{
+        block(value);
+    });
+}
+
+static BOOL isFailure(id value)
+{
+    return [value isKindOfClass:[BRUEitherErrorOrSuccess class]] && ![(BRUEitherErrorOrSuccess *)value isSuccessful];
+}
+
+- (nonnull instancetype)newDeferredOnSameQueue
+{
+    return [[[self class] alloc] initWithTargetQueue:self.targetQueue];
+}
+
+/**
+ * Removes a then block which hasn't been dispatched yet, a no-op if the deferred is already resolved.
+ */
+- (void)removePendingThenBlock:(nullable BRUPromiseThenBlock)block
+{
+    if (!block) {
+        return;
+    }
+
+    uintptr_t state = [self lockUnlessResolved];
+    if (state & BRUPromiseStateResolved) {
+        return;
+    }
+
+    BRUPromiseThenBlock removed = nil;
+    for (NSUInteger i = 0; i < _inlineThenBlocksCount; i++) {
+        if (_inlineThenBlocks[i] == block) {
+            removed = _inlineThenBlocks[i];
+            for (NSUInteger j = i + 1; j < _inlineThenBlocksCount; j++) {
+                _inlineThenBlocks[j - 1] = _inlineThenBlocks[j];
+            }
+            _inlineThenBlocks[--_inlineThenBlocksCount] = nil;
+            break;
+        }
+    }
+    if (!removed && _moreThenBlocks) {
+        NSUInteger idx = [_moreThenBlocks indexOfObjectIdenticalTo:block];
+        if (idx != NSNotFound) {
+            removed = _moreThenBlocks[idx];
+            [_moreThenBlocks removeObjectAtIndex:idx];
+        }
+    }
+
+    atomic_store_explicit(&_state, state, memory_order_release);
+}
+
+#pragma mark - Public API
+
 - (void)resolve:(nullable id)value
 {
-    dispatch_async(self.syncQueue, ^{
+    BOOL resolved = [self tryResolve:value];
+    BRUAssert(resolved, @"Attempt to resolve a resolved promise");
+}
 
-        BRUAssert(self.state == BRUPromiseStatePending,
-                  @"Attempt to resolve a %@ promise", [BRUDeferred stringForState:self.state]);
+- (BOOL)tryResolve:(nullable id)value
+{
+    uintptr_t state = [self lockUnlessResolved];
+    if (state & BRUPromiseStateResolved) {
+        return NO;
+    }
 
-        self.state = BRUPromiseStateResolved;
-        self.value = value;
-        [self processBlocks];
+    _value = value;
 
-    });
+    BRUPromiseThenBlock thenBlocks[BRU_DEFERRED_INLINE_THEN_BLOCKS] = { nil };
+    NSUInteger thenBlocksCount = _inlineThenBlocksCount;
+    for (NSUInteger i = 0; i < thenBlocksCount; i++) {
+        thenBlocks[i] = _inlineThenBlocks[i];
+        _inlineThenBlocks[i] = nil;
+    }
+    _inlineThenBlocksCount = 0;
+    NSArray<BRUPromiseThenBlock> *moreThenBlocks = _moreThenBlocks;
+    _moreThenBlocks = nil;
+
+    atomic_store_explicit(&_state, BRUPromiseStateResolved, memory_order_release);
+
+    for (NSUInteger i = 0; i < thenBlocksCount; i++) {
+        [self dispatchThenBlock:thenBlocks[i] value:value];
+    }
+    for (BRUPromiseThenBlock block in moreThenBlocks) {
+        [self dispatchThenBlock:block value:value];
+    }
+    return YES;
 }
 
 - (nonnull id<BRUPromise>)promise
@@ -111,40 +197,196 @@ typedef NS_ENUM(NSUInteger, BRUPromiseState) {
 {
     BRUParameterAssert(block);
 
-    dispatch_async(self.syncQueue, ^{
+    uintptr_t state = [self lockUnlessResolved];
+    if (state & BRUPromiseStateResolved) {
+        /* never synchronously, that would overtake blocks dispatched when the deferred got resolved */
+        [self dispatchThenBlock:block value:_value];
+        return;
+    }
 
-        [self.thenBlocks addObject:[block copy]];
-        [self processBlocks];
+    if (_inlineThenBlocksCount < BRU_DEFERRED_INLINE_THEN_BLOCKS) {
+        _inlineThenBlocks[_inlineThenBlocksCount++] = [block copy];
+    } else {
+        if (!_moreThenBlocks) {
+            _moreThenBlocks = [NSMutableArray array];
+        }
+        [_moreThenBlocks addObject:[block copy]];
+    }
 
-    });
+    atomic_store_explicit(&_state, state, memory_order_release);
 }
 
-- (void)processBlocks
+- (void)then:(nonnull BRUPromiseThenBlock)block cancellationToken:(nullable BRUCancellationToken *)cancellationToken
 {
-    BRU_ASSERT_ON_QUEUE(self.syncQueue);
-
-    if (self.state == BRUPromiseStatePending) {
+    BRUParameterAssert(block);
 
+    if (!cancellationToken) {
+        [self then:block];
         return;
+    } else if (cancellationToken.isCancelled) {
+        return;
+    }
 
-    } else if (self.state == BRUPromiseStateResolved) {
+    __block id registration = nil;
+    __weak BRUCancellationToken *weakToken = cancellationToken;
+    BRUPromiseThenBlock thenBlock = ^(id value) {
+        [weakToken removeCancellationHandler:registration];
+        block(value);
+    };
+
+    __weak BRUDeferred *weakSelf = self;
+    __weak BRUPromiseThenBlock weakThenBlock = thenBlock;
+    registration = [cancellationToken addCancellationHandler:^{
+        [weakSelf removePendingThenBlock:weakThenBlock];
+    }];
+    if (!registration) {
+        /* cancelled concurrently */
+        return;
+    }
 
-        for (BRUPromiseThenBlock block in self.thenBlocks) {
+    [self then:thenBlock];
+    if (cancellationToken.isCancelled) {
+        /* the handler might have run before the block was pending */
+        [self removePendingThenBlock:thenBlock];
+    }
+}
 
-            dispatch_async(self.completionQueue, ^{
+- (nonnull id<BRUPromise>)map:(nonnull BRUPromiseMapBlock)block
+{
+    BRUParameterAssert(block);
 
-                block(self.value);
+    BRUDeferred *result = [self newDeferredOnSameQueue];
+    [self then:^(id value) {
+        [result resolve:isFailure(value) ? value : block(value)];
+    }];
+    return result.promise;
+}
 
-            });
+- (nonnull id<BRUPromise>)flatMap:(nonnull BRUPromiseFlatMapBlock)block
+{
+    BRUParameterAssert(block);
 
+    BRUDeferred *result = [self newDeferredOnSameQueue];
+    [self then:^(id value) {
+        if (isFailure(value)) {
+            [result resolve:value];
+            return;
         }
-        [self.thenBlocks removeAllObjects];
+        id<BRUPromise> next = block(value);
+        BRUAssert(next, @"flatMap: block returned nil");
+        [next then:^(id nextValue) {
+            [result resolve:nextValue];
+        }];
+    }];
+    return result.promise;
+}
 
-    } else {
+- (nonnull id<BRUPromise>)timeoutAfter:(NSTimeInterval)timeout
+{
+    BRUDeferred *result = [self newDeferredOnSameQueue];
+    dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0,
+                                                     dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0));
+    dispatch_source_set_timer(timer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeout * 1e9)),
+                              DISPATCH_TIME_FOREVER, 0);
+    dispatch_source_set_event_handler(timer, ^{
+        NSString *reason = [NSString stringWithFormat:@"promise not resolved within %f seconds", timeout];
+        NSError *error = [NSError errorWithDomain:NSPOSIXErrorDomain
+                                             code:ETIMEDOUT
+                                         userInfo:@{BRUErrorReasonKey: reason}];
+        [result tryResolve:[BRUEitherErrorOrSuccess newWithError:error]];
+        dispatch_source_cancel(timer);
+    });
+    dispatch_resume(timer);
+
+    [self then:^(id value) {
+        /* cancelling releases the event handler and with it `result` */
+        dispatch_source_cancel(timer);
+        [result tryResolve:value];
+    }];
+    return result.promise;
+}
+
+#pragma mark - Combinators
 
-        BRU_ASSERT_NOT_REACHED(@"Unknown state %ld", self.state);
++ (nonnull id<BRUPromise>)all:(nonnull NSArray<id<BRUPromise>> *)promises
+{
+    BRUParameterAssert(promises);
+
+    BRUDeferred *result = [self deferred];
+    NSUInteger count = promises.count;
+    if (count == 0) {
+        [result resolve:@[]];
+        return result.promise;
+    }
+
+    NSMutableArray *values = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [values addObject:[NSNull null]];
+    }
+    __block NSUInteger outstanding = count;
+    [promises enumerateObjectsUsingBlock:^(id<BRUPromise> promise, NSUInteger idx, __unused BOOL *stop) {
+        [promise then:^(id value) {
+            if (isFailure(value)) {
+                [result tryResolve:value];
+                return;
+            }
+            BOOL done = NO;
+            @synchronized(values) {
+                values[idx] = value ?: [NSNull null];
+                done = --outstanding == 0;
+            }
+            if (done) {
+                [result tryResolve:[values copy]];
+            }
+        }];
+    }];
+    return result.promise;
+}
+
++ (nonnull id<BRUPromise>)any:(nonnull NSArray<id<BRUPromise>> *)promises
+{
+    BRUParameterAssert(promises);
+
+    BRUDeferred *result = [self deferred];
+    if (promises.count == 0) {
+        NSError *error = [NSError errorWithDomain:NSPOSIXErrorDomain
+                                             code:EINVAL
+                                         userInfo:@{BRUErrorReasonKey: @"no promises given"}];
+        [result resolve:[BRUEitherErrorOrSuccess newWithError:error]];
+        return result.promise;
+    }
+
+    NSObject *lock = [NSObject new];
+    __block NSUInteger outstanding = promises.count;
+    for (id<BRUPromise> promise in promises) {
+        [promise then:^(id value) {
+            if (!isFailure(value)) {
+                [result tryResolve:value];
+                return;
+            }
+            BOOL done = NO;
+            @synchronized(lock) {
+                done = --outstanding == 0;
+            }
+            if (done) {
+                [result tryResolve:value];
+            }
+        }];
+    }
+    return result.promise;
+}
+
++ (nonnull id<BRUPromise>)race:(nonnull NSArray<id<BRUPromise>> *)promises
+{
+    BRUParameterAssert(promises.count > 0);
 
+    BRUDeferred *result = [self deferred];
+    for (id<BRUPromise> promise in promises) {
+        [promise then:^(id value) {
+            [result tryResolve:value];
+        }];
     }
+    return result.promise;
 }
 
 @end
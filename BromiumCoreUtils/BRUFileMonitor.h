@@ -11,17 +11,77 @@
 
 #import "BRUBaseDefines.h"
 
+@class BRUFileMonitor;
+
+/**
+ * What happened to a path in a directory tree monitored by a recursive `BRUFileMonitor`.
+ */
+typedef NS_OPTIONS(NSUInteger, BRUFileMonitorChangeKind) {
+    BRUFileMonitorChangeKindCreated = 1 << 0,
+    BRUFileMonitorChangeKindRemoved = 1 << 1,
+    BRUFileMonitorChangeKindModified = 1 << 2, /* contents (of a file) or entries (of a directory) changed */
+    BRUFileMonitorChangeKindAttributes = 1 << 3,
+    BRUFileMonitorChangeKindRenamed = 1 << 4, /* renamed from or to the path */
+    BRUFileMonitorChangeKindMustRescan = 1 << 5 /* changes below the path were lost, rescan it */
+};
+
+/**
+ * A path in a monitored tree and everything that happened to it during one debounce window.
+ */
+@interface BRUFileMonitorChange : NSObject
+
+BRU_DEFAULT_INIT_UNAVAILABLE(null_unspecified)
+
+@property (nonatomic, readonly, copy, nonnull) NSString *path;
+@property (nonatomic, readonly, assign) BRUFileMonitorChangeKind kind;
+
+@end
+
+typedef void (^BRUFileMonitorChangesHandler)(BRUFileMonitor * _Nonnull monitor,
+                                             NSArray<BRUFileMonitorChange *> * _Nonnull changes);
+
+/**
+ * A `BRUFileMonitor` watches a single path (the callback fires when it or the path to it changes) or, if created with
+ * `initWithDirectoryTreeAtPath:debounceInterval:completionQueue:`, a whole directory tree.
+ *
+ * Recursive monitors collect the changes of one debounce window (starting with the first change) and deliver them in
+ * one batch, with one entry per path.
+ *
+ * All monitors of a process share their kernel watches: each watched inode has one watch (and file descriptor),
+ * however many monitors watch it or a path below it, and all events are handled on one queue.
+ */
 @interface BRUFileMonitor : NSObject
 
 @property (nonatomic, strong, readonly, nonnull) NSString *path;
 @property (atomic, assign, readonly) BOOL isMonitoring;
+@property (nonatomic, assign, readonly, getter = isRecursive) BOOL recursive;
+@property (nonatomic, assign, readonly) NSTimeInterval debounceInterval;
 
 - (nonnull instancetype)initWithPath:(nonnull NSString *)path;
 - (nonnull instancetype)initWithPath:(nonnull NSString *)path completionQueue:(nonnull dispatch_queue_t)completionQueue;
 
+/**
+ * Initialise a recursive monitor, to be started with `startWithError:changesHandler:`.
+ *
+ * @param path The root of the directory tree.
+ * @param debounceInterval How long to collect changes before delivering them.
+ * @param completionQueue The queue to call the changes handler on.
+ */
+- (nonnull instancetype)initWithDirectoryTreeAtPath:(nonnull NSString *)path
+                                   debounceInterval:(NSTimeInterval)debounceInterval
+                                    completionQueue:(nonnull dispatch_queue_t)completionQueue;
+
 - (BOOL)startWithError:(BRUOutError)error
               callback:(void (^ _Nonnull)(BRUFileMonitor * _Nonnull monitor))callback;
 
+/**
+ * Start a recursive monitor.
+ *
+ * @param changesHandler Receives the batched changes. Paths are below `path` as given to the initialiser.
+ */
+- (BOOL)startWithError:(BRUOutError)error
+        changesHandler:(nonnull BRUFileMonitorChangesHandler)changesHandler;
+
 - (BOOL)stop:(BRUOutError)error;
 
 @end
@@ -8,6 +8,12 @@
 //
 
 #include <sys/stat.h>
+#if defined(__linux__)
+#include <dirent.h>
+#include <sys/inotify.h>
+#else
+#include <CoreServices/CoreServices.h>
+#endif
 
 #import "BRUAsserts.h"
 #import "BRUDispatchUtils.h"
@@ -16,6 +22,364 @@
 #import "BRUNullabilityUtils.h"
 #import "BRUFileMonitor.h"
 
+#if defined(__linux__)
+#define BRU_FILE_MONITOR_USE_INOTIFY 1
+#else
+#define BRU_FILE_MONITOR_USE_INOTIFY 0
+#endif
+
+#if BRU_FILE_MONITOR_USE_INOTIFY
+/* the inotify equivalents of the DISPATCH_VNODE_* events the kqueue backend watches, not following symlinks either.
+ IN_CLOSE_WRITE stands in for writes through shared mappings which inotify doesn't report as IN_MODIFY. */
+#define BRU_FILE_MONITOR_INOTIFY_MASK (IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | \
+                                       IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | \
+                                       IN_DONT_FOLLOW)
+#else
+#define BRU_FILE_MONITOR_VNODE_MASK (DISPATCH_VNODE_DELETE | \
+                                     DISPATCH_VNODE_EXTEND | \
+                                     DISPATCH_VNODE_WRITE | \
+                                     DISPATCH_VNODE_ATTRIB | \
+                                     DISPATCH_VNODE_LINK | \
+                                     DISPATCH_VNODE_RENAME | \
+                                     DISPATCH_VNODE_REVOKE)
+#endif
+
+/**
+ * One kernel watch of an inode, shared by all (monitors') paths resolving to that inode. With inotify the kernel hands
+ * out the same watch descriptor for all of them, with kqueue we look the inode up ourselves.
+ */
+@interface BRUFileWatch : NSObject
+
+@property (nonatomic, readonly, strong) id<NSCopying> key; /* the watch descriptor (inotify) or device and inode */
+@property (nonatomic, readonly, strong) NSMutableArray *registrations; /* the watch is removed once empty */
+#if !BRU_FILE_MONITOR_USE_INOTIFY
+@property (nonatomic, readwrite, strong) dispatch_source_t source;
+@property (nonatomic, readonly, strong) dispatch_group_t registered; /* entered until the source is registered */
+#endif
+
+@end
+
+@implementation BRUFileWatch
+
+- (instancetype)initWithKey:(id<NSCopying>)key
+{
+    if ((self = [super init])) {
+        self->_key = key;
+        self->_registrations = [NSMutableArray new];
+#if !BRU_FILE_MONITOR_USE_INOTIFY
+        self->_registered = dispatch_group_create();
+#endif
+    }
+    return self;
+}
+
+@end
+
+/**
+ * Receives the event flags (inotify mask or `DISPATCH_VNODE_*`) and, for inotify events about an entry of a watched
+ * directory, the entry's name.
+ */
+typedef void (^BRUFileWatchHandler)(uint32_t flags, NSString *name);
+
+@interface BRUFileWatchRegistration : NSObject
+
+@property (nonatomic, readonly, strong) BRUFileWatch *watch;
+@property (nonatomic, readonly, strong) BRUFileWatchHandler handler;
+
+@end
+
+@implementation BRUFileWatchRegistration
+
+- (instancetype)initWithWatch:(BRUFileWatch *)watch handler:(BRUFileWatchHandler)handler
+{
+    if ((self = [super init])) {
+        self->_watch = watch;
+        self->_handler = handler;
+    }
+    return self;
+}
+
+@end
+
+/**
+ * The process-wide, reference counted registry of kernel watches all BRUFileMonitors attach to: one watch per inode
+ * (on one shared inotify instance on Linux), fanned out to all registrations. All events are handled on one queue.
+ */
+@interface BRUFileWatchRegistry : NSObject
+
+@property (nonatomic, readonly, strong) dispatch_queue_t queue;
+#if BRU_FILE_MONITOR_USE_INOTIFY
+@property (nonatomic, readonly, assign) int fd;
+@property (nonatomic, readonly, strong) dispatch_source_t readSource;
+#endif
+
+/* only accessed on queue */
+@property (nonatomic, readonly, strong) NSMutableDictionary<id<NSCopying>, BRUFileWatch *> *watches;
+
+@end
+
+@implementation BRUFileWatchRegistry
+
++ (instancetype)sharedRegistry
+{
+    static BRUFileWatchRegistry *sharedRegistry;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedRegistry = [BRUFileWatchRegistry new];
+    });
+    return sharedRegistry;
+}
+
+- (instancetype)init
+{
+    if ((self = [super init])) {
+        self->_queue = bru_dispatch_queue_create("com.bromium.BRUFileMonitor.watchQueue", DISPATCH_QUEUE_SERIAL);
+        self->_watches = [NSMutableDictionary new];
+#if BRU_FILE_MONITOR_USE_INOTIFY
+        self->_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        BRUAssertDebugLog(self->_fd >= 0, @"inotify_init1 failed: %d (%s)", errno, strerror(errno));
+        if (self->_fd >= 0) {
+            self->_readSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ,
+                                                       (uintptr_t)self->_fd,
+                                                       0,
+                                                       self->_queue);
+            /* the shared registry lives as long as the process */
+            dispatch_source_set_event_handler(self->_readSource, ^{
+                [self readEvents];
+            });
+            dispatch_resume(self->_readSource);
+        }
+#endif
+    }
+    return self;
+}
+
+- (void)notifyWatch:(BRUFileWatch *)watch flags:(uint32_t)flags name:(NSString *)name
+{
+    BRU_ASSERT_ON_QUEUE(self.queue);
+
+    for (BRUFileWatchRegistration *registration in [watch.registrations copy]) {
+        registration.handler(flags, name);
+    }
+}
+
+#if BRU_FILE_MONITOR_USE_INOTIFY
+
+- (void)processEvent:(const struct inotify_event *)event
+{
+    BRU_ASSERT_ON_QUEUE(self.queue);
+
+    if (event->mask & IN_Q_OVERFLOW) {
+        /* events got lost, everybody has to re-evaluate */
+        for (BRUFileWatch *watch in [self.watches allValues]) {
+            [self notifyWatch:watch flags:event->mask name:nil];
+        }
+        return;
+    }
+
+    BRUFileWatch *watch = self.watches[@(event->wd)];
+    if (!watch) {
+        return;
+    }
+    if (event->mask & IN_IGNORED) {
+        /* the kernel removed the watch (inode deleted or unmounted), the preceding event told the monitors */
+        [self.watches removeObjectForKey:@(event->wd)];
+        return;
+    }
+    NSString *name = nil;
+    if (event->len > 0) {
+        /* NUL padded */
+        name = [[NSFileManager defaultManager] stringWithFileSystemRepresentation:event->name
+                                                                           length:strlen(event->name)];
+    }
+    [self notifyWatch:watch flags:event->mask name:name];
+}
+
+- (void)readEvents
+{
+    BRU_ASSERT_ON_QUEUE(self.queue);
+
+    char buffer[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true) {
+        ssize_t n;
+        do {
+            n = read(self.fd, buffer, sizeof(buffer));
+        } while (n < 0 && EINTR == errno);
+        if (n <= 0) {
+            /* EAGAIN, all read */
+            return;
+        }
+        const char *end = buffer + n;
+        for (const char *next = buffer; next < end; ) {
+            const struct inotify_event *event = (const struct inotify_event *)(const void *)next;
+            [self processEvent:event];
+            next += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+/**
+ * Returns the watch for `path`, creating it if needed.
+ */
+- (BRUFileWatch *)watchForPath:(NSString *)path
+{
+    BRU_ASSERT_ON_QUEUE(self.queue);
+
+    if (self.fd < 0) {
+        return nil;
+    }
+    /* all watches use the same mask, so adding an inode again doesn't change its watch */
+    int wd = inotify_add_watch(self.fd, [path fileSystemRepresentation], BRU_FILE_MONITOR_INOTIFY_MASK);
+    if (wd < 0) {
+        return nil;
+    }
+    BRUFileWatch *watch = self.watches[@(wd)];
+    if (!watch) {
+        watch = [[BRUFileWatch alloc] initWithKey:@(wd)];
+        self.watches[@(wd)] = watch;
+    }
+    return watch;
+}
+
+- (void)destroyWatch:(BRUFileWatch *)watch
+{
+    BRU_ASSERT_ON_QUEUE(self.queue);
+
+    inotify_rm_watch(self.fd, [(NSNumber *)watch.key intValue]);
+}
+
+#else
+
+/**
+ * Returns the watch for `path`, creating it if needed.
+ */
+- (BRUFileWatch *)watchForPath:(NSString *)path
+{
+    BRU_ASSERT_ON_QUEUE(self.queue);
+
+    int fd = open([path fileSystemRepresentation], O_EVTONLY | O_SYMLINK);
+    if (fd < 0) {
+        return nil;
+    }
+    struct stat st;
+    if (0 != fstat(fd, &st)) {
+        close(fd);
+        return nil;
+    }
+    NSString *key = [NSString stringWithFormat:@"%llu:%llu", (unsigned long long)st.st_dev,
+                     (unsigned long long)st.st_ino];
+    BRUFileWatch *watch = self.watches[key];
+    if (watch) {
+        /* the open inode can't be reused, so this is the inode the watch is watching */
+        close(fd);
+        return watch;
+    }
+
+    watch = [[BRUFileWatch alloc] initWithKey:key];
+    dispatch_source_t src = dispatch_source_create(DISPATCH_SOURCE_TYPE_VNODE,
+                                                   (uintptr_t)fd,
+                                                   BRU_FILE_MONITOR_VNODE_MASK,
+                                                   self.queue);
+    BRUAssert(NULL != src, @"Failed to create dispatch src");
+
+    BRU_weakify(watch);
+    dispatch_source_set_event_handler(src, ^{
+        BRU_strongify(watch);
+        if (nil == watch) {
+            return;
+        }
+        [self notifyWatch:watch flags:(uint32_t)dispatch_source_get_data(watch.source) name:nil];
+    });
+    dispatch_source_set_cancel_handler(src, ^{
+        close(fd);
+    });
+    dispatch_group_t registered = watch.registered;
+    dispatch_group_enter(registered);
+    dispatch_source_set_registration_handler(src, ^{
+        dispatch_group_leave(registered);
+    });
+
+    watch.source = src;
+    self.watches[key] = watch;
+    dispatch_resume(src);
+    return watch;
+}
+
+- (void)destroyWatch:(BRUFileWatch *)watch
+{
+    BRU_ASSERT_ON_QUEUE(self.queue);
+
+    dispatch_source_cancel(watch.source);
+}
+
+#endif
+
+/**
+ * Watches `path` (not following a symlink) and calls `handler` on `queue` when it (or, for a directory, its entries)
+ * changes. Returns once the kernel watch is in place.
+ *
+ * @return The registration to pass to `removeWatch:` or `nil` if the path can't be watched.
+ */
+- (BRUFileWatchRegistration *)addWatchForPath:(NSString *)path handler:(BRUFileWatchHandler)handler
+{
+    BRU_ASSERT_OFF_QUEUE(self.queue);
+
+    __block BRUFileWatchRegistration *registration = nil;
+    dispatch_sync(self.queue, ^{
+        BRUFileWatch *watch = [self watchForPath:path];
+        if (nil == watch) {
+            return;
+        }
+        registration = [[BRUFileWatchRegistration alloc] initWithWatch:watch handler:handler];
+        [watch.registrations addObject:registration];
+    });
+#if !BRU_FILE_MONITOR_USE_INOTIFY
+    if (registration) {
+        /* the watch might have been created just now, by us or concurrently */
+        dispatch_group_wait(registration.watch.registered, DISPATCH_TIME_FOREVER);
+    }
+#endif
+    return registration;
+}
+
+- (void)removeWatch:(BRUFileWatchRegistration *)registration
+{
+    BRU_ASSERT_OFF_QUEUE(self.queue);
+
+    dispatch_sync(self.queue, ^{
+        BRUFileWatch *watch = registration.watch;
+        [watch.registrations removeObjectIdenticalTo:registration];
+        if (0 == watch.registrations.count && self.watches[watch.key] == watch) {
+            /* last one out, unless the kernel removed it already */
+            [self destroyWatch:watch];
+            [self.watches removeObjectForKey:watch.key];
+        }
+    });
+}
+
+@end
+
+@implementation BRUFileMonitorChange
+
+BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
+
+- (instancetype)initWithPath:(NSString *)path kind:(BRUFileMonitorChangeKind)kind
+{
+    if ((self = [super init])) {
+        self->_path = [path copy];
+        self->_kind = kind;
+    }
+    return self;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"BRUFileMonitorChange {path='%@', kind=0x%lx}",
+            self.path, (unsigned long)self.kind];
+}
+
+@end
+
 @interface BRUFileMonitor ()
 
 @property (nonatomic, strong, readonly) dispatch_queue_t syncQueue;
@@ -23,13 +387,79 @@
 @property (nonatomic, strong, readonly) dispatch_queue_t completionQueue;
 
 // Only accesses on syncQueue
+// (the BRUFileWatchRegistrations of the path's components)
 @property (nonatomic, strong, readwrite) NSArray *dispatch_source_list;
 @property (nonatomic, assign, readwrite) BOOL isStatValid;
 @property (nonatomic, assign, readwrite) struct stat stat;
 @property (nonatomic, strong, readwrite) void (^eventCallback)(BRUFileMonitor *monitor);
 
+// Recursive mode, only accessed on syncQueue
+@property (nonatomic, strong, readwrite) BRUFileMonitorChangesHandler changesHandler;
+@property (nonatomic, strong, readwrite) NSMutableDictionary<NSString *, NSNumber *> *pendingChanges;
+@property (nonatomic, assign, readwrite) BOOL deliveryScheduled;
+@property (nonatomic, assign, readwrite) NSUInteger deliveryGeneration; /* bumped on stop, drops stale deliveries */
+#if BRU_FILE_MONITOR_USE_INOTIFY
+@property (nonatomic, strong, readwrite) NSMutableDictionary<NSString *, BRUFileWatchRegistration *> *treeWatches;
+#else
+@property (nonatomic, assign, readwrite) FSEventStreamRef eventStream;
+@property (nonatomic, copy, readwrite) NSString *resolvedPath; /* the path FSEvents reports changes with */
+#endif
+
 @end
 
+#if BRU_FILE_MONITOR_USE_INOTIFY
+static BRUFileMonitorChangeKind changeKindWithInotifyMask(uint32_t mask)
+{
+    BRUFileMonitorChangeKind kind = 0;
+    if (mask & IN_CREATE) {
+        kind |= BRUFileMonitorChangeKindCreated;
+    }
+    if (mask & (IN_DELETE | IN_DELETE_SELF | IN_UNMOUNT)) {
+        kind |= BRUFileMonitorChangeKindRemoved;
+    }
+    if (mask & (IN_MODIFY | IN_CLOSE_WRITE)) {
+        kind |= BRUFileMonitorChangeKindModified;
+    }
+    if (mask & IN_ATTRIB) {
+        kind |= BRUFileMonitorChangeKindAttributes;
+    }
+    if (mask & (IN_MOVED_FROM | IN_MOVED_TO | IN_MOVE_SELF)) {
+        kind |= BRUFileMonitorChangeKindRenamed;
+    }
+    return kind;
+}
+#else
+static BRUFileMonitorChangeKind changeKindWithEventStreamFlags(FSEventStreamEventFlags flags)
+{
+    BRUFileMonitorChangeKind kind = 0;
+    if (flags & kFSEventStreamEventFlagItemCreated) {
+        kind |= BRUFileMonitorChangeKindCreated;
+    }
+    if (flags & kFSEventStreamEventFlagItemRemoved) {
+        kind |= BRUFileMonitorChangeKindRemoved;
+    }
+    if (flags & kFSEventStreamEventFlagItemModified) {
+        kind |= BRUFileMonitorChangeKindModified;
+    }
+    if (flags & (kFSEventStreamEventFlagItemInodeMetaMod |
+                 kFSEventStreamEventFlagItemChangeOwner |
+                 kFSEventStreamEventFlagItemXattrMod |
+                 kFSEventStreamEventFlagItemFinderInfoMod)) {
+        kind |= BRUFileMonitorChangeKindAttributes;
+    }
+    if (flags & kFSEventStreamEventFlagItemRenamed) {
+        kind |= BRUFileMonitorChangeKindRenamed;
+    }
+    if (flags & (kFSEventStreamEventFlagMustScanSubDirs |
+                 kFSEventStreamEventFlagUserDropped |
+                 kFSEventStreamEventFlagKernelDropped |
+                 kFSEventStreamEventFlagRootChanged)) {
+        kind |= BRUFileMonitorChangeKindMustRescan;
+    }
+    return kind;
+}
+#endif
+
 @implementation BRUFileMonitor
 
 #pragma mark - public interface
@@ -49,9 +479,25 @@
     if (nil != self) {
         _path = [path copy];
         _syncQueue = bru_dispatch_queue_create("com.bromium.BRUFileMonitor.syncQueue", DISPATCH_QUEUE_SERIAL);
-        _monitorQueue = bru_dispatch_queue_create("com.bromium.BRUFileMonitor.monitorQueue", DISPATCH_QUEUE_SERIAL);
+        /* all monitors share the watches and their queue */
+        _monitorQueue = [BRUFileWatchRegistry sharedRegistry].queue;
         _completionQueue = completionQueue;
         _dispatch_source_list = nil;
+        _recursive = NO;
+        _debounceInterval = 0;
+    }
+    return self;
+}
+
+- (instancetype)initWithDirectoryTreeAtPath:(NSString *)path
+                           debounceInterval:(NSTimeInterval)debounceInterval
+                            completionQueue:(dispatch_queue_t)completionQueue
+{
+    BRUParameterAssert(debounceInterval >= 0);
+    self = [self initWithPath:path completionQueue:completionQueue];
+    if (nil != self) {
+        _recursive = YES;
+        _debounceInterval = debounceInterval;
     }
     return self;
 }
@@ -65,6 +511,14 @@
     if (!BRUParameterNotNil(callback, error)) {
         return NO;
     }
+    if (self.recursive) {
+        BRU_ASSIGN_OUT_PTR(error, [NSError errorWithDomain:NSPOSIXErrorDomain
+                                                      code:ENOTSUP
+                                                  userInfo:@{BRUErrorReasonKey:
+                                                                 @"Recursive monitors deliver changes, use "
+                                                                 @"startWithError:changesHandler:."}]);
+        return NO;
+    }
 
     __block BOOL success = YES;
     dispatch_sync(self.syncQueue, ^(){
@@ -77,7 +531,7 @@
             self.stat = pre;
         }
 
-        if (nil != self.dispatch_source_list) {
+        if ([self isStartedUnsynchronized]) {
             BRU_ASSIGN_OUT_PTR(error, [NSError errorWithDomain:NSPOSIXErrorDomain
                                                           code:ENOTSUP
                                                       userInfo:@{BRUErrorReasonKey:
@@ -103,7 +557,7 @@
     __block BOOL success = YES;
     dispatch_sync(self.syncQueue, ^(){
 
-        if (nil == self.dispatch_source_list) {
+        if (![self isStartedUnsynchronized]) {
             BRU_ASSIGN_OUT_PTR(error, [NSError errorWithDomain:NSPOSIXErrorDomain
                                                           code:ENOTSUP
                                                       userInfo:@{BRUErrorReasonKey:
@@ -112,6 +566,15 @@
             return;
         }
 
+        if (self.recursive) {
+            [self destroyTreeMonitor];
+            self.changesHandler = nil;
+            self.pendingChanges = nil;
+            self.deliveryScheduled = NO;
+            self.deliveryGeneration++;
+            return;
+        }
+
         [self destroyMonitors];
         self.eventCallback = nil;
         self.isStatValid = NO;
@@ -126,19 +589,66 @@
 
     __block BOOL rv;
     dispatch_sync(self.syncQueue, ^() {
-        rv = self.dispatch_source_list != nil;
+        rv = [self isStartedUnsynchronized];
     });
     return rv;
 }
 
+- (BOOL)startWithError:(NSError **)error
+        changesHandler:(BRUFileMonitorChangesHandler)changesHandler
+{
+    BRU_ASSERT_OFF_QUEUE(self.syncQueue);
+    BRU_ASSERT_OFF_QUEUE(self.monitorQueue);
+
+    if (!BRUParameterNotNil(changesHandler, error)) {
+        return NO;
+    }
+    if (!self.recursive) {
+        BRU_ASSIGN_OUT_PTR(error, [NSError errorWithDomain:NSPOSIXErrorDomain
+                                                      code:ENOTSUP
+                                                  userInfo:@{BRUErrorReasonKey:
+                                                                 @"Only recursive monitors deliver changes."}]);
+        return NO;
+    }
+
+    __block BOOL success = YES;
+    dispatch_sync(self.syncQueue, ^(){
+        if ([self isStartedUnsynchronized]) {
+            BRU_ASSIGN_OUT_PTR(error, [NSError errorWithDomain:NSPOSIXErrorDomain
+                                                          code:ENOTSUP
+                                                      userInfo:@{BRUErrorReasonKey:
+                                                                     @"Can't start already started monitor."}]);
+            success = NO;
+            return;
+        }
+
+        self.changesHandler = changesHandler;
+        self.pendingChanges = [NSMutableDictionary new];
+        success = [self buildTreeMonitorWithError:error];
+        if (!success) {
+            self.changesHandler = nil;
+            self.pendingChanges = nil;
+        }
+    });
+
+    return success;
+}
+
 - (void)dealloc
 {
-    BRUAssert(nil == self.dispatch_source_list, @"Monitor still running when dealloced");
+    BRUAssert(nil == self.dispatch_source_list && nil == self.changesHandler, @"Monitor still running when dealloced");
 }
 
 
 #pragma mark - internal
 
+- (BOOL)isStartedUnsynchronized
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
+
+    return nil != self.dispatch_source_list || nil != self.changesHandler;
+}
+
 - (void)buildMonitors
 {
     BRU_ASSERT_ON_QUEUE(self.syncQueue);
@@ -146,55 +656,33 @@
 
     BRUAssert(nil == self.dispatch_source_list, @"building monitors whilst already built");
 
-    dispatch_group_t syncgroup = dispatch_group_create();
-
     NSMutableArray *srcs = [NSMutableArray array];
     NSString *subPath = @"";
     for (NSString *subPathComponent in [self.path pathComponents]) {
         subPath = [subPath stringByAppendingPathComponent:subPathComponent];
-        int fd = open([subPath fileSystemRepresentation], O_EVTONLY | O_SYMLINK);
-        if (fd >= 0) {
-            dispatch_source_t src = dispatch_source_create(DISPATCH_SOURCE_TYPE_VNODE,
-                                                           (uintptr_t)fd,
-                                                           DISPATCH_VNODE_DELETE |
-                                                           DISPATCH_VNODE_EXTEND |
-                                                           DISPATCH_VNODE_WRITE |
-                                                           DISPATCH_VNODE_ATTRIB |
-                                                           DISPATCH_VNODE_LINK |
-                                                           DISPATCH_VNODE_RENAME |
-                                                           DISPATCH_VNODE_REVOKE,
-                                                           self.monitorQueue);
-            BRUAssert(NULL != src, @"Failed to create dispatch src");
-
-            BRU_weakify(self);
-            dispatch_source_set_event_handler(src, ^{
+
+        BRU_weakify(self);
+        BRUFileWatchHandler eventHandler = ^(__unused uint32_t flags, __unused NSString *name) {
+            BRU_strongify(self);
+            if (nil == self) {
+                return;
+            }
+
+            dispatch_async(self.syncQueue, ^() {
                 BRU_strongify(self);
-                if (nil == self) {
+                if ((nil == self) || (nil == self.dispatch_source_list)) {
                     return;
                 }
-
-                dispatch_async(self.syncQueue, ^() {
-                    BRU_strongify(self);
-                    if ((nil == self) || (nil == self.dispatch_source_list)) {
-                        return;
-                    }
-                    [self evaluateForPath:subPath];
-                });
-            });
-            dispatch_source_set_cancel_handler(src, ^{
-                close(fd);
+                [self evaluateForPath:subPath];
             });
+        };
 
-            dispatch_group_enter(syncgroup);
-            dispatch_source_set_registration_handler(src, ^{
-                dispatch_group_leave(syncgroup);
-            });
-
-            [srcs addObject:src];
-            dispatch_resume(src);
+        BRUFileWatchRegistration *registration = [[BRUFileWatchRegistry sharedRegistry] addWatchForPath:subPath
+                                                                                                 handler:eventHandler];
+        if (registration) {
+            [srcs addObject:registration];
         }
     }
-    dispatch_group_wait(syncgroup, DISPATCH_TIME_FOREVER);
 
     self.dispatch_source_list = srcs;
 }
@@ -205,8 +693,8 @@
 
     BRUAssert(nil != self.dispatch_source_list, @"destroying monitors when already destroyed");
 
-    for (dispatch_source_t src in self.dispatch_source_list) {
-        dispatch_source_cancel(src);
+    for (BRUFileWatchRegistration *registration in self.dispatch_source_list) {
+        [[BRUFileWatchRegistry sharedRegistry] removeWatch:registration];
     }
     self.dispatch_source_list = nil;
 }
@@ -290,5 +778,299 @@
     }
 }
 
+#pragma mark - internal (recursive mode)
+
+- (void)deliverChanges
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
+
+    self.deliveryScheduled = NO;
+    BRUFileMonitorChangesHandler changesHandler = self.changesHandler;
+    if (nil == changesHandler || 0 == self.pendingChanges.count) {
+        return;
+    }
+
+    NSArray<NSString *> *paths = [[self.pendingChanges allKeys] sortedArrayUsingSelector:@selector(compare:)];
+    NSMutableArray<BRUFileMonitorChange *> *changes = [NSMutableArray arrayWithCapacity:paths.count];
+    for (NSString *path in paths) {
+        [changes addObject:[[BRUFileMonitorChange alloc] initWithPath:path
+                                                                 kind:self.pendingChanges[path].unsignedIntegerValue]];
+    }
+    [self.pendingChanges removeAllObjects];
+
+    BRU_weakify(self);
+    dispatch_async(self.completionQueue, ^{
+        BRU_strongify(self);
+        if (nil == self) {
+            return;
+        }
+        changesHandler(self, changes);
+    });
+}
+
+/**
+ * Adds a change to the current batch, starting the debounce window if it's the first one.
+ */
+- (void)recordChangeAtPath:(NSString *)path kind:(BRUFileMonitorChangeKind)kind
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
+
+    if (nil == self.changesHandler || 0 == kind) {
+        return;
+    }
+    /* duplicate events for the same path collapse into one change */
+    self.pendingChanges[path] = @(self.pendingChanges[path].unsignedIntegerValue | kind);
+
+    if (!self.deliveryScheduled) {
+        self.deliveryScheduled = YES;
+        NSUInteger generation = self.deliveryGeneration;
+        BRU_weakify(self);
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.debounceInterval * NSEC_PER_SEC)),
+                       self.syncQueue,
+                       ^{
+                           BRU_strongify(self);
+                           if (generation != self.deliveryGeneration) {
+                               /* the monitor was stopped (and maybe restarted) since */
+                               return;
+                           }
+                           [self deliverChanges];
+                       });
+    }
+}
+
+#if BRU_FILE_MONITOR_USE_INOTIFY
+
+- (BOOL)watchDirectory:(NSString *)directory
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
+
+    BRU_weakify(self);
+    BRUFileWatchHandler handler = ^(uint32_t mask, NSString *name) {
+        BRU_strongify(self);
+        if (nil == self) {
+            return;
+        }
+
+        dispatch_async(self.syncQueue, ^() {
+            BRU_strongify(self);
+            if ((nil == self) || (nil == self.treeWatches)) {
+                return;
+            }
+            [self processTreeEventWithMask:mask name:name inDirectory:directory];
+        });
+    };
+    BRUFileWatchRegistration *registration = [[BRUFileWatchRegistry sharedRegistry] addWatchForPath:directory
+                                                                                             handler:handler];
+    if (nil == registration) {
+        /* most likely out of inotify watches, changes below here will go unnoticed */
+        [self recordChangeAtPath:directory kind:BRUFileMonitorChangeKindMustRescan];
+        return NO;
+    }
+    self.treeWatches[directory] = registration;
+    return YES;
+}
+
+/**
+ * Watches all directories in the tree at `root`.
+ *
+ * @param reportContents Whether to report everything in the tree as created (for trees that appeared while
+ *                       monitoring).
+ */
+- (void)watchDirectoryTreeAtPath:(NSString *)root reportContents:(BOOL)reportContents
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
+
+    NSMutableArray<NSString *> *directories = [NSMutableArray arrayWithObject:root];
+    while (directories.count > 0) {
+        NSString *directory = directories.lastObject;
+        [directories removeLastObject];
+        /* watch before listing so that no entry created in between goes unnoticed */
+        if (nil != self.treeWatches[directory] || ![self watchDirectory:directory]) {
+            continue;
+        }
+
+        DIR *dir = opendir([directory fileSystemRepresentation]);
+        if (NULL == dir) {
+            continue;
+        }
+        struct dirent *entry;
+        while (NULL != (entry = readdir(dir))) {
+            if (0 == strcmp(entry->d_name, ".") || 0 == strcmp(entry->d_name, "..")) {
+                continue;
+            }
+            NSString *name = [[NSFileManager defaultManager] stringWithFileSystemRepresentation:entry->d_name
+                                                                                         length:strlen(entry->d_name)];
+            NSString *path = [directory stringByAppendingPathComponent:name];
+            if (reportContents) {
+                [self recordChangeAtPath:path kind:BRUFileMonitorChangeKindCreated];
+            }
+            BOOL isDirectory = DT_DIR == entry->d_type;
+            if (DT_UNKNOWN == entry->d_type) {
+                struct stat st;
+                isDirectory = 0 == lstat([path fileSystemRepresentation], &st) && S_ISDIR(st.st_mode);
+            }
+            if (isDirectory) {
+                [directories addObject:path];
+            }
+        }
+        closedir(dir);
+    }
+}
+
+- (void)unwatchDirectoryTreeAtPath:(NSString *)root
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
+
+    NSString *prefix = [root stringByAppendingString:@"/"];
+    for (NSString *directory in [self.treeWatches allKeys]) {
+        if ([directory isEqualToString:root] || [directory hasPrefix:prefix]) {
+            [[BRUFileWatchRegistry sharedRegistry] removeWatch:self.treeWatches[directory]];
+            [self.treeWatches removeObjectForKey:directory];
+        }
+    }
+}
+
+- (void)processTreeEventWithMask:(uint32_t)mask name:(NSString *)name inDirectory:(NSString *)directory
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
+
+    if (mask & IN_Q_OVERFLOW) {
+        [self recordChangeAtPath:self.path kind:BRUFileMonitorChangeKindMustRescan];
+        return;
+    }
+
+    NSString *path = name ? [directory stringByAppendingPathComponent:name] : directory;
+    if (mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT)) {
+        /* the directory's parent reports the change too, unless it's the root */
+        [self unwatchDirectoryTreeAtPath:directory];
+        if ([directory isEqualToString:self.path]) {
+            [self recordChangeAtPath:path kind:changeKindWithInotifyMask(mask)];
+        }
+        return;
+    }
+    if ((mask & IN_ISDIR) && (mask & IN_MOVED_FROM)) {
+        [self unwatchDirectoryTreeAtPath:path];
+    }
+    [self recordChangeAtPath:path kind:changeKindWithInotifyMask(mask)];
+    if ((mask & IN_ISDIR) && (mask & (IN_CREATE | IN_MOVED_TO))) {
+        [self watchDirectoryTreeAtPath:path reportContents:YES];
+    }
+}
+
+- (BOOL)buildTreeMonitorWithError:(__unused NSError **)error
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
+
+    self.treeWatches = [NSMutableDictionary new];
+    [self watchDirectoryTreeAtPath:self.path reportContents:NO];
+    return YES;
+}
+
+- (void)destroyTreeMonitor
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
+
+    for (BRUFileWatchRegistration *registration in [self.treeWatches allValues]) {
+        [[BRUFileWatchRegistry sharedRegistry] removeWatch:registration];
+    }
+    self.treeWatches = nil;
+}
+
+#else
+
+/**
+ * Translates a path reported by FSEvents (symlinks resolved) back to one below `path`.
+ */
+- (NSString *)monitoredPathWithEventPath:(NSString *)eventPath
+{
+    NSString *resolvedPath = self.resolvedPath;
+    if ([eventPath isEqualToString:resolvedPath]) {
+        return self.path;
+    } else if ([eventPath hasPrefix:[resolvedPath stringByAppendingString:@"/"]]) {
+        return [self.path stringByAppendingPathComponent:[eventPath substringFromIndex:resolvedPath.length + 1]];
+    }
+    return eventPath;
+}
+
+static void fileMonitorEventStreamCallback(__unused ConstFSEventStreamRef stream,
+                                           void *info,
+                                           size_t numEvents,
+                                           void *eventPaths,
+                                           const FSEventStreamEventFlags eventFlags[],
+                                           __unused const FSEventStreamEventId eventIds[])
+{
+    BRUFileMonitor *monitor = (__bridge BRUFileMonitor *)info;
+    char **paths = eventPaths;
+
+    NSMutableArray<NSString *> *changedPaths = [NSMutableArray arrayWithCapacity:numEvents];
+    NSMutableArray<NSNumber *> *kinds = [NSMutableArray arrayWithCapacity:numEvents];
+    for (size_t i = 0; i < numEvents; i++) {
+        NSString *eventPath = [[NSFileManager defaultManager] stringWithFileSystemRepresentation:paths[i]
+                                                                                          length:strlen(paths[i])];
+        [changedPaths addObject:eventPath];
+        [kinds addObject:@(changeKindWithEventStreamFlags(eventFlags[i]))];
+    }
+
+    dispatch_async(monitor.syncQueue, ^{
+        for (NSUInteger i = 0; i < changedPaths.count; i++) {
+            [monitor recordChangeAtPath:[monitor monitoredPathWithEventPath:changedPaths[i]]
+                                   kind:kinds[i].unsignedIntegerValue];
+        }
+    });
+}
+
+- (BOOL)buildTreeMonitorWithError:(NSError **)error
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
+
+    char resolvedPath[PATH_MAX];
+    if (NULL != realpath([self.path fileSystemRepresentation], resolvedPath)) {
+        self.resolvedPath = [[NSFileManager defaultManager] stringWithFileSystemRepresentation:resolvedPath
+                                                                                        length:strlen(resolvedPath)];
+    } else {
+        self.resolvedPath = self.path;
+    }
+
+    /* the stream retains us until it's released in destroyTreeMonitor */
+    FSEventStreamContext context = { 0, (__bridge void *)self, CFRetain, CFRelease, NULL };
+    FSEventStreamRef stream = FSEventStreamCreate(kCFAllocatorDefault,
+                                                  fileMonitorEventStreamCallback,
+                                                  &context,
+                                                  (__bridge CFArrayRef)@[self.path],
+                                                  kFSEventStreamEventIdSinceNow,
+                                                  0 /* latency, we debounce ourselves */,
+                                                  kFSEventStreamCreateFlagFileEvents |
+                                                  kFSEventStreamCreateFlagNoDefer |
+                                                  kFSEventStreamCreateFlagWatchRoot);
+    if (NULL == stream) {
+        BRU_ASSIGN_OUT_PTR(error, [NSError errorWithDomain:NSPOSIXErrorDomain
+                                                      code:EINVAL
+                                                  userInfo:@{BRUErrorReasonKey:@"Can't create FSEvents stream."}]);
+        return NO;
+    }
+    FSEventStreamSetDispatchQueue(stream, self.monitorQueue);
+    if (!FSEventStreamStart(stream)) {
+        FSEventStreamInvalidate(stream);
+        FSEventStreamRelease(stream);
+        BRU_ASSIGN_OUT_PTR(error, [NSError errorWithDomain:NSPOSIXErrorDomain
+                                                      code:EIO
+                                                  userInfo:@{BRUErrorReasonKey:@"Can't start FSEvents stream."}]);
+        return NO;
+    }
+    self.eventStream = stream;
+    return YES;
+}
+
+- (void)destroyTreeMonitor
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
+
+    FSEventStreamStop(self.eventStream);
+    FSEventStreamInvalidate(self.eventStream);
+    FSEventStreamRelease(self.eventStream);
+    self.eventStream = NULL;
+}
+
+#endif
 
 @end
@@ -0,0 +1,107 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "BRUBaseDefines.h"
+#import "BRUMemoryRegion.h"
+
+/**
+ * How a file is mapped.
+ */
+typedef NS_ENUM(NSInteger, BRUMappedFileMode) {
+
+    /**
+     * The region is read-only, writing to it crashes.
+     */
+    BRUMappedFileModeReadOnly = 0,
+
+    /**
+     * The region is writable but changes are private to the mapping, the file is never modified.
+     */
+    BRUMappedFileModeCopyOnWrite = 1,
+
+};
+
+/**
+ * Hints about how the mapped region will be accessed.
+ */
+typedef NS_OPTIONS(NSUInteger, BRUMappedFileOptions) {
+
+    /**
+     * Read the whole file in while mapping it (`MAP_POPULATE` on Linux, `MADV_WILLNEED` elsewhere), so that the first
+     * access of each page doesn't fault.
+     */
+    BRUMappedFileOptionPopulate = 1 << 0,
+
+    /**
+     * The region will be read front to back (`MADV_SEQUENTIAL`), pages can be read ahead aggressively and dropped
+     * early.
+     */
+    BRUMappedFileOptionSequential = 1 << 1,
+
+    /**
+     * The region will be accessed randomly (`MADV_RANDOM`), read-ahead is pointless.
+     */
+    BRUMappedFileOptionRandom = 1 << 2,
+
+};
+
+BRU_assume_nonnull_begin
+
+/**
+ * A `BRUMappedFile` maps a file into memory and exposes it as a `BRUMemoryRegion`, so that it can be parsed without
+ * copying it.
+ *
+ * The region is valid until the file is unmapped, either explicitly with `unmapWithError:` or when the
+ * `BRUMappedFile` is deallocated, so keep it alive for as long as the region (or any sub-region) is in use. Empty files
+ * map to `BRUMemoryRegionNull`. Truncating the file while it is mapped makes accesses beyond its new end crash
+ * (`SIGBUS`).
+ */
+BRU_restrict_subclassing @interface BRUMappedFile : NSObject
+
+BRU_DEFAULT_INIT_UNAVAILABLE(null_unspecified)
+
+@property (nonatomic, readonly, copy) NSString *path;
+@property (nonatomic, readonly, assign) BRUMappedFileMode mode;
+
+/**
+ * The mapped file, `BRUMemoryRegionNull` once unmapped.
+ */
+@property (nonatomic, readonly, assign) BRUMemoryRegion region;
+
+/**
+ * Map a file.
+ *
+ * @param path The file to map.
+ * @param mode Whether the mapping is read-only or copy-on-write.
+ * @param options Access hints, a failure to apply them isn't an error.
+ * @param error Set if the file can't be opened or mapped.
+ */
++ (nullable instancetype)mappedFileWithPath:(NSString *)path
+                                       mode:(BRUMappedFileMode)mode
+                                    options:(BRUMappedFileOptions)options
+                                      error:(BRUOutError)error;
+
+/**
+ * Initialise by mapping a file, see `mappedFileWithPath:mode:options:error:`.
+ */
+- (nullable instancetype)initWithPath:(NSString *)path
+                                 mode:(BRUMappedFileMode)mode
+                              options:(BRUMappedFileOptions)options
+                                error:(BRUOutError)error NS_DESIGNATED_INITIALIZER;
+
+/**
+ * Unmap the file now instead of when the `BRUMappedFile` is deallocated. Unmapping twice is allowed.
+ *
+ * @return NO (with `error` set) if `munmap` failed.
+ */
+- (BOOL)unmapWithError:(BRUOutError)error;
+
+@end
+
+BRU_assume_nonnull_end
@@ -0,0 +1,167 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#import "BRUAsserts.h"
+#import "BRUMappedFile.h"
+#import "BRUResourceCleanup.h"
+
+static NSError *posixErrorWithReason(int code, NSString *reason, NSString *path)
+{
+    return [NSError errorWithDomain:NSPOSIXErrorDomain
+                               code:code
+                           userInfo:@{BRUErrorReasonKey:reason, NSFilePathErrorKey:path}];
+}
+
+@interface BRUMappedFile ()
+
+/* protected by @synchronized(self), NULL and 0 if nothing's mapped */
+@property (nonatomic, readwrite, assign) void *mappedBytes;
+@property (nonatomic, readwrite, assign) size_t mappedLength;
+
+@end
+
+@implementation BRUMappedFile
+
+BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
+
++ (instancetype)mappedFileWithPath:(NSString *)path
+                              mode:(BRUMappedFileMode)mode
+                           options:(BRUMappedFileOptions)options
+                             error:(BRUOutError)error
+{
+    return [[self alloc] initWithPath:path mode:mode options:options error:error];
+}
+
+- (instancetype)initWithPath:(NSString *)path
+                        mode:(BRUMappedFileMode)mode
+                     options:(BRUMappedFileOptions)options
+                       error:(BRUOutError)error
+{
+    BRUParameterAssert(path);
+    BRUParameterAssert(!((options & BRUMappedFileOptionSequential) && (options & BRUMappedFileOptionRandom)));
+
+    if ((self = [super init])) {
+        self->_path = [path copy];
+        self->_mode = mode;
+
+        BRUResourceCleanup *cleanup = [BRUResourceCleanup new];
+        int fd = open([path fileSystemRepresentation], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            BRU_ASSIGN_OUT_PTR(error, posixErrorWithReason(errno, @"open failed", path));
+            [cleanup runAllCleanupsWithError:nil];
+            return nil;
+        }
+        [cleanup addCleanupBlockForClosingFileDescriptor:fd];
+
+        struct stat st;
+        size_t length = 0;
+        if (0 != fstat(fd, &st)) {
+            BRU_ASSIGN_OUT_PTR(error, posixErrorWithReason(errno, @"fstat failed", path));
+            [cleanup runAllCleanupsWithError:nil];
+            return nil;
+        }
+        if (!S_ISREG(st.st_mode)) {
+            BRU_ASSIGN_OUT_PTR(error, posixErrorWithReason(S_ISDIR(st.st_mode) ? EISDIR : ENODEV,
+                                                           @"not a regular file", path));
+            [cleanup runAllCleanupsWithError:nil];
+            return nil;
+        }
+        if (!bru_ptrdiff_to_size((ptrdiff_t)st.st_size, &length)) {
+            BRU_ASSIGN_OUT_PTR(error, posixErrorWithReason(EOVERFLOW, @"file size out of range", path));
+            [cleanup runAllCleanupsWithError:nil];
+            return nil;
+        }
+
+        if (length > 0) {
+            int prot = PROT_READ;
+            int flags = MAP_SHARED;
+            if (BRUMappedFileModeCopyOnWrite == mode) {
+                prot |= PROT_WRITE;
+                flags = MAP_PRIVATE;
+            }
+#if defined(MAP_POPULATE)
+            if (options & BRUMappedFileOptionPopulate) {
+                flags |= MAP_POPULATE;
+            }
+#endif
+            void *bytes = mmap(NULL, length, prot, flags, fd, 0);
+            if (MAP_FAILED == bytes) {
+                BRU_ASSIGN_OUT_PTR(error, posixErrorWithReason(errno, @"mmap failed", path));
+                [cleanup runAllCleanupsWithError:nil];
+                return nil;
+            }
+            self->_mappedBytes = bytes;
+            self->_mappedLength = length;
+
+            /* only hints, the mapping is usable regardless */
+            int advice = MADV_NORMAL;
+            if (options & BRUMappedFileOptionSequential) {
+                advice = MADV_SEQUENTIAL;
+            } else if (options & BRUMappedFileOptionRandom) {
+                advice = MADV_RANDOM;
+            }
+            if (MADV_NORMAL != advice && 0 != madvise(bytes, length, advice)) {
+                BRUAssertDebugLog(NO, @"madvise(%d) failed: %d (%s)", advice, errno, strerror(errno));
+            }
+#if !defined(MAP_POPULATE)
+            if ((options & BRUMappedFileOptionPopulate) && 0 != madvise(bytes, length, MADV_WILLNEED)) {
+                BRUAssertDebugLog(NO, @"madvise(MADV_WILLNEED) failed: %d (%s)", errno, strerror(errno));
+            }
+#endif
+        }
+
+        /* the mapping keeps the file referenced, the descriptor isn't needed anymore */
+        [cleanup runAllCleanupsWithError:nil];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    if (NULL != self->_mappedBytes) {
+        int err = munmap(self->_mappedBytes, self->_mappedLength);
+        BRUAssertDebugLog(0 == err, @"munmap failed: %d (%s)", errno, strerror(errno));
+    }
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"BRUMappedFile {path='%@', mode=%ld, region=%@}",
+            self.path, (long)self.mode, NSStringFromBRUMemoryRegion(self.region)];
+}
+
+#pragma mark - Public API
+
+- (BRUMemoryRegion)region
+{
+    @synchronized(self) {
+        return BRUMemoryRegionMake(self.mappedBytes, self.mappedLength);
+    }
+}
+
+- (BOOL)unmapWithError:(BRUOutError)error
+{
+    @synchronized(self) {
+        if (NULL == self.mappedBytes) {
+            return YES;
+        }
+        if (0 != munmap(self.mappedBytes, self.mappedLength)) {
+            BRU_ASSIGN_OUT_PTR(error, posixErrorWithReason(errno, @"munmap failed", self.path));
+            return NO;
+        }
+        self.mappedBytes = NULL;
+        self.mappedLength = 0;
+        return YES;
+    }
+}
+
+@end
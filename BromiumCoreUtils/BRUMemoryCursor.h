@@ -0,0 +1,241 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#include <string.h>
+
+#import "BRUMemoryRegion.h"
+
+/**
+ * A bounds-checked, zero-copy reader walking a memory region front to back.
+ *
+ * The region is validated once, when the cursor is made. After that every read checks the remaining length only: a
+ * read that doesn't fit fails the cursor, returning 0 (or `BRUMemoryRegionNull`). Failure is sticky, the cursor
+ * skips to the end so that all later reads fail too, and the offset of the first failed read is kept. A parser can
+ * therefore read a whole record and check `BRUMemoryCursorHasFailed` once at the end.
+ *
+ * In hot loops, `BRUMemoryCursorRequire` validates a span once; the `...Unchecked` reads inside it then don't check at
+ * all (in debug builds they assert).
+ *
+ * Don't touch the fields directly.
+ */
+typedef struct {
+    uint8_t * __nullable start;
+    uint8_t * __nullable next;
+    uint8_t * __nullable end;
+    size_t failureOffset; /* SIZE_MAX while the cursor hasn't failed */
+} BRUMemoryCursor;
+
+inline static void _bru_memory_cursor_fail_at(BRUMemoryCursor * __nonnull cursor, uint8_t * __nullable position) {
+    if (SIZE_MAX == cursor->failureOffset) {
+        cursor->failureOffset = (size_t)(position - cursor->start);
+    }
+    cursor->next = cursor->end;
+}
+
+/**
+ * Return a cursor at the start of region, region. If region wraps around the end of the address space, the cursor is
+ * failed right away.
+ *
+ * @param region Memory region to read.
+ *
+ * @return Cursor reading region.
+ */
+inline static BRUMemoryCursor BRUMemoryCursorMake(BRUMemoryRegion region) {
+    BRUMemoryCursor cursor = { region.bytes, region.bytes, region.bytes, SIZE_MAX };
+    void *end = NULL;
+    if (!BRUMemoryRegionGetEnd(region, &end)) {
+        _bru_memory_cursor_fail_at(&cursor, cursor.start);
+        return cursor;
+    }
+    cursor.end = end;
+    return cursor;
+}
+
+/**
+ * Return whether a read of the cursor, cursor, failed.
+ */
+inline static bool BRUMemoryCursorHasFailed(const BRUMemoryCursor * __nonnull cursor) {
+    return SIZE_MAX != cursor->failureOffset;
+}
+
+/**
+ * Return the offset (from the start of the region) of the first failed read of the cursor, cursor. Only meaningful if
+ * the cursor failed.
+ */
+inline static size_t BRUMemoryCursorFailureOffset(const BRUMemoryCursor * __nonnull cursor) {
+    return cursor->failureOffset;
+}
+
+/**
+ * Return the offset of the cursor, cursor, from the start of the region.
+ */
+inline static size_t BRUMemoryCursorOffset(const BRUMemoryCursor * __nonnull cursor) {
+    return (size_t)(cursor->next - cursor->start);
+}
+
+/**
+ * Return the number of bytes left to read from the cursor, cursor. 0 once it failed.
+ */
+inline static size_t BRUMemoryCursorRemaining(const BRUMemoryCursor * __nonnull cursor) {
+    return (size_t)(cursor->end - cursor->next);
+}
+
+/**
+ * Validate that at least length bytes are left to read, failing the cursor otherwise. Doesn't move the cursor.
+ *
+ * @return true if the next length bytes may be read with the `...Unchecked` functions; otherwise, false.
+ */
+__attribute__((warn_unused_result))
+inline static bool BRUMemoryCursorRequire(BRUMemoryCursor * __nonnull cursor, size_t length) {
+    if (BRU_unlikely(BRUMemoryCursorRemaining(cursor) < length)) {
+        _bru_memory_cursor_fail_at(cursor, cursor->next);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Skip length bytes.
+ *
+ * @return true if the bytes were there; otherwise, false (and the cursor failed).
+ */
+__attribute__((warn_unused_result))
+inline static bool BRUMemoryCursorSkip(BRUMemoryCursor * __nonnull cursor, size_t length) {
+    if (!BRUMemoryCursorRequire(cursor, length)) {
+        return false;
+    }
+    cursor->next += length;
+    return true;
+}
+
+/**
+ * Read the next length bytes as a sub-region, without copying them.
+ *
+ * @return The sub-region or, if there aren't enough bytes left, BRUMemoryRegionNull (and the cursor failed).
+ */
+__attribute__((warn_unused_result))
+inline static BRUMemoryRegion BRUMemoryCursorReadSlice(BRUMemoryCursor * __nonnull cursor, size_t length) {
+    if (!BRUMemoryCursorRequire(cursor, length)) {
+        return BRUMemoryRegionNull;
+    }
+    BRUMemoryRegion slice = BRUMemoryRegionMake(cursor->next, length);
+    cursor->next += length;
+    return slice;
+}
+
+#pragma mark - Fixed width integers
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define _bru_memory_cursor_to_host_LE(_bits, _v) (_v)
+#define _bru_memory_cursor_to_host_BE(_bits, _v) __builtin_bswap##_bits(_v)
+#else
+#define _bru_memory_cursor_to_host_LE(_bits, _v) __builtin_bswap##_bits(_v)
+#define _bru_memory_cursor_to_host_BE(_bits, _v) (_v)
+#endif
+
+/*
+ * Defines BRUMemoryCursorReadUInt<bits><order> (checked, returns 0 and fails the cursor if there aren't enough bytes)
+ * and BRUMemoryCursorReadUInt<bits><order>Unchecked (only valid inside a span validated by BRUMemoryCursorRequire).
+ */
+#define _bru_memory_cursor_define_read(_bits, _order) /*
+*/inline static uint##_bits##_t BRUMemoryCursorReadUInt##_bits##_order##Unchecked(BRUMemoryCursor * __nonnull cursor) { /*
+*/    BRUAssertDebugFatal(BRUMemoryCursorRemaining(cursor) >= sizeof(uint##_bits##_t), @"unchecked read out of bounds"); /*
+*/    uint##_bits##_t value; /*
+*/    memcpy(&value, cursor->next, sizeof(value)); /*
+*/    cursor->next += sizeof(value); /*
+*/    return _bru_memory_cursor_to_host_##_order(_bits, value); /*
+*/} /*
+*/__attribute__((warn_unused_result)) /*
+*/inline static uint##_bits##_t BRUMemoryCursorReadUInt##_bits##_order(BRUMemoryCursor * __nonnull cursor) { /*
+*/    if (!BRUMemoryCursorRequire(cursor, sizeof(uint##_bits##_t))) { /*
+*/        return 0; /*
+*/    } /*
+*/    return BRUMemoryCursorReadUInt##_bits##_order##Unchecked(cursor); /*
+*/}
+
+_bru_memory_cursor_define_read(16, LE)
+_bru_memory_cursor_define_read(16, BE)
+_bru_memory_cursor_define_read(32, LE)
+_bru_memory_cursor_define_read(32, BE)
+_bru_memory_cursor_define_read(64, LE)
+_bru_memory_cursor_define_read(64, BE)
+
+/**
+ * Read one byte, see BRUMemoryCursorReadUInt8.
+ */
+inline static uint8_t BRUMemoryCursorReadUInt8Unchecked(BRUMemoryCursor * __nonnull cursor) {
+    BRUAssertDebugFatal(BRUMemoryCursorRemaining(cursor) >= 1, @"unchecked read out of bounds");
+    return *cursor->next++;
+}
+
+/**
+ * Read one byte.
+ *
+ * @return The byte or, if there's none left, 0 (and the cursor failed).
+ */
+__attribute__((warn_unused_result))
+inline static uint8_t BRUMemoryCursorReadUInt8(BRUMemoryCursor * __nonnull cursor) {
+    if (!BRUMemoryCursorRequire(cursor, 1)) {
+        return 0;
+    }
+    return BRUMemoryCursorReadUInt8Unchecked(cursor);
+}
+
+#pragma mark - Varints
+
+/**
+ * Read an unsigned LEB128 varint (as used by protocol buffers) of up to 10 bytes.
+ *
+ * @return The value or, if the varint is truncated or doesn't fit 64 bits, 0 (and the cursor failed at the varint's
+ *         first byte).
+ */
+__attribute__((warn_unused_result))
+inline static uint64_t BRUMemoryCursorReadVarUInt64(BRUMemoryCursor * __nonnull cursor) {
+    uint8_t *start = cursor->next;
+    uint64_t value = 0;
+    for (unsigned int shift = 0; shift < 64; shift += 7) {
+        if (BRU_unlikely(cursor->next == cursor->end)) {
+            break;
+        }
+        uint8_t byte = *cursor->next++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            if (BRU_unlikely(63 == shift && byte > 1)) {
+                /* the 10th byte only holds the top bit */
+                break;
+            }
+            return value;
+        }
+    }
+    _bru_memory_cursor_fail_at(cursor, start);
+    return 0;
+}
+
+/**
+ * Read a zigzag encoded signed varint, see BRUMemoryCursorReadVarUInt64.
+ */
+__attribute__((warn_unused_result))
+inline static int64_t BRUMemoryCursorReadVarInt64(BRUMemoryCursor * __nonnull cursor) {
+    uint64_t value = BRUMemoryCursorReadVarUInt64(cursor);
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/**
+ * Read a slice prefixed with its length as unsigned varint.
+ *
+ * @return The slice or, if the length or slice don't fit, BRUMemoryRegionNull (and the cursor failed).
+ */
+__attribute__((warn_unused_result))
+inline static BRUMemoryRegion BRUMemoryCursorReadVarUInt64PrefixedSlice(BRUMemoryCursor * __nonnull cursor) {
+    uint8_t *start = cursor->next;
+    uint64_t length = BRUMemoryCursorReadVarUInt64(cursor);
+    if (BRU_unlikely(BRUMemoryCursorHasFailed(cursor) || length > BRUMemoryCursorRemaining(cursor))) {
+        _bru_memory_cursor_fail_at(cursor, start);
+        return BRUMemoryRegionNull;
+    }
+    return BRUMemoryCursorReadSlice(cursor, (size_t)length);
+}
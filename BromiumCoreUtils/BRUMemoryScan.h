@@ -0,0 +1,101 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "BRUMemoryRegion.h"
+
+/*
+ * Vectorised scans and comparisons of memory regions. The kernels are picked once at runtime: AVX2 if the CPU (and OS)
+ * support it, otherwise SSE2 on x86 and plain C everywhere else. All results are the same whichever kernels run.
+ *
+ * Regions whose end address overflows are invalid: nothing is read and the functions fail (return NO or 0).
+ */
+
+/**
+ * The kernel sets.
+ */
+typedef NS_ENUM(NSInteger, BRUMemoryScanKernels) {
+    BRUMemoryScanKernelsScalar = 0,
+    BRUMemoryScanKernelsSSE2 = 1,
+    BRUMemoryScanKernelsAVX2 = 2,
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Return the kernel set currently in use.
+ */
+BRUMemoryScanKernels BRUMemoryScanActiveKernels(void);
+
+/**
+ * Switch to another kernel set, for tests and benchmarks. Not thread-safe with concurrent scans.
+ *
+ * @param kernels The kernel set to use.
+ *
+ * @return YES if the CPU supports the kernels (and they're used now); otherwise, NO.
+ */
+BOOL BRUMemoryScanUseKernels(BRUMemoryScanKernels kernels);
+
+/**
+ * Find the first occurrence of the byte, byte, in the memory region, region (like `memchr`).
+ *
+ * @param region Memory region to search.
+ * @param byte Byte to search for.
+ * @param offset Out-param for the offset of the byte in region.
+ *
+ * @return YES if byte was found; otherwise, NO.
+ */
+__attribute__((warn_unused_result))
+BOOL BRUMemoryRegionFindByte(BRUMemoryRegion region, uint8_t byte, size_t * __nonnull offset);
+
+/**
+ * Find the first byte of the memory region, region, that is one of the bytes in the memory region, set (like
+ * `strpbrk`). Sets of up to 8 bytes are searched vectorised.
+ *
+ * @param region Memory region to search.
+ * @param set Memory region holding the bytes to search for.
+ * @param offset Out-param for the offset of the found byte in region.
+ *
+ * @return YES if any byte of set was found; otherwise, NO.
+ */
+__attribute__((warn_unused_result))
+BOOL BRUMemoryRegionFindAnyByte(BRUMemoryRegion region, BRUMemoryRegion set, size_t * __nonnull offset);
+
+/**
+ * Find the offset of the first byte that differs between the memory regions, region1 and region2. If one region is
+ * a prefix of the other, that's the length of the shorter one.
+ *
+ * @param region1 Memory region to compare.
+ * @param region2 Memory region to compare.
+ * @param offset Out-param for the offset of the first difference.
+ *
+ * @return YES if the regions differ; otherwise (or if a region is invalid), NO.
+ */
+__attribute__((warn_unused_result))
+BOOL BRUMemoryRegionFindFirstDifference(BRUMemoryRegion region1, BRUMemoryRegion region2, size_t * __nonnull offset);
+
+/**
+ * Return a BOOL indicating whether the memory regions, region1 and region2, have the same length and contents.
+ */
+BOOL BRUMemoryRegionIsEqualToRegion(BRUMemoryRegion region1, BRUMemoryRegion region2);
+
+/**
+ * Return a BOOL indicating whether all bytes of the memory region, region, are zero. An empty region is.
+ */
+BOOL BRUMemoryRegionIsAllZero(BRUMemoryRegion region);
+
+/**
+ * Return the number of set bits in the memory region, region.
+ */
+uint64_t BRUMemoryRegionPopulationCount(BRUMemoryRegion region);
+
+#ifdef __cplusplus
+}
+#endif
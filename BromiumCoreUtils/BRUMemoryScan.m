@@ -0,0 +1,494 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#include <string.h>
+
+#import "BRUAsserts.h"
+#import "BRUMemoryScan.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define BRU_MEMORY_SCAN_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#else
+#define BRU_MEMORY_SCAN_X86 0
+#endif
+
+/* the largest set BRUMemoryRegionFindAnyByte compares against vectorised, larger sets use a lookup table */
+#define BRU_MEMORY_SCAN_MAX_VECTOR_SET 8
+
+/**
+ * One implementation of all scans. The find functions return `length` if there's nothing to be found.
+ */
+typedef struct {
+    size_t (*findByte)(const uint8_t *bytes, size_t length, uint8_t byte);
+    size_t (*findAnyByte)(const uint8_t *bytes, size_t length, const uint8_t *set, size_t setLength);
+    size_t (*findDifference)(const uint8_t *bytes1, const uint8_t *bytes2, size_t length);
+    bool (*isAllZero)(const uint8_t *bytes, size_t length);
+    uint64_t (*populationCount)(const uint8_t *bytes, size_t length);
+} BRUMemoryScanKernelTable;
+
+#pragma mark - Scalar kernels
+
+static size_t scalarFindByte(const uint8_t *bytes, size_t length, uint8_t byte)
+{
+    for (size_t i = 0; i < length; i++) {
+        if (bytes[i] == byte) {
+            return i;
+        }
+    }
+    return length;
+}
+
+static size_t scalarFindAnyByte(const uint8_t *bytes, size_t length, const uint8_t *set, size_t setLength)
+{
+    bool member[256] = { false };
+    for (size_t i = 0; i < setLength; i++) {
+        member[set[i]] = true;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (member[bytes[i]]) {
+            return i;
+        }
+    }
+    return length;
+}
+
+static size_t scalarFindDifference(const uint8_t *bytes1, const uint8_t *bytes2, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        if (bytes1[i] != bytes2[i]) {
+            return i;
+        }
+    }
+    return length;
+}
+
+static bool scalarIsAllZero(const uint8_t *bytes, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        if (bytes[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint64_t scalarPopulationCount(const uint8_t *bytes, size_t length)
+{
+    uint64_t count = 0;
+    size_t i = 0;
+    for (; length - i >= sizeof(uint64_t); i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        count += (uint64_t)__builtin_popcountll(word);
+    }
+    for (; i < length; i++) {
+        count += (uint64_t)__builtin_popcount(bytes[i]);
+    }
+    return count;
+}
+
+static const BRUMemoryScanKernelTable scalarKernels = {
+    scalarFindByte,
+    scalarFindAnyByte,
+    scalarFindDifference,
+    scalarIsAllZero,
+    scalarPopulationCount,
+};
+
+#if BRU_MEMORY_SCAN_X86
+
+#pragma mark - SSE2 kernels
+
+/* the tails (less than a vector) are left to the scalar kernels */
+
+static inline __m128i sse2Load(const uint8_t *bytes)
+{
+    return _mm_loadu_si128((const __m128i *)(const void *)bytes);
+}
+
+static size_t sse2FindByte(const uint8_t *bytes, size_t length, uint8_t byte)
+{
+    const __m128i needle = _mm_set1_epi8((char)byte);
+    size_t i = 0;
+    for (; length - i >= 16; i += 16) {
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(sse2Load(bytes + i), needle));
+        if (mask) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    return i + scalarFindByte(bytes + i, length - i, byte);
+}
+
+static size_t sse2FindAnyByte(const uint8_t *bytes, size_t length, const uint8_t *set, size_t setLength)
+{
+    if (0 == setLength || setLength > BRU_MEMORY_SCAN_MAX_VECTOR_SET) {
+        return scalarFindAnyByte(bytes, length, set, setLength);
+    }
+    __m128i needles[BRU_MEMORY_SCAN_MAX_VECTOR_SET];
+    for (size_t j = 0; j < setLength; j++) {
+        needles[j] = _mm_set1_epi8((char)set[j]);
+    }
+    size_t i = 0;
+    for (; length - i >= 16; i += 16) {
+        __m128i chunk = sse2Load(bytes + i);
+        __m128i hits = _mm_cmpeq_epi8(chunk, needles[0]);
+        for (size_t j = 1; j < setLength; j++) {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, needles[j]));
+        }
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(hits);
+        if (mask) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    return i + scalarFindAnyByte(bytes + i, length - i, set, setLength);
+}
+
+static size_t sse2FindDifference(const uint8_t *bytes1, const uint8_t *bytes2, size_t length)
+{
+    size_t i = 0;
+    for (; length - i >= 16; i += 16) {
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(sse2Load(bytes1 + i),
+                                                                           sse2Load(bytes2 + i)));
+        if (0xffffu != mask) {
+            return i + (size_t)__builtin_ctz(~mask);
+        }
+    }
+    return i + scalarFindDifference(bytes1 + i, bytes2 + i, length - i);
+}
+
+static bool sse2IsAllZero(const uint8_t *bytes, size_t length)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    /* OR four vectors together, so there's one test per cache line */
+    for (; length - i >= 64; i += 64) {
+        __m128i acc = _mm_or_si128(_mm_or_si128(sse2Load(bytes + i), sse2Load(bytes + i + 16)),
+                                   _mm_or_si128(sse2Load(bytes + i + 32), sse2Load(bytes + i + 48)));
+        if (0xffff != _mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero))) {
+            return false;
+        }
+    }
+    for (; length - i >= 16; i += 16) {
+        if (0xffff != _mm_movemask_epi8(_mm_cmpeq_epi8(sse2Load(bytes + i), zero))) {
+            return false;
+        }
+    }
+    return scalarIsAllZero(bytes + i, length - i);
+}
+
+static uint64_t sse2PopulationCount(const uint8_t *bytes, size_t length)
+{
+    /* SSE2 has no popcnt, count the bits of each byte in parallel and sum the bytes up with psadbw */
+    const __m128i m1 = _mm_set1_epi8(0x55);
+    const __m128i m2 = _mm_set1_epi8(0x33);
+    const __m128i m4 = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i total = _mm_setzero_si128();
+    size_t i = 0;
+    for (; length - i >= 16; i += 16) {
+        __m128i x = sse2Load(bytes + i);
+        x = _mm_sub_epi8(x, _mm_and_si128(_mm_srli_epi16(x, 1), m1));
+        x = _mm_add_epi8(_mm_and_si128(x, m2), _mm_and_si128(_mm_srli_epi16(x, 2), m2));
+        x = _mm_and_si128(_mm_add_epi8(x, _mm_srli_epi16(x, 4)), m4);
+        total = _mm_add_epi64(total, _mm_sad_epu8(x, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)(void *)lanes, total);
+    return lanes[0] + lanes[1] + scalarPopulationCount(bytes + i, length - i);
+}
+
+static const BRUMemoryScanKernelTable sse2Kernels = {
+    sse2FindByte,
+    sse2FindAnyByte,
+    sse2FindDifference,
+    sse2IsAllZero,
+    sse2PopulationCount,
+};
+
+#pragma mark - AVX2 kernels
+
+/* the tails (less than a vector) are left to the SSE2 kernels */
+
+#define BRU_MEMORY_SCAN_AVX2 __attribute__((target("avx2")))
+
+BRU_MEMORY_SCAN_AVX2 static inline __m256i avx2Load(const uint8_t *bytes)
+{
+    return _mm256_loadu_si256((const __m256i *)(const void *)bytes);
+}
+
+BRU_MEMORY_SCAN_AVX2 static size_t avx2FindByte(const uint8_t *bytes, size_t length, uint8_t byte)
+{
+    const __m256i needle = _mm256_set1_epi8((char)byte);
+    size_t i = 0;
+    for (; length - i >= 32; i += 32) {
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(avx2Load(bytes + i), needle));
+        if (mask) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    return i + sse2FindByte(bytes + i, length - i, byte);
+}
+
+BRU_MEMORY_SCAN_AVX2 static size_t avx2FindAnyByte(const uint8_t *bytes,
+                                                   size_t length,
+                                                   const uint8_t *set,
+                                                   size_t setLength)
+{
+    if (0 == setLength || setLength > BRU_MEMORY_SCAN_MAX_VECTOR_SET) {
+        return scalarFindAnyByte(bytes, length, set, setLength);
+    }
+    __m256i needles[BRU_MEMORY_SCAN_MAX_VECTOR_SET];
+    for (size_t j = 0; j < setLength; j++) {
+        needles[j] = _mm256_set1_epi8((char)set[j]);
+    }
+    size_t i = 0;
+    for (; length - i >= 32; i += 32) {
+        __m256i chunk = avx2Load(bytes + i);
+        __m256i hits = _mm256_cmpeq_epi8(chunk, needles[0]);
+        for (size_t j = 1; j < setLength; j++) {
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, needles[j]));
+        }
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(hits);
+        if (mask) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    return i + sse2FindAnyByte(bytes + i, length - i, set, setLength);
+}
+
+BRU_MEMORY_SCAN_AVX2 static size_t avx2FindDifference(const uint8_t *bytes1, const uint8_t *bytes2, size_t length)
+{
+    size_t i = 0;
+    for (; length - i >= 32; i += 32) {
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(avx2Load(bytes1 + i),
+                                                                                 avx2Load(bytes2 + i)));
+        if (0xffffffffu != mask) {
+            return i + (size_t)__builtin_ctz(~mask);
+        }
+    }
+    return i + sse2FindDifference(bytes1 + i, bytes2 + i, length - i);
+}
+
+BRU_MEMORY_SCAN_AVX2 static bool avx2IsAllZero(const uint8_t *bytes, size_t length)
+{
+    size_t i = 0;
+    /* OR four vectors together, so there's one test per two cache lines */
+    for (; length - i >= 128; i += 128) {
+        __m256i acc = _mm256_or_si256(_mm256_or_si256(avx2Load(bytes + i), avx2Load(bytes + i + 32)),
+                                      _mm256_or_si256(avx2Load(bytes + i + 64), avx2Load(bytes + i + 96)));
+        if (!_mm256_testz_si256(acc, acc)) {
+            return false;
+        }
+    }
+    for (; length - i >= 32; i += 32) {
+        __m256i chunk = avx2Load(bytes + i);
+        if (!_mm256_testz_si256(chunk, chunk)) {
+            return false;
+        }
+    }
+    return sse2IsAllZero(bytes + i, length - i);
+}
+
+BRU_MEMORY_SCAN_AVX2 static uint64_t avx2PopulationCount(const uint8_t *bytes, size_t length)
+{
+    /* look the bit counts of both nibbles of each byte up with vpshufb, then sum the bytes up with vpsadbw */
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowNibbles = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; length - i >= 32; i += 32) {
+        __m256i x = avx2Load(bytes + i);
+        __m256i low = _mm256_and_si256(x, lowNibbles);
+        __m256i high = _mm256_and_si256(_mm256_srli_epi16(x, 4), lowNibbles);
+        __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, low), _mm256_shuffle_epi8(lookup, high));
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(counts, zero));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)(void *)lanes, total);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sse2PopulationCount(bytes + i, length - i);
+}
+
+static const BRUMemoryScanKernelTable avx2Kernels = {
+    avx2FindByte,
+    avx2FindAnyByte,
+    avx2FindDifference,
+    avx2IsAllZero,
+    avx2PopulationCount,
+};
+
+static bool cpuSupportsAVX2(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE) || !(ecx & bit_AVX)) {
+        return false;
+    }
+    /* the OS must save the YMM registers on context switches */
+    uint32_t xcr0Low, xcr0High;
+    __asm__ ("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+    (void)xcr0High;
+    if (0x6 != (xcr0Low & 0x6)) {
+        return false;
+    }
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return false;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return 0 != (ebx & bit_AVX2);
+}
+
+#endif
+
+#pragma mark - Dispatch
+
+static const BRUMemoryScanKernelTable *activeKernelTable;
+static BRUMemoryScanKernels activeKernels;
+
+/**
+ * Returns the kernels of the set, kernels, or NULL if the CPU doesn't support them.
+ */
+static const BRUMemoryScanKernelTable *kernelTableWithKernels(BRUMemoryScanKernels kernels)
+{
+    switch (kernels) {
+        case BRUMemoryScanKernelsScalar:
+            return &scalarKernels;
+        case BRUMemoryScanKernelsSSE2:
+#if BRU_MEMORY_SCAN_X86
+            return &sse2Kernels;
+#else
+            return NULL;
+#endif
+        case BRUMemoryScanKernelsAVX2:
+#if BRU_MEMORY_SCAN_X86
+            return cpuSupportsAVX2() ? &avx2Kernels : NULL;
+#else
+            return NULL;
+#endif
+    }
+    return NULL;
+}
+
+static const BRUMemoryScanKernelTable *kernelTable(void)
+{
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        BRUMemoryScanKernels best[] = { BRUMemoryScanKernelsAVX2, BRUMemoryScanKernelsSSE2 };
+        activeKernelTable = &scalarKernels;
+        activeKernels = BRUMemoryScanKernelsScalar;
+        for (size_t i = 0; i < sizeof(best) / sizeof(best[0]); i++) {
+            const BRUMemoryScanKernelTable *table = kernelTableWithKernels(best[i]);
+            if (table) {
+                activeKernelTable = table;
+                activeKernels = best[i];
+                break;
+            }
+        }
+    });
+    return activeKernelTable;
+}
+
+BRUMemoryScanKernels BRUMemoryScanActiveKernels(void)
+{
+    (void)kernelTable();
+    return activeKernels;
+}
+
+BOOL BRUMemoryScanUseKernels(BRUMemoryScanKernels kernels)
+{
+    (void)kernelTable();
+    const BRUMemoryScanKernelTable *table = kernelTableWithKernels(kernels);
+    if (NULL == table) {
+        return NO;
+    }
+    activeKernelTable = table;
+    activeKernels = kernels;
+    return YES;
+}
+
+#pragma mark - Public API
+
+static BOOL isValidRegion(BRUMemoryRegion region)
+{
+    void *end = NULL;
+    return BRUMemoryRegionGetEnd(region, &end);
+}
+
+BOOL BRUMemoryRegionFindByte(BRUMemoryRegion region, uint8_t byte, size_t *offset)
+{
+    BRUParameterAssert(offset);
+    if (!isValidRegion(region)) {
+        return NO;
+    }
+    size_t found = kernelTable()->findByte(region.bytes, region.length, byte);
+    if (found == region.length) {
+        return NO;
+    }
+    *offset = found;
+    return YES;
+}
+
+BOOL BRUMemoryRegionFindAnyByte(BRUMemoryRegion region, BRUMemoryRegion set, size_t *offset)
+{
+    BRUParameterAssert(offset);
+    if (!isValidRegion(region) || !isValidRegion(set)) {
+        return NO;
+    }
+    size_t found = kernelTable()->findAnyByte(region.bytes, region.length, set.bytes, set.length);
+    if (found == region.length) {
+        return NO;
+    }
+    *offset = found;
+    return YES;
+}
+
+BOOL BRUMemoryRegionFindFirstDifference(BRUMemoryRegion region1, BRUMemoryRegion region2, size_t *offset)
+{
+    BRUParameterAssert(offset);
+    if (!isValidRegion(region1) || !isValidRegion(region2)) {
+        return NO;
+    }
+    size_t length = MIN(region1.length, region2.length);
+    size_t found = length;
+    if (region1.bytes != region2.bytes) {
+        found = kernelTable()->findDifference(region1.bytes, region2.bytes, length);
+    }
+    if (found == length && region1.length == region2.length) {
+        return NO;
+    }
+    *offset = found;
+    return YES;
+}
+
+BOOL BRUMemoryRegionIsEqualToRegion(BRUMemoryRegion region1, BRUMemoryRegion region2)
+{
+    if (region1.length != region2.length || !isValidRegion(region1) || !isValidRegion(region2)) {
+        return NO;
+    }
+    if (region1.bytes == region2.bytes) {
+        return YES;
+    }
+    return kernelTable()->findDifference(region1.bytes, region2.bytes, region1.length) == region1.length;
+}
+
+BOOL BRUMemoryRegionIsAllZero(BRUMemoryRegion region)
+{
+    if (!isValidRegion(region)) {
+        return NO;
+    }
+    return kernelTable()->isAllZero(region.bytes, region.length);
+}
+
+uint64_t BRUMemoryRegionPopulationCount(BRUMemoryRegion region)
+{
+    if (!isValidRegion(region)) {
+        return 0;
+    }
+    return kernelTable()->populationCount(region.bytes, region.length);
+}
@@ -11,6 +11,8 @@
 
 typedef void (^BRURateLimiterCompletionBlock)(void);
 typedef void (^BRURateLimiterResultBlock)(__nonnull id result, __nonnull BRURateLimiterCompletionBlock completionBlock);
+typedef void (^BRUBatchingRateLimiterResultBlock)(NSArray * __nonnull results,
+                                                  __nonnull BRURateLimiterCompletionBlock completionBlock);
 
 @interface BRURateLimiter<T> : NSObject
 
@@ -21,3 +23,43 @@ BRU_DEFAULT_INIT_UNAVAILABLE(null_unspecified)
 - (void)setResult:(nonnull T)result;
 
 @end
+
+/**
+ * Like `BRURateLimiter` but instead of dropping all but the latest result, `BRUBatchingRateLimiter` accumulates every
+ * result added while the result block is busy and hands them over as one batch (in the order they were added) once
+ * the completion block was called.
+ *
+ * Adding a result is lock-free. Optionally, batches can be limited in size (remaining results are delivered with the
+ * next batch) and results can be held back for up to a maximum delay to collect bigger batches.
+ */
+@interface BRUBatchingRateLimiter<T> : NSObject
+
+BRU_DEFAULT_INIT_UNAVAILABLE(null_unspecified)
+
+/**
+ * Initialise a `BRUBatchingRateLimiter` delivering everything accumulated right away.
+ *
+ * @param targetQueue The queue to run the result block on.
+ * @param resultBlock The block receiving the batches, must call the completion block when done.
+ */
+- (nonnull instancetype)initWithTargetQueue:(nonnull dispatch_queue_t)targetQueue
+                                resultBlock:(nonnull BRUBatchingRateLimiterResultBlock)resultBlock;
+
+/**
+ * Initialise a `BRUBatchingRateLimiter`.
+ *
+ * @param targetQueue The queue to run the result block on.
+ * @param maxBatchSize The maximum number of results in one batch, 0 for no limit.
+ * @param maxDelay For how long results may be held back to collect more of them, 0 to deliver them right away. A
+ *                 full batch is delivered without delay.
+ * @param resultBlock The block receiving the batches, must call the completion block when done.
+ */
+- (nonnull instancetype)initWithTargetQueue:(nonnull dispatch_queue_t)targetQueue
+                               maxBatchSize:(NSUInteger)maxBatchSize
+                                   maxDelay:(NSTimeInterval)maxDelay
+                                resultBlock:(nonnull BRUBatchingRateLimiterResultBlock)resultBlock
+    NS_DESIGNATED_INITIALIZER;
+
+- (void)addResult:(nonnull T)result;
+
+@end
@@ -7,6 +7,9 @@
 //  Created by Jason Barrie Morley on 06/10/2015.
 //
 
+#include <stdatomic.h>
+#include <stdlib.h>
+
 #import "BRUConcurrentBox.h"
 #import "BRUDispatchUtils.h"
 #import "BRUAsserts.h"
@@ -14,17 +17,69 @@
 
 #import "BRURateLimiter.h"
 
-@interface BRURateLimiter<T> ()
+/**
+ * What the rate limiters share to hold back their sync queue while the result block runs.
+ */
+@protocol BRURateLimiterSuspending <NSObject>
 
-@property (nonatomic, readonly, strong) dispatch_queue_t targetQueue;
 @property (nonatomic, readonly, strong) dispatch_queue_t syncQueue;
-@property (nonatomic, readonly, strong) BRUConcurrentBox<T> *concurrentBox;
-@property (nonatomic, readonly, strong) BRURateLimiterResultBlock resultBlock;
 
 /**
  * Synchronized on self.
  */
-@property (nonatomic, readwrite, strong) void (^completionBlock)(BRURateLimiter *);
+@property (nonatomic, readwrite, strong) void (^completionBlock)(id<BRURateLimiterSuspending>);
+
+@end
+
+/**
+ * Suspends the sync queue of `rateLimiter` until the returned block is called (which must happen exactly once).
+ */
+static BRURateLimiterCompletionBlock suspendSyncQueueUntilCompletion(id<BRURateLimiterSuspending> rateLimiter)
+{
+    // Suspend the syncQueue to ensure that no further operations are performed until the delegate has
+    // informed us that the current operation is complete by means of the completionBlock.
+    // This is resumed in the completion block. We are guaranteed that we are never released during the completion.
+    // Should the block be deallocated without being called it will be called in the class destructor through the
+    // completionBlock property.
+    void (^completionBlock)(id<BRURateLimiterSuspending>);
+    @synchronized(rateLimiter) {
+        
+        BRUAssertAlwaysFatal(rateLimiter.completionBlock == nil, @"Rate limiter completion block should be non-nil.");
+        
+        __block BOOL completionBlockDidRun = NO;
+        
+        // Since this block is retained by the rate limiter for cleanup purposes, it's super important that the
+        // completion block does not retain it as this will lead to retain cycles.
+        completionBlock = ^(id<BRURateLimiterSuspending> limiter) {
+            @synchronized(limiter) {
+                
+                BRUAssertAlwaysFatal(completionBlockDidRun == NO,
+                                     @"Rate limiter completion block cannot be called more than once.");
+                completionBlockDidRun = YES;
+                limiter.completionBlock = nil;
+                dispatch_resume(limiter.syncQueue);
+                
+            }
+        };
+        
+        rateLimiter.completionBlock = completionBlock;
+        
+        dispatch_suspend(rateLimiter.syncQueue);
+        
+    }
+    
+    return ^{
+        completionBlock(rateLimiter);
+    };
+}
+
+@interface BRURateLimiter<T> () <BRURateLimiterSuspending>
+
+@property (nonatomic, readonly, strong) dispatch_queue_t targetQueue;
+@property (nonatomic, readonly, strong) dispatch_queue_t syncQueue;
+@property (nonatomic, readonly, strong) BRUConcurrentBox<T> *concurrentBox;
+@property (nonatomic, readonly, strong) BRURateLimiterResultBlock resultBlock;
+@property (nonatomic, readwrite, strong) void (^completionBlock)(id<BRURateLimiterSuspending>);
 
 @end
 
@@ -75,41 +130,180 @@ BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
 
 - (void)performSetResult:(id)result
 {
-    // Suspend the syncQueue to ensure that no further operations are performed until the delegate has
-    // informed us that the current operation is complete by means of the completionBlock.
-    // This is resumed in the completion block. We are guaranteed that we are never released during the completion.
-    // Should the block be deallocated without being called it will be called in the class destructor through the
-    // completionBlock property.
-    void (^completionBlock)(BRURateLimiter *);
-    @synchronized(self) {
-        
-        BRUAssertAlwaysFatal(self.completionBlock == nil, @"Rate limiter completion block should be non-nil.");
-        
-        __block BOOL completionBlockDidRun = NO;
-        
-        // Since this block is retained by self for cleanup purposes, it's super important that the completion block
-        // does not retain self as this will lead to retain cycles.
-        completionBlock = ^(BRURateLimiter *rateLimiter) {
-            @synchronized(rateLimiter) {
-                
-                BRUAssertAlwaysFatal(completionBlockDidRun == NO,
-                                     @"Rate limiter completion block cannot be called more than once.");
-                completionBlockDidRun = YES;
-                rateLimiter.completionBlock = nil;
-                dispatch_resume(rateLimiter.syncQueue);
-                
-            }
-        };
-        
-        self.completionBlock = completionBlock;
-        
-        dispatch_suspend(self.syncQueue);
-        
+    self.resultBlock(result, suspendSyncQueueUntilCompletion(self));
+}
+
+@end
+
+/**
+ * A node of the append buffer of `BRUBatchingRateLimiter`.
+ */
+typedef struct BRUBatchingRateLimiterNode {
+    struct BRUBatchingRateLimiterNode *next;
+    void *result; /* retained */
+} BRUBatchingRateLimiterNode;
+
+@interface BRUBatchingRateLimiter<T> () <BRURateLimiterSuspending> {
+    /* lock-free append buffer: a stack of the added results, newest first, taken as a whole by the delivery */
+    _Atomic(BRUBatchingRateLimiterNode *) _appended;
+    _Atomic(uintptr_t) _appendedCount;
+    _Atomic(uintptr_t) _deliveryScheduled;
+}
+
+@property (nonatomic, readonly, strong) dispatch_queue_t targetQueue;
+@property (nonatomic, readonly, strong) dispatch_queue_t syncQueue;
+@property (nonatomic, readonly, strong) BRUBatchingRateLimiterResultBlock resultBlock;
+@property (nonatomic, readonly, assign) NSUInteger maxBatchSize;
+@property (nonatomic, readonly, assign) NSTimeInterval maxDelay;
+
+/**
+ * Results taken from the append buffer that didn't fit in the last batch. Synchronized on syncQueue.
+ */
+@property (nonatomic, readonly, strong) NSMutableArray<T> *backlog;
+
+@property (nonatomic, readwrite, strong) void (^completionBlock)(id<BRURateLimiterSuspending>);
+
+@end
+
+@implementation BRUBatchingRateLimiter
+
+BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
+
+- (instancetype)initWithTargetQueue:(dispatch_queue_t)targetQueue
+                        resultBlock:(BRUBatchingRateLimiterResultBlock)resultBlock
+{
+    return [self initWithTargetQueue:targetQueue maxBatchSize:0 maxDelay:0 resultBlock:resultBlock];
+}
+
+- (instancetype)initWithTargetQueue:(dispatch_queue_t)targetQueue
+                       maxBatchSize:(NSUInteger)maxBatchSize
+                           maxDelay:(NSTimeInterval)maxDelay
+                        resultBlock:(BRUBatchingRateLimiterResultBlock)resultBlock
+{
+    BRUParameterAssert(targetQueue);
+    BRUParameterAssert(resultBlock);
+    BRUParameterAssert(maxDelay >= 0);
+
+    self = [super init];
+    if (self) {
+        self->_targetQueue = targetQueue;
+        self->_resultBlock = resultBlock;
+        self->_maxBatchSize = maxBatchSize;
+        self->_maxDelay = maxDelay;
+        self->_syncQueue = bru_dispatch_queue_create("com.bromium.BromiumUtils.BRUBatchingRateLimiter.syncQueue",
+                                                     DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(self->_syncQueue, self->_targetQueue);
+        self->_backlog = [NSMutableArray new];
+        atomic_init(&self->_appended, NULL);
+        atomic_init(&self->_appendedCount, 0);
+        atomic_init(&self->_deliveryScheduled, 0);
     }
-    
-    self.resultBlock(result, ^{
-        completionBlock(self);
-    });
+    return self;
+}
+
+- (void)dealloc
+{
+    if (_completionBlock) {
+        _completionBlock(self);
+    }
+    BRUAssertAlwaysFatal(_completionBlock == nil, @"Completion block should be nil at destruction.");
+
+    BRUBatchingRateLimiterNode *node = atomic_load_explicit(&_appended, memory_order_acquire);
+    while (node) {
+        BRUBatchingRateLimiterNode *next = node->next;
+        CFBridgingRelease(node->result);
+        free(node);
+        node = next;
+    }
+}
+
+- (void)addResult:(id)result
+{
+    BRUParameterAssert(result);
+
+    BRUBatchingRateLimiterNode *node = malloc(sizeof(*node));
+    BRUAssertAlwaysFatal(node, @"out of memory");
+    node->result = (void *)CFBridgingRetain(result);
+    node->next = atomic_load_explicit(&self->_appended, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&self->_appended, &node->next, node,
+                                                  memory_order_release, memory_order_relaxed)) {
+        /* node->next got updated to the current head, retry */
+    }
+    uintptr_t count = atomic_fetch_add_explicit(&self->_appendedCount, 1, memory_order_relaxed) + 1;
+
+    if (0 == atomic_exchange_explicit(&self->_deliveryScheduled, 1, memory_order_acq_rel)) {
+        [self scheduleDeliveryAfter:self.maxDelay];
+    } else if (self.maxDelay > 0 && count == self.maxBatchSize) {
+        /* the batch is full, don't hold it back any longer */
+        [self scheduleDeliveryAfter:0];
+    }
+}
+
+- (void)scheduleDeliveryAfter:(NSTimeInterval)delay
+{
+    BRU_weakify(self);
+    dispatch_block_t deliver = ^{
+        BRU_strongify(self);
+        if (self == nil) {
+            return;
+        }
+        [self deliverBatch];
+    };
+    if (delay > 0) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), self.syncQueue, deliver);
+    } else {
+        dispatch_async(self.syncQueue, deliver);
+    }
+}
+
+- (void)deliverBatch
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
+
+    /* results appended from now on need a new delivery */
+    atomic_store_explicit(&self->_deliveryScheduled, 0, memory_order_release);
+    BRUBatchingRateLimiterNode *node = atomic_exchange_explicit(&self->_appended, NULL, memory_order_acq_rel);
+
+    /* the stack is newest first, reverse it to get the results in order */
+    BRUBatchingRateLimiterNode *reversed = NULL;
+    while (node) {
+        BRUBatchingRateLimiterNode *next = node->next;
+        node->next = reversed;
+        reversed = node;
+        node = next;
+    }
+    NSUInteger taken = 0;
+    while (reversed) {
+        BRUBatchingRateLimiterNode *next = reversed->next;
+        [self.backlog addObject:CFBridgingRelease(reversed->result)];
+        free(reversed);
+        reversed = next;
+        taken++;
+    }
+    atomic_fetch_sub_explicit(&self->_appendedCount, taken, memory_order_relaxed);
+
+    if (self.backlog.count == 0) {
+        return;
+    }
+
+    NSArray *batch = nil;
+    if (self.maxBatchSize == 0 || self.backlog.count <= self.maxBatchSize) {
+        batch = [self.backlog copy];
+        [self.backlog removeAllObjects];
+    } else {
+        NSRange range = NSMakeRange(0, self.maxBatchSize);
+        batch = [self.backlog subarrayWithRange:range];
+        [self.backlog removeObjectsInRange:range];
+        /* runs once the result block completes as syncQueue is suspended until then */
+        [self scheduleDeliveryAfter:0];
+    }
+    [self performDeliverBatch:batch];
+}
+
+- (void)performDeliverBatch:(NSArray *)batch
+{
+    /* results accumulate in the append buffer until the result block completes */
+    self.resultBlock(batch, suspendSyncQueueUntilCompletion(self));
 }
 
 @end
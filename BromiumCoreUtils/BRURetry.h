@@ -11,6 +11,8 @@
 
 #import "BRUBaseDefines.h"
 
+@class BRUCancellationToken;
+
 /**
  * Describes the nature of the result when performing an action.
  */
@@ -218,6 +220,8 @@ BRURetryPolicyBlock __nonnull BRURetryPolicyBlockWithMaxRetries(NSUInteger retri
  * - If a retry attempt is already in progress the `NSUUID` will be the identifier of the ongoing operation and will be
  *   the same as the one returned to the `startWithCompletionBlock:` call which initiated the operation.
  * - An operation can be cancelled by calling `cancel:` with the corresponding identifier.
+ * - Alternatively, a `BRUCancellationToken` can be passed to `startWithCompletionBlock:cancellationToken:`.
+ *   Cancelling the token has the same effect as calling `cancel:` with the operation's identifier.
  */
 BRU_restrict_subclassing
 @interface BRURetry : NSObject
@@ -264,6 +268,21 @@ BRU_DEFAULT_INIT_UNAVAILABLE(nonnull)
  */
 - (nonnull NSUUID *)startWithCompletionBlock:(nullable BRURetryCompletionBlock)completionBlock;
 
+/**
+ * Start a retry operation like `startWithCompletionBlock:` which gets cancelled when `cancellationToken` is
+ * cancelled. If the operation is in its delay phase, the pending retry is torn down immediately; if an action is in
+ * progress, no further attempt will be made after it completes.
+ *
+ * Note that as with `cancel:` the operation is cancelled for all callers which joined it.
+ *
+ * @param completionBlock Completion block to be called with the resutls of the retry operation.
+ * @param cancellationToken Token cancelling the operation, may be nil.
+ *
+ * @return Identifier assocaited with the new (or current) retry attempt.
+ */
+- (nonnull NSUUID *)startWithCompletionBlock:(nullable BRURetryCompletionBlock)completionBlock
+                           cancellationToken:(nullable BRUCancellationToken *)cancellationToken;
+
 /**
  * Calls to cancel are ignored if the retry attempt is already being cancelled, is not running, or if the identifier
  * doesn't match the retry attempt in progress.
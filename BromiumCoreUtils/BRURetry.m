@@ -15,6 +15,7 @@
 #import "BRUEqualityUtils.h"
 #import "BRUARCUtils.h"
 #import "BRUDeferred.h"
+#import "BRUCancellationToken.h"
 
 BRURetryPolicyBlock __nonnull BRURetryPolicyBlockWithMaxRetries(NSUInteger retries) {
 
@@ -112,6 +113,13 @@ BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
  */
 @property (nonatomic, strong, readwrite) BRUDeferred *deferred;
 
+/**
+ * Blocks unregistering the cancellation handlers of the current operation from their tokens.
+ *
+ * Synchronized on syncQueue.
+ */
+@property (nonatomic, strong, readonly) NSMutableArray<dispatch_block_t> *cancellationCleanups;
+
 @end
 
 @implementation BRURetry
@@ -167,6 +175,7 @@ BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
         self->_attempt = 0;
         self->_state = BRURetryStateIdle;
         self->_deferred = nil;
+        self->_cancellationCleanups = [NSMutableArray array];
 
     }
     return self;
@@ -181,7 +190,8 @@ BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
                && self.attempt == 0
                && self.identifier == nil
                && BRUDoubleEquals(self.currentDelay, self.delay, DBL_EPSILON)
-               && self.deferred == nil) ||
+               && self.deferred == nil
+               && self.cancellationCleanups.count == 0) ||
               (self.state == BRURetryStateDelay
                && self.timer != nil
                && self.attempt > 0
@@ -239,7 +249,48 @@ BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
     self.state = BRURetryStateDelay;
 }
 
+- (void)removeCancellationHandlersUnsynchronized
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
+
+    for (dispatch_block_t cleanup in self.cancellationCleanups) {
+        cleanup();
+    }
+    [self.cancellationCleanups removeAllObjects];
+}
+
+- (void)addCancellationToken:(BRUCancellationToken *)cancellationToken
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
+
+    NSUUID *identifier = self.identifier;
+    BRU_weakify(self);
+    id registration = [cancellationToken addCancellationHandler:^{
+        /* the handler might run synchronously right here (on syncQueue) if the token is already cancelled */
+        BRU_strongify(self);
+        if (!self) {
+            return;
+        }
+        dispatch_async(self.syncQueue, ^{
+            [self cancelUnsynchronized:identifier];
+        });
+    }];
+
+    if (registration) {
+        __weak BRUCancellationToken *weakToken = cancellationToken;
+        [self.cancellationCleanups addObject:^{
+            [weakToken removeCancellationHandler:registration];
+        }];
+    }
+}
+
 - (nonnull NSUUID *)startWithCompletionBlock:(nullable BRURetryCompletionBlock)completionBlock
+{
+    return [self startWithCompletionBlock:completionBlock cancellationToken:nil];
+}
+
+- (nonnull NSUUID *)startWithCompletionBlock:(nullable BRURetryCompletionBlock)completionBlock
+                           cancellationToken:(nullable BRUCancellationToken *)cancellationToken
 {
     __block NSUUID *identifier = nil;
 
@@ -273,6 +324,10 @@ BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
             BRU_ASSERT_NOT_REACHED(@"Invalid state %lu", (unsigned long)self.state);
         }
 
+        if (cancellationToken) {
+            [self addCancellationToken:cancellationToken];
+        }
+
         if (completionBlock) {
 
             BRU_weakify(self);
@@ -308,58 +363,68 @@ BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
     __block BOOL success = NO;
     BRU_ASSERT_OFF_QUEUE(self.syncQueue);
     dispatch_sync(self.syncQueue, ^{
+        success = [self cancelUnsynchronized:identifier];
+    });
+    return success;
+}
 
-        if (![self.identifier isEqual:identifier]) {
-            return;
-        }
+- (BOOL)cancelUnsynchronized:(nonnull NSUUID *)identifier
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
 
-        if (self.state == BRURetryStateIdle) {
+    if (![self.identifier isEqual:identifier]) {
+        return NO;
+    }
 
-            // Already stopped. Nothing to do.
-            // This state should never happen as we're guarding against this scenario by checking the identifier.
+    BOOL success = NO;
 
-        } else if (self.state == BRURetryStateDelay) {
+    if (self.state == BRURetryStateIdle) {
+
+        // Already stopped. Nothing to do.
+        // This state should never happen as we're guarding against this scenario by checking the identifier.
 
-            // Delay phase. Cancel immediately.
+    } else if (self.state == BRURetryStateDelay) {
 
-            NSUUID *previousIdentifier = self.identifier;
+        // Delay phase. Cancel immediately.
 
-            [self.timer suspend];
-            self.timer = nil;
+        NSUUID *previousIdentifier = self.identifier;
 
-            self.state = BRURetryStateIdle;
+        [self.timer suspend];
+        self.timer = nil;
+
+        self.state = BRURetryStateIdle;
 
-            BRUDeferred *deferred = self.deferred;
+        BRUDeferred *deferred = self.deferred;
 
-            self.identifier = nil;
-            self.attempt = 0;
-            self.currentDelay = self.delay;
-            self.deferred = nil;
+        self.identifier = nil;
+        self.attempt = 0;
+        self.currentDelay = self.delay;
+        self.deferred = nil;
+        [self removeCancellationHandlersUnsynchronized];
 
-            NSError *error = [BRURetry cancellationErrorWithIdentifier:previousIdentifier];
-            [deferred resolve:[[BRURetryResult alloc] initWithSuccess:NO error:error]];
+        NSError *error = [BRURetry cancellationErrorWithIdentifier:previousIdentifier];
+        [deferred resolve:[[BRURetryResult alloc] initWithSuccess:NO error:error]];
 
-            success = YES;
+        success = YES;
 
-        } else if (self.state == BRURetryStateActiveWaiting) {
+    } else if (self.state == BRURetryStateActiveWaiting) {
 
-            // Indicate that we wish to cancel at the end of the next action.
+        // Indicate that we wish to cancel at the end of the next action.
 
-            self.state = BRURetryStateActiveCancelling;
+        self.state = BRURetryStateActiveCancelling;
 
-            success = YES;
+        success = YES;
 
-        } else if (self.state == BRURetryStateActiveCancelling) {
+    } else if (self.state == BRURetryStateActiveCancelling) {
 
-            // Already cancelling. Nothing to do.
+        // Already cancelling. Nothing to do.
 
-        } else {
-            BRU_ASSERT_NOT_REACHED(@"Invalid state %lu", (unsigned long)self.state);
-        }
+    } else {
+        BRU_ASSERT_NOT_REACHED(@"Invalid state %lu", (unsigned long)self.state);
+    }
 
-        [self checkInvariants];
+    [self checkInvariants];
 
-    });
     return success;
 }
 
@@ -388,6 +453,7 @@ BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
         self.currentDelay = self.delay;
         self.identifier = nil;
         self.deferred = nil;
+        [self removeCancellationHandlersUnsynchronized];
 
         [deferred resolve:[[BRURetryResult alloc] initWithSuccess:success error:error]];
 
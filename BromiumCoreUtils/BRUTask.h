@@ -11,6 +11,26 @@
 
 #import "BRUBaseDefines.h"
 
+@class BRUTaskTemplate;
+@protocol BRUPromise;
+
+typedef NS_ENUM(NSUInteger, BRUTaskLaunchMethod) {
+    BRUTaskLaunchMethodFork = 1,
+    BRUTaskLaunchMethodPosixSpawn = 2
+};
+
+/**
+ * The resources a `BRUTask` used, see `accountsResourceUsage`.
+ */
+typedef struct {
+    NSTimeInterval wallTime; /* from launch to exit (or the last sample) */
+    NSTimeInterval userTime;
+    NSTimeInterval systemTime;
+    uint64_t maxResidentSetSize; /* bytes */
+    uint64_t bytesRead; /* from storage */
+    uint64_t bytesWritten; /* to storage */
+} BRUTaskResourceUsage;
+
 /**
  * This is a drop-in replacement for NSTask. Everything but the launch method (which doesn't throw excetions in the
  * case of BRUTask) should be the same.
@@ -27,6 +47,9 @@ BRU_restrict_subclassing
 @property (atomic, readwrite, copy) NSDictionary *environment;
 @property (atomic, readwrite, copy) NSString *currentDirectoryPath;
 @property (atomic, readwrite, strong) id standardInput;
+/**
+ * Besides `NSPipe` and `NSFileHandle`, output can also be streamed to a `BRUTaskOutputStream`.
+ */
 @property (atomic, readwrite, strong) id standardOutput;
 @property (atomic, readwrite, strong) id standardError;
 @property (atomic, readwrite, copy) void (^terminationHandler)(BRUTask *);
@@ -43,9 +66,72 @@ BRU_restrict_subclassing
  */
 @property (atomic, readwrite, assign) BOOL spawnAsSessionLeader;
 
+/**
+ * Specifies how the task is launched. Default is `BRUTaskLaunchMethodFork`.
+ *
+ * `BRUTaskLaunchMethodPosixSpawn` uses `posix_spawn` which neither copies the parent's page tables nor has to close
+ * every possible file descriptor in the child and therefore launches much faster from big processes. If the task
+ * needs a feature `posix_spawn` can't express on this platform (eg. `currentDirectoryPath` before macOS 10.15), the
+ * task falls back to `BRUTaskLaunchMethodFork`.
+ *
+ * `BRUTaskLaunchMethodPosixSpawn` is only available on Apple platforms: it relies on `POSIX_SPAWN_CLOEXEC_DEFAULT` to
+ * close the descriptors that aren't inherited and on `POSIX_SPAWN_START_SUSPENDED`. Everywhere else, tasks always
+ * fall back to `BRUTaskLaunchMethodFork`.
+ *
+ * This is a feature only available in BRUTask, not in NSTask.
+ */
+@property (atomic, readwrite, assign) BRUTaskLaunchMethod launchMethod;
+
+/**
+ * File descriptors (besides stdin, stdout and stderr) the launched task inherits, all others are closed in the child.
+ * Default is `nil`, ie. none.
+ *
+ * This is a feature only available in BRUTask, not in NSTask.
+ */
+@property (atomic, readwrite, copy) NSIndexSet *inheritedFileDescriptors;
+
+/**
+ * Specifies whether the task records its `resourceUsage`. Default is `NO`.
+ *
+ * This is a feature only available in BRUTask, not in NSTask.
+ */
+@property (atomic, readwrite, assign) BOOL accountsResourceUsage;
+
+/**
+ * If positive (and `accountsResourceUsage` is set), `resourceUsage` is also sampled in this interval while the task
+ * runs. Default is `0`, ie. the resource usage is only recorded when the task exits.
+ *
+ * This is a feature only available in BRUTask, not in NSTask.
+ */
+@property (atomic, readwrite, assign) NSTimeInterval resourceUsageSamplingInterval;
+
+/**
+ * The resources the task used, final once the task exited. All zero unless `accountsResourceUsage` is set. CPU times
+ * and the maximum resident set size come from `wait4`, the I/O counters are taken from the process right before it is
+ * reaped (where the platform provides them).
+ *
+ * This is a feature only available in BRUTask, not in NSTask.
+ */
+@property (atomic, readonly, assign) BRUTaskResourceUsage resourceUsage;
+
+/**
+ * The template the task was created with, if any.
+ *
+ * This is a feature only available in BRUTask, not in NSTask.
+ */
+@property (atomic, readonly, strong) BRUTaskTemplate *taskTemplate;
+
 
 - (id)init;
 
+/**
+ * Initialise a task with the launch path, environment and working directory of `taskTemplate`. As long as those
+ * properties aren't changed, launching the task uses the pre-encoded values and only encodes the arguments.
+ *
+ * This is a feature only available in BRUTask, not in NSTask.
+ */
+- (instancetype)initWithTemplate:(BRUTaskTemplate *)taskTemplate;
+
 - (BOOL)launchWithError:(NSError **)error;
 
 - (void)interrupt;
@@ -54,6 +140,22 @@ BRU_restrict_subclassing
 - (BOOL)suspend;
 - (BOOL)resume;
 
+/**
+ * Returns a promise which is resolved with the task once it exited (after the `terminationHandler` ran). Never
+ * resolved if the task doesn't launch successfully.
+ *
+ * This is a feature only available in BRUTask, not in NSTask.
+ */
+- (id<BRUPromise>)exitPromise;
+
+/**
+ * Calls `completion` (on an unspecified queue) once the task exited, without blocking the calling thread.
+ * `completion` is always dispatched asynchronously, even if the task already exited.
+ *
+ * This is a feature only available in BRUTask, not in NSTask.
+ */
+- (void)waitForExitWithCompletion:(void (^)(BRUTask *task))completion;
+
 @end
 
 @interface BRUTask (BRUTaskConveniences)
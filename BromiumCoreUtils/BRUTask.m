@@ -7,13 +7,68 @@
 //  Created by Johannes Weiß on 31/05/2016.
 //
 
+#include <spawn.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#if defined(__APPLE__)
+#include <libproc.h>
+#include <mach/mach_time.h>
+#elif defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
 #import "BRUDispatchUtils.h"
 #import "BRUAsserts.h"
+#import "BRUARCUtils.h"
+#import "BRUDeferred.h"
 #import "BRUNullabilityUtils.h"
+#import "BRUTaskOutputStream.h"
+#import "BRUTaskTemplate.h"
+#import "BRUTimer.h"
 #import "BRUTask.h"
 
 #define AssertStateInternal BRUAssert
 
+/*
+ * posix_spawn is only used if it can close all other fds and start the child suspended (to set up the exit source),
+ * ie. on Apple platforms only
+ */
+#if defined(POSIX_SPAWN_CLOEXEC_DEFAULT) && defined(POSIX_SPAWN_START_SUSPENDED)
+#define BRU_TASK_HAVE_POSIX_SPAWN 1
+#else
+#define BRU_TASK_HAVE_POSIX_SPAWN 0
+#endif
+
+#if BRU_TASK_HAVE_POSIX_SPAWN && defined(POSIX_SPAWN_SETSID)
+#define BRU_TASK_HAVE_POSIX_SPAWN_SETSID 1
+#else
+#define BRU_TASK_HAVE_POSIX_SPAWN_SETSID 0
+#endif
+
+#if BRU_TASK_HAVE_POSIX_SPAWN && defined(__MAC_OS_X_VERSION_MIN_REQUIRED) && __MAC_OS_X_VERSION_MIN_REQUIRED >= 101500
+#define BRU_TASK_HAVE_POSIX_SPAWN_CHDIR 1
+#else
+#define BRU_TASK_HAVE_POSIX_SPAWN_CHDIR 0
+#endif
+
+@interface BRUTaskOutputStream (BRUTask)
+
+@property (nonatomic, readonly, strong) NSFileHandle *fileHandleForWriting;
+
+- (void)startReadingWithLaunchSucceeded:(BOOL)launchSucceeded;
+
+@end
+
+@interface BRUTaskTemplate (BRUTask)
+
+@property (nonatomic, readonly, assign) char *currentDirectoryPathCString;
+@property (nonatomic, readonly, assign) char **environmentVector;
+
+- (char **)newArgumentVectorWithArguments:(NSArray *)arguments;
+
+@end
+
 @interface BRUTask ()
 
 @property (atomic, readwrite, assign) pid_t processIdentifier;
@@ -25,8 +80,42 @@
 @property (atomic, readwrite, assign) BOOL hasBeenWaitedOn;
 @property (nonatomic, readonly, strong) dispatch_semaphore_t waitOnSemaphore;
 @property (nonatomic, readwrite, strong) dispatch_source_t childExitedSrc;
+
+/**
+ * Whether childExitedSrc only fires once the child exited (as opposed to a SIGCHLD source firing for any child).
+ */
+@property (nonatomic, readwrite, assign) BOOL childExitedSrcIsExact;
+
+/**
+ * Whether a retry of reaping the child is scheduled. Synchronized on childTerminationHandlingQueue.
+ */
+@property (nonatomic, readwrite, assign) BOOL reapRetryScheduled;
+
 @property (nonatomic, readonly, strong) dispatch_queue_t childTerminationHandlingQueue;
 
+/**
+ * Resolved with the task once it exited.
+ */
+@property (nonatomic, readonly, strong) BRUDeferred *exitDeferred;
+
+/**
+ * Set by BRUTaskPool which reaps the child itself instead of the task using its childExitedSrc.
+ */
+@property (atomic, readwrite, assign) BOOL reapedExternally;
+
+@property (atomic, readwrite, assign) BRUTaskResourceUsage resourceUsage;
+@property (nonatomic, readwrite, assign) uint64_t launchTime; /* BRUMonotonicNanoseconds */
+
+/**
+ * Set once the final resource usage is recorded so that a late sample doesn't overwrite it. Synchronized on self.
+ */
+@property (nonatomic, readwrite, assign) BOOL resourceUsageFinal;
+
+/**
+ * Samples `resourceUsage` while the task runs. Synchronized on childTerminationHandlingQueue.
+ */
+@property (nonatomic, readwrite, strong) dispatch_source_t resourceUsageSampler;
+
 @end
 
 static char **deepMallocedNullTerminatedArrayOfCUTF8StringsWithArray(NSArray *arr)
@@ -54,6 +143,215 @@ static void freeDeepMallocedNullTerminatedArrayOfCUTF8StringsWithArray(char **cA
     free(cArray);
 }
 
+static void noopRunLoopSourcePerform(__unused void *info)
+{
+}
+
+static NSTimeInterval timeIntervalWithTimeval(struct timeval tv)
+{
+    return (NSTimeInterval)tv.tv_sec + (NSTimeInterval)tv.tv_usec / USEC_PER_SEC;
+}
+
+#if defined(__linux__)
+static BOOL readProcFile(pid_t pid, const char *name, char *buffer, size_t size)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NO;
+    }
+    ssize_t n;
+    do {
+        n = read(fd, buffer, size - 1);
+    } while (n < 0 && EINTR == errno);
+    close(fd);
+    if (n < 0) {
+        return NO;
+    }
+    buffer[n] = '\0';
+    return YES;
+}
+
+static uint64_t procFileFieldValue(const char *contents, const char *field)
+{
+    const char *line = strstr(contents, field);
+    if (!line) {
+        return 0;
+    }
+    return strtoull(line + strlen(field), NULL, 10);
+}
+#endif
+
+/**
+ * Samples the CPU times, the maximum resident set size and the I/O counters of the (running or zombie) process `pid`
+ * into `usage`. Leaves `wallTime` alone.
+ *
+ * @return Whether the platform provided the values.
+ */
+static BOOL sampleProcessResourceUsage(pid_t pid, BRUTaskResourceUsage *usage)
+{
+#if defined(__APPLE__)
+    struct rusage_info_v2 info;
+    if (0 != proc_pid_rusage(pid, RUSAGE_INFO_V2, (rusage_info_t *)&info)) {
+        return NO;
+    }
+    static mach_timebase_info_data_t timebase;
+    if (0 == timebase.denom) {
+        mach_timebase_info(&timebase);
+    }
+    usage->userTime = (NSTimeInterval)(info.ri_user_time * timebase.numer / timebase.denom) / NSEC_PER_SEC;
+    usage->systemTime = (NSTimeInterval)(info.ri_system_time * timebase.numer / timebase.denom) / NSEC_PER_SEC;
+    /* only the current resident size is available, the samples approximate the maximum */
+    usage->maxResidentSetSize = MAX(usage->maxResidentSetSize, info.ri_resident_size);
+    usage->bytesRead = info.ri_diskio_bytesread;
+    usage->bytesWritten = info.ri_diskio_byteswritten;
+    return YES;
+#elif defined(__linux__)
+    char buffer[4096];
+    if (!readProcFile(pid, "stat", buffer, sizeof(buffer))) {
+        return NO;
+    }
+    /* the command name (in parentheses) may contain spaces, the fields we need follow after it */
+    const char *afterName = strrchr(buffer, ')');
+    unsigned long long utime = 0;
+    unsigned long long stime = 0;
+    if (!afterName || 2 != sscanf(afterName + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+                                  &utime, &stime)) {
+        return NO;
+    }
+    NSTimeInterval ticksPerSecond = (NSTimeInterval)sysconf(_SC_CLK_TCK);
+    usage->userTime = (NSTimeInterval)utime / ticksPerSecond;
+    usage->systemTime = (NSTimeInterval)stime / ticksPerSecond;
+    if (readProcFile(pid, "status", buffer, sizeof(buffer))) {
+        usage->maxResidentSetSize = MAX(usage->maxResidentSetSize, procFileFieldValue(buffer, "\nVmHWM:") * 1024);
+    }
+    /* not readable for processes of other users or without task I/O accounting in the kernel */
+    if (readProcFile(pid, "io", buffer, sizeof(buffer))) {
+        usage->bytesRead = procFileFieldValue(buffer, "\nread_bytes:");
+        usage->bytesWritten = procFileFieldValue(buffer, "\nwrite_bytes:");
+    }
+    return YES;
+#else
+    (void)pid;
+    (void)usage;
+    return NO;
+#endif
+}
+
+/**
+ * Returns whether `fd` is in `keep` (sorted ascending). Async-signal-safe.
+ */
+static bool fileDescriptorIsKept(int fd, const int *keep, size_t keepCount)
+{
+    for (size_t i = 0; i < keepCount && keep[i] <= fd; i++) {
+        if (keep[i] == fd) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#if defined(__linux__)
+/**
+ * Same as `struct linux_dirent64` which glibc doesn't export.
+ */
+struct bru_linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/**
+ * Parses a non-negative decimal file descriptor number, returns -1 on failure. Async-signal-safe.
+ */
+static int parseFileDescriptor(const char *str)
+{
+    int fd = 0;
+    if (!*str) {
+        return -1;
+    }
+    for (; *str; str++) {
+        if (*str < '0' || *str > '9' || fd > (INT_MAX - 9) / 10) {
+            return -1;
+        }
+        fd = fd * 10 + (*str - '0');
+    }
+    return fd;
+}
+#endif
+
+/**
+ * Closes all file descriptors from `lowestFD` on except the ones in `keep` (sorted ascending). This is called in the
+ * child between `fork` and `exec` and is therefore async-signal-safe: no allocations, only plain syscalls.
+ *
+ * Instead of calling `close` for every possible file descriptor (which are millions with a high `RLIMIT_NOFILE`),
+ * only what's actually open is closed: with `close_range` on Linux if available, otherwise by enumerating the open
+ * file descriptors (`/proc/self/fd` on Linux, `proc_pidinfo` on Darwin). If all that fails, it falls back to closing
+ * every possible file descriptor.
+ */
+static void closeFileDescriptorsExcept(int lowestFD, const int *keep, size_t keepCount)
+{
+#if defined(__linux__)
+#if defined(SYS_close_range)
+    /* close the ranges in between the kept file descriptors */
+    bool closeRangeWorks = true;
+    unsigned int from = (unsigned int)lowestFD;
+    for (size_t i = 0; i < keepCount && closeRangeWorks; i++) {
+        if (keep[i] < lowestFD || (unsigned int)keep[i] < from) {
+            continue;
+        }
+        if ((unsigned int)keep[i] > from) {
+            closeRangeWorks = 0 == syscall(SYS_close_range, from, (unsigned int)keep[i] - 1, 0);
+        }
+        from = (unsigned int)keep[i] + 1;
+    }
+    if (closeRangeWorks && 0 == syscall(SYS_close_range, from, ~0U, 0)) {
+        return;
+    }
+#endif
+    int dirFD = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFD >= 0) {
+        char buf[4096] __attribute__((aligned(8)));
+        long nread;
+        while ((nread = syscall(SYS_getdents64, dirFD, buf, sizeof(buf))) > 0) {
+            for (long off = 0; off < nread; ) {
+                struct bru_linux_dirent64 *entry = (struct bru_linux_dirent64 *)(void *)(buf + off);
+                int fd = parseFileDescriptor(entry->d_name);
+                if (fd >= lowestFD && fd != dirFD && !fileDescriptorIsKept(fd, keep, keepCount)) {
+                    close(fd);
+                }
+                off += entry->d_reclen;
+            }
+        }
+        close(dirFD);
+        if (0 == nread) {
+            return;
+        }
+    }
+#elif defined(__APPLE__)
+    struct proc_fdinfo fdInfos[1024];
+    int size = proc_pidinfo(getpid(), PROC_PIDLISTFDS, 0, fdInfos, (int)sizeof(fdInfos));
+    if (size > 0 && (size_t)size < sizeof(fdInfos)) {
+        /* got all of them (if the buffer was filled up, there might be more) */
+        for (size_t i = 0; i < (size_t)size / sizeof(fdInfos[0]); i++) {
+            int fd = fdInfos[i].proc_fd;
+            if (fd >= lowestFD && !fileDescriptorIsKept(fd, keep, keepCount)) {
+                close(fd);
+            }
+        }
+        return;
+    }
+#endif
+    for (int fd = lowestFD; fd <= getdtablesize(); fd++) {
+        if (!fileDescriptorIsKept(fd, keep, keepCount)) {
+            close(fd);
+        }
+    }
+}
+
 
 @implementation BRUTask
 
@@ -83,11 +381,15 @@ static void freeDeepMallocedNullTerminatedArrayOfCUTF8StringsWithArray(char **cA
                 fileHandle = p.fileHandleForReading;
             }
             shouldClose = YES;
+        } else if ([obj isKindOfClass:[BRUTaskOutputStream class]]) {
+            BRUAssert(writeMode, @"BRUTaskOutputStream can only be used for output");
+            fileHandle = ((BRUTaskOutputStream *)obj).fileHandleForWriting;
+            shouldClose = YES;
         } else if ([obj isKindOfClass:[NSFileHandle class]]) {
             fileHandle = obj;
             shouldClose = NO;
         } else {
-            BRUAssert(NO, @"wrong type: %@, supported: NSPipe and NSFileHandle", [obj class]);
+            BRUAssert(NO, @"wrong type: %@, supported: NSPipe, NSFileHandle and BRUTaskOutputStream", [obj class]);
         }
     }
     if (outShouldClose) {
@@ -96,15 +398,277 @@ static void freeDeepMallocedNullTerminatedArrayOfCUTF8StringsWithArray(char **cA
     return fileHandle;
 }
 
+/**
+ * Whether the task can be launched with `posix_spawn` with the current settings.
+ */
+- (BOOL)canLaunchWithPosixSpawn
+{
+#if !BRU_TASK_HAVE_POSIX_SPAWN
+    return NO;
+#else
+#if !BRU_TASK_HAVE_POSIX_SPAWN_SETSID
+    if (self.spawnAsSessionLeader) {
+        return NO;
+    }
+#endif
+#if !BRU_TASK_HAVE_POSIX_SPAWN_CHDIR
+    if (self.currentDirectoryPath) {
+        return NO;
+    }
+#endif
+    return YES;
+#endif
+}
+
+/**
+ * Creates the (suspended) dispatch source notifying `childTerminationHandlingQueue` about the exit of the child.
+ */
+- (dispatch_source_t)newChildExitedSourceWithPid:(pid_t)pid
+{
+#if defined(__linux__)
+#if defined(SYS_pidfd_open)
+    /* a pidfd becomes readable once the process exited, no signals involved */
+    int pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd >= 0) {
+        dispatch_source_t src = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ,
+                                                       (uintptr_t)pidfd,
+                                                       0,
+                                                       self.childTerminationHandlingQueue);
+        dispatch_source_set_cancel_handler(src, ^{
+            close(pidfd);
+        });
+        self.childExitedSrcIsExact = YES;
+        return src;
+    }
+#endif
+    /* kernel too old for pidfds, a SIGCHLD only tells us that some child changed state */
+    self.childExitedSrcIsExact = NO;
+    return dispatch_source_create(DISPATCH_SOURCE_TYPE_SIGNAL, SIGCHLD, 0, self.childTerminationHandlingQueue);
+#else
+    self.childExitedSrcIsExact = YES;
+    return dispatch_source_create(DISPATCH_SOURCE_TYPE_PROC,
+                                  (uintptr_t)pid /* yes, that's correct */,
+                                  DISPATCH_PROC_EXIT,
+                                  self.childTerminationHandlingQueue);
+#endif
+}
+
+- (void)sampleResourceUsage
+{
+    BRU_ASSERT_ON_QUEUE(self.childTerminationHandlingQueue);
+
+    @synchronized(self) {
+        if (self.resourceUsageFinal) {
+            return;
+        }
+        BRUTaskResourceUsage usage = self.resourceUsage;
+        if (sampleProcessResourceUsage(self.processIdentifier, &usage)) {
+            usage.wallTime = (NSTimeInterval)(BRUMonotonicNanoseconds() - self.launchTime) / NSEC_PER_SEC;
+            self.resourceUsage = usage;
+        }
+    }
+}
+
+- (void)startSamplingResourceUsage
+{
+    BRU_ASSERT_ON_QUEUE(self.childTerminationHandlingQueue);
+
+    if (!self.running) {
+        /* exited already */
+        return;
+    }
+    uint64_t interval = (uint64_t)(self.resourceUsageSamplingInterval * NSEC_PER_SEC);
+    dispatch_source_t sampler = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER,
+                                                       0,
+                                                       0,
+                                                       self.childTerminationHandlingQueue);
+    dispatch_source_set_timer(sampler, dispatch_time(DISPATCH_TIME_NOW, (int64_t)interval), interval, interval / 10);
+    BRU_weakify(self);
+    dispatch_source_set_event_handler(sampler, ^{
+        BRU_strongify(self);
+        [self sampleResourceUsage];
+    });
+    self.resourceUsageSampler = sampler;
+    dispatch_resume(sampler);
+}
+
+/**
+ * Reaps the child if it exited.
+ *
+ * @param notified Whether childExitedSrc fired. If it's exact, the child did exit and the status is just not ready
+ *                 yet if `wait4` doesn't return it.
+ */
+- (void)reapChildAfterExitNotification:(BOOL)notified
+{
+    BRU_ASSERT_ON_QUEUE(self.childTerminationHandlingQueue);
+
+    if (!self.running) {
+        /* already reaped */
+        return;
+    }
+
+    int wp_status = 0;
+    pid_t err_wp = [self reapChildIfExitedWithStatus:&wp_status];
+
+    if (err_wp < 0) {
+        BRUAssertDebugLog(err_wp >= 0, @"wait4(%d, ...) returned %d (errno=%d, %s)",
+                          self.processIdentifier, err_wp, errno, strerror(errno));
+        return;
+    } else if (0 == err_wp) {
+        if (notified && self.childExitedSrcIsExact && !self.reapRetryScheduled) {
+            /* that's a race: dispatch_source already fired but wait4() hasn't the status ready yet. Check again
+             shortly without blocking the queue. */
+            self.reapRetryScheduled = YES;
+            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)NSEC_PER_MSEC),
+                           self.childTerminationHandlingQueue, ^{
+                self.reapRetryScheduled = NO;
+                [self reapChildAfterExitNotification:YES];
+            });
+        }
+        return;
+    }
+
+    /* process exited */
+    /* the next line makes sure to break the reference cycle. Most likely it's not needed because cancel hopefully
+     does its job and removes the event handler. However, the documentation doesn't guarantee it, so we make
+     it sure. */
+    dispatch_source_set_event_handler(self.childExitedSrc, ^{});
+    dispatch_source_cancel(self.childExitedSrc);
+    [self processExitWithStatus:wp_status];
+}
+
+/**
+ * Records the exit of the (already reaped) child and notifies everybody waiting for it.
+ *
+ * @param wp_status The status as returned by `waitpid`.
+ */
+- (void)processExitWithStatus:(int)wp_status
+{
+    BRU_ASSERT_ON_QUEUE(self.childTerminationHandlingQueue);
+    BRUAssertAlwaysFatal(self.running && self.wasLaunched, @"received SIGCHLD without a running task");
+
+    if (WIFSIGNALED(wp_status)) {
+        self.terminationReason = NSTaskTerminationReasonUncaughtSignal;
+        self.terminationStatus = WTERMSIG(wp_status);
+    } else if (WIFEXITED(wp_status)) {
+        self.terminationReason = NSTaskTerminationReasonExit;
+        self.terminationStatus = WEXITSTATUS(wp_status);
+    } else {
+        BRUAssert(NO, @"waitpid() returned with pid that has neither exited, nor signalled: 0x%x", wp_status);
+    }
+
+    self.running = NO;
+    if (self.resourceUsageSampler) {
+        dispatch_source_cancel(self.resourceUsageSampler);
+        self.resourceUsageSampler = nil;
+    }
+
+    dispatch_semaphore_signal(self.waitOnSemaphore);
+
+    void (^terminationHandler)(BRUTask *) = self.terminationHandler;
+    if (terminationHandler) {
+        terminationHandler(self);
+    }
+    [self.exitDeferred resolve:self];
+
+    dispatch_async(dispatch_get_main_queue(), ^{
+        /* This is on main thread for greater NSTask compatibility */
+        [[NSNotificationCenter defaultCenter] postNotificationName:NSTaskDidTerminateNotification
+                                                            object:self
+                                                          userInfo:@{}];
+    });
+}
+
+#pragma mark - Internal API (used by BRUTaskPool)
+
+/**
+ * Reaps the child if it exited (like `waitpid(pid, wp_status, WNOHANG)` does) and records its final resource usage.
+ */
+- (pid_t)reapChildIfExitedWithStatus:(int *)wp_status
+{
+    pid_t pid = self.processIdentifier;
+    BOOL accountsResourceUsage = self.accountsResourceUsage;
+    pid_t err_wp;
+
+    /* like the sampler's, so that the final usage builds on its latest sample; nothing in here blocks */
+    @synchronized(self) {
+        BRUTaskResourceUsage usage = self.resourceUsage;
+
+        if (accountsResourceUsage) {
+            /* the I/O counters are gone once the child is reaped, so peek whether it exited and sample them first */
+            siginfo_t info;
+            memset(&info, 0, sizeof(info));
+            int err;
+            do {
+                err = waitid(P_PID, (id_t)pid, &info, WEXITED | WNOHANG | WNOWAIT);
+            } while (err < 0 && EINTR == errno);
+            if (0 == err && info.si_pid == pid) {
+                sampleProcessResourceUsage(pid, &usage);
+            }
+        }
+
+        struct rusage rusage;
+        memset(&rusage, 0, sizeof(rusage));
+        do {
+            err_wp = wait4(pid, wp_status, WNOHANG, &rusage);
+        } while (err_wp < 0 && EINTR == errno);
+
+        if (err_wp > 0 && accountsResourceUsage) {
+            usage.wallTime = (NSTimeInterval)(BRUMonotonicNanoseconds() - self.launchTime) / NSEC_PER_SEC;
+            usage.userTime = timeIntervalWithTimeval(rusage.ru_utime);
+            usage.systemTime = timeIntervalWithTimeval(rusage.ru_stime);
+#if defined(__APPLE__)
+            uint64_t maxResidentSetSize = (uint64_t)rusage.ru_maxrss; /* bytes */
+#else
+            uint64_t maxResidentSetSize = (uint64_t)rusage.ru_maxrss * 1024; /* kilobytes */
+#endif
+            usage.maxResidentSetSize = MAX(usage.maxResidentSetSize, maxResidentSetSize);
+            self.resourceUsage = usage;
+            self.resourceUsageFinal = YES;
+        }
+    }
+    return err_wp;
+}
+
+- (void)processExternallyReapedExitWithStatus:(int)wp_status completion:(dispatch_block_t)completion
+{
+    BRUAssert(self.reapedExternally, @"task reaps itself");
+    dispatch_async(self.childTerminationHandlingQueue, ^{
+        [self processExitWithStatus:wp_status];
+        completion();
+    });
+}
+
 #pragma mark - Public API
 
 - (id)init
+{
+    return [self initWithTemplate:nil];
+}
+
+- (instancetype)initWithTemplate:(BRUTaskTemplate *)taskTemplate
 {
     if ((self = [super init])) {
+        self->_taskTemplate = taskTemplate;
+        self->_launchPath = taskTemplate.launchPath;
+        self->_environment = taskTemplate.environment;
+        self->_currentDirectoryPath = taskTemplate.currentDirectoryPath;
         self->_wasLaunched = NO;
         self->_hasBeenWaitedOn = NO;
         self->_waitOnSemaphore = dispatch_semaphore_create(0);
         self->_spawnAsSessionLeader = YES;
+        self->_launchMethod = BRUTaskLaunchMethodFork;
+        self->_inheritedFileDescriptors = nil;
+        self->_reapedExternally = NO;
+        self->_childExitedSrcIsExact = NO;
+        self->_reapRetryScheduled = NO;
+        self->_exitDeferred = [BRUDeferred deferred];
+        self->_accountsResourceUsage = NO;
+        self->_resourceUsageSamplingInterval = 0;
+        self->_resourceUsage = (BRUTaskResourceUsage){ 0, 0, 0, 0, 0, 0 };
+        self->_launchTime = 0;
+        self->_resourceUsageFinal = NO;
+        self->_resourceUsageSampler = nil;
         self->_childTerminationHandlingQueue = bru_dispatch_queue_create("com.bromium.BRUTask.ProcessSignalsQueue",
                                                                          DISPATCH_QUEUE_SERIAL);
         self->_childExitedSrc = NULL;
@@ -139,24 +703,38 @@ static void freeDeepMallocedNullTerminatedArrayOfCUTF8StringsWithArray(char **cA
 
 - (BOOL)launchWithError:(NSError **)outError
 {
-    NSMutableArray *argvNS = [NSMutableArray arrayWithCapacity:1+[self.arguments count]];
     char **argv = NULL;
     char **envp = NULL;
-    const char *pwd = [self.currentDirectoryPath UTF8String];
+    const char *pwd = NULL;
     __block BOOL success = NO;
     __block int error_errno = 0;
     __block char *error_desc = NULL;
 
     AssertStateInternal(!self.wasLaunched, @"BRUTask has already been launched");
     self.wasLaunched = YES;
+    self.launchTime = BRUMonotonicNanoseconds();
 
-    [argvNS addObject:self.launchPath];
-    for (NSString *arg in self.arguments) {
-        [argvNS addObject:arg];
-    }
-    argv = deepMallocedNullTerminatedArrayOfCUTF8StringsWithArray(argvNS);
-    if (self.environment) {
-        envp = [BRUTask buildEnvironmentWithDictionary:self.environment];
+    BRUTaskTemplate *taskTemplate = self.taskTemplate;
+    /* the template only applies as long as nobody changed what it pre-encoded (the properties are immutable copies) */
+    BOOL useTemplate = (taskTemplate &&
+                        self.launchPath == taskTemplate.launchPath &&
+                        self.environment == taskTemplate.environment &&
+                        self.currentDirectoryPath == taskTemplate.currentDirectoryPath);
+    if (useTemplate) {
+        argv = [taskTemplate newArgumentVectorWithArguments:self.arguments];
+        envp = taskTemplate.environmentVector;
+        pwd = taskTemplate.currentDirectoryPathCString;
+    } else {
+        NSMutableArray *argvNS = [NSMutableArray arrayWithCapacity:1+[self.arguments count]];
+        [argvNS addObject:self.launchPath];
+        for (NSString *arg in self.arguments) {
+            [argvNS addObject:arg];
+        }
+        argv = deepMallocedNullTerminatedArrayOfCUTF8StringsWithArray(argvNS);
+        if (self.environment) {
+            envp = [BRUTask buildEnvironmentWithDictionary:self.environment];
+        }
+        pwd = [self.currentDirectoryPath UTF8String];
     }
 
     dispatch_block_t doFork = ^{
@@ -204,7 +782,22 @@ static void freeDeepMallocedNullTerminatedArrayOfCUTF8StringsWithArray(char **cA
         fd_stdout = fh_stdout ? [fh_stdout fileDescriptor] : -1;
         fd_stderr = fh_stderr ? [fh_stderr fileDescriptor] : -1;
 
+        /* the child must keep the inherited file descriptors and its end of child2parent (closed by exec) */
+        NSMutableIndexSet *keepFDsSet = [self.inheritedFileDescriptors mutableCopy] ?: [NSMutableIndexSet new];
+        [keepFDsSet addIndex:(NSUInteger)child2parent[1]];
+        size_t keepFDsCount = keepFDsSet.count;
+        int *keepFDs = malloc(keepFDsCount * sizeof(int)); /* can't allocate in the child */
+        BRUAssertAlwaysFatal(keepFDs, @"out of memory");
+        size_t keepFDsIdx = 0;
+        for (NSUInteger fd = keepFDsSet.firstIndex; fd != NSNotFound; fd = [keepFDsSet indexGreaterThanIndex:fd]) {
+            keepFDs[keepFDsIdx++] = (int)fd;
+        }
+
         pid_t pid = fork();
+        if (pid != 0) {
+            free(keepFDs);
+            keepFDs = NULL;
+        }
         if (pid > 0) {
             /* parent */
 
@@ -214,10 +807,9 @@ static void freeDeepMallocedNullTerminatedArrayOfCUTF8StringsWithArray(char **cA
             int err_exec = 0;
             close(parent2child[0]);
             close(child2parent[1]);
-            self.childExitedSrc = dispatch_source_create(DISPATCH_SOURCE_TYPE_PROC,
-                                                         (uintptr_t)pid /* yes, that's correct */,
-                                                         DISPATCH_PROC_EXIT,
-                                                         self.childTerminationHandlingQueue);
+            if (!self.reapedExternally) {
+                self.childExitedSrc = [self newChildExitedSourceWithPid:pid];
+            }
             ssize_t suc_write = write(parent2child[1], "\0", 1); /* signal child that it can execv now */
             BOOL start_failure = NO;
             int errno_save = errno;
@@ -317,11 +909,12 @@ static void freeDeepMallocedNullTerminatedArrayOfCUTF8StringsWithArray(char **cA
                 close(fd_stderr);
             }
 
-            for (int i=STDERR_FILENO+1; i<=getdtablesize(); i++) {
-                if (i != child2parent[1]) {
-                    close(i);
+            for (size_t i=0; i<keepFDsCount; i++) {
+                if (keepFDs[i] != child2parent[1]) {
+                    fcntl(keepFDs[i], F_SETFD, 0); /* inherit across exec */
                 }
             }
+            closeFileDescriptorsExcept(STDERR_FILENO+1, keepFDs, keepFDsCount);
             if (beSessionLeader) {
                 setsid();
             }
@@ -346,78 +939,162 @@ static void freeDeepMallocedNullTerminatedArrayOfCUTF8StringsWithArray(char **cA
         }
     };
 
-    doFork(); /* We don't do this on main thread anymore */
-
-    if (argv) {
-        freeDeepMallocedNullTerminatedArrayOfCUTF8StringsWithArray(argv);
-    }
-    if (envp) {
-        freeDeepMallocedNullTerminatedArrayOfCUTF8StringsWithArray(envp);
-    }
+    dispatch_block_t doSpawn = ^{
+#if BRU_TASK_HAVE_POSIX_SPAWN
+        BOOL beSessionLeader = self.spawnAsSessionLeader;
+        BOOL shouldClose[3] = { NO, NO, NO };
+        NSFileHandle *fileHandles[3] = {
+            [BRUTask extractFileHandleWithObject:self.standardInput
+                                       writeMode:NO
+                            shouldCloseParentEnd:&shouldClose[STDIN_FILENO]],
+            [BRUTask extractFileHandleWithObject:self.standardOutput
+                                       writeMode:YES
+                            shouldCloseParentEnd:&shouldClose[STDOUT_FILENO]],
+            [BRUTask extractFileHandleWithObject:self.standardError
+                                       writeMode:YES
+                            shouldCloseParentEnd:&shouldClose[STDERR_FILENO]]
+        };
+        posix_spawn_file_actions_t fileActions;
+        posix_spawnattr_t attributes;
+        int err = posix_spawn_file_actions_init(&fileActions);
+        if (err) {
+            success = NO;
+            error_errno = err;
+            error_desc = "posix_spawn_file_actions_init() failed";
+            return;
+        }
+        err = posix_spawnattr_init(&attributes);
+        if (err) {
+            posix_spawn_file_actions_destroy(&fileActions);
+            success = NO;
+            error_errno = err;
+            error_desc = "posix_spawnattr_init() failed";
+            return;
+        }
 
-    if (success) {
-        BRUAssertAlwaysFatal(self.childExitedSrc, @"child exited dispatch_source nil");
-        if (!self.childExitedSrc) { BRU_ASSERT_NOT_REACHED(@"the impossible happned"); } /* make analyser happy */
-        dispatch_source_set_event_handler(self.childExitedSrc, ^{
-            /* this block deliberately captures self and creates a temporary reference cycle until the task dies */
-            int err_wp;
-            int wp_status = 0;
+        /* everything not mentioned here gets closed in the child (POSIX_SPAWN_CLOEXEC_DEFAULT) */
+        for (int i = STDIN_FILENO; i <= STDERR_FILENO && !err; i++) {
+            NSFileHandle *fh = fileHandles[i];
+            if (fh) {
+                err = posix_spawn_file_actions_adddup2(&fileActions, [fh fileDescriptor], i);
+            } else {
+                err = posix_spawn_file_actions_addinherit_np(&fileActions, i);
+            }
+        }
+        NSIndexSet *inheritedFDs = self.inheritedFileDescriptors;
+        NSUInteger fd = inheritedFDs ? inheritedFDs.firstIndex : NSNotFound;
+        for (; fd != NSNotFound && !err; fd = [inheritedFDs indexGreaterThanIndex:fd]) {
+            if (fd > STDERR_FILENO) {
+                err = posix_spawn_file_actions_addinherit_np(&fileActions, (int)fd);
+            }
+        }
+#if BRU_TASK_HAVE_POSIX_SPAWN_CHDIR
+        if (!err && pwd) {
+            err = posix_spawn_file_actions_addchdir_np(&fileActions, pwd);
+        }
+#endif
 
-            while (true) {
-                err_wp = waitpid(self.processIdentifier, &wp_status, WNOHANG);
-                if (err_wp < 0 && EINTR == errno) {
-                    continue;
-                }
+        /* same as the fork path: default handlers for all signals and nothing blocked */
+        sigset_t sig_set_all = 0;
+        sigset_t sig_set_none = 0;
+        sigfillset(&sig_set_all);
+        sigemptyset(&sig_set_none);
+        int flags = POSIX_SPAWN_CLOEXEC_DEFAULT | POSIX_SPAWN_START_SUSPENDED |
+                    POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+#if BRU_TASK_HAVE_POSIX_SPAWN_SETSID
+        if (beSessionLeader) {
+            flags |= POSIX_SPAWN_SETSID;
+        }
+#else
+        BRUAssert(!beSessionLeader, @"posix_spawn can't launch session leaders here");
+#endif
+        err = err ?: posix_spawnattr_setsigdefault(&attributes, &sig_set_all);
+        err = err ?: posix_spawnattr_setsigmask(&attributes, &sig_set_none);
+        err = err ?: posix_spawnattr_setflags(&attributes, (short)flags);
 
-                if (err_wp < 0) {
-                    BRUAssertDebugLog(err_wp >= 0, @"waitpid(%d, ...) returned %d (errno=%d, %s)",
-                                      self.processIdentifier, err_wp, errno, strerror(errno));
-                    return;
-                } else if (0 == err_wp) {
-                    /* that's a race: dispatch_source already fired but waitpid() hasn't the status ready yet */
-                    [NSThread sleepForTimeInterval:0.01];
-                    continue;
-                } else {
-                    break;
-                }
+        pid_t pid = -1;
+        if (err) {
+            error_desc = "setting up posix_spawn failed";
+        } else {
+            err = posix_spawn(&pid, argv[0], &fileActions, &attributes, argv, envp);
+            if (err) {
+                error_desc = "posix_spawn() failed";
             }
+        }
+        posix_spawnattr_destroy(&attributes);
+        posix_spawn_file_actions_destroy(&fileActions);
+        if (err) {
+            success = NO;
+            error_errno = err;
+            return;
+        }
 
-            /* process exited */
-            /* the next line makes sure to break the reference cycle. Most likely it's not needed because cancel hopefully
-             does its job and removes the event handler. However, the documentation doesn't guarantee it, so we make
-             it sure. */
-            dispatch_source_set_event_handler(self.childExitedSrc, ^{});
-            dispatch_source_cancel(self.childExitedSrc);
-            BRUAssertAlwaysFatal(self.running && self.wasLaunched, @"received SIGCHLD without a running task");
-
-            if (WIFSIGNALED(wp_status)) {
-                self.terminationReason = NSTaskTerminationReasonUncaughtSignal;
-                self.terminationStatus = WTERMSIG(wp_status);
-            } else if (WIFEXITED(wp_status)) {
-                self.terminationReason = NSTaskTerminationReasonExit;
-                self.terminationStatus = WEXITSTATUS(wp_status);
-            } else {
-                BRUAssert(NO, @"waitpid() returned with pid that has neither exited, nor signalled: 0x%x", wp_status);
+        self.processIdentifier = pid;
+        if (!self.reapedExternally) {
+            self.childExitedSrc = [self newChildExitedSourceWithPid:pid];
+        }
+        /* the child was started suspended so that it can't exit before the dispatch_source is set up */
+        kill(pid, SIGCONT);
+        self.running = YES;
+        success = YES;
+
+        /* NSTask only closes these file descriptors if the launch doesn't fail, so do we... */
+        for (int i = STDIN_FILENO; i <= STDERR_FILENO; i++) {
+            if (shouldClose[i] && [fileHandles[i] fileDescriptor] > STDERR_FILENO) {
+                [fileHandles[i] closeFile];
             }
+        }
+#else
+        BRU_ASSERT_NOT_REACHED(@"posix_spawn not supported");
+#endif
+    };
 
-            self.running = NO;
+    if (self.launchMethod == BRUTaskLaunchMethodPosixSpawn && [self canLaunchWithPosixSpawn]) {
+        doSpawn();
+    } else {
+        doFork(); /* We don't do this on main thread anymore */
+    }
 
-            dispatch_semaphore_signal(self.waitOnSemaphore);
+    NSArray *outputs = @[BRUNonnull(self.standardOutput, [NSNull null]), BRUNonnull(self.standardError, [NSNull null])];
+    for (id output in outputs) {
+        if ([output isKindOfClass:[BRUTaskOutputStream class]]) {
+            [(BRUTaskOutputStream *)output startReadingWithLaunchSucceeded:success];
+        }
+    }
 
-            void (^terminationHandler)(BRUTask *) = self.terminationHandler;
-            if (terminationHandler) {
-                terminationHandler(self);
-            }
+    if (useTemplate) {
+        /* one block, envp belongs to the template */
+        free(argv);
+    } else {
+        if (argv) {
+            freeDeepMallocedNullTerminatedArrayOfCUTF8StringsWithArray(argv);
+        }
+        if (envp) {
+            freeDeepMallocedNullTerminatedArrayOfCUTF8StringsWithArray(envp);
+        }
+    }
 
-            dispatch_async(dispatch_get_main_queue(), ^{
-                /* This is on main thread for greater NSTask compatibility */
-                [[NSNotificationCenter defaultCenter] postNotificationName:NSTaskDidTerminateNotification
-                                                                    object:self
-                                                                  userInfo:@{}];
-            });
+    if (success && self.accountsResourceUsage && self.resourceUsageSamplingInterval > 0) {
+        dispatch_async(self.childTerminationHandlingQueue, ^{
+            [self startSamplingResourceUsage];
+        });
+    }
+
+    if (success && self.reapedExternally) {
+        /* BRUTaskPool takes care of the exit */
+    } else if (success) {
+        BRUAssertAlwaysFatal(self.childExitedSrc, @"child exited dispatch_source nil");
+        if (!self.childExitedSrc) { BRU_ASSERT_NOT_REACHED(@"the impossible happned"); } /* make analyser happy */
+        dispatch_source_set_event_handler(self.childExitedSrc, ^{
+            /* this block deliberately captures self and creates a temporary reference cycle until the task dies */
+            [self reapChildAfterExitNotification:YES];
         });
 
         dispatch_resume(self.childExitedSrc);
+        dispatch_async(self.childTerminationHandlingQueue, ^{
+            /* in case the child exited before the source was resumed */
+            [self reapChildAfterExitNotification:NO];
+        });
     } else {
         if (self.childExitedSrc) {
             dispatch_source_set_event_handler(self.childExitedSrc, ^{});
@@ -483,6 +1160,19 @@ static void freeDeepMallocedNullTerminatedArrayOfCUTF8StringsWithArray(char **cA
     }
 }
 
+- (id<BRUPromise>)exitPromise
+{
+    return self.exitDeferred.promise;
+}
+
+- (void)waitForExitWithCompletion:(void (^)(BRUTask *))completion
+{
+    BRUParameterAssert(completion);
+    [self.exitPromise then:^(id task) {
+        completion(task);
+    }];
+}
+
 - (void)waitUntilExit
 {
     AssertStateInternal(self.wasLaunched, @"task wasn't launched yet");
@@ -494,6 +1184,18 @@ static void freeDeepMallocedNullTerminatedArrayOfCUTF8StringsWithArray(char **cA
     } else {
         NSRunLoop *rl = [NSRunLoop currentRunLoop];
         if (rl) {
+            /* signalled on exit to make the run loop return right away rather than after up to a second */
+            CFRunLoopSourceContext context = { 0 };
+            context.perform = noopRunLoopSourcePerform;
+            id exitSource = CFBridgingRelease(CFRunLoopSourceCreate(kCFAllocatorDefault, 0, &context));
+            id cfRunLoop = (__bridge id)[rl getCFRunLoop];
+            CFRunLoopAddSource((__bridge CFRunLoopRef)cfRunLoop,
+                               (__bridge CFRunLoopSourceRef)exitSource,
+                               kCFRunLoopDefaultMode);
+            [self waitForExitWithCompletion:^(__unused BRUTask *task) {
+                CFRunLoopSourceSignal((__bridge CFRunLoopSourceRef)exitSource);
+                CFRunLoopWakeUp((__bridge CFRunLoopRef)cfRunLoop);
+            }];
             while (true) {
                 long timeout = dispatch_semaphore_wait(self.waitOnSemaphore, DISPATCH_TIME_NOW);
                 if (timeout) {
@@ -503,6 +1205,9 @@ static void freeDeepMallocedNullTerminatedArrayOfCUTF8StringsWithArray(char **cA
                     break;
                 }
             }
+            CFRunLoopRemoveSource((__bridge CFRunLoopRef)cfRunLoop,
+                                  (__bridge CFRunLoopSourceRef)exitSource,
+                                  kCFRunLoopDefaultMode);
         } else {
             dispatch_semaphore_wait(self.waitOnSemaphore, DISPATCH_TIME_FOREVER);
         }
@@ -0,0 +1,77 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "BRUBaseDefines.h"
+
+BRU_assume_nonnull_begin
+
+/**
+ * Receives the next chunk of output. `chunk` points into a buffer that gets reused, it's only valid until `done` is
+ * called. No further output is read until `done` was called.
+ */
+typedef void (^BRUTaskOutputStreamChunkHandler)(NSData *chunk, dispatch_block_t done);
+
+/**
+ * Receives the next line of output (without the trailing newline). `line` is only valid during the call.
+ */
+typedef void (^BRUTaskOutputStreamLineHandler)(NSData *line);
+
+/**
+ * Called once the output ended, `error` is 0 on EOF or the `errno` reading failed with.
+ */
+typedef void (^BRUTaskOutputStreamCompletionHandler)(int error);
+
+/**
+ * A `BRUTaskOutputStream` can be used instead of an `NSPipe` as `standardOutput` or `standardError` of a `BRUTask` to
+ * stream the output to a handler as it is produced instead of buffering all of it.
+ *
+ * The output is read into one reusable buffer of `chunkSize` bytes which is handed to the handler without copying.
+ * The next chunk is only read once the handler is done with the last one, so a slow handler slows down the task
+ * (it blocks once the pipe is full) rather than piling up output in memory: memory use is bounded by `chunkSize`
+ * (plus `maxLineLength` in line mode).
+ *
+ * The stream keeps itself alive until the output ended, it can be used for one task only.
+ */
+BRU_restrict_subclassing @interface BRUTaskOutputStream : NSObject
+
+BRU_DEFAULT_INIT_UNAVAILABLE(null_unspecified)
+
+@property (nonatomic, readonly, assign) size_t chunkSize;
+@property (nonatomic, readonly, strong) dispatch_queue_t queue;
+
+/**
+ * Creates a stream delivering the output in chunks.
+ *
+ * @param queue The queue to run the handlers on, serial or concurrent (the handlers never run concurrently).
+ * @param chunkSize The maximum size of a chunk, must be positive.
+ * @param chunkHandler Receives the chunks, must call `done` when done with the chunk.
+ * @param completionHandler Called once the output ended.
+ */
++ (instancetype)outputStreamWithQueue:(dispatch_queue_t)queue
+                            chunkSize:(size_t)chunkSize
+                         chunkHandler:(BRUTaskOutputStreamChunkHandler)chunkHandler
+                    completionHandler:(nullable BRUTaskOutputStreamCompletionHandler)completionHandler;
+
+/**
+ * Creates a stream delivering the output line by line. Lines longer than `maxLineLength` are delivered in pieces of
+ * `maxLineLength` bytes, a last line without newline is delivered before `completionHandler` is called.
+ *
+ * @param queue The queue to run the handlers on, serial or concurrent (the handlers never run concurrently).
+ * @param maxLineLength The maximum length of a line, must be positive.
+ * @param lineHandler Receives the lines.
+ * @param completionHandler Called once the output ended.
+ */
++ (instancetype)lineOutputStreamWithQueue:(dispatch_queue_t)queue
+                            maxLineLength:(size_t)maxLineLength
+                              lineHandler:(BRUTaskOutputStreamLineHandler)lineHandler
+                        completionHandler:(nullable BRUTaskOutputStreamCompletionHandler)completionHandler;
+
+@end
+
+BRU_assume_nonnull_end
@@ -0,0 +1,250 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#import "BRUAsserts.h"
+#import "BRUTaskOutputStream.h"
+
+#define BRU_TASK_OUTPUT_STREAM_LINE_MODE_CHUNK_SIZE ((size_t)64 * 1024)
+
+@interface BRUTaskOutputStream () {
+    int _readFD;
+    void *_buffer; /* chunkSize bytes, only touched by the read source's handler */
+    char *_partialLine; /* maxLineLength bytes, only touched by the read source's handler */
+    size_t _partialLineLength;
+    BOOL _started; /* synchronized on self */
+}
+
+@property (nonatomic, readonly, strong) NSFileHandle *fileHandleForWriting;
+@property (nonatomic, readonly, assign) size_t maxLineLength;
+
+/*
+ * set to nil once the output ended to break the reference cycles, only touched by the read source's handler (which
+ * never runs concurrently with itself, whatever `queue` is)
+ */
+@property (nonatomic, readwrite, strong) BRUTaskOutputStreamChunkHandler chunkHandler;
+@property (nonatomic, readwrite, strong) BRUTaskOutputStreamLineHandler lineHandler;
+@property (nonatomic, readwrite, strong) BRUTaskOutputStreamCompletionHandler completionHandler;
+
+/**
+ * Created when reading starts, synchronized on self.
+ */
+@property (nonatomic, readwrite, strong) dispatch_source_t readSource;
+
+@end
+
+@implementation BRUTaskOutputStream
+
+BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
+
+- (instancetype)initWithQueue:(dispatch_queue_t)queue
+                    chunkSize:(size_t)chunkSize
+                maxLineLength:(size_t)maxLineLength
+                 chunkHandler:(BRUTaskOutputStreamChunkHandler)chunkHandler
+                  lineHandler:(BRUTaskOutputStreamLineHandler)lineHandler
+            completionHandler:(BRUTaskOutputStreamCompletionHandler)completionHandler
+{
+    BRUParameterAssert(queue);
+    BRUParameterAssert(chunkSize > 0);
+
+    if ((self = [super init])) {
+        int fds[2];
+        int err = pipe(fds);
+        BRUAssertAlwaysFatal(0 == err, @"pipe() failed: %d", errno);
+        /* the child gets a dup2'ed copy of the write end, neither end must leak into any other child */
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+        self->_readFD = fds[0];
+        self->_fileHandleForWriting = [[NSFileHandle alloc] initWithFileDescriptor:fds[1] closeOnDealloc:YES];
+        self->_queue = queue;
+        self->_chunkSize = chunkSize;
+        self->_maxLineLength = maxLineLength;
+        self->_buffer = malloc(chunkSize);
+        BRUAssertAlwaysFatal(self->_buffer, @"out of memory");
+        self->_partialLine = NULL;
+        if (maxLineLength > 0) {
+            self->_partialLine = malloc(maxLineLength);
+            BRUAssertAlwaysFatal(self->_partialLine, @"out of memory");
+        }
+        self->_partialLineLength = 0;
+        self->_chunkHandler = chunkHandler;
+        self->_lineHandler = lineHandler;
+        self->_completionHandler = completionHandler;
+        self->_started = NO;
+        self->_readSource = nil;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    if (!self->_readSource) {
+        /* never started, otherwise the read source's cancel handler closes it */
+        close(self->_readFD);
+    }
+    free(self->_buffer);
+    free(self->_partialLine);
+}
+
+#pragma mark - Helpers
+
+- (void)deliverPartialLine
+{
+    self.lineHandler([NSData dataWithBytesNoCopy:self->_partialLine
+                                          length:self->_partialLineLength
+                                    freeWhenDone:NO]);
+    self->_partialLineLength = 0;
+}
+
+- (void)splitLinesInBytes:(const char *)bytes length:(size_t)length
+{
+    const char *end = bytes + length;
+    while (bytes < end) {
+        const char *newline = memchr(bytes, '\n', (size_t)(end - bytes));
+        const char *segmentEnd = newline ?: end;
+        while (bytes < segmentEnd) {
+            if (self->_partialLineLength == self.maxLineLength) {
+                /* overlong line, deliver what we have */
+                [self deliverPartialLine];
+            }
+            size_t n = MIN((size_t)(segmentEnd - bytes), self.maxLineLength - self->_partialLineLength);
+            memcpy(self->_partialLine + self->_partialLineLength, bytes, n);
+            self->_partialLineLength += n;
+            bytes += n;
+        }
+        if (newline) {
+            [self deliverPartialLine];
+            bytes = newline + 1;
+        }
+    }
+}
+
+- (void)finishWithError:(int)error
+{
+    dispatch_source_t readSource = nil;
+    @synchronized(self) {
+        readSource = self.readSource;
+    }
+    /* break the reference cycle, see startReadingWithLaunchSucceeded: */
+    dispatch_source_set_event_handler(readSource, ^{});
+    dispatch_source_cancel(readSource);
+
+    if (self.lineHandler && self->_partialLineLength > 0) {
+        [self deliverPartialLine];
+    }
+    BRUTaskOutputStreamCompletionHandler completionHandler = self.completionHandler;
+    self.chunkHandler = nil;
+    self.lineHandler = nil;
+    self.completionHandler = nil;
+    if (completionHandler) {
+        completionHandler(error);
+    }
+}
+
+- (void)readAvailableOutput
+{
+    ssize_t n;
+    do {
+        n = read(self->_readFD, self->_buffer, self.chunkSize);
+    } while (n < 0 && EINTR == errno);
+
+    if (n < 0) {
+        if (EAGAIN != errno) {
+            [self finishWithError:errno];
+        }
+        return;
+    } else if (0 == n) {
+        [self finishWithError:0];
+        return;
+    }
+
+    if (self.lineHandler) {
+        [self splitLinesInBytes:self->_buffer length:(size_t)n];
+        return;
+    }
+
+    /* don't read (and overwrite the buffer) until the handler is done with the chunk */
+    dispatch_source_t readSource = nil;
+    @synchronized(self) {
+        readSource = self.readSource;
+    }
+    dispatch_suspend(readSource);
+    __block BOOL doneDidRun = NO;
+    self.chunkHandler([NSData dataWithBytesNoCopy:self->_buffer length:(size_t)n freeWhenDone:NO], ^{
+        BRUAssertAlwaysFatal(!doneDidRun, @"BRUTaskOutputStream chunk handler called done more than once.");
+        doneDidRun = YES;
+        dispatch_resume(readSource);
+    });
+}
+
+#pragma mark - Internal API (used by BRUTask)
+
+- (void)startReadingWithLaunchSucceeded:(BOOL)launchSucceeded
+{
+    @synchronized(self) {
+        if (self->_started) {
+            /* used for both stdout and stderr */
+            return;
+        }
+        self->_started = YES;
+
+        if (!launchSucceeded) {
+            /* nobody will ever write, make sure we see EOF */
+            [self.fileHandleForWriting closeFile];
+        }
+
+        int readFD = self->_readFD;
+        self.readSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, (uintptr_t)readFD, 0, self.queue);
+        /* deliberately captures self and creates a temporary reference cycle until the output ended */
+        dispatch_source_set_event_handler(self.readSource, ^{
+            [self readAvailableOutput];
+        });
+        dispatch_source_set_cancel_handler(self.readSource, ^{
+            close(readFD);
+        });
+        dispatch_resume(self.readSource);
+    }
+}
+
+#pragma mark - Public API
+
++ (instancetype)outputStreamWithQueue:(dispatch_queue_t)queue
+                            chunkSize:(size_t)chunkSize
+                         chunkHandler:(BRUTaskOutputStreamChunkHandler)chunkHandler
+                    completionHandler:(BRUTaskOutputStreamCompletionHandler)completionHandler
+{
+    BRUParameterAssert(chunkHandler);
+    return [[self alloc] initWithQueue:queue
+                             chunkSize:chunkSize
+                         maxLineLength:0
+                          chunkHandler:chunkHandler
+                           lineHandler:nil
+                     completionHandler:completionHandler];
+}
+
++ (instancetype)lineOutputStreamWithQueue:(dispatch_queue_t)queue
+                            maxLineLength:(size_t)maxLineLength
+                              lineHandler:(BRUTaskOutputStreamLineHandler)lineHandler
+                        completionHandler:(BRUTaskOutputStreamCompletionHandler)completionHandler
+{
+    BRUParameterAssert(maxLineLength > 0);
+    BRUParameterAssert(lineHandler);
+    return [[self alloc] initWithQueue:queue
+                             chunkSize:BRU_TASK_OUTPUT_STREAM_LINE_MODE_CHUNK_SIZE
+                         maxLineLength:maxLineLength
+                          chunkHandler:nil
+                           lineHandler:lineHandler
+                     completionHandler:completionHandler];
+}
+
+@end
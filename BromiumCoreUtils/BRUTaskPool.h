@@ -0,0 +1,69 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "BRUBaseDefines.h"
+
+@class BRUTask;
+@protocol BRUPromise;
+
+/**
+ * A snapshot of what a `BRUTaskPool` is doing.
+ */
+typedef struct {
+    NSUInteger queueDepth; /* tasks submitted but not launched yet */
+    NSUInteger runningTasks;
+    NSUInteger launchedTasks; /* tasks launched so far (including failed launches) */
+    NSTimeInterval totalWaitTime; /* time the launched tasks spent waiting in the queue */
+    NSTimeInterval maxWaitTime; /* longest time a launched task spent waiting in the queue */
+} BRUTaskPoolStatistics;
+
+BRU_assume_nonnull_begin
+
+/**
+ * A `BRUTaskPool` runs submitted `BRUTask`s, at most `maxConcurrentTasks` at the same time. Further tasks wait in a
+ * queue (first come, first served) until a running task exits.
+ *
+ * Instead of every task watching its own child, the pool reaps all its children through one shared `SIGCHLD` source.
+ * The termination handler and `waitUntilExit` of the tasks work as usual. The pool must be retained until all its
+ * tasks exited.
+ */
+BRU_restrict_subclassing @interface BRUTaskPool : NSObject
+
+BRU_DEFAULT_INIT_UNAVAILABLE(null_unspecified)
+
+@property (nonatomic, readonly, assign) NSUInteger maxConcurrentTasks;
+
+/**
+ * Create a pool running as many tasks concurrently as there are active CPUs.
+ */
++ (instancetype)taskPool;
+
+/**
+ * Initialise a pool.
+ *
+ * @param maxConcurrentTasks The maximum number of tasks running at the same time, must be positive.
+ */
+- (instancetype)initWithMaxConcurrentTasks:(NSUInteger)maxConcurrentTasks NS_DESIGNATED_INITIALIZER;
+
+/**
+ * Submit a task to be launched once the pool has capacity. The task must be fully set up and not be launched.
+ *
+ * @param task The task to run.
+ * @return A promise resolved with a `BRUEitherErrorOrSuccess` holding the task once it exited or the launch error.
+ */
+- (id<BRUPromise>)submitTask:(BRUTask *)task;
+
+/**
+ * Returns the current statistics of the pool.
+ */
+- (BRUTaskPoolStatistics)statistics;
+
+@end
+
+BRU_assume_nonnull_end
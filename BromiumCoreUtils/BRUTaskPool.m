@@ -0,0 +1,208 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#include <signal.h>
+
+#import "BRUDispatchUtils.h"
+#import "BRUAsserts.h"
+#import "BRUARCUtils.h"
+#import "BRUDeferred.h"
+#import "BRUEitherErrorOrSuccess.h"
+#import "BRUTimer.h"
+#import "BRUTask.h"
+#import "BRUTaskPool.h"
+
+@interface BRUTask (BRUTaskPool)
+
+@property (atomic, readwrite, assign) BOOL reapedExternally;
+
+- (pid_t)reapChildIfExitedWithStatus:(int *)wp_status;
+- (void)processExternallyReapedExitWithStatus:(int)wp_status completion:(dispatch_block_t)completion;
+
+@end
+
+@interface BRUTaskPoolEntry : NSObject
+
+@property (nonatomic, readonly, strong) BRUTask *task;
+@property (nonatomic, readonly, strong) BRUDeferred *deferred;
+@property (nonatomic, readonly, assign) uint64_t submitTime; /* BRUMonotonicNanoseconds */
+
+@end
+
+@implementation BRUTaskPoolEntry
+
+- (instancetype)initWithTask:(BRUTask *)task
+{
+    if ((self = [super init])) {
+        self->_task = task;
+        self->_deferred = [BRUDeferred deferred];
+        self->_submitTime = BRUMonotonicNanoseconds();
+    }
+    return self;
+}
+
+@end
+
+@interface BRUTaskPool ()
+
+@property (nonatomic, readonly, strong) dispatch_queue_t syncQueue;
+@property (nonatomic, readonly, strong) dispatch_source_t childExitedSrc;
+
+/* all synchronized on syncQueue */
+@property (nonatomic, readonly, strong) NSMutableArray<BRUTaskPoolEntry *> *pending;
+@property (nonatomic, readonly, strong) NSMutableDictionary<NSNumber *, BRUTaskPoolEntry *> *running;
+@property (nonatomic, readwrite, assign) NSUInteger launchedTasks;
+@property (nonatomic, readwrite, assign) uint64_t totalWaitNanoseconds;
+@property (nonatomic, readwrite, assign) uint64_t maxWaitNanoseconds;
+
+@end
+
+@implementation BRUTaskPool
+
+BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
+
++ (instancetype)taskPool
+{
+    return [[self alloc] initWithMaxConcurrentTasks:MAX([NSProcessInfo processInfo].activeProcessorCount,
+                                                        (NSUInteger)1)];
+}
+
+- (instancetype)initWithMaxConcurrentTasks:(NSUInteger)maxConcurrentTasks
+{
+    BRUParameterAssert(maxConcurrentTasks > 0);
+
+    if ((self = [super init])) {
+        self->_maxConcurrentTasks = maxConcurrentTasks;
+        self->_syncQueue = bru_dispatch_queue_create("com.bromium.BRUTaskPool.syncQueue", DISPATCH_QUEUE_SERIAL);
+        self->_pending = [NSMutableArray new];
+        self->_running = [NSMutableDictionary new];
+        self->_launchedTasks = 0;
+        self->_totalWaitNanoseconds = 0;
+        self->_maxWaitNanoseconds = 0;
+
+        /* one source for all children, SIGCHLD doesn't tell which child exited so we check all the running ones */
+        self->_childExitedSrc = dispatch_source_create(DISPATCH_SOURCE_TYPE_SIGNAL,
+                                                       SIGCHLD,
+                                                       0,
+                                                       self->_syncQueue);
+        BRU_weakify(self);
+        dispatch_source_set_event_handler(self->_childExitedSrc, ^{
+            BRU_strongify(self);
+            [self reapExitedTasksUnsynchronized];
+        });
+        dispatch_resume(self->_childExitedSrc);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    dispatch_source_cancel(self->_childExitedSrc);
+}
+
+#pragma mark - Helpers
+
+/**
+ * Reaps the child of `entry` if it exited.
+ *
+ * @return Whether the child exited.
+ */
+- (BOOL)reapEntryUnsynchronized:(BRUTaskPoolEntry *)entry
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
+
+    pid_t pid = entry.task.processIdentifier;
+    int wp_status = 0;
+    /* wait4 also records the resource usage of the task if it accounts it */
+    pid_t err_wp = [entry.task reapChildIfExitedWithStatus:&wp_status];
+
+    if (err_wp < 0) {
+        BRUAssertDebugLog(err_wp >= 0, @"wait4(%d, ...) returned %d (errno=%d, %s)",
+                          pid, err_wp, errno, strerror(errno));
+        return NO;
+    } else if (0 == err_wp) {
+        /* still running */
+        return NO;
+    }
+
+    [self.running removeObjectForKey:@(pid)];
+    BRUDeferred *deferred = entry.deferred;
+    BRUTask *task = entry.task;
+    [task processExternallyReapedExitWithStatus:wp_status completion:^{
+        [deferred resolve:[BRUEitherErrorOrSuccess newWithSuccessObject:task]];
+    }];
+    return YES;
+}
+
+- (void)reapExitedTasksUnsynchronized
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
+
+    BOOL reaped = NO;
+    for (BRUTaskPoolEntry *entry in [self.running allValues]) {
+        reaped = [self reapEntryUnsynchronized:entry] || reaped;
+    }
+    if (reaped) {
+        [self launchPendingTasksUnsynchronized];
+    }
+}
+
+- (void)launchPendingTasksUnsynchronized
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
+
+    while (self.running.count < self.maxConcurrentTasks && self.pending.count > 0) {
+        BRUTaskPoolEntry *entry = self.pending.firstObject;
+        [self.pending removeObjectAtIndex:0];
+
+        uint64_t waitTime = BRUMonotonicNanoseconds() - entry.submitTime;
+        self.launchedTasks++;
+        self.totalWaitNanoseconds += waitTime;
+        self.maxWaitNanoseconds = MAX(self.maxWaitNanoseconds, waitTime);
+
+        NSError *error = nil;
+        entry.task.reapedExternally = YES;
+        if (![entry.task launchWithError:&error]) {
+            [entry.deferred resolve:[BRUEitherErrorOrSuccess newWithError:error]];
+            continue;
+        }
+        self.running[@(entry.task.processIdentifier)] = entry;
+        /* the child might have exited before it was in `running`, don't miss its SIGCHLD */
+        [self reapEntryUnsynchronized:entry];
+    }
+}
+
+#pragma mark - Public API
+
+- (id<BRUPromise>)submitTask:(BRUTask *)task
+{
+    BRUParameterAssert(task);
+
+    BRUTaskPoolEntry *entry = [[BRUTaskPoolEntry alloc] initWithTask:task];
+    dispatch_async(self.syncQueue, ^{
+        [self.pending addObject:entry];
+        [self launchPendingTasksUnsynchronized];
+    });
+    return entry.deferred.promise;
+}
+
+- (BRUTaskPoolStatistics)statistics
+{
+    BRU_ASSERT_OFF_QUEUE(self.syncQueue);
+
+    __block BRUTaskPoolStatistics statistics = { 0, 0, 0, 0, 0 };
+    dispatch_sync(self.syncQueue, ^{
+        statistics.queueDepth = self.pending.count;
+        statistics.runningTasks = self.running.count;
+        statistics.launchedTasks = self.launchedTasks;
+        statistics.totalWaitTime = (NSTimeInterval)self.totalWaitNanoseconds / NSEC_PER_SEC;
+        statistics.maxWaitTime = (NSTimeInterval)self.maxWaitNanoseconds / NSEC_PER_SEC;
+    });
+    return statistics;
+}
+
+@end
@@ -0,0 +1,42 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "BRUBaseDefines.h"
+
+BRU_assume_nonnull_begin
+
+/**
+ * A `BRUTaskTemplate` holds what many launches of the same executable have in common: launch path, environment and
+ * working directory. They're encoded into C strings once, in one contiguous block of memory, so that launching a
+ * `BRUTask` created with `-[BRUTask initWithTemplate:]` only has to encode its arguments.
+ *
+ * Templates are immutable and can be shared between threads and tasks.
+ */
+BRU_restrict_subclassing @interface BRUTaskTemplate : NSObject
+
+BRU_DEFAULT_INIT_UNAVAILABLE(null_unspecified)
+
+@property (nonatomic, readonly, copy) NSString *launchPath;
+@property (nonatomic, readonly, copy, nullable) NSDictionary<NSString *, NSString *> *environment;
+@property (nonatomic, readonly, copy, nullable) NSString *currentDirectoryPath;
+
+/**
+ * Initialise a template.
+ *
+ * @param launchPath The executable to launch.
+ * @param environment The environment of the tasks, `nil` behaves like an unset `BRUTask.environment`.
+ * @param currentDirectoryPath The working directory of the tasks, `nil` to inherit ours.
+ */
+- (instancetype)initWithLaunchPath:(NSString *)launchPath
+                       environment:(nullable NSDictionary<NSString *, NSString *> *)environment
+              currentDirectoryPath:(nullable NSString *)currentDirectoryPath NS_DESIGNATED_INITIALIZER;
+
+@end
+
+BRU_assume_nonnull_end
@@ -0,0 +1,124 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#include <stdlib.h>
+
+#import "BRUAsserts.h"
+#import "BRUTaskTemplate.h"
+
+/**
+ * Encodes `strings` into one malloc'ed block (to be released with `free`): a NULL terminated vector of
+ * `prefixCount + strings.count` pointers followed by the NUL terminated UTF-8 strings. The first `prefixCount`
+ * pointers are NULL, for the caller to fill in.
+ */
+static char **newContiguousStringVector(NSArray<NSString *> *strings, NSUInteger prefixCount)
+{
+    NSUInteger count = prefixCount + strings.count;
+    size_t stringsSize = 0;
+    for (NSString *string in strings) {
+        stringsSize += [string lengthOfBytesUsingEncoding:NSUTF8StringEncoding] + 1;
+    }
+    size_t vectorSize = (count + 1) * sizeof(char *);
+    char **vector = malloc(vectorSize + stringsSize);
+    BRUAssertAlwaysFatal(vector, @"out of memory");
+
+    for (NSUInteger i = 0; i < prefixCount; i++) {
+        vector[i] = NULL;
+    }
+    char *next = (char *)vector + vectorSize;
+    size_t remaining = stringsSize;
+    NSUInteger i = prefixCount;
+    for (NSString *string in strings) {
+        NSUInteger used = 0;
+        [string getBytes:next
+               maxLength:remaining - 1
+              usedLength:&used
+                encoding:NSUTF8StringEncoding
+                 options:0
+                   range:NSMakeRange(0, string.length)
+          remainingRange:NULL];
+        next[used] = '\0';
+        vector[i++] = next;
+        next += used + 1;
+        remaining -= used + 1;
+    }
+    vector[count] = NULL;
+    return vector;
+}
+
+@interface BRUTaskTemplate ()
+
+/**
+ * The arena: launch path, working directory (if any) and environment (if any), see newContiguousStringVector.
+ */
+@property (nonatomic, readonly, assign) char **strings;
+
+@property (nonatomic, readonly, assign) char *launchPathCString;
+@property (nonatomic, readonly, assign) char *currentDirectoryPathCString;
+@property (nonatomic, readonly, assign) char **environmentVector;
+
+@end
+
+@implementation BRUTaskTemplate
+
+BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
+
+- (instancetype)initWithLaunchPath:(NSString *)launchPath
+                       environment:(NSDictionary<NSString *, NSString *> *)environment
+              currentDirectoryPath:(NSString *)currentDirectoryPath
+{
+    BRUParameterAssert(launchPath);
+
+    if ((self = [super init])) {
+        self->_launchPath = [launchPath copy];
+        self->_environment = [environment copy];
+        self->_currentDirectoryPath = [currentDirectoryPath copy];
+
+        NSMutableArray<NSString *> *strings = [NSMutableArray arrayWithCapacity:2 + environment.count];
+        [strings addObject:self->_launchPath];
+        if (self->_currentDirectoryPath) {
+            [strings addObject:self->_currentDirectoryPath];
+        }
+        NSUInteger environmentIndex = strings.count;
+        for (NSString *key in [self->_environment keyEnumerator]) {
+            [strings addObject:[NSString stringWithFormat:@"%@=%@", key, self->_environment[key]]];
+        }
+        self->_strings = newContiguousStringVector(strings, 0);
+
+        self->_launchPathCString = self->_strings[0];
+        self->_currentDirectoryPathCString = self->_currentDirectoryPath ? self->_strings[1] : NULL;
+        /* the environment is the NULL terminated tail of the vector */
+        self->_environmentVector = self->_environment ? self->_strings + environmentIndex : NULL;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    free(self->_strings);
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"BRUTaskTemplate {launchPath='%@', currentDirectoryPath='%@', environment=%@}",
+            self.launchPath, self.currentDirectoryPath, self.environment];
+}
+
+#pragma mark - Internal API (used by BRUTask)
+
+/**
+ * Returns a NULL terminated argument vector (`argv[0]` being the launch path), to be released with `free`. Only
+ * valid while the template is alive.
+ */
+- (char **)newArgumentVectorWithArguments:(NSArray<NSString *> *)arguments
+{
+    char **argv = newContiguousStringVector(arguments ?: @[], 1);
+    argv[0] = self.launchPathCString;
+    return argv;
+}
+
+@end
@@ -0,0 +1,92 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "BRUBaseDefines.h"
+
+typedef NS_ENUM(NSUInteger, BRUThroughputLimiterMode) {
+    BRUThroughputLimiterModeTokenBucket = 1,
+    BRUThroughputLimiterModeLeakyBucket = 2
+};
+
+BRU_assume_nonnull_begin
+
+/**
+ * A `BRUThroughputLimiter` limits operations to a given rate (operations per second). Unlike `BRURateLimiter` which
+ * collapses results, it lets every operation through but spaces them out over time. One limiter can be shared
+ * between any number of threads.
+ *
+ * In `BRUThroughputLimiterModeTokenBucket` the limiter saves up unused permits up to `burst`, ie. after being idle
+ * `burst` operations may run right away before the rate applies again. Waiting acquisitions queue up without limit.
+ *
+ * In `BRUThroughputLimiterModeLeakyBucket` operations are let through at exactly the rate, there are no bursts.
+ * `burst` is the size of the bucket instead: once `burst` acquisitions are waiting, further ones overflow and are
+ * rejected.
+ *
+ * Permits are handed out first come, first served: as long as acquisitions are waiting, `tryAcquire` fails.
+ * Checking the rate is lock-free, only waiting acquisitions are parked on an internal queue targeting `targetQueue`.
+ * The limiter must be retained for as long as acquisitions are waiting, the blocks of waiting acquisitions are
+ * dropped when it is deallocated.
+ */
+BRU_restrict_subclassing @interface BRUThroughputLimiter : NSObject
+
+BRU_DEFAULT_INIT_UNAVAILABLE(null_unspecified)
+
+@property (nonatomic, readonly, assign) double rate;
+@property (nonatomic, readonly, assign) NSUInteger burst;
+@property (nonatomic, readonly, assign) BRUThroughputLimiterMode mode;
+@property (nonatomic, readonly, strong) dispatch_queue_t targetQueue;
+
+/**
+ * Initialise a `BRUThroughputLimiter`.
+ *
+ * @param rate The operations per second to allow, must be positive.
+ * @param burst The bucket size (see class description for the semantics), must be positive.
+ * @param mode The limiter's mode.
+ * @param targetQueue The queue to run the blocks of `acquireWithBlock:` on.
+ */
+- (instancetype)initWithRate:(double)rate
+                       burst:(NSUInteger)burst
+                        mode:(BRUThroughputLimiterMode)mode
+                 targetQueue:(dispatch_queue_t)targetQueue NS_DESIGNATED_INITIALIZER;
+
+/**
+ * Try to acquire one permit without waiting.
+ *
+ * @return `YES` if the operation may run now, `NO` otherwise.
+ */
+- (BOOL)tryAcquire;
+
+/**
+ * Try to acquire `permits` permits at once without waiting.
+ *
+ * @param permits The number of permits to acquire, must be positive and (in token bucket mode) at most `burst`.
+ * @return `YES` if the operations may run now, `NO` otherwise.
+ */
+- (BOOL)tryAcquire:(NSUInteger)permits;
+
+/**
+ * Acquire one permit and run `block` on `targetQueue` once it was granted.
+ *
+ * @param block The operation to run.
+ * @return `YES` if the acquisition was queued, `NO` if it overflowed the leaky bucket (`block` won't run then).
+ */
+- (BOOL)acquireWithBlock:(dispatch_block_t)block;
+
+/**
+ * Acquire `permits` permits at once and run `block` on `targetQueue` once they were granted.
+ *
+ * @param permits The number of permits to acquire, must be positive and (in token bucket mode) at most `burst`.
+ * @param block The operation to run.
+ * @return `YES` if the acquisition was queued, `NO` if it overflowed the leaky bucket (`block` won't run then).
+ */
+- (BOOL)acquire:(NSUInteger)permits withBlock:(dispatch_block_t)block;
+
+@end
+
+BRU_assume_nonnull_end
@@ -0,0 +1,222 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#include <stdatomic.h>
+
+#import "BRUDispatchUtils.h"
+#import "BRUAsserts.h"
+#import "BRUARCUtils.h"
+#import "BRUTimer.h"
+#import "BRUThroughputLimiter.h"
+
+@interface BRUThroughputLimiterWaiter : NSObject
+
+@property (nonatomic, readonly, assign) NSUInteger permits;
+@property (nonatomic, readonly, strong) dispatch_block_t block;
+
+@end
+
+@implementation BRUThroughputLimiterWaiter
+
+- (instancetype)initWithPermits:(NSUInteger)permits block:(dispatch_block_t)block
+{
+    if ((self = [super init])) {
+        self->_permits = permits;
+        self->_block = block;
+    }
+    return self;
+}
+
+@end
+
+/*
+ * The rate is checked with the generic cell rate algorithm: instead of a token count which would need refilling, the
+ * limiter keeps the 'theoretical arrival time', the point in time at which the bucket will be empty again. Taking
+ * permits moves it forward by one emission interval per permit, so checking and taking is a single compare and swap.
+ */
+@interface BRUThroughputLimiter () {
+    _Atomic(uint64_t) _theoreticalArrivalTime; /* in BRUMonotonicNanoseconds */
+    _Atomic(uintptr_t) _waiting; /* acquisitions queued but not yet granted */
+    uint64_t _emissionInterval; /* nanoseconds per permit */
+    NSUInteger _maxWaiting;
+}
+
+@property (nonatomic, readonly, strong) dispatch_queue_t syncQueue;
+
+/**
+ * Synchronized on syncQueue.
+ */
+@property (nonatomic, readonly, strong) NSMutableArray<BRUThroughputLimiterWaiter *> *waiters;
+
+/**
+ * Lazily created, wakes up the waiters once the next permits are available. Synchronized on syncQueue.
+ */
+@property (nonatomic, readwrite, strong) dispatch_source_t wakeupSource;
+
+@end
+
+@implementation BRUThroughputLimiter
+
+BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
+
+- (instancetype)initWithRate:(double)rate
+                       burst:(NSUInteger)burst
+                        mode:(BRUThroughputLimiterMode)mode
+                 targetQueue:(dispatch_queue_t)targetQueue
+{
+    BRUParameterAssert(rate > 0);
+    BRUParameterAssert(burst > 0);
+    BRUParameterAssert(targetQueue);
+
+    if ((self = [super init])) {
+        self->_rate = rate;
+        self->_burst = burst;
+        self->_mode = mode;
+        self->_targetQueue = targetQueue;
+        self->_syncQueue = bru_dispatch_queue_create("com.bromium.BromiumUtils.BRUThroughputLimiter.syncQueue",
+                                                     DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(self->_syncQueue, self->_targetQueue);
+        self->_waiters = [NSMutableArray new];
+        self->_wakeupSource = nil;
+        self->_emissionInterval = MAX((uint64_t)(NSEC_PER_SEC / rate), (uint64_t)1);
+        self->_maxWaiting = mode == BRUThroughputLimiterModeLeakyBucket ? burst : NSUIntegerMax;
+        atomic_init(&self->_theoreticalArrivalTime, 0);
+        atomic_init(&self->_waiting, 0);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    if (self->_wakeupSource) {
+        dispatch_source_cancel(self->_wakeupSource);
+    }
+}
+
+#pragma mark - Helpers
+
+/**
+ * Takes `permits` permits if they're available now, regardless of waiters.
+ *
+ * @param permits The number of permits to take.
+ * @param outDelay Set to the nanoseconds until the permits will be available if they're not available now.
+ * @return Whether the permits were taken.
+ */
+- (BOOL)takePermits:(NSUInteger)permits delay:(uint64_t *)outDelay
+{
+    uint64_t cost = permits * self->_emissionInterval;
+    /* a token bucket may be up to `burst` permits ahead, a leaky bucket must have run dry */
+    uint64_t limit = self.mode == BRUThroughputLimiterModeLeakyBucket ? cost : self.burst * self->_emissionInterval;
+    uint64_t now = BRUMonotonicNanoseconds();
+    uint64_t tat = atomic_load_explicit(&self->_theoreticalArrivalTime, memory_order_relaxed);
+    for (;;) {
+        uint64_t newTat = MAX(tat, now) + cost;
+        if (newTat - now > limit) {
+            if (outDelay) {
+                *outDelay = newTat - now - limit;
+            }
+            return NO;
+        }
+        if (atomic_compare_exchange_weak_explicit(&self->_theoreticalArrivalTime, &tat, newTat,
+                                                  memory_order_acq_rel, memory_order_relaxed)) {
+            return YES;
+        }
+    }
+}
+
+- (void)grantWaitersUnsynchronized
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
+
+    while (self.waiters.count > 0) {
+        BRUThroughputLimiterWaiter *waiter = self.waiters.firstObject;
+        uint64_t delay = 0;
+        if (![self takePermits:waiter.permits delay:&delay]) {
+            [self wakeUpUnsynchronizedAfter:delay];
+            return;
+        }
+        [self.waiters removeObjectAtIndex:0];
+        atomic_fetch_sub_explicit(&self->_waiting, 1, memory_order_release);
+        dispatch_async(self.targetQueue, waiter.block);
+    }
+}
+
+- (void)wakeUpUnsynchronizedAfter:(uint64_t)delay
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQueue);
+
+    if (!self.wakeupSource) {
+        self.wakeupSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.syncQueue);
+        BRU_weakify(self);
+        dispatch_source_set_event_handler(self.wakeupSource, ^{
+            BRU_strongify(self);
+            [self grantWaitersUnsynchronized];
+        });
+        dispatch_resume(self.wakeupSource);
+    }
+    dispatch_source_set_timer(self.wakeupSource,
+                              dispatch_time(DISPATCH_TIME_NOW, (int64_t)delay),
+                              DISPATCH_TIME_FOREVER,
+                              0);
+}
+
+#pragma mark - Public API
+
+- (BOOL)tryAcquire
+{
+    return [self tryAcquire:1];
+}
+
+- (BOOL)tryAcquire:(NSUInteger)permits
+{
+    BRUParameterAssert(permits > 0);
+    BRUParameterAssert(self.mode == BRUThroughputLimiterModeLeakyBucket || permits <= self.burst);
+
+    if (atomic_load_explicit(&self->_waiting, memory_order_acquire) > 0) {
+        /* don't overtake the waiters */
+        return NO;
+    }
+    return [self takePermits:permits delay:NULL];
+}
+
+- (BOOL)acquireWithBlock:(dispatch_block_t)block
+{
+    return [self acquire:1 withBlock:block];
+}
+
+- (BOOL)acquire:(NSUInteger)permits withBlock:(dispatch_block_t)block
+{
+    BRUParameterAssert(permits > 0);
+    BRUParameterAssert(self.mode == BRUThroughputLimiterModeLeakyBucket || permits <= self.burst);
+    BRUParameterAssert(block);
+
+    uintptr_t waiting = atomic_fetch_add_explicit(&self->_waiting, 1, memory_order_acq_rel);
+    if (waiting >= self->_maxWaiting) {
+        /* bucket overflowed */
+        atomic_fetch_sub_explicit(&self->_waiting, 1, memory_order_release);
+        return NO;
+    }
+
+    BRUThroughputLimiterWaiter *waiter = [[BRUThroughputLimiterWaiter alloc] initWithPermits:permits block:block];
+    /* weakly, waiting acquisitions mustn't keep the limiter alive */
+    BRU_weakify(self);
+    dispatch_async(self.syncQueue, ^{
+        BRU_strongify(self);
+        if (nil == self) {
+            return;
+        }
+        BOOL mustGrant = self.waiters.count == 0;
+        [self.waiters addObject:waiter];
+        if (mustGrant) {
+            /* otherwise the wakeup source is already armed for the waiters ahead of this one */
+            [self grantWaitersUnsynchronized];
+        }
+    });
+    return YES;
+}
+
+@end
@@ -11,13 +11,35 @@
 
 #import "BRUBaseDefines.h"
 
+@class BRUCancellationToken;
+@class BRUTimerWheel;
+
 typedef NS_ENUM(NSUInteger, BRUTimerMode) {
     BRUTimerModeIntervalBetweenBlockExecutions = 1,
-    BRUTimerModeIntervalClockedOnWallClockTime = 2
+    BRUTimerModeIntervalClockedOnWallClockTime = 2,
+    BRUTimerModeFixedRateOnMonotonicClock = 3
 };
 
 BRU_assume_nonnull_begin
 
+@class BRUTimer;
+
+/**
+ * The block of a timer in `BRUTimerModeFixedRateOnMonotonicClock`.
+ *
+ * @param timer The timer that fired.
+ * @param deadline The deadline (see `BRUMonotonicNanoseconds`) this fire was scheduled for.
+ * @param missedTicks The number of deadlines skipped since the previous fire because the block overran or the timer
+ *                    couldn't fire in time.
+ */
+typedef void (^BRUTimerMonotonicBlock)(BRUTimer *timer, uint64_t deadline, NSUInteger missedTicks);
+
+/**
+ * Returns the current time of the monotonic clock libdispatch uses for `DISPATCH_TIME_NOW` in nanoseconds. The clock
+ * isn't affected by changes to the wall clock and doesn't advance while the machine is asleep.
+ */
+uint64_t BRUMonotonicNanoseconds(void);
+
 /**
  * BRUTimer is a timer object based on libdispatch. It has four major differences to NSTimer:
  *
@@ -35,19 +57,53 @@ BRU_assume_nonnull_begin
  * _after the previous execution of the block ends_. For non-repeating timers and the first timer fire the `mode`
  * has no relevance.
  *
+ * `BRUTimerModeFixedRateOnMonotonicClock` schedules against absolute deadlines on the monotonic clock: the n-th fire
+ * is due at `start + n * interval`, so the fires don't drift, however long scheduling or the block takes. Deadlines
+ * that pass while the block is still running (or that can't be met at all) are skipped and reported to the next fire
+ * as missed ticks, the block is never run concurrently with itself. Such timers are best created with
+ * `initWithInterval:monotonicBlock:onQueue:repeats:timerWheel:` which hands the block the deadline as cheap
+ * monotonic nanosecond value instead of an `NSDate`. If `adjustFun` changes the interval, the deadlines restart
+ * from the current one.
+ *
  * `BRUTimer` allows for an external queue to be specified which is used to dispatch the block whenever the timer
  * fires. If no queue is specified a newly created _serial_ queue is used.
  *
+ * Each fire may be delayed by up to `leeway` seconds which allows the system to fire timers due at about the same time
+ * together, saving wakeups. With `coalescing` set, the timer goes further: its deadlines are rounded up to multiples
+ * of half the `leeway` (the system may defer the fire by the other half) so that timers with the same leeway share
+ * deadlines, and fires of all coalescing timers with the same target queue that happen at the same time are run in one
+ * batch on that queue.
+ *
+ * By default every `BRUTimer` has its own synchronisation queue and schedules each fire with `dispatch_after`. When
+ * very many timers are needed (eg. per-connection timeouts), they can be backed by a shared `BRUTimerWheel` instead:
+ * the timers then synchronise on the wheel's queue, (re)scheduling a fire is O(1) and all fires of one tick are
+ * handled in one go. The semantics stay the same but fires are rounded up to the wheel's resolution, and as all of
+ * the wheel's timers share one queue, `adjustFun` must not call synchronous methods of other timers of the same wheel.
+ *
  */
 @interface BRUTimer : NSObject
 
 BRU_DEFAULT_INIT_UNAVAILABLE(null_unspecified)
 
 @property (nonatomic, readonly, assign) NSTimeInterval initialInterval;
-@property (nonatomic, readonly, strong) void(^block)(BRUTimer *, NSDate *);
+@property (atomic, readonly, strong) void(^block)(BRUTimer *, NSDate *);
+@property (atomic, readonly, strong, nullable) BRUTimerMonotonicBlock monotonicBlock;
 @property (nonatomic, readonly, assign) BOOL repeat;
-@property (nonatomic, readonly, strong) NSTimeInterval(^adjustFun)(BRUTimer *, NSTimeInterval);
+@property (atomic, readonly, strong) NSTimeInterval(^adjustFun)(BRUTimer *, NSTimeInterval);
 @property (nonatomic, readonly, assign) BRUTimerMode mode;
+@property (nonatomic, readonly, strong, nullable) BRUTimerWheel *timerWheel;
+
+/**
+ * The amount of time (in seconds) each fire may be deferred by the system, defaults to 0. Changes take effect when
+ * the next fire is scheduled. Not used with a timer wheel which always rounds up to its resolution.
+ */
+@property (atomic, readwrite, assign) NSTimeInterval leeway;
+
+/**
+ * Whether the timer coalesces its fires with other timers (see class description), defaults to `NO`. Changes take
+ * effect when the next fire is scheduled.
+ */
+@property (atomic, readwrite, assign) BOOL coalescing;
 
 /**
  * Initialise a suspended BRUTimer
@@ -58,13 +114,32 @@ BRU_DEFAULT_INIT_UNAVAILABLE(null_unspecified)
  * @param repeat Whether the timer repeats
  * @param mode The timer's mode (see class description for the semantics).
  * @param adjustFun The function to adjust the interval after each time the timer fired.
+ * @param timerWheel The timer wheel to schedule the fires on. If nil uses `dispatch_after`.
  */
 - (instancetype)initWithInterval:(NSTimeInterval)interval
                            block:(void (^)(BRUTimer *, NSDate *))block
                          onQueue:(nullable dispatch_queue_t)targetQueue
                          repeats:(BOOL)repeat
                             mode:(BRUTimerMode)mode
-                  adjustInterval:(NSTimeInterval(^ __nullable)(BRUTimer *, NSTimeInterval))adjustFun NS_DESIGNATED_INITIALIZER;
+                  adjustInterval:(NSTimeInterval(^ __nullable)(BRUTimer *, NSTimeInterval))adjustFun
+                      timerWheel:(nullable BRUTimerWheel *)timerWheel NS_DESIGNATED_INITIALIZER;
+
+/**
+ * Initialise a suspended BRUTimer
+ *
+ * @param interval The fire interval
+ * @param block The block to execute on fire
+ * @param targetQueue The queue to execute the block on. If nil uses the default global queue.
+ * @param repeat Whether the timer repeats
+ * @param mode The timer's mode (see class description for the semantics).
+ * @param adjustFun The function to adjust the interval after each time the timer fired.
+ */
+- (instancetype)initWithInterval:(NSTimeInterval)interval
+                           block:(void (^)(BRUTimer *, NSDate *))block
+                         onQueue:(nullable dispatch_queue_t)targetQueue
+                         repeats:(BOOL)repeat
+                            mode:(BRUTimerMode)mode
+                  adjustInterval:(NSTimeInterval(^ __nullable)(BRUTimer *, NSTimeInterval))adjustFun;
 
 /**
  * Initialise a suspended BRUTimer (running in `BRUTimerModeIntervalBetweenBlockExecutions` mode)
@@ -81,6 +156,21 @@ BRU_DEFAULT_INIT_UNAVAILABLE(null_unspecified)
                          repeats:(BOOL)repeat
                   adjustInterval:(NSTimeInterval(^ __nullable)(BRUTimer *, NSTimeInterval))adjustFun;
 
+/**
+ * Initialise a suspended BRUTimer in `BRUTimerModeFixedRateOnMonotonicClock` mode
+ *
+ * @param interval The fire interval
+ * @param block The block to execute on fire
+ * @param targetQueue The queue to execute the block on. If nil uses the default global queue.
+ * @param repeat Whether the timer repeats
+ * @param timerWheel The timer wheel to schedule the fires on. If nil uses a dispatch timer.
+ */
+- (instancetype)initWithInterval:(NSTimeInterval)interval
+                  monotonicBlock:(BRUTimerMonotonicBlock)block
+                         onQueue:(nullable dispatch_queue_t)targetQueue
+                         repeats:(BOOL)repeat
+                      timerWheel:(nullable BRUTimerWheel *)timerWheel;
+
 /**
  * Initially starts the timer
  */
@@ -113,6 +203,20 @@ BRU_DEFAULT_INIT_UNAVAILABLE(null_unspecified)
  */
 - (void)fire;
 
+/**
+ * Stops the timer for good and releases its block (and everything the block captured). Pending fires are dropped and
+ * an invalidated timer can't be started or resumed again.
+ */
+- (void)invalidate;
+
+/**
+ * Invalidates the timer (see `invalidate`) when `cancellationToken` is cancelled. If the token is already cancelled,
+ * the timer is invalidated right away.
+ *
+ * @param cancellationToken The token tearing the timer down.
+ */
+- (void)invalidateWhenCancelled:(BRUCancellationToken *)cancellationToken;
+
 /**
  * Returns a running BRUTimer. Make sure to retain the returned timer to make sure it fires.
  *
@@ -7,24 +7,105 @@
 //  Created by Johannes Weiß on 20/03/2014.
 //
 
+#include <mach/mach_time.h>
+
 #import "BRUDispatchUtils.h"
 #import "BRUBaseDefines.h"
 #import "BRUAsserts.h"
 #import "BRUARCUtils.h"
+#import "BRUCancellationToken.h"
+#import "BRUTimerWheel.h"
 #import "BRUTimer.h"
 
 @interface BRUTimer () {
     BOOL _running; /* synchronised by syncQ */
+    BOOL _invalidated; /* synchronised by syncQ */
     NSUInteger _generation; /* synchronized by syncQ */
+    NSUInteger _scheduledGeneration; /* synchronized by syncQ, the generation the pending fire was scheduled in */
+    NSMutableArray<dispatch_block_t> *_cancellationCleanups; /* synchronized by syncQ */
+
+    /* BRUTimerModeFixedRateOnMonotonicClock only, all synchronized by syncQ */
+    uint64_t _deadlineBase; /* the n-th deadline is at `_deadlineBase + n * _intervalNanoseconds` */
+    uint64_t _intervalNanoseconds;
+    uint64_t _nextTick; /* n of the next deadline */
+    NSUInteger _missedTicks; /* ticks missed since the last fire */
+    BOOL _fireInFlight; /* whether the last fire's block hasn't finished yet */
 }
 
+@property (atomic, readwrite, strong) void(^block)(BRUTimer *, NSDate *);
+@property (atomic, readwrite, strong, nullable) BRUTimerMonotonicBlock monotonicBlock;
+@property (atomic, readwrite, strong) NSTimeInterval(^adjustFun)(BRUTimer *, NSTimeInterval);
+
 @property (nonatomic, readonly, strong) dispatch_queue_t syncQ;
 @property (nonatomic, readonly, strong) dispatch_queue_t targetQ;
+@property (nonatomic, readonly, strong) BRUTimerWheelEntry *timerWheelEntry;
+
+/**
+ * Lazily created, only used without a timer wheel. Synchronized on syncQ.
+ */
+@property (nonatomic, readwrite, strong) dispatch_source_t timerSource;
 
 @property (atomic, readwrite, assign) NSTimeInterval currentInterval;
 
 @end
 
+/**
+ * Pending coalesced fires by target queue.
+ */
+static NSMapTable<dispatch_queue_t, NSMutableArray<dispatch_block_t> *> *coalescedFires(void)
+{
+    static NSMapTable *coalescedFires = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        coalescedFires = [NSMapTable mapTableWithKeyOptions:(NSPointerFunctionsStrongMemory |
+                                                             NSPointerFunctionsObjectPointerPersonality)
+                                               valueOptions:NSPointerFunctionsStrongMemory];
+    });
+    return coalescedFires;
+}
+
+/**
+ * Runs `fire` on `queue` together with all other coalesced fires for `queue` that are pending by the time the queue
+ * gets to run them, ie. with a single dispatch to `queue`.
+ */
+static void dispatchCoalescedFire(dispatch_queue_t queue, dispatch_block_t fire)
+{
+    NSMapTable<dispatch_queue_t, NSMutableArray<dispatch_block_t> *> *pending = coalescedFires();
+    BOOL firstFire = NO;
+    @synchronized(pending) {
+        NSMutableArray<dispatch_block_t> *fires = [pending objectForKey:queue];
+        if (!fires) {
+            firstFire = YES;
+            fires = [NSMutableArray array];
+            [pending setObject:fires forKey:queue];
+        }
+        [fires addObject:fire];
+    }
+
+    if (firstFire) {
+        dispatch_async(queue, ^{
+            NSArray<dispatch_block_t> *fires = nil;
+            @synchronized(pending) {
+                fires = [pending objectForKey:queue];
+                [pending removeObjectForKey:queue];
+            }
+            for (dispatch_block_t f in fires) {
+                f();
+            }
+        });
+    }
+}
+
+uint64_t BRUMonotonicNanoseconds(void)
+{
+    static mach_timebase_info_data_t timebase;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        mach_timebase_info(&timebase);
+    });
+    return mach_absolute_time() * timebase.numer / timebase.denom;
+}
+
 @implementation BRUTimer
 
 - (void)incrementGenerationUnsynchronized
@@ -65,6 +146,9 @@
 {
     dispatch_barrier_async(self.syncQ, ^{
         [self setRunningUnsynchronized:running];
+        if (!running) {
+            [self unscheduleUnsynchronized];
+        }
     });
 }
 
@@ -73,72 +157,321 @@
 - (void)fireWithDate:(NSDate *)date postFireBlock:(void(^)(void))postFireBlock
 {
     BRU_weakify(self);
-    dispatch_async(self.targetQ, ^{
+    dispatch_block_t fire = ^{
         BRU_strongify(self);
         if (self) {
-            self.block(self, date);
+            BRUTimerMonotonicBlock monotonicBlock = self.monotonicBlock;
+            if (monotonicBlock) {
+                monotonicBlock(self, BRUMonotonicNanoseconds(), 0);
+            } else {
+                self.block(self, date);
+            }
             postFireBlock();
         }
-    });
+    };
+    [self dispatchFire:fire];
+}
+
+- (void)dispatchFire:(dispatch_block_t)fire
+{
+    if (self.coalescing) {
+        dispatchCoalescedFire(self.targetQ, fire);
+    } else {
+        dispatch_async(self.targetQ, fire);
+    }
+}
+
+/**
+ * Drops the pending fire (if any).
+ */
+- (void)unscheduleUnsynchronized
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQ);
+
+    if (self.timerWheel) {
+        [self.timerWheel unscheduleEntry:self.timerWheelEntry];
+    } else if (self.timerSource) {
+        dispatch_source_set_timer(self.timerSource, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+    }
+}
+
+/**
+ * Adjusts the interval for the next fire and stops non-repeating timers, to be called when the timer fires.
+ */
+- (void)prepareFireUnsynchronized
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQ);
+
+    NSTimeInterval nextInterval = self.adjustFun(self, self.currentInterval);
+    self.currentInterval = nextInterval;
+
+    if (!self.repeat) {
+        [self setRunningUnsynchronized:NO];
+    }
+}
+
+/**
+ * Returns the time until the next fire is due in nanoseconds.
+ */
+- (uint64_t)nextFireDelayUnsynchronized
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQ);
+
+    if (self.mode == BRUTimerModeFixedRateOnMonotonicClock) {
+        uint64_t deadline = self->_deadlineBase + self->_nextTick * self->_intervalNanoseconds;
+        uint64_t now = BRUMonotonicNanoseconds();
+        return deadline > now ? deadline - now : 0;
+    }
+    return (uint64_t)(MAX(self.currentInterval, 0.0) * NSEC_PER_SEC);
+}
+
+/**
+ * Restarts the deadlines of `BRUTimerModeFixedRateOnMonotonicClock` at `base` using the current interval.
+ */
+- (void)resetDeadlinesUnsynchronizedWithBase:(uint64_t)base
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQ);
+
+    self->_deadlineBase = base;
+    self->_intervalNanoseconds = MAX((uint64_t)(MAX(self.currentInterval, 0.0) * NSEC_PER_SEC), (uint64_t)1);
+    self->_nextTick = 1;
+}
+
+/**
+ * Handles a fire in `BRUTimerModeFixedRateOnMonotonicClock`, called by both backends once the generation is checked.
+ */
+- (void)deadlineReachedUnsynchronized
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQ);
+
+    uint64_t now = BRUMonotonicNanoseconds();
+    uint64_t interval = self->_intervalNanoseconds;
+    uint64_t deadline = self->_deadlineBase + self->_nextTick * interval;
+    if (now < deadline) {
+        /* early (the deadline got rounded), try again */
+        [self scheduleNextFireUnsynchronized];
+        return;
+    }
+
+    /* fire for the latest deadline that passed, skipping the ones before it */
+    uint64_t late = (now - deadline) / interval;
+    deadline += late * interval;
+    self->_nextTick += 1 + late;
+    self->_missedTicks += (NSUInteger)late;
+
+    if (self->_fireInFlight) {
+        /* the block overran, skip this deadline too */
+        self->_missedTicks++;
+        [self scheduleNextFireUnsynchronized];
+        return;
+    }
+
+    NSUInteger missedTicks = self->_missedTicks;
+    self->_missedTicks = 0;
+
+    [self prepareFireUnsynchronized];
+    if ((uint64_t)(MAX(self.currentInterval, 0.0) * NSEC_PER_SEC) != interval) {
+        /* interval got adjusted, count the new deadlines from this one */
+        [self resetDeadlinesUnsynchronizedWithBase:deadline];
+    }
+    [self scheduleNextFireUnsynchronized];
+
+    self->_fireInFlight = YES;
+    BRU_weakify(self);
+    [self dispatchFire:^{
+        BRU_strongify(self);
+        if (!self) {
+            return;
+        }
+        BRUTimerMonotonicBlock monotonicBlock = self.monotonicBlock;
+        if (monotonicBlock) {
+            monotonicBlock(self, deadline, missedTicks);
+        } else {
+            self.block(self, [NSDate date]);
+        }
+        dispatch_async(self.syncQ, ^{
+            self->_fireInFlight = NO;
+        });
+    }];
+}
+
+/**
+ * Schedules the next fire on the timer's backend.
+ */
+- (void)scheduleNextFireUnsynchronized
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQ);
+
+    if (self.timerWheel) {
+        [self scheduleOnTimerWheelUnsynchronized];
+    } else {
+        [self armTimerSourceUnsynchronized];
+    }
+}
+
+- (void)scheduleOnTimerWheelUnsynchronized
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQ);
+
+    if (![self runningUnsynchronized]) {
+        return;
+    }
+    self->_scheduledGeneration = [self generationUnsynchronized];
+    [self.timerWheel scheduleEntry:self.timerWheelEntry
+                     afterInterval:(NSTimeInterval)[self nextFireDelayUnsynchronized] / NSEC_PER_SEC];
+}
+
+- (void)timerWheelEntryExpired
+{
+    /* attention we're on the timer wheel's queue here, shared with all of its timers, be quick! */
+    BRU_ASSERT_ON_QUEUE(self.syncQ);
+
+    if (self->_scheduledGeneration != [self generationUnsynchronized] || ![self runningUnsynchronized]) {
+        /* scheduled in older generation or not running, ignoring */
+        return;
+    }
+
+    if (self.mode == BRUTimerModeFixedRateOnMonotonicClock) {
+        [self deadlineReachedUnsynchronized];
+        return;
+    }
+
+    NSDate *fireDate = [NSDate date];
+    [self prepareFireUnsynchronized];
+
+    void (^postFireBlock)(void) = ^{};
+    if (self.repeat) {
+        switch (self.mode) {
+            case BRUTimerModeIntervalBetweenBlockExecutions: {
+                BRU_weakify(self);
+                postFireBlock = ^{
+                    BRU_strongify(self);
+                    [self setupTimer];
+                };
+                break;
+            }
+            case BRUTimerModeIntervalClockedOnWallClockTime:
+                /* no need to hop to another queue, rescheduling is cheap */
+                [self scheduleOnTimerWheelUnsynchronized];
+                break;
+            case BRUTimerModeFixedRateOnMonotonicClock:
+                BRU_ASSERT_NOT_REACHED(@"fixed rate fires are handled separately");
+        }
+    }
+    [self fireWithDate:fireDate postFireBlock:postFireBlock];
 }
 
 - (void)setupTimer
 {
-    NSUInteger gen = [self generation];
+    if (self.timerWheel) {
+        BRU_weakify(self);
+        dispatch_async(self.syncQ, ^{
+            BRU_strongify(self);
+            [self scheduleOnTimerWheelUnsynchronized];
+        });
+        return;
+    }
+
+    BRU_weakify(self);
+    dispatch_async(self.syncQ, ^{
+        BRU_strongify(self);
+        [self armTimerSourceUnsynchronized];
+    });
+}
+
+- (void)armTimerSourceUnsynchronized
+{
+    BRU_ASSERT_ON_QUEUE(self.syncQ);
+
+    if (![self runningUnsynchronized]) {
+        return;
+    }
+
+    if (!self.timerSource) {
+        self.timerSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.syncQ);
+        BRU_weakify(self);
+        dispatch_source_set_event_handler(self.timerSource, ^{
+            BRU_strongify(self);
+            [self timerSourceFired];
+        });
+        dispatch_source_set_timer(self.timerSource, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        dispatch_resume(self.timerSource);
+    }
+
+    NSTimeInterval leeway = MAX(self.leeway, 0.0);
+    uint64_t delay = [self nextFireDelayUnsynchronized];
+    uint64_t leewayNanoseconds = (uint64_t)(leeway * NSEC_PER_SEC);
+    if (self.coalescing && leewayNanoseconds > 1) {
+        /*
+         * round the deadline up to the next multiple of half the leeway so that timers fire at the same time, the
+         * other half is left to the system. Together that's at most `leeway` late.
+         */
+        uint64_t bucketNanoseconds = leewayNanoseconds / 2;
+        uint64_t now = BRUMonotonicNanoseconds();
+        uint64_t deadline = now + delay;
+        deadline = ((deadline + bucketNanoseconds - 1) / bucketNanoseconds) * bucketNanoseconds;
+        delay = deadline - now;
+        leewayNanoseconds -= bucketNanoseconds;
+    }
+
+    self->_scheduledGeneration = [self generationUnsynchronized];
+    dispatch_source_set_timer(self.timerSource,
+                              dispatch_time(DISPATCH_TIME_NOW, (int64_t)delay),
+                              DISPATCH_TIME_FOREVER,
+                              leewayNanoseconds);
+}
+
+- (void)timerSourceFired
+{
+    /* attention we're on syncQ here, be quick! */
+    BRU_ASSERT_ON_QUEUE(self.syncQ);
+
+    NSUInteger gen = self->_scheduledGeneration;
+    NSUInteger currentGen = [self generationUnsynchronized];
+    BRUAssert(currentGen > 0 && currentGen >= gen,
+              @"consistency problems: timer fire gen: %lu, current timer gen: %lu",
+              gen, currentGen);
+    if (gen != currentGen || ![self runningUnsynchronized]) {
+        /* fired in older generation or not running, ignoring */
+        return;
+    }
+
+    if (self.mode == BRUTimerModeFixedRateOnMonotonicClock) {
+        [self deadlineReachedUnsynchronized];
+        return;
+    }
+
+    NSDate *fireDate = [NSDate date];
+    [self prepareFireUnsynchronized];
+
     BRU_weakify(self);
-    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.currentInterval * NSEC_PER_SEC)),
-                   self.syncQ, ^
-                   {
-                       NSDate *fireDate = [NSDate date];
-
-                       /* attention we're on syncQ here, be quick! */
-                       BRU_strongify(self);
-                       if (!self) {
-                           return;
-                       }
-                       NSUInteger currentGen = [self generationUnsynchronized];
-                       BRUAssert(currentGen > 0 && currentGen >= gen,
-                                 @"consistency problems: timer fire gen: %lu, current timer gen: %lu",
-                                 gen, currentGen);
-                       if (gen != currentGen || ![self runningUnsynchronized]) {
-                           /* fired in older generation or not running, ignoring */
-                           return;
-                       }
-
-                       NSTimeInterval nextInterval = self.adjustFun(self, self.currentInterval);
-                       self.currentInterval = nextInterval;
-
-                       if (!self.repeat) {
-                           [self setRunningUnsynchronized:NO];
-                       }
-
-                       dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-                           BRU_strongify(self);
-                           if (self) {
-                               void (^setupTimerBlock)(void) = ^ {
-                                   BRU_strongify(self);
-                                   if (self.repeat) {
-                                       [self setupTimer];
-                                   }
-                               };
-                               void (^preFireBlock)(void);
-                               void (^postFireBlock)(void);
-
-                               switch (self.mode) {
-                                   case BRUTimerModeIntervalBetweenBlockExecutions:
-                                       preFireBlock = ^{};
-                                       postFireBlock = setupTimerBlock;
-                                       break;
-                                   case BRUTimerModeIntervalClockedOnWallClockTime:
-                                       preFireBlock = setupTimerBlock;
-                                       postFireBlock = ^{};
-                                       break;
-                               }
-                               preFireBlock();
-                               [self fireWithDate:fireDate postFireBlock:postFireBlock];
-                           }
-                       });
-                   });
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        BRU_strongify(self);
+        if (self) {
+            void (^setupTimerBlock)(void) = ^ {
+                BRU_strongify(self);
+                if (self.repeat) {
+                    [self setupTimer];
+                }
+            };
+            void (^preFireBlock)(void);
+            void (^postFireBlock)(void);
+
+            switch (self.mode) {
+                case BRUTimerModeIntervalBetweenBlockExecutions:
+                    preFireBlock = ^{};
+                    postFireBlock = setupTimerBlock;
+                    break;
+                case BRUTimerModeIntervalClockedOnWallClockTime:
+                case BRUTimerModeFixedRateOnMonotonicClock: /* not reached, handled above */
+                    preFireBlock = setupTimerBlock;
+                    postFireBlock = ^{};
+                    break;
+            }
+            preFireBlock();
+            [self fireWithDate:fireDate postFireBlock:postFireBlock];
+        }
+    });
 }
 
 - (BOOL)running
@@ -159,6 +492,7 @@
                          repeats:(BOOL)repeat
                             mode:(BRUTimerMode)mode
                   adjustInterval:(NSTimeInterval(^)(BRUTimer *, NSTimeInterval))adjustFun
+                      timerWheel:(BRUTimerWheel *)timerWheel
 {
     if ((self = [super init])) {
         self->_initialInterval = interval;
@@ -166,9 +500,32 @@
         self->_adjustFun = adjustFun ?: ^(__unused BRUTimer *t, NSTimeInterval iv) { return iv; };
         self->_repeat = repeat;
         self->_running = NO;
+        self->_invalidated = NO;
+        self->_cancellationCleanups = nil;
         self->_mode = mode;
 
-        self->_syncQ = bru_dispatch_queue_create("com.bromium.BRUTimer.syncQ", DISPATCH_QUEUE_SERIAL);
+        self->_timerWheel = timerWheel;
+        if (timerWheel) {
+            self->_syncQ = timerWheel.queue;
+            BRU_weakify(self);
+            self->_timerWheelEntry = [BRUTimerWheelEntry entryWithBlock:^{
+                BRU_strongify(self);
+                [self timerWheelEntryExpired];
+            }];
+        } else {
+            self->_syncQ = bru_dispatch_queue_create("com.bromium.BRUTimer.syncQ", DISPATCH_QUEUE_SERIAL);
+            self->_timerWheelEntry = nil;
+        }
+        self->_monotonicBlock = nil;
+        self->_deadlineBase = 0;
+        self->_intervalNanoseconds = 1;
+        self->_nextTick = 1;
+        self->_missedTicks = 0;
+        self->_fireInFlight = NO;
+        self->_timerSource = nil;
+        self->_leeway = 0;
+        self->_coalescing = NO;
+        self->_scheduledGeneration = 0;
         self->_targetQ = userTargetQueue ?: bru_dispatch_queue_create("com.bromium.BRUTimer.SerialTargetQ",
                                                                       DISPATCH_QUEUE_SERIAL);
         self->_currentInterval = interval;
@@ -177,6 +534,22 @@
     return self;
 }
 
+- (instancetype)initWithInterval:(NSTimeInterval)interval
+                           block:(void(^)(BRUTimer *, NSDate *))block
+                         onQueue:(dispatch_queue_t)targetQueue
+                         repeats:(BOOL)repeat
+                            mode:(BRUTimerMode)mode
+                  adjustInterval:(NSTimeInterval(^)(BRUTimer *, NSTimeInterval))adjustFun
+{
+    return [self initWithInterval:interval
+                            block:block
+                          onQueue:targetQueue
+                          repeats:repeat
+                             mode:mode
+                   adjustInterval:adjustFun
+                       timerWheel:nil];
+}
+
 - (instancetype)initWithInterval:(NSTimeInterval)interval
                            block:(void(^)(BRUTimer *, NSDate *))block
                          onQueue:(dispatch_queue_t)targetQueue
@@ -191,6 +564,45 @@
                    adjustInterval:adjustFun];
 }
 
+- (instancetype)initWithInterval:(NSTimeInterval)interval
+                  monotonicBlock:(BRUTimerMonotonicBlock)block
+                         onQueue:(dispatch_queue_t)targetQueue
+                         repeats:(BOOL)repeat
+                      timerWheel:(BRUTimerWheel *)timerWheel
+{
+    BRUParameterAssert(block);
+    if ((self = [self initWithInterval:interval
+                                 block:^(__unused BRUTimer *t, __unused NSDate *d) {}
+                               onQueue:targetQueue
+                               repeats:repeat
+                                  mode:BRUTimerModeFixedRateOnMonotonicClock
+                        adjustInterval:nil
+                            timerWheel:timerWheel])) {
+        self->_monotonicBlock = block;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    for (dispatch_block_t cleanup in self->_cancellationCleanups) {
+        cleanup();
+    }
+
+    if (self->_timerSource) {
+        dispatch_source_cancel(self->_timerSource);
+    }
+
+    BRUTimerWheel *timerWheel = self->_timerWheel;
+    BRUTimerWheelEntry *timerWheelEntry = self->_timerWheelEntry;
+    if (timerWheel) {
+        /* don't leave the entry behind in the wheel until it expires */
+        dispatch_async(timerWheel.queue, ^{
+            [timerWheel unscheduleEntry:timerWheelEntry];
+        });
+    }
+}
+
 - (void)fire
 {
     [self fireWithDate:[NSDate date] postFireBlock:^{}];
@@ -225,14 +637,75 @@
 - (void)resumeWithUpdateInterval:(BOOL)updateInterval interval:(NSTimeInterval)timeInterval
 {
     BRU_ASSERT_OFF_QUEUE(self.syncQ);
+    __block BOOL invalidated = NO;
     dispatch_sync(self.syncQ, ^{
+        invalidated = self->_invalidated;
+        if (invalidated) {
+            return;
+        }
         if (updateInterval) {
             self.currentInterval = timeInterval;
         }
         [self incrementGenerationUnsynchronized];
         [self setRunningUnsynchronized:YES];
+        [self resetDeadlinesUnsynchronizedWithBase:BRUMonotonicNanoseconds()];
+        self->_missedTicks = 0;
+    });
+    if (!invalidated) {
+        [self setupTimer];
+    }
+}
+
+- (void)invalidate
+{
+    dispatch_barrier_async(self.syncQ, ^{
+        if (self->_invalidated) {
+            return;
+        }
+        self->_invalidated = YES;
+        /* bumping the generation makes pending fires no-ops */
+        [self incrementGenerationUnsynchronized];
+        [self setRunningUnsynchronized:NO];
+        self.block = ^(__unused BRUTimer *t, __unused NSDate *d) {};
+        self.monotonicBlock = nil;
+        self.adjustFun = ^(__unused BRUTimer *t, NSTimeInterval iv) { return iv; };
+        [self unscheduleUnsynchronized];
+
+        NSArray<dispatch_block_t> *cleanups = self->_cancellationCleanups;
+        self->_cancellationCleanups = nil;
+        for (dispatch_block_t cleanup in cleanups) {
+            cleanup();
+        }
+    });
+}
+
+- (void)invalidateWhenCancelled:(BRUCancellationToken *)cancellationToken
+{
+    BRUParameterAssert(cancellationToken);
+
+    BRU_weakify(self);
+    id registration = [cancellationToken addCancellationHandler:^{
+        BRU_strongify(self);
+        [self invalidate];
+    }];
+    if (!registration) {
+        return;
+    }
+
+    __weak BRUCancellationToken *weakToken = cancellationToken;
+    dispatch_barrier_async(self.syncQ, ^{
+        dispatch_block_t cleanup = ^{
+            [weakToken removeCancellationHandler:registration];
+        };
+        if (self->_invalidated) {
+            cleanup();
+            return;
+        }
+        if (!self->_cancellationCleanups) {
+            self->_cancellationCleanups = [NSMutableArray array];
+        }
+        [self->_cancellationCleanups addObject:cleanup];
     });
-    [self setupTimer];
 }
 
 + (BRUTimer *)scheduledTimerWithInterval:(NSTimeInterval)interval
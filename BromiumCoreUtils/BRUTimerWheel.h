@@ -0,0 +1,90 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "BRUBaseDefines.h"
+
+BRU_assume_nonnull_begin
+
+/**
+ * An entry which can be scheduled (and rescheduled) in a `BRUTimerWheel`. The entry is reusable: rescheduling an
+ * entry just moves it within the wheel, nothing gets allocated.
+ */
+BRU_restrict_subclassing @interface BRUTimerWheelEntry : NSObject
+
+BRU_DEFAULT_INIT_UNAVAILABLE(null_unspecified)
+
+/**
+ * Create an entry which runs `block` (on the wheel's queue) whenever it expires.
+ */
++ (instancetype)entryWithBlock:(dispatch_block_t)block;
+
+/**
+ * Whether the entry is currently scheduled. Synchronized on the wheel's queue.
+ */
+@property (nonatomic, readonly, assign, getter = isScheduled) BOOL scheduled;
+
+@end
+
+/**
+ * A hierarchical timer wheel as described by Varghese & Lauck in "Hashed and Hierarchical Timing Wheels" which is able
+ * to handle a very large number of timers cheaply: scheduling, rescheduling and unscheduling an entry are all O(1),
+ * there is just one clock (a libdispatch timer source on the wheel's `queue`) for all entries and all entries
+ * expiring in the same tick are handled in one go.
+ *
+ * Time is divided into ticks of `resolution` seconds; entries fire at the first tick boundary after their interval
+ * has elapsed, ie. up to one tick late. The clock only wakes up when there's something to do.
+ *
+ * All methods must be called on (and all entry blocks are run on) `queue`, a serial queue. Entry blocks must be quick
+ * and must not block.
+ *
+ * Normally, you wouldn't use `BRUTimerWheel` directly but pass it to `BRUTimer` instead.
+ */
+BRU_restrict_subclassing @interface BRUTimerWheel : NSObject
+
+BRU_DEFAULT_INIT_UNAVAILABLE(null_unspecified)
+
+/**
+ * The serial queue synchronising the wheel and running the entries' blocks.
+ */
+@property (nonatomic, readonly, strong) dispatch_queue_t queue;
+
+/**
+ * The length of one tick in seconds.
+ */
+@property (nonatomic, readonly, assign) NSTimeInterval resolution;
+
+/**
+ * A process-wide timer wheel with a resolution of one millisecond.
+ */
++ (instancetype)sharedTimerWheel;
+
+/**
+ * Create a new timer wheel.
+ *
+ * @param resolution The length of one tick in seconds, must be positive.
+ */
++ (instancetype)timerWheelWithResolution:(NSTimeInterval)resolution;
+
+/**
+ * Schedule `entry` to expire after `interval` seconds. If `entry` is already scheduled, it is rescheduled.
+ *
+ * Must be called on `queue`.
+ */
+- (void)scheduleEntry:(BRUTimerWheelEntry *)entry afterInterval:(NSTimeInterval)interval;
+
+/**
+ * Unschedule `entry`, a no-op if it's not scheduled.
+ *
+ * Must be called on `queue`.
+ */
+- (void)unscheduleEntry:(BRUTimerWheelEntry *)entry;
+
+@end
+
+BRU_assume_nonnull_end
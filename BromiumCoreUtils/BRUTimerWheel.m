@@ -0,0 +1,357 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import "BRUDispatchUtils.h"
+#import "BRUAsserts.h"
+#import "BRUARCUtils.h"
+#import "BRUTimer.h"
+#import "BRUTimerWheel.h"
+
+#define BRU_TIMER_WHEEL_LEVEL_BITS 6
+#define BRU_TIMER_WHEEL_SLOTS (1u << BRU_TIMER_WHEEL_LEVEL_BITS)
+#define BRU_TIMER_WHEEL_SLOT_MASK ((uint64_t)BRU_TIMER_WHEEL_SLOTS - 1)
+#define BRU_TIMER_WHEEL_LEVELS 4
+/* entries further out than that get parked in the last slot of the last level and are re-inserted when cascaded */
+#define BRU_TIMER_WHEEL_MAX_TICKS ((uint64_t)1 << (BRU_TIMER_WHEEL_LEVEL_BITS * BRU_TIMER_WHEEL_LEVELS))
+
+@interface BRUTimerWheelEntry () {
+    @package
+    /* all synchronized on the wheel's queue */
+    BRUTimerWheelEntry *_next;
+    __unsafe_unretained BRUTimerWheelEntry *_prev;
+    __unsafe_unretained BRUTimerWheel *_wheel;
+    uint64_t _expiry;
+    uint32_t _level;
+    uint32_t _slot;
+}
+
+@property (nonatomic, readonly, strong) dispatch_block_t block;
+
+@end
+
+@implementation BRUTimerWheelEntry
+
+BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
+
++ (instancetype)entryWithBlock:(dispatch_block_t)block
+{
+    return [[self alloc] initWithBlock:block];
+}
+
+- (instancetype)initWithBlock:(dispatch_block_t)block
+{
+    BRUParameterAssert(block);
+
+    self = [super init];
+    if (self) {
+        self->_block = [block copy];
+        self->_next = nil;
+        self->_prev = nil;
+        self->_wheel = nil;
+        self->_expiry = 0;
+        self->_level = 0;
+        self->_slot = 0;
+    }
+    return self;
+}
+
+- (BOOL)isScheduled
+{
+    return self->_wheel != nil;
+}
+
+@end
+
+@interface BRUTimerWheel () {
+    /* all synchronized on queue */
+    BRUTimerWheelEntry *_slots[BRU_TIMER_WHEEL_LEVELS][BRU_TIMER_WHEEL_SLOTS];
+    NSUInteger _levelCounts[BRU_TIMER_WHEEL_LEVELS];
+    uint64_t _now; /* the last tick that has been processed */
+    uint64_t _armedTick; /* the tick the clock is set to wake up at, UINT64_MAX if it isn't armed */
+}
+
+@property (nonatomic, readonly, assign) uint64_t startNanoseconds;
+@property (nonatomic, readonly, assign) uint64_t resolutionNanoseconds;
+@property (nonatomic, readonly, strong) dispatch_source_t clock;
+
+@end
+
+@implementation BRUTimerWheel
+
+BRU_DEFAULT_INIT_UNAVAILABLE_IMPL
+
++ (instancetype)sharedTimerWheel
+{
+    static BRUTimerWheel *sharedTimerWheel = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedTimerWheel = [self timerWheelWithResolution:0.001];
+    });
+    return sharedTimerWheel;
+}
+
++ (instancetype)timerWheelWithResolution:(NSTimeInterval)resolution
+{
+    return [[self alloc] initWithResolution:resolution];
+}
+
+- (instancetype)initWithResolution:(NSTimeInterval)resolution
+{
+    BRUParameterAssert(resolution > 0);
+
+    self = [super init];
+    if (self) {
+        self->_resolution = resolution;
+        self->_resolutionNanoseconds = MAX((uint64_t)(resolution * 1e9), (uint64_t)1);
+        self->_startNanoseconds = BRUMonotonicNanoseconds();
+        self->_now = 0;
+        self->_armedTick = UINT64_MAX;
+        for (NSUInteger level = 0; level < BRU_TIMER_WHEEL_LEVELS; level++) {
+            self->_levelCounts[level] = 0;
+        }
+
+        self->_queue = bru_dispatch_queue_create("com.bromium.BRUTimerWheel.queue", DISPATCH_QUEUE_SERIAL);
+        self->_clock = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self->_queue);
+        BRU_weakify(self);
+        dispatch_source_set_event_handler(self->_clock, ^{
+            BRU_strongify(self);
+            [self clockFired];
+        });
+        dispatch_source_set_timer(self->_clock, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        dispatch_resume(self->_clock);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    dispatch_source_cancel(self->_clock);
+
+    /* break the lists up iteratively, releasing a long list recursively could overflow the stack */
+    for (NSUInteger level = 0; level < BRU_TIMER_WHEEL_LEVELS; level++) {
+        for (NSUInteger slot = 0; slot < BRU_TIMER_WHEEL_SLOTS; slot++) {
+            BRUTimerWheelEntry *entry = self->_slots[level][slot];
+            self->_slots[level][slot] = nil;
+            while (entry) {
+                BRUTimerWheelEntry *next = entry->_next;
+                entry->_next = nil;
+                entry->_prev = nil;
+                entry->_wheel = nil;
+                entry = next;
+            }
+        }
+    }
+}
+
+#pragma mark - Helpers
+
+- (uint64_t)currentTick
+{
+    return (BRUMonotonicNanoseconds() - self.startNanoseconds) / self.resolutionNanoseconds;
+}
+
+- (void)insertEntryUnsynchronized:(BRUTimerWheelEntry *)entry
+{
+    uint64_t expiry = entry->_expiry;
+    uint64_t delta = expiry > self->_now ? expiry - self->_now : 0;
+    if (delta >= BRU_TIMER_WHEEL_MAX_TICKS) {
+        expiry = self->_now + BRU_TIMER_WHEEL_MAX_TICKS - 1;
+        delta = BRU_TIMER_WHEEL_MAX_TICKS - 1;
+    }
+
+    uint32_t level = 0;
+    while (delta >= ((uint64_t)1 << (BRU_TIMER_WHEEL_LEVEL_BITS * (level + 1)))) {
+        level++;
+    }
+    uint32_t slot = (uint32_t)((expiry >> (BRU_TIMER_WHEEL_LEVEL_BITS * level)) & BRU_TIMER_WHEEL_SLOT_MASK);
+
+    BRUTimerWheelEntry *head = self->_slots[level][slot];
+    entry->_next = head;
+    entry->_prev = nil;
+    if (head) {
+        head->_prev = entry;
+    }
+    self->_slots[level][slot] = entry;
+    entry->_level = level;
+    entry->_slot = slot;
+    entry->_wheel = self;
+    self->_levelCounts[level]++;
+}
+
+- (void)removeEntryUnsynchronized:(BRUTimerWheelEntry *)entry
+{
+    BRUTimerWheelEntry *next = entry->_next;
+    if (entry->_prev) {
+        entry->_prev->_next = next;
+    } else {
+        self->_slots[entry->_level][entry->_slot] = next;
+    }
+    if (next) {
+        next->_prev = entry->_prev;
+    }
+    entry->_next = nil;
+    entry->_prev = nil;
+    entry->_wheel = nil;
+    self->_levelCounts[entry->_level]--;
+}
+
+- (NSUInteger)countUnsynchronized
+{
+    NSUInteger count = 0;
+    for (uint32_t level = 0; level < BRU_TIMER_WHEEL_LEVELS; level++) {
+        count += self->_levelCounts[level];
+    }
+    return count;
+}
+
+- (void)cascadeUnsynchronized
+{
+    if ((self->_now & BRU_TIMER_WHEEL_SLOT_MASK) != 0) {
+        return;
+    }
+    for (uint32_t level = 1; level < BRU_TIMER_WHEEL_LEVELS; level++) {
+        uint64_t slot = (self->_now >> (BRU_TIMER_WHEEL_LEVEL_BITS * level)) & BRU_TIMER_WHEEL_SLOT_MASK;
+        /* re-inserted entries always end up in a lower level or a different slot so this terminates */
+        BRUTimerWheelEntry *entry = nil;
+        while ((entry = self->_slots[level][slot])) {
+            [self removeEntryUnsynchronized:entry];
+            [self insertEntryUnsynchronized:entry];
+        }
+        if (slot != 0) {
+            break;
+        }
+    }
+}
+
+- (void)expireCurrentSlotUnsynchronized
+{
+    uint64_t slot = self->_now & BRU_TIMER_WHEEL_SLOT_MASK;
+    /* Entries are popped one at a time because the blocks might (re|un)schedule any entry, including the ones in this
+       slot. Nothing scheduled from a block can end up in this slot again. */
+    BRUTimerWheelEntry *entry = nil;
+    while ((entry = self->_slots[0][slot])) {
+        [self removeEntryUnsynchronized:entry];
+        entry.block();
+    }
+}
+
+- (void)advanceToTickUnsynchronized:(uint64_t)tick
+{
+    while (self->_now < tick) {
+        if (self->_levelCounts[0] == 0) {
+            /* nothing can expire before level 0 wraps around, skip ahead */
+            uint64_t lastTickBeforeWrap = self->_now | BRU_TIMER_WHEEL_SLOT_MASK;
+            if (lastTickBeforeWrap >= tick) {
+                self->_now = tick;
+                break;
+            }
+            self->_now = lastTickBeforeWrap;
+        }
+        self->_now++;
+        [self cascadeUnsynchronized];
+        [self expireCurrentSlotUnsynchronized];
+    }
+}
+
+- (uint64_t)nextWakeTickUnsynchronized
+{
+    uint64_t wakeTick = UINT64_MAX;
+    for (uint32_t level = 1; level < BRU_TIMER_WHEEL_LEVELS; level++) {
+        if (self->_levelCounts[level] > 0) {
+            /* need to cascade at the next wrap-around of level 0 */
+            wakeTick = (self->_now | BRU_TIMER_WHEEL_SLOT_MASK) + 1;
+            break;
+        }
+    }
+    if (self->_levelCounts[0] > 0) {
+        /* all level 0 entries expire within the next BRU_TIMER_WHEEL_SLOTS ticks */
+        for (uint64_t tick = self->_now + 1; tick < wakeTick && tick <= self->_now + BRU_TIMER_WHEEL_SLOTS; tick++) {
+            if (self->_slots[0][tick & BRU_TIMER_WHEEL_SLOT_MASK]) {
+                wakeTick = tick;
+                break;
+            }
+        }
+    }
+    return wakeTick;
+}
+
+- (void)armClockUnsynchronizedForTick:(uint64_t)tick
+{
+    self->_armedTick = tick;
+    if (tick == UINT64_MAX) {
+        dispatch_source_set_timer(self.clock, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        return;
+    }
+
+    uint64_t wakeNanoseconds = self.startNanoseconds + tick * self.resolutionNanoseconds;
+    uint64_t nowNanoseconds = BRUMonotonicNanoseconds();
+    int64_t delta = wakeNanoseconds > nowNanoseconds ? (int64_t)(wakeNanoseconds - nowNanoseconds) : 0;
+    dispatch_source_set_timer(self.clock,
+                              dispatch_time(DISPATCH_TIME_NOW, delta),
+                              DISPATCH_TIME_FOREVER,
+                              self.resolutionNanoseconds / 10);
+}
+
+- (void)clockFired
+{
+    BRU_ASSERT_ON_QUEUE(self.queue);
+
+    [self advanceToTickUnsynchronized:[self currentTick]];
+    [self armClockUnsynchronizedForTick:[self nextWakeTickUnsynchronized]];
+}
+
+#pragma mark - Public API
+
+- (void)scheduleEntry:(BRUTimerWheelEntry *)entry afterInterval:(NSTimeInterval)interval
+{
+    BRUParameterAssert(entry);
+    BRU_ASSERT_ON_QUEUE(self.queue);
+    BRUAssert(entry->_wheel == nil || entry->_wheel == self, @"entry scheduled in a different timer wheel");
+
+    if (entry->_wheel) {
+        [self removeEntryUnsynchronized:entry];
+    }
+
+    uint64_t elapsedNanoseconds = BRUMonotonicNanoseconds() - self.startNanoseconds;
+    uint64_t currentTick = elapsedNanoseconds / self.resolutionNanoseconds;
+    if ([self countUnsynchronized] == 0 && currentTick > self->_now) {
+        /* the wheel is empty, no need to catch up tick by tick */
+        self->_now = currentTick;
+    }
+
+    /*
+     * Round the absolute deadline up to a tick, an entry must never expire early. `currentTick` is rounded down so
+     * adding the interval's ticks to it would fire up to one tick early. Intervals are capped (at some 136 years) so
+     * that the deadline can't overflow.
+     */
+    uint64_t intervalNanoseconds = interval > 0 ? (uint64_t)(MIN(interval, (double)UINT32_MAX) * 1e9) : 0;
+    uint64_t deadlineNanoseconds = elapsedNanoseconds + intervalNanoseconds;
+    uint64_t deadlineTick = (deadlineNanoseconds + self.resolutionNanoseconds - 1) / self.resolutionNanoseconds;
+    entry->_expiry = MAX(deadlineTick, currentTick + 1);
+    [self insertEntryUnsynchronized:entry];
+
+    /* higher level entries need the clock at the next cascade */
+    uint64_t wakeTick = entry->_level == 0 ? entry->_expiry : (self->_now | BRU_TIMER_WHEEL_SLOT_MASK) + 1;
+    if (wakeTick < self->_armedTick) {
+        [self armClockUnsynchronizedForTick:wakeTick];
+    }
+}
+
+- (void)unscheduleEntry:(BRUTimerWheelEntry *)entry
+{
+    BRUParameterAssert(entry);
+    BRU_ASSERT_ON_QUEUE(self.queue);
+
+    if (!entry->_wheel) {
+        return;
+    }
+    BRUAssert(entry->_wheel == self, @"entry scheduled in a different timer wheel");
+    [self removeEntryUnsynchronized:entry];
+    /* the clock may now wake up for nothing which is harmless, re-arming it isn't worth it */
+}
+
+@end
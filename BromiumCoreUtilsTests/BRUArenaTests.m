@@ -0,0 +1,136 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "BRUArena.h"
+
+@interface BRUArenaTests : XCTestCase
+
+@end
+
+@implementation BRUArenaTests
+
+- (void)testRegionsAreAlignedAndDisjoint
+{
+    BRUArena *arena = [[BRUArena alloc] initWithChunkSize:1024 usesThreadLocalFreeList:NO];
+    uintptr_t previousEnd = 0;
+    for (size_t alignment = 1; alignment <= 256; alignment *= 2) {
+        BRUMemoryRegion region = [arena allocateRegionWithLength:10 alignment:alignment];
+        XCTAssertFalse(BRUMemoryRegionIsNull(region));
+        XCTAssertEqual(region.length, (size_t)10);
+        XCTAssertEqual((uintptr_t)region.bytes % alignment, (uintptr_t)0, @"not aligned to %zu", alignment);
+        XCTAssertGreaterThanOrEqual((uintptr_t)region.bytes, previousEnd, @"regions overlap");
+        memset(region.bytes, 0xaa, region.length);
+        previousEnd = (uintptr_t)region.bytes + region.length;
+    }
+    BRUMemoryRegion region = [arena allocateRegionWithLength:3];
+    XCTAssertEqual((uintptr_t)region.bytes % 16, (uintptr_t)0, @"default alignment too small");
+    XCTAssertEqual(arena.bytesReserved, (size_t)1024, @"everything should fit one chunk");
+}
+
+- (void)testNewChunksAndOversizedRegions
+{
+    BRUArena *arena = [[BRUArena alloc] initWithChunkSize:1024 usesThreadLocalFreeList:NO];
+    for (int i = 0; i < 20; i++) {
+        BRUMemoryRegion region = [arena allocateRegionWithLength:100];
+        XCTAssertFalse(BRUMemoryRegionIsNull(region));
+        memset(region.bytes, i, region.length);
+    }
+    XCTAssertEqual(arena.bytesReserved, (size_t)3 * 1024);
+
+    BRUMemoryRegion big = [arena allocateRegionWithLength:10000 alignment:4096];
+    XCTAssertFalse(BRUMemoryRegionIsNull(big));
+    XCTAssertEqual((uintptr_t)big.bytes % 4096, (uintptr_t)0);
+    memset(big.bytes, 0xff, big.length);
+    XCTAssertGreaterThanOrEqual(arena.bytesReserved, (size_t)3 * 1024 + 10000);
+
+    XCTAssertTrue(BRUMemoryRegionIsNull([arena allocateRegionWithLength:SIZE_MAX - 8]), @"overflow not detected");
+}
+
+- (void)testAllocationFailureReturnsNull
+{
+    BRUArena *arena = [[BRUArena alloc] initWithChunkSize:1024 usesThreadLocalFreeList:NO];
+    BRUMemoryRegion region = [arena allocateRegionWithLength:100];
+    XCTAssertFalse(BRUMemoryRegionIsNull(region));
+    size_t reserved = arena.bytesReserved;
+
+    /* representable but more than the address space, like a bogus length read from a file */
+    XCTAssertTrue(BRUMemoryRegionIsNull([arena allocateRegionWithLength:(size_t)1 << 48]),
+                  @"malloc failure not handled");
+    XCTAssertEqual(arena.bytesReserved, reserved);
+
+    /* the arena stays usable */
+    XCTAssertFalse(BRUMemoryRegionIsNull([arena allocateRegionWithLength:100]));
+}
+
+- (void)testResetToMarkReusesMemory
+{
+    BRUArena *arena = [[BRUArena alloc] initWithChunkSize:1024 usesThreadLocalFreeList:NO];
+    BRUMemoryRegion first = [arena allocateRegionWithLength:100];
+    BRUArenaMark mark = [arena mark];
+    BRUMemoryRegion second = [arena allocateRegionWithLength:100];
+    for (int i = 0; i < 30; i++) {
+        (void)[arena allocateRegionWithLength:100];
+    }
+    XCTAssertGreaterThan(arena.bytesReserved, (size_t)1024);
+
+    [arena resetToMark:mark];
+    XCTAssertEqual(arena.bytesReserved, (size_t)1024, @"chunks after the mark not released");
+    BRUMemoryRegion again = [arena allocateRegionWithLength:100];
+    XCTAssertEqual(again.bytes, second.bytes, @"memory after the mark not reused");
+    XCTAssertNotEqual(again.bytes, first.bytes);
+
+    [arena reset];
+    XCTAssertEqual(arena.bytesReserved, (size_t)0);
+    XCTAssertFalse(BRUMemoryRegionIsNull([arena allocateRegionWithLength:100]));
+}
+
+- (void)testThreadLocalFreeListReusesChunks
+{
+    void *chunkMemory = NULL;
+    @autoreleasepool {
+        BRUArena *arena = [[BRUArena alloc] initWithChunkSize:4096 usesThreadLocalFreeList:YES];
+        chunkMemory = [arena allocateRegionWithLength:64].bytes;
+    }
+    BRUArena *arena = [[BRUArena alloc] initWithChunkSize:4096 usesThreadLocalFreeList:YES];
+    XCTAssertEqual([arena allocateRegionWithLength:64].bytes, chunkMemory, @"chunk not taken from the free list");
+}
+
+#pragma mark - Benchmarks
+
+- (void)testBenchmarkMallocAndFree
+{
+    [self measureBlock:^{
+        for (int request = 0; request < 1000; request++) {
+            void *buffers[100];
+            for (size_t i = 0; i < 100; i++) {
+                buffers[i] = malloc(16 + i * 8);
+                memset(buffers[i], 0, 16);
+            }
+            for (size_t i = 0; i < 100; i++) {
+                free(buffers[i]);
+            }
+        }
+    }];
+}
+
+- (void)testBenchmarkArena
+{
+    BRUArena *arena = [BRUArena arena];
+    [self measureBlock:^{
+        for (int request = 0; request < 1000; request++) {
+            for (size_t i = 0; i < 100; i++) {
+                BRUMemoryRegion region = [arena allocateRegionWithLength:16 + i * 8];
+                memset(region.bytes, 0, 16);
+            }
+            [arena reset];
+        }
+    }];
+}
+
+@end
@@ -0,0 +1,107 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "BRUCancellationToken.h"
+
+@interface BRUCancellationTokenTests : XCTestCase
+
+@end
+
+@implementation BRUCancellationTokenTests
+
+- (void)testCancelRunsHandlersOnce
+{
+    BRUCancellationToken *token = [BRUCancellationToken token];
+    __block NSUInteger runs = 0;
+    [token addCancellationHandler:^{
+        runs++;
+    }];
+    [token addCancellationHandler:^{
+        runs++;
+    }];
+    XCTAssertFalse(token.isCancelled);
+    XCTAssertTrue([token cancel]);
+    XCTAssertTrue(token.isCancelled);
+    XCTAssertEqual(runs, (NSUInteger)2);
+    XCTAssertFalse([token cancel]);
+    XCTAssertEqual(runs, (NSUInteger)2);
+}
+
+- (void)testHandlersRunInRegistrationOrder
+{
+    BRUCancellationToken *token = [BRUCancellationToken token];
+    NSMutableArray<NSNumber *> *order = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 20; i++) {
+        [token addCancellationHandler:^{
+            [order addObject:@(i)];
+        }];
+    }
+    [token cancel];
+    for (NSUInteger i = 0; i < 20; i++) {
+        XCTAssertEqualObjects(order[i], @(i));
+    }
+}
+
+- (void)testAddingToCancelledTokenRunsHandlerImmediately
+{
+    BRUCancellationToken *token = [BRUCancellationToken token];
+    [token cancel];
+    __block BOOL ran = NO;
+    id registration = [token addCancellationHandler:^{
+        ran = YES;
+    }];
+    XCTAssertNil(registration);
+    XCTAssertTrue(ran);
+}
+
+- (void)testRemovedHandlerDoesNotRunAndIsReleased
+{
+    BRUCancellationToken *token = [BRUCancellationToken token];
+    __block BOOL ran = NO;
+    __weak NSObject *weakCaptured = nil;
+    id registration = nil;
+    @autoreleasepool {
+        NSObject *captured = [NSObject new];
+        weakCaptured = captured;
+        registration = [token addCancellationHandler:^{
+            ran = captured != nil;
+        }];
+    }
+    XCTAssertNotNil(weakCaptured);
+    [token removeCancellationHandler:registration];
+    XCTAssertNil(weakCaptured);
+    [token cancel];
+    XCTAssertFalse(ran);
+}
+
+- (void)testConcurrentCancelRunsHandlersOnce
+{
+    BRUCancellationToken *token = [BRUCancellationToken token];
+    /* only the winning `cancel` runs the handlers, so no synchronisation needed for `runs` */
+    __block NSUInteger runs = 0;
+    for (NSUInteger i = 0; i < 100; i++) {
+        [token addCancellationHandler:^{
+            runs++;
+        }];
+    }
+    NSMutableArray<NSNumber *> *results = [NSMutableArray array];
+    dispatch_apply(8, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(__unused size_t i) {
+        BOOL cancelled = [token cancel];
+        @synchronized(results) {
+            [results addObject:@(cancelled)];
+        }
+    });
+    XCTAssertEqual([results indexesOfObjectsPassingTest:^BOOL(NSNumber *r, __unused NSUInteger idx,
+                                                              __unused BOOL *stop) {
+        return r.boolValue;
+    }].count, (NSUInteger)1);
+    XCTAssertEqual(runs, (NSUInteger)100);
+}
+
+@end
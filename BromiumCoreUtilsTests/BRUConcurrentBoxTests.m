@@ -296,4 +296,68 @@
                           seenNumbers, expectedNumbers);
 }
 
+#pragma mark - Benchmarks
+
+/* `threadCount` threads pass one token around by taking it out of and putting it back into the same box. */
+- (void)measureHandOffLatencyWithThreadCount:(NSUInteger)threadCount
+{
+    const NSUInteger handOffsPerThread = 20000;
+    BRUConcurrentBox<NSNumber *> *box = [BRUConcurrentBox boxWithValue:@0];
+    [self measureBlock:^{
+        dispatch_group_t dispatchGroup = dispatch_group_create();
+        for (NSUInteger t=0; t<threadCount; t++) {
+            dispatch_group_async(dispatchGroup, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+                for (NSUInteger i=0; i<handOffsPerThread; i++) {
+                    NSNumber *token = [box take];
+                    [box put:token];
+                }
+            });
+        }
+        long success = dispatch_group_wait(dispatchGroup, dispatch_time(DISPATCH_TIME_NOW, 120 * NSEC_PER_SEC));
+        XCTAssertTrue(0 == success, @"wait timed out");
+    }];
+}
+
+- (void)testBenchmarkHandOff1Thread
+{
+    [self measureHandOffLatencyWithThreadCount:1];
+}
+
+- (void)testBenchmarkHandOff2Threads
+{
+    [self measureHandOffLatencyWithThreadCount:2];
+}
+
+- (void)testBenchmarkHandOff8Threads
+{
+    [self measureHandOffLatencyWithThreadCount:8];
+}
+
+- (void)testBenchmarkHandOff32Threads
+{
+    [self measureHandOffLatencyWithThreadCount:32];
+}
+
+/* Two threads ping-pong a value through two boxes, the time per iteration is two hand-offs. */
+- (void)testBenchmarkPingPong
+{
+    const NSUInteger iterations = 100000;
+    BRUConcurrentBox<NSNumber *> *ping = [BRUConcurrentBox emptyBox];
+    BRUConcurrentBox<NSNumber *> *pong = [BRUConcurrentBox emptyBox];
+    [self measureBlock:^{
+        dispatch_group_t dispatchGroup = dispatch_group_create();
+        dispatch_group_async(dispatchGroup, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            for (NSUInteger i=0; i<iterations; i++) {
+                [pong put:[ping take]];
+            }
+        });
+        for (NSUInteger i=0; i<iterations; i++) {
+            [ping put:@1];
+            [pong take];
+        }
+        long success = dispatch_group_wait(dispatchGroup, dispatch_time(DISPATCH_TIME_NOW, 120 * NSEC_PER_SEC));
+        XCTAssertTrue(0 == success, @"wait timed out");
+    }];
+}
+
 @end
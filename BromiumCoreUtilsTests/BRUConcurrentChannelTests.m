@@ -0,0 +1,147 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "BRUDispatchUtils.h"
+#import "BRUConcurrentChannel.h"
+
+@interface BRUConcurrentChannelTests : XCTestCase
+
+@end
+
+@implementation BRUConcurrentChannelTests
+
+- (void)testChannelTrivialEmpty
+{
+    BRUConcurrentChannel<NSObject *> *chan = [BRUConcurrentChannel channelWithCapacity:4];
+    XCTAssertTrue(chan.isEmpty, @"empty channel not empty");
+    XCTAssertEqual((NSUInteger)4, chan.capacity);
+    XCTAssertNil([chan tryTake], @"took value out of empty channel");
+}
+
+- (void)testChannelIsFIFO
+{
+    BRUConcurrentChannel<NSNumber *> *chan = [BRUConcurrentChannel channelWithCapacity:3];
+    for (int round=0; round<5; round++) {
+        [chan put:@1];
+        [chan put:@2];
+        XCTAssertEqualObjects(@1, [chan take]);
+        [chan put:@3];
+        [chan put:@4];
+        XCTAssertEqual((NSUInteger)3, [chan count]);
+        XCTAssertEqualObjects(@2, [chan take]);
+        XCTAssertEqualObjects(@3, [chan tryTake]);
+        XCTAssertEqualObjects(@4, [chan take]);
+        XCTAssertTrue(chan.isEmpty, @"channel not empty after taking everything out");
+    }
+}
+
+- (void)testChannelTryPutFailsOnFullChannel
+{
+    BRUConcurrentChannel<NSNumber *> *chan = [BRUConcurrentChannel channelWithCapacity:2];
+    XCTAssertTrue([chan tryPut:@1]);
+    XCTAssertTrue([chan tryPut:@2]);
+    XCTAssertFalse([chan tryPut:@3], @"tryPut succeeded on full channel");
+    XCTAssertEqualObjects(@1, [chan take]);
+    XCTAssertTrue([chan tryPut:@3]);
+    XCTAssertEqualObjects((@[@2, @3]), [chan takeUpTo:10]);
+}
+
+- (void)testChannelTakeWithTimeoutTimesOut
+{
+    BRUConcurrentChannel<NSNumber *> *chan = [BRUConcurrentChannel channelWithCapacity:1];
+    NSDate *start = [NSDate date];
+    XCTAssertNil([chan tryTakeUntil:[NSDate dateWithTimeIntervalSinceNow:0.2]]);
+    XCTAssertGreaterThanOrEqual([[NSDate date] timeIntervalSinceDate:start], 0.15);
+    XCTAssertNil([chan tryTakeUntil:[NSDate distantPast]]);
+}
+
+- (void)testChannelWorksWithOtherThreadPutting
+{
+    BRUConcurrentChannel<NSString *> *chan = [BRUConcurrentChannel channelWithCapacity:1];
+    NSString *expected = @"";
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.5 * NSEC_PER_SEC)),
+                   dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+                       [chan put:expected];
+                   });
+    XCTAssertEqual(expected, [chan tryTakeUntil:[NSDate dateWithTimeIntervalSinceNow:10]]);
+}
+
+- (void)testChannelPutBlocksUntilThereIsSpace
+{
+    BRUConcurrentChannel<NSNumber *> *chan = [BRUConcurrentChannel channelWithCapacity:1];
+    dispatch_semaphore_t putDone = dispatch_semaphore_create(0);
+    [chan put:@1];
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        [chan put:@2];
+        dispatch_semaphore_signal(putDone);
+    });
+    XCTAssertNotEqual(0, dispatch_semaphore_wait(putDone, dispatch_time(DISPATCH_TIME_NOW, NSEC_PER_SEC / 5)),
+                      @"put into full channel didn't block");
+    XCTAssertEqualObjects(@1, [chan take]);
+    XCTAssertEqual(0, dispatch_semaphore_wait(putDone, dispatch_time(DISPATCH_TIME_NOW, 10 * NSEC_PER_SEC)),
+                   @"put didn't resume after take");
+    XCTAssertEqualObjects(@2, [chan take]);
+}
+
+- (void)testChannelPutAllLargerThanCapacity
+{
+    const NSUInteger count = 1000;
+    BRUConcurrentChannel<NSNumber *> *chan = [BRUConcurrentChannel channelWithCapacity:7];
+    NSMutableArray<NSNumber *> *expected = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i=0; i<count; i++) {
+        [expected addObject:@(i)];
+    }
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        [chan putAll:expected];
+    });
+    NSMutableArray<NSNumber *> *actual = [NSMutableArray arrayWithCapacity:count];
+    while ([actual count] < count) {
+        NSArray<NSNumber *> *batch = [chan takeUpTo:5];
+        XCTAssertTrue([batch count] >= 1 && [batch count] <= 5, @"wrong batch size %lu", (unsigned long)[batch count]);
+        [actual addObjectsFromArray:batch];
+    }
+    XCTAssertEqualObjects(expected, actual, @"putAll/takeUpTo didn't preserve order");
+}
+
+- (void)testChannelWorksWithLoadsOfProducersAndConsumers
+{
+    const int count = 10000;
+    const int consumers = 8;
+    BRUConcurrentChannel<NSNumber *> *chan = [BRUConcurrentChannel channelWithCapacity:16];
+    dispatch_queue_t putQueue = bru_dispatch_queue_create("com.bromium.test.putQueue", DISPATCH_QUEUE_CONCURRENT);
+    dispatch_queue_t takeQueue = bru_dispatch_queue_create("com.bromium.test.takeQueue", DISPATCH_QUEUE_CONCURRENT);
+    dispatch_queue_t syncQueue = bru_dispatch_queue_create("com.bromium.test.syncQueue", DISPATCH_QUEUE_SERIAL);
+    NSMutableSet<NSNumber *> *actual = [NSMutableSet setWithCapacity:count];
+    NSMutableSet<NSNumber *> *expected = [NSMutableSet setWithCapacity:count];
+    for (int i=0; i<count; i++) {
+        [expected addObject:@(i)];
+        dispatch_async(putQueue, ^{
+            [chan put:@(i)];
+        });
+    }
+    dispatch_group_t dispatchGroup = dispatch_group_create();
+    for (int c=0; c<consumers; c++) {
+        dispatch_group_async(dispatchGroup, takeQueue, ^{
+            for (int i=0; i<count/consumers; i++) {
+                NSNumber *o = [chan tryTakeUntil:[NSDate dateWithTimeIntervalSinceNow:60]];
+                XCTAssertNotNil(o, @"timed out taking from channel");
+                if (o) {
+                    dispatch_sync(syncQueue, ^{
+                        [actual addObject:o];
+                    });
+                }
+            }
+        });
+    }
+    long success = dispatch_group_wait(dispatchGroup, dispatch_time(DISPATCH_TIME_NOW, 60 * NSEC_PER_SEC));
+    XCTAssertTrue(0 == success, @"wait timed out");
+    XCTAssertEqualObjects(expected, actual, @"got wrong objects out of channel");
+}
+
+@end
@@ -105,4 +105,144 @@
     XCTAssertEqualObjects(expected, actual, @"got wrong objects out of variable");
 }
 
+#pragma mark - Read-mostly mode
+
+- (void)testBRUCVReadMostlySimpleSetGet
+{
+    NSObject *o = [[NSObject alloc] init];
+    BRUConcurrentVariable<NSObject *> *cv = [BRUConcurrentVariable newReadMostlyWithValue:o];
+    XCTAssertEqual(o, [cv readVariable]);
+    XCTAssertEqual(o, [cv readVariable]);
+}
+
+- (void)testBRUCVReadMostlySimpleOverwrite
+{
+    NSObject *o1 = [[NSObject alloc] init];
+    NSObject *o2 = [[NSObject alloc] init];
+    BRUConcurrentVariable<NSObject *> *cv = [BRUConcurrentVariable newReadMostlyWithValue:o1];
+    XCTAssertEqual(o1, [cv readVariable]);
+    [cv writeVariableWithValue:o2];
+    XCTAssertEqual(o2, [cv readVariable]);
+}
+
+- (void)testBRUCVReadMostlySimpleModify
+{
+    NSObject *o1 = [[NSObject alloc] init];
+    NSObject *o2 = [[NSObject alloc] init];
+    BRUConcurrentVariable<NSObject *> *cv = [BRUConcurrentVariable newReadMostlyWithValue:o1];
+    id expectO1asWell = [cv modifyVariableWithBlock:^id  (id __nonnull expectO1) {
+        XCTAssertEqual(o1, expectO1);
+        return o2;
+    }];
+    XCTAssertEqual(o1, expectO1asWell);
+    XCTAssertEqual(o2, [cv readVariable]);
+    XCTAssertEqual(o2, [cv swapVariableWithValue:o1]);
+    XCTAssertEqual(o1, [cv readVariable]);
+}
+
+- (void)testBRUCVReadMostlyReleasesReplacedValues
+{
+    __weak NSObject *weakO1 = nil;
+    BRUConcurrentVariable<NSObject *> *cv = nil;
+    @autoreleasepool {
+        NSObject *o1 = [[NSObject alloc] init];
+        weakO1 = o1;
+        cv = [BRUConcurrentVariable newReadMostlyWithValue:o1];
+        XCTAssertEqual(o1, [cv readVariable]);
+        [cv writeVariableWithValue:[[NSObject alloc] init]];
+    }
+    XCTAssertNil(weakO1, @"replaced value not released although nobody was reading");
+}
+
+- (void)testBRUCVReadMostlyConcurrentReadersOnlySeeLiveValues
+{
+    const NSUInteger readers = 8;
+    const NSUInteger writes = 10000;
+    BRUConcurrentVariable<NSMutableString *> *cv = [BRUConcurrentVariable
+                                                    newReadMostlyWithValue:[NSMutableString stringWithString:@"0"]];
+    __block volatile BOOL done = NO;
+    dispatch_group_t dispatchGroup = dispatch_group_create();
+    for (NSUInteger i=0; i<readers; i++) {
+        dispatch_group_async(dispatchGroup, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            NSInteger last = 0;
+            while (!done) {
+                @autoreleasepool {
+                    NSInteger current = [[cv readVariable] integerValue];
+                    XCTAssertGreaterThanOrEqual(current, last, @"read went back in time");
+                    last = current;
+                }
+            }
+        });
+    }
+    for (NSUInteger i=1; i<=writes; i++) {
+        [cv writeVariableWithValue:[NSMutableString stringWithFormat:@"%lu", (unsigned long)i]];
+    }
+    done = YES;
+    long success = dispatch_group_wait(dispatchGroup, dispatch_time(DISPATCH_TIME_NOW, 60 * NSEC_PER_SEC));
+    XCTAssertTrue(0 == success, @"wait timed out");
+    XCTAssertEqualObjects(([NSString stringWithFormat:@"%lu", (unsigned long)writes]), [cv readVariable]);
+}
+
+#pragma mark - Benchmarks
+
+/* Every thread performs the same number of reads whilst one writer keeps replacing the value, so perfect scaling
+ shows up as the same time regardless of the thread count. */
+- (void)measureReadsWithVariable:(BRUConcurrentVariable<NSObject *> *)cv threadCount:(NSUInteger)threadCount
+{
+    const NSUInteger readsPerThread = 100000;
+    [self measureBlock:^{
+        __block volatile BOOL done = NO;
+        dispatch_group_t writerGroup = dispatch_group_create();
+        dispatch_group_async(writerGroup, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            while (!done) {
+                [cv writeVariableWithValue:[NSObject new]];
+                usleep(1000);
+            }
+        });
+        dispatch_group_t readerGroup = dispatch_group_create();
+        for (NSUInteger t=0; t<threadCount; t++) {
+            dispatch_group_async(readerGroup, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+                for (NSUInteger i=0; i<readsPerThread; i++) {
+                    @autoreleasepool {
+                        XCTAssertNotNil([cv readVariable]);
+                    }
+                }
+            });
+        }
+        dispatch_group_wait(readerGroup, DISPATCH_TIME_FOREVER);
+        done = YES;
+        dispatch_group_wait(writerGroup, DISPATCH_TIME_FOREVER);
+    }];
+}
+
+- (void)testBenchmarkReads1Thread
+{
+    [self measureReadsWithVariable:[BRUConcurrentVariable newWithValue:[NSObject new]] threadCount:1];
+}
+
+- (void)testBenchmarkReads8Threads
+{
+    [self measureReadsWithVariable:[BRUConcurrentVariable newWithValue:[NSObject new]] threadCount:8];
+}
+
+- (void)testBenchmarkReadMostlyReads1Thread
+{
+    [self measureReadsWithVariable:[BRUConcurrentVariable newReadMostlyWithValue:[NSObject new]] threadCount:1];
+}
+
+- (void)testBenchmarkReadMostlyReads2Threads
+{
+    [self measureReadsWithVariable:[BRUConcurrentVariable newReadMostlyWithValue:[NSObject new]] threadCount:2];
+}
+
+- (void)testBenchmarkReadMostlyReads4Threads
+{
+    [self measureReadsWithVariable:[BRUConcurrentVariable newReadMostlyWithValue:[NSObject new]] threadCount:4];
+}
+
+- (void)testBenchmarkReadMostlyReads8Threads
+{
+    [self measureReadsWithVariable:[BRUConcurrentVariable newReadMostlyWithValue:[NSObject new]] threadCount:8];
+}
+
 @end
@@ -12,6 +12,8 @@
 
 #import <BRUDispatchUtils.h>
 #import <BRUDeferred.h>
+#import <BRUEitherErrorOrSuccess.h>
+#import <BRUCancellationToken.h>
 
 #define TEST_SEMAPHORE_WAIT_SUCCESS(_x,_msg) { /*
 */  long rv = dispatch_semaphore_wait(_x, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(2 * NSEC_PER_SEC))); /*
@@ -161,4 +163,358 @@
     TEST_SEMAPHORE_WAIT_SUCCESS(sem, @"Failed to get value");
 }
 
+- (void)testMoreThenBlocksThanStoredInline
+{
+    const int count = 100;
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+
+    BRUDeferred *deferred = [BRUDeferred deferred];
+    for (int i = 0; i < count; i++) {
+        [[deferred promise] then:^(NSNumber *val) {
+            XCTAssertEqualObjects(val, @42);
+            dispatch_semaphore_signal(sem);
+        }];
+    }
+    [deferred resolve:@42];
+
+    for (int i = 0; i < count; i++) {
+        TEST_SEMAPHORE_WAIT_SUCCESS(sem, @"Failed to get value");
+    }
+}
+
+- (void)testThenOnTargetQueueOfResolvedDeferredKeepsOrder
+{
+    dispatch_queue_t queue = bru_dispatch_queue_create("com.bromium.BromiumUtilsTests.BRUDeferredTests.queue",
+                                                       DISPATCH_QUEUE_SERIAL);
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    NSMutableArray<NSNumber *> *order = [NSMutableArray array];
+
+    BRUDeferred *deferred = [BRUDeferred deferredWithTargetQueue:queue];
+    [[deferred promise] then:^(__unused id result) {
+        [order addObject:@1];
+    }];
+    dispatch_sync(queue, ^{
+        [deferred resolve:@"cheese"];
+        [[deferred promise] then:^(NSString *result) {
+            XCTAssertEqualObjects(result, @"cheese");
+            [order addObject:@2];
+            dispatch_semaphore_signal(sem);
+        }];
+        XCTAssertEqual(order.count, 0, @"then block of resolved deferred run synchronously");
+    });
+
+    TEST_SEMAPHORE_WAIT_SUCCESS(sem, @"then block not run");
+    XCTAssertEqualObjects(order, (@[@1, @2]));
+}
+
+- (void)testThenBlocksRunOnTargetQueue
+{
+    dispatch_queue_t queue = bru_dispatch_queue_create("com.bromium.BromiumUtilsTests.BRUDeferredTests.queue",
+                                                       DISPATCH_QUEUE_SERIAL);
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+
+    BRUDeferred *deferred = [BRUDeferred deferredWithTargetQueue:queue];
+    [[deferred promise] then:^(__unused id result) {
+        BRU_ASSERT_ON_QUEUE(queue);
+        dispatch_semaphore_signal(sem);
+    }];
+    [deferred resolve:nil];
+    [[deferred promise] then:^(__unused id result) {
+        BRU_ASSERT_ON_QUEUE(queue);
+        dispatch_semaphore_signal(sem);
+    }];
+
+    TEST_SEMAPHORE_WAIT_SUCCESS(sem, @"Failed to get value");
+    TEST_SEMAPHORE_WAIT_SUCCESS(sem, @"Failed to get value");
+}
+
+#pragma mark - Combinators
+
+- (id)waitForPromise:(id<BRUPromise>)promise
+{
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    __block id result = nil;
+    [promise then:^(id value) {
+        result = value;
+        dispatch_semaphore_signal(sem);
+    }];
+    TEST_SEMAPHORE_WAIT_SUCCESS(sem, @"promise not resolved");
+    return result;
+}
+
+- (BRUEitherErrorOrSuccess *)failure
+{
+    return [BRUEitherErrorOrSuccess newWithError:[NSError errorWithDomain:NSPOSIXErrorDomain code:EIO userInfo:nil]];
+}
+
+- (void)testTryResolve
+{
+    BRUDeferred *deferred = [BRUDeferred deferred];
+    XCTAssertTrue([deferred tryResolve:@1]);
+    XCTAssertFalse([deferred tryResolve:@2]);
+    XCTAssertEqualObjects([self waitForPromise:deferred.promise], @1);
+}
+
+- (void)testMapChain
+{
+    BRUDeferred *deferred = [BRUDeferred deferred];
+    id<BRUPromise> promise = [[deferred.promise map:^id(NSNumber *value) {
+        return @(value.integerValue + 1);
+    }] map:^id(NSNumber *value) {
+        return @(value.integerValue * 2);
+    }];
+    [deferred resolve:@20];
+    XCTAssertEqualObjects([self waitForPromise:promise], @42);
+}
+
+- (void)testMapPropagatesFailure
+{
+    BRUDeferred *deferred = [BRUDeferred deferred];
+    __block BOOL ran = NO;
+    id<BRUPromise> promise = [deferred.promise map:^id(__unused id value) {
+        ran = YES;
+        return @1;
+    }];
+    BRUEitherErrorOrSuccess *failure = [self failure];
+    [deferred resolve:failure];
+    XCTAssertEqual([self waitForPromise:promise], failure);
+    XCTAssertFalse(ran);
+}
+
+- (void)testFlatMap
+{
+    BRUDeferred *deferred = [BRUDeferred deferred];
+    id<BRUPromise> promise = [deferred.promise flatMap:^id<BRUPromise>(NSString *value) {
+        BRUDeferred *inner = [BRUDeferred deferred];
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            [inner resolve:[value stringByAppendingString:@" world"]];
+        });
+        return inner.promise;
+    }];
+    [deferred resolve:@"hello"];
+    XCTAssertEqualObjects([self waitForPromise:promise], @"hello world");
+}
+
+- (void)testMapKeepsTargetQueue
+{
+    dispatch_queue_t queue = bru_dispatch_queue_create("com.bromium.BRUDeferredTests.target", DISPATCH_QUEUE_SERIAL);
+    BRUDeferred *deferred = [BRUDeferred deferredWithTargetQueue:queue];
+    id<BRUPromise> promise = [deferred.promise map:^id(id value) {
+        BRU_ASSERT_ON_QUEUE(queue);
+        return value;
+    }];
+    [deferred resolve:@1];
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    [promise then:^(__unused id value) {
+        BRU_ASSERT_ON_QUEUE(queue);
+        dispatch_semaphore_signal(sem);
+    }];
+    TEST_SEMAPHORE_WAIT_SUCCESS(sem, @"promise not resolved");
+}
+
+- (void)testFlatMapAndTimeoutKeepTargetQueue
+{
+    dispatch_queue_t queue = bru_dispatch_queue_create("com.bromium.BRUDeferredTests.target", DISPATCH_QUEUE_SERIAL);
+    BRUDeferred *deferred = [BRUDeferred deferredWithTargetQueue:queue];
+    id<BRUPromise> flatMapped = [deferred.promise flatMap:^id<BRUPromise>(id value) {
+        BRU_ASSERT_ON_QUEUE(queue);
+        BRUDeferred *inner = [BRUDeferred deferred];
+        [inner resolve:value];
+        return inner.promise;
+    }];
+    id<BRUPromise> timedOut = [deferred.promise timeoutAfter:0.01];
+    [deferred resolve:@1];
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    for (id<BRUPromise> promise in @[flatMapped, timedOut]) {
+        [promise then:^(__unused id value) {
+            BRU_ASSERT_ON_QUEUE(queue);
+            dispatch_semaphore_signal(sem);
+        }];
+    }
+    TEST_SEMAPHORE_WAIT_SUCCESS(sem, @"promise not resolved");
+    TEST_SEMAPHORE_WAIT_SUCCESS(sem, @"promise not resolved");
+}
+
+- (void)testAll
+{
+    BRUDeferred *d1 = [BRUDeferred deferred];
+    BRUDeferred *d2 = [BRUDeferred deferred];
+    BRUDeferred *d3 = [BRUDeferred deferred];
+    id<BRUPromise> promise = [BRUDeferred all:@[d1.promise, d2.promise, d3.promise]];
+    [d3 resolve:@3];
+    [d1 resolve:@1];
+    [d2 resolve:nil];
+    XCTAssertEqualObjects([self waitForPromise:promise], (@[@1, [NSNull null], @3]));
+}
+
+- (void)testAllEmpty
+{
+    XCTAssertEqualObjects([self waitForPromise:[BRUDeferred all:@[]]], @[]);
+}
+
+- (void)testAllFailsFast
+{
+    BRUDeferred *d1 = [BRUDeferred deferred];
+    BRUDeferred *d2 = [BRUDeferred deferred];
+    id<BRUPromise> promise = [BRUDeferred all:@[d1.promise, d2.promise]];
+    BRUEitherErrorOrSuccess *failure = [self failure];
+    [d2 resolve:failure];
+    XCTAssertEqual([self waitForPromise:promise], failure);
+    [d1 resolve:@1];
+}
+
+- (void)testAny
+{
+    BRUDeferred *d1 = [BRUDeferred deferred];
+    BRUDeferred *d2 = [BRUDeferred deferred];
+    id<BRUPromise> promise = [BRUDeferred any:@[d1.promise, d2.promise]];
+    [d1 resolve:[self failure]];
+    [d2 resolve:@2];
+    XCTAssertEqualObjects([self waitForPromise:promise], @2);
+}
+
+- (void)testAnyDoesNotWrapSuccessfulEither
+{
+    BRUDeferred *d1 = [BRUDeferred deferred];
+    id<BRUPromise> promise = [BRUDeferred any:@[d1.promise]];
+    BRUEitherErrorOrSuccess *success = [BRUEitherErrorOrSuccess newWithSuccessObject:@"cheese"];
+    [d1 resolve:success];
+    XCTAssertEqual([self waitForPromise:promise], success);
+}
+
+- (void)testAnyAllFailed
+{
+    BRUDeferred *d1 = [BRUDeferred deferred];
+    BRUDeferred *d2 = [BRUDeferred deferred];
+    id<BRUPromise> promise = [BRUDeferred any:@[d1.promise, d2.promise]];
+    [d1 resolve:[self failure]];
+    [d2 resolve:[self failure]];
+    BRUEitherErrorOrSuccess *result = [self waitForPromise:promise];
+    XCTAssertFalse(result.isSuccessful);
+    XCTAssertEqual(result.error.code, EIO);
+}
+
+- (void)testRace
+{
+    BRUDeferred *d1 = [BRUDeferred deferred];
+    BRUDeferred *d2 = [BRUDeferred deferred];
+    id<BRUPromise> promise = [BRUDeferred race:@[d1.promise, d2.promise]];
+    [d2 resolve:@"second"];
+    XCTAssertEqualObjects([self waitForPromise:promise], @"second");
+    [d1 resolve:@"first"];
+}
+
+- (void)testTimeoutAfterFires
+{
+    BRUDeferred *deferred = [BRUDeferred deferred];
+    BRUEitherErrorOrSuccess *result = [self waitForPromise:[deferred.promise timeoutAfter:0.01]];
+    XCTAssertFalse(result.isSuccessful);
+    XCTAssertEqualObjects(result.error.domain, NSPOSIXErrorDomain);
+    XCTAssertEqual(result.error.code, ETIMEDOUT);
+    [deferred resolve:@1];
+}
+
+- (void)testTimeoutAfterNotReached
+{
+    BRUDeferred *deferred = [BRUDeferred deferred];
+    id<BRUPromise> promise = [deferred.promise timeoutAfter:10];
+    [deferred resolve:@"in time"];
+    XCTAssertEqualObjects([self waitForPromise:promise], @"in time");
+}
+
+#pragma mark - Cancellation
+
+- (void)testCancelledThenBlockIsDroppedAndReleased
+{
+    BRUCancellationToken *token = [BRUCancellationToken token];
+    BRUDeferred *deferred = [BRUDeferred deferred];
+    __weak NSObject *weakCaptured = nil;
+    @autoreleasepool {
+        NSObject *captured = [NSObject new];
+        weakCaptured = captured;
+        for (NSUInteger i = 0; i < 8; i++) {
+            [deferred.promise then:^(__unused id value) {
+                XCTFail(@"cancelled then block ran (%@)", captured);
+            } cancellationToken:token];
+        }
+    }
+    XCTAssertNotNil(weakCaptured);
+    [token cancel];
+    XCTAssertNil(weakCaptured, @"then blocks not released on cancellation");
+
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    [deferred.promise then:^(__unused id value) {
+        dispatch_semaphore_signal(sem);
+    }];
+    [deferred resolve:@1];
+    TEST_SEMAPHORE_WAIT_SUCCESS(sem, @"uncancelled then block didn't run");
+    TEST_SEMAPHORE_WAIT_FAIL(sem, @"cancelled then block ran");
+}
+
+- (void)testThenWithCancelledTokenNeverRuns
+{
+    BRUCancellationToken *token = [BRUCancellationToken token];
+    [token cancel];
+    BRUDeferred *deferred = [BRUDeferred deferred];
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    [deferred.promise then:^(__unused id value) {
+        dispatch_semaphore_signal(sem);
+    } cancellationToken:token];
+    [deferred resolve:@1];
+    TEST_SEMAPHORE_WAIT_FAIL(sem, @"then block with cancelled token ran");
+}
+
+- (void)testThenWithTokenRunsUnlessCancelled
+{
+    BRUCancellationToken *token = [BRUCancellationToken token];
+    BRUDeferred *deferred = [BRUDeferred deferred];
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    [deferred.promise then:^(id value) {
+        XCTAssertEqualObjects(value, @1);
+        dispatch_semaphore_signal(sem);
+    } cancellationToken:token];
+    [deferred resolve:@1];
+    TEST_SEMAPHORE_WAIT_SUCCESS(sem, @"then block didn't run");
+    XCTAssertTrue([token cancel]);
+}
+
+#pragma mark - Benchmarks
+
+- (void)testBenchmarkCreateThenResolve
+{
+    const NSUInteger count = 100000;
+    [self measureBlock:^{
+        dispatch_group_t group = dispatch_group_create();
+        for (NSUInteger i = 0; i < count; i++) {
+            BRUDeferred *deferred = [BRUDeferred deferred];
+            dispatch_group_enter(group);
+            [[deferred promise] then:^(__unused id value) {
+                dispatch_group_leave(group);
+            }];
+            [deferred resolve:@(i)];
+        }
+        XCTAssertEqual(0, dispatch_group_wait(group, dispatch_time(DISPATCH_TIME_NOW, 60 * NSEC_PER_SEC)));
+    }];
+}
+
+- (void)testBenchmarkCreateResolveThenOnTargetQueue
+{
+    const NSUInteger count = 100000;
+    dispatch_queue_t queue = bru_dispatch_queue_create("com.bromium.BromiumUtilsTests.BRUDeferredTests.queue",
+                                                       DISPATCH_QUEUE_SERIAL);
+    [self measureBlock:^{
+        dispatch_sync(queue, ^{
+            __block NSUInteger resolved = 0;
+            for (NSUInteger i = 0; i < count; i++) {
+                BRUDeferred *deferred = [BRUDeferred deferredWithTargetQueue:queue];
+                [deferred resolve:@(i)];
+                [[deferred promise] then:^(__unused id value) {
+                    resolved++;
+                }];
+            }
+            XCTAssertEqual(count, resolved);
+        });
+    }];
+}
+
 @end
@@ -355,6 +355,248 @@
     XCTAssertTrue(success, @"removing temporary directory unsuccessful: %@", error);
 }
 
+- (void)testMonitorsOfSamePathAreIndependent
+{
+    NSString *path = [BRUTemporaryFiles createTemporaryFileError:nil];
+    XCTAssertNotNil(path, @"failed to create temp file for test");
+
+    BRUFileMonitor *monitor1 = [[BRUFileMonitor alloc] initWithPath:path];
+    BRUFileMonitor *monitor2 = [[BRUFileMonitor alloc] initWithPath:path];
+
+    dispatch_semaphore_t sem1 = dispatch_semaphore_create(0);
+    dispatch_semaphore_t sem2 = dispatch_semaphore_create(0);
+
+    BOOL rv = [monitor1 startWithError:nil
+                              callback:^(__unused BRUFileMonitor *monitor) {
+                                  dispatch_semaphore_signal(sem1);
+                              }];
+    XCTAssertTrue(rv, @"Failed to start monitor");
+    rv = [monitor2 startWithError:nil
+                         callback:^(__unused BRUFileMonitor *monitor) {
+                             dispatch_semaphore_signal(sem2);
+                         }];
+    XCTAssertTrue(rv, @"Failed to start monitor");
+
+    NSError *error = nil;
+    rv = [@"test" writeToFile:path atomically:NO encoding:NSUTF8StringEncoding error:&error];
+    XCTAssertTrue(rv, @"Failed to write file: %@", error);
+
+    long r = dispatch_semaphore_wait(sem1, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(2 * NSEC_PER_SEC)));
+    XCTAssertEqual(r, (long)0, @"Failed to get notification on first monitor");
+    r = dispatch_semaphore_wait(sem2, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(2 * NSEC_PER_SEC)));
+    XCTAssertEqual(r, (long)0, @"Failed to get notification on second monitor");
+
+    /* stopping one monitor mustn't stop the other one watching the same file */
+    rv = [monitor1 stop:&error];
+    XCTAssertTrue(rv, @"file monitor stop unsuccessful: %@", error);
+    [NSThread sleepForTimeInterval:0.1];
+    while (0 == dispatch_semaphore_wait(sem2, DISPATCH_TIME_NOW)) {
+        /* drain */
+    }
+
+    rv = [@"test42" writeToFile:path atomically:NO encoding:NSUTF8StringEncoding error:&error];
+    XCTAssertTrue(rv, @"Failed to write file: %@", error);
+    r = dispatch_semaphore_wait(sem2, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(2 * NSEC_PER_SEC)));
+    XCTAssertEqual(r, (long)0, @"Second monitor stopped with the first");
+
+    rv = [monitor2 stop:&error];
+    XCTAssertTrue(rv, @"file monitor stop unsuccessful: %@", error);
+    rv = [[NSFileManager defaultManager] removeItemAtPath:path error:&error];
+    XCTAssertTrue(rv, @"removing temporary file unsuccessful: %@", error);
+}
+
+- (void)testManyMonitorsOfOverlappingPaths
+{
+    NSString *dir = [BRUTemporaryFiles createTemporaryDirectoryError:nil];
+    XCTAssertNotNil(dir, @"failed to create temp dir for test");
+
+    NSMutableArray<BRUFileMonitor *> *monitors = [NSMutableArray array];
+    NSMutableArray<dispatch_semaphore_t> *sems = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 64; i++) {
+        /* half of them watch the same file, the others a file each, all share the path to the directory */
+        NSString *path = [dir stringByAppendingPathComponent:[NSString stringWithFormat:@"file%lu",
+                                                              (unsigned long)(i % 2 ? i : 0)]];
+        BRUFileMonitor *monitor = [[BRUFileMonitor alloc] initWithPath:path];
+        dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+        BOOL rv = [monitor startWithError:nil
+                                 callback:^(__unused BRUFileMonitor *m) {
+                                     dispatch_semaphore_signal(sem);
+                                 }];
+        XCTAssertTrue(rv, @"Failed to start monitor");
+        [monitors addObject:monitor];
+        [sems addObject:sem];
+    }
+
+    /* stop every fourth monitor, the ones sharing their watches must carry on */
+    NSError *error = nil;
+    for (NSUInteger i = 0; i < monitors.count; i += 4) {
+        BOOL rv = [monitors[i] stop:&error];
+        XCTAssertTrue(rv, @"file monitor stop unsuccessful: %@", error);
+    }
+
+    for (NSUInteger i = 0; i < monitors.count; i++) {
+        if (0 == i % 4) {
+            continue;
+        }
+        NSString *path = monitors[i].path;
+        BOOL rv = [@"test" writeToFile:path atomically:NO encoding:NSUTF8StringEncoding error:&error];
+        XCTAssertTrue(rv, @"Failed to write file: %@", error);
+        long r = dispatch_semaphore_wait(sems[i], dispatch_time(DISPATCH_TIME_NOW, (int64_t)(2 * NSEC_PER_SEC)));
+        XCTAssertEqual(r, (long)0, @"Failed to get notification on monitor %lu", (unsigned long)i);
+    }
+
+    for (NSUInteger i = 0; i < monitors.count; i++) {
+        if (0 != i % 4) {
+            BOOL rv = [monitors[i] stop:&error];
+            XCTAssertTrue(rv, @"file monitor stop unsuccessful: %@", error);
+        }
+    }
+    BOOL rv = [[NSFileManager defaultManager] removeItemAtPath:dir error:&error];
+    XCTAssertTrue(rv, @"removing temporary dir unsuccessful: %@", error);
+}
+
+- (void)testRecursiveMonitorCoalescesChangesInTree
+{
+    NSString *path = [BRUTemporaryFiles createTemporaryDirectoryError:nil];
+    XCTAssertNotNil(path, @"failed to create temp dir for test");
+    NSString *subdir = [path stringByAppendingPathComponent:@"sub/dir"];
+    NSError *error = nil;
+    BOOL rv = [[NSFileManager defaultManager] createDirectoryAtPath:subdir
+                                        withIntermediateDirectories:YES
+                                                         attributes:nil
+                                                              error:&error];
+    XCTAssertTrue(rv, @"Failed to create directory: %@", error);
+
+    BRUFileMonitor *monitor = [[BRUFileMonitor alloc] initWithDirectoryTreeAtPath:path
+                                                                  debounceInterval:0.5
+                                                                   completionQueue:dispatch_get_main_queue()];
+    XCTAssertTrue(monitor.recursive);
+    XCTAssertFalse([monitor startWithError:nil callback:^(__unused BRUFileMonitor *m) {}],
+                   @"Recursive monitor started with callback");
+
+    NSMutableArray<NSArray<BRUFileMonitorChange *> *> *batches = [NSMutableArray array]; /* on main queue */
+    XCTestExpectation *delivered = [self expectationWithDescription:@"batch delivered"];
+    rv = [monitor startWithError:&error
+                  changesHandler:^(__unused BRUFileMonitor *m, NSArray<BRUFileMonitorChange *> *changes) {
+                      [batches addObject:changes];
+                      if (1 == batches.count) {
+                          [delivered fulfill];
+                      }
+                  }];
+    XCTAssertTrue(rv, @"Failed to start monitor: %@", error);
+    XCTAssertTrue(monitor.isMonitoring);
+
+    NSString *filepath = [subdir stringByAppendingPathComponent:@"test"];
+    int fd = open([filepath fileSystemRepresentation], O_CREAT | O_WRONLY, 0644);
+    XCTAssert(fd >= 0, @"Failed to open file: %s", strerror(errno));
+    for (int i = 0; i < 1000; i++) {
+        write(fd, "x", 1);
+    }
+    close(fd);
+
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    /* a second batch would be delivered one debounce interval after the first one at the earliest */
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:monitor.debounceInterval]];
+    XCTAssertEqual(batches.count, (NSUInteger)1, @"Expected one batch for a burst of writes");
+
+    NSUInteger entriesForFile = 0;
+    BRUFileMonitorChangeKind kind = 0;
+    for (BRUFileMonitorChange *change in batches.firstObject) {
+        if ([change.path isEqualToString:filepath]) {
+            entriesForFile++;
+            kind = change.kind;
+        }
+    }
+    XCTAssertEqual(entriesForFile, (NSUInteger)1, @"Changes of the same path not collapsed: %@", batches.firstObject);
+    XCTAssertTrue(kind & BRUFileMonitorChangeKindCreated, @"Creation not reported");
+
+    rv = [monitor stop:&error];
+    XCTAssertTrue(rv, @"file monitor stop unsuccessful: %@", error);
+    XCTAssertFalse(monitor.isMonitoring);
+    rv = [[NSFileManager defaultManager] removeItemAtPath:path error:&error];
+    XCTAssertTrue(rv, @"removing temporary directory unsuccessful: %@", error);
+}
+
+- (void)testRestartedRecursiveMonitorDeliversChanges
+{
+    NSString *path = [BRUTemporaryFiles createTemporaryDirectoryError:nil];
+    XCTAssertNotNil(path, @"failed to create temp dir for test");
+    NSString *filepath = [path stringByAppendingPathComponent:@"test"];
+    BRUFileMonitor *monitor = [[BRUFileMonitor alloc] initWithDirectoryTreeAtPath:path
+                                                                  debounceInterval:0.5
+                                                                   completionQueue:dispatch_get_main_queue()];
+    NSError *error = nil;
+    BOOL rv = NO;
+
+    for (NSUInteger run = 0; run < 2; run++) {
+        XCTestExpectation *delivered = [self expectationWithDescription:@"batch delivered"];
+        __block NSUInteger batches = 0; /* on main queue */
+        rv = [monitor startWithError:&error
+                      changesHandler:^(__unused BRUFileMonitor *m, __unused NSArray<BRUFileMonitorChange *> *c) {
+                          if (1 == ++batches) {
+                              [delivered fulfill];
+                          }
+                      }];
+        XCTAssertTrue(rv, @"Failed to start monitor: %@", error);
+        rv = [@"test" writeToFile:filepath atomically:NO encoding:NSUTF8StringEncoding error:&error];
+        XCTAssertTrue(rv, @"Failed to write file: %@", error);
+        [self waitForExpectationsWithTimeout:10 handler:nil];
+
+        /* stop with a delivery pending, the restarted monitor must still deliver its first batch */
+        rv = [@"test42" writeToFile:filepath atomically:NO encoding:NSUTF8StringEncoding error:&error];
+        XCTAssertTrue(rv, @"Failed to write file: %@", error);
+        [NSThread sleepForTimeInterval:0.1];
+        rv = [monitor stop:&error];
+        XCTAssertTrue(rv, @"file monitor stop unsuccessful: %@", error);
+    }
+
+    rv = [[NSFileManager defaultManager] removeItemAtPath:path error:&error];
+    XCTAssertTrue(rv, @"removing temporary directory unsuccessful: %@", error);
+}
+
+- (void)testRecursiveMonitorWatchesNewDirectories
+{
+    NSString *path = [BRUTemporaryFiles createTemporaryDirectoryError:nil];
+    XCTAssertNotNil(path, @"failed to create temp dir for test");
+
+    BRUFileMonitor *monitor = [[BRUFileMonitor alloc] initWithDirectoryTreeAtPath:path
+                                                                  debounceInterval:0.1
+                                                                   completionQueue:dispatch_get_main_queue()];
+    NSMutableSet<NSString *> *changedPaths = [NSMutableSet set]; /* on main queue */
+    NSError *error = nil;
+    BOOL rv = [monitor startWithError:&error
+                       changesHandler:^(__unused BRUFileMonitor *m, NSArray<BRUFileMonitorChange *> *changes) {
+                           for (BRUFileMonitorChange *change in changes) {
+                               [changedPaths addObject:change.path];
+                           }
+                       }];
+    XCTAssertTrue(rv, @"Failed to start monitor: %@", error);
+
+    NSString *newDir = [path stringByAppendingPathComponent:@"new"];
+    rv = [[NSFileManager defaultManager] createDirectoryAtPath:newDir
+                                   withIntermediateDirectories:NO
+                                                    attributes:nil
+                                                         error:&error];
+    XCTAssertTrue(rv, @"Failed to create directory: %@", error);
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+
+    NSString *filepath = [newDir stringByAppendingPathComponent:@"test"];
+    rv = [@"test" writeToFile:filepath atomically:NO encoding:NSUTF8StringEncoding error:&error];
+    XCTAssertTrue(rv, @"Failed to write file: %@", error);
+
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:5];
+    while (![changedPaths containsObject:filepath] && [deadline timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+    }
+    XCTAssertTrue([changedPaths containsObject:newDir], @"New directory not reported: %@", changedPaths);
+    XCTAssertTrue([changedPaths containsObject:filepath], @"File in new directory not reported: %@", changedPaths);
+
+    rv = [monitor stop:&error];
+    XCTAssertTrue(rv, @"file monitor stop unsuccessful: %@", error);
+    rv = [[NSFileManager defaultManager] removeItemAtPath:path error:&error];
+    XCTAssertTrue(rv, @"removing temporary directory unsuccessful: %@", error);
+}
+
 - (void)testFileSideBySideFileModifyOrDeleteDoesNotTrigger
 {
     NSString *path = [BRUTemporaryFiles createTemporaryDirectoryError:nil];
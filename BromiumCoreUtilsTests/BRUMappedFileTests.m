@@ -0,0 +1,129 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "BRUMappedFile.h"
+#import "BRUTemporaryFiles.h"
+
+@interface BRUMappedFileTests : XCTestCase
+
+@end
+
+@implementation BRUMappedFileTests
+
+- (NSString *)temporaryFileWithData:(NSData *)data
+{
+    NSString *path = [BRUTemporaryFiles createTemporaryFileError:nil];
+    XCTAssertNotNil(path, @"failed to create temp file for test");
+    NSError *error = nil;
+    BOOL suc = [data writeToFile:path options:0 error:&error];
+    XCTAssertTrue(suc, @"failed to write temp file: %@", error);
+    return path;
+}
+
+- (void)testReadOnlyMappingHasFileContents
+{
+    NSData *data = [@"Hello, mapped world!" dataUsingEncoding:NSUTF8StringEncoding];
+    NSString *path = [self temporaryFileWithData:data];
+
+    NSError *error = nil;
+    BRUMappedFile *file = [BRUMappedFile mappedFileWithPath:path
+                                                       mode:BRUMappedFileModeReadOnly
+                                                    options:BRUMappedFileOptionPopulate | BRUMappedFileOptionSequential
+                                                      error:&error];
+    XCTAssertNotNil(file, @"mapping failed: %@", error);
+    BRUMemoryRegion region = file.region;
+    XCTAssertEqual(region.length, data.length);
+    XCTAssertEqual(0, memcmp(region.bytes, data.bytes, data.length));
+
+    BRUMemoryRegion world;
+    XCTAssertTrue(BRUMemoryRegionSubRegionWithOffset(region, 14, 5, &world));
+    XCTAssertEqual(0, memcmp(world.bytes, "world", 5));
+
+    XCTAssertTrue([file unmapWithError:&error], @"unmap failed: %@", error);
+    XCTAssertTrue(BRUMemoryRegionIsNull(file.region));
+    XCTAssertTrue([file unmapWithError:&error], @"second unmap failed: %@", error);
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testCopyOnWriteDoesNotModifyFile
+{
+    NSData *data = [@"original" dataUsingEncoding:NSUTF8StringEncoding];
+    NSString *path = [self temporaryFileWithData:data];
+
+    NSError *error = nil;
+    BRUMappedFile *file = [[BRUMappedFile alloc] initWithPath:path
+                                                         mode:BRUMappedFileModeCopyOnWrite
+                                                      options:BRUMappedFileOptionRandom
+                                                        error:&error];
+    XCTAssertNotNil(file, @"mapping failed: %@", error);
+    memcpy(file.region.bytes, "modified", 8);
+    XCTAssertEqual(0, memcmp(file.region.bytes, "modified", 8));
+    file = nil;
+
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:path], data, @"file modified through private mapping");
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testEmptyFileMapsToNullRegion
+{
+    NSString *path = [self temporaryFileWithData:[NSData data]];
+    NSError *error = nil;
+    BRUMappedFile *file = [BRUMappedFile mappedFileWithPath:path
+                                                       mode:BRUMappedFileModeReadOnly
+                                                    options:0
+                                                      error:&error];
+    XCTAssertNotNil(file, @"mapping failed: %@", error);
+    XCTAssertTrue(BRUMemoryRegionIsNull(file.region));
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testMappingFailures
+{
+    NSError *error = nil;
+    BRUMappedFile *file = [BRUMappedFile mappedFileWithPath:@"/This/path/will/NOT/exist/on/your/system/I/hope/:-)"
+                                                       mode:BRUMappedFileModeReadOnly
+                                                    options:0
+                                                      error:&error];
+    XCTAssertNil(file);
+    XCTAssertEqualObjects(error.domain, NSPOSIXErrorDomain);
+    XCTAssertEqual(error.code, (NSInteger)ENOENT);
+
+    error = nil;
+    file = [BRUMappedFile mappedFileWithPath:NSTemporaryDirectory()
+                                        mode:BRUMappedFileModeReadOnly
+                                     options:0
+                                       error:&error];
+    XCTAssertNil(file);
+    XCTAssertEqual(error.code, (NSInteger)EISDIR);
+}
+
+#pragma mark - Benchmarks
+
+- (void)testBenchmarkSumMappedFile
+{
+    NSMutableData *data = [NSMutableData dataWithLength:64 * 1024 * 1024];
+    memset(data.mutableBytes, 1, data.length);
+    NSString *path = [self temporaryFileWithData:data];
+    [self measureBlock:^{
+        BRUMappedFile *file = [BRUMappedFile mappedFileWithPath:path
+                                                           mode:BRUMappedFileModeReadOnly
+                                                        options:BRUMappedFileOptionPopulate
+                                                          error:nil];
+        BRUMemoryRegion region = file.region;
+        const uint8_t *bytes = region.bytes;
+        uint64_t sum = 0;
+        for (size_t i = 0; i < region.length; i += 4096) {
+            sum += bytes[i];
+        }
+        XCTAssertEqual(sum, (uint64_t)(data.length / 4096));
+    }];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+@end
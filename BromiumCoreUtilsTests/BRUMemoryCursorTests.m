@@ -0,0 +1,192 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "BRUMemoryCursor.h"
+
+@interface BRUMemoryCursorTests : XCTestCase
+
+@end
+
+@implementation BRUMemoryCursorTests
+
+- (void)testFixedWidthIntegers
+{
+    uint8_t bytes[] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+    BRUMemoryCursor cursor = BRUMemoryCursorMake(BRUMemoryRegionMake(bytes, sizeof(bytes)));
+    XCTAssertEqual(BRUMemoryCursorReadUInt8(&cursor), (uint8_t)0x01);
+    XCTAssertEqual(BRUMemoryCursorReadUInt16LE(&cursor), (uint16_t)0x0302);
+    XCTAssertEqual(BRUMemoryCursorReadUInt16BE(&cursor), (uint16_t)0x0405);
+    XCTAssertEqual(BRUMemoryCursorReadUInt32LE(&cursor), 0x09080706u);
+    XCTAssertEqual(BRUMemoryCursorReadUInt32BE(&cursor), 0x0a0b0c0du);
+    XCTAssertEqual(BRUMemoryCursorRemaining(&cursor), (size_t)2);
+    XCTAssertFalse(BRUMemoryCursorHasFailed(&cursor));
+
+    cursor = BRUMemoryCursorMake(BRUMemoryRegionMake(bytes, sizeof(bytes)));
+    XCTAssertEqual(BRUMemoryCursorReadUInt64LE(&cursor), 0x0807060504030201ull);
+    cursor = BRUMemoryCursorMake(BRUMemoryRegionMake(bytes, sizeof(bytes)));
+    XCTAssertEqual(BRUMemoryCursorReadUInt64BE(&cursor), 0x0102030405060708ull);
+}
+
+- (void)testFailureIsSticky
+{
+    uint8_t bytes[] = { 0x01, 0x02, 0x03, 0x04, 0x05 };
+    BRUMemoryCursor cursor = BRUMemoryCursorMake(BRUMemoryRegionMake(bytes, sizeof(bytes)));
+    XCTAssertEqual(BRUMemoryCursorReadUInt16LE(&cursor), (uint16_t)0x0201);
+    XCTAssertEqual(BRUMemoryCursorReadUInt32LE(&cursor), 0u, @"read past the end");
+    XCTAssertTrue(BRUMemoryCursorHasFailed(&cursor));
+    XCTAssertEqual(BRUMemoryCursorFailureOffset(&cursor), (size_t)2);
+
+    /* the byte that was left can't be read anymore, the failure offset stays */
+    XCTAssertEqual(BRUMemoryCursorReadUInt8(&cursor), (uint8_t)0);
+    XCTAssertTrue(BRUMemoryRegionIsNull(BRUMemoryCursorReadSlice(&cursor, 1)));
+    XCTAssertEqual(BRUMemoryCursorRemaining(&cursor), (size_t)0);
+    XCTAssertEqual(BRUMemoryCursorFailureOffset(&cursor), (size_t)2);
+}
+
+- (void)testInvalidRegionFailsImmediately
+{
+    BRUMemoryCursor cursor = BRUMemoryCursorMake(BRUMemoryRegionMake((void *)(UINTPTR_MAX - 1), 16));
+    XCTAssertTrue(BRUMemoryCursorHasFailed(&cursor));
+    XCTAssertEqual(BRUMemoryCursorRemaining(&cursor), (size_t)0);
+
+    cursor = BRUMemoryCursorMake(BRUMemoryRegionNull);
+    XCTAssertFalse(BRUMemoryCursorHasFailed(&cursor));
+    XCTAssertEqual(BRUMemoryCursorReadUInt8(&cursor), (uint8_t)0);
+    XCTAssertTrue(BRUMemoryCursorHasFailed(&cursor));
+}
+
+- (void)testRequireAndUncheckedReads
+{
+    uint8_t bytes[] = { 0xff, 0x00, 0x00, 0x00, 0x2a, 0x00 };
+    BRUMemoryCursor cursor = BRUMemoryCursorMake(BRUMemoryRegionMake(bytes, sizeof(bytes)));
+    XCTAssertTrue(BRUMemoryCursorRequire(&cursor, 5));
+    XCTAssertEqual(BRUMemoryCursorReadUInt32LEUnchecked(&cursor), 0xffu);
+    XCTAssertEqual(BRUMemoryCursorReadUInt8Unchecked(&cursor), (uint8_t)0x2a);
+    XCTAssertFalse(BRUMemoryCursorRequire(&cursor, 2));
+    XCTAssertTrue(BRUMemoryCursorHasFailed(&cursor));
+    XCTAssertEqual(BRUMemoryCursorFailureOffset(&cursor), (size_t)5);
+}
+
+- (void)testVarints
+{
+    uint8_t bytes[] = {
+        0x00,
+        0x7f,
+        0xac, 0x02, /* 300 */
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01, /* UINT64_MAX */
+        0x03, /* zigzag -2 */
+        0x04, /* zigzag 2 */
+    };
+    BRUMemoryCursor cursor = BRUMemoryCursorMake(BRUMemoryRegionMake(bytes, sizeof(bytes)));
+    XCTAssertEqual(BRUMemoryCursorReadVarUInt64(&cursor), 0ull);
+    XCTAssertEqual(BRUMemoryCursorReadVarUInt64(&cursor), 127ull);
+    XCTAssertEqual(BRUMemoryCursorReadVarUInt64(&cursor), 300ull);
+    XCTAssertEqual(BRUMemoryCursorReadVarUInt64(&cursor), UINT64_MAX);
+    XCTAssertEqual(BRUMemoryCursorReadVarInt64(&cursor), -2ll);
+    XCTAssertEqual(BRUMemoryCursorReadVarInt64(&cursor), 2ll);
+    XCTAssertFalse(BRUMemoryCursorHasFailed(&cursor));
+    XCTAssertEqual(BRUMemoryCursorRemaining(&cursor), (size_t)0);
+}
+
+- (void)testMalformedVarints
+{
+    uint8_t truncated[] = { 0x01, 0x80, 0x80 };
+    BRUMemoryCursor cursor = BRUMemoryCursorMake(BRUMemoryRegionMake(truncated, sizeof(truncated)));
+    XCTAssertEqual(BRUMemoryCursorReadVarUInt64(&cursor), 1ull);
+    XCTAssertEqual(BRUMemoryCursorReadVarUInt64(&cursor), 0ull);
+    XCTAssertTrue(BRUMemoryCursorHasFailed(&cursor));
+    XCTAssertEqual(BRUMemoryCursorFailureOffset(&cursor), (size_t)1);
+
+    uint8_t overflowing[] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x02 };
+    cursor = BRUMemoryCursorMake(BRUMemoryRegionMake(overflowing, sizeof(overflowing)));
+    XCTAssertEqual(BRUMemoryCursorReadVarUInt64(&cursor), 0ull);
+    XCTAssertTrue(BRUMemoryCursorHasFailed(&cursor));
+
+    uint8_t tooLong[] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00 };
+    cursor = BRUMemoryCursorMake(BRUMemoryRegionMake(tooLong, sizeof(tooLong)));
+    XCTAssertEqual(BRUMemoryCursorReadVarUInt64(&cursor), 0ull);
+    XCTAssertTrue(BRUMemoryCursorHasFailed(&cursor));
+}
+
+- (void)testLengthPrefixedSlices
+{
+    uint8_t bytes[] = { 0x03, 'f', 'o', 'o', 0x00, 0x05, 'b', 'a', 'r' };
+    BRUMemoryCursor cursor = BRUMemoryCursorMake(BRUMemoryRegionMake(bytes, sizeof(bytes)));
+    BRUMemoryRegion foo = BRUMemoryCursorReadVarUInt64PrefixedSlice(&cursor);
+    XCTAssertEqual(foo.bytes, (void *)&bytes[1], @"slice was copied");
+    XCTAssertEqual(foo.length, (size_t)3);
+    BRUMemoryRegion empty = BRUMemoryCursorReadVarUInt64PrefixedSlice(&cursor);
+    XCTAssertEqual(empty.length, (size_t)0);
+    XCTAssertFalse(BRUMemoryCursorHasFailed(&cursor));
+
+    BRUMemoryRegion bar = BRUMemoryCursorReadVarUInt64PrefixedSlice(&cursor);
+    XCTAssertTrue(BRUMemoryRegionIsNull(bar), @"slice longer than the rest");
+    XCTAssertTrue(BRUMemoryCursorHasFailed(&cursor));
+    XCTAssertEqual(BRUMemoryCursorFailureOffset(&cursor), (size_t)5);
+}
+
+#pragma mark - Benchmarks
+
+static const size_t kRecordCount = 4 * 1024 * 1024;
+static const size_t kRecordSize = 16; /* uint32_t tag, uint32_t length, uint64_t value */
+
+- (NSMutableData *)records
+{
+    NSMutableData *data = [NSMutableData dataWithLength:kRecordCount * kRecordSize];
+    uint8_t *bytes = data.mutableBytes;
+    for (size_t i = 0; i < kRecordCount; i++) {
+        bytes[i * kRecordSize] = 1;
+        bytes[i * kRecordSize + 8] = (uint8_t)i;
+    }
+    return data;
+}
+
+- (void)testBenchmarkParseRecordsWithSubRegions
+{
+    NSMutableData *data = [self records];
+    BRUMemoryRegion region = BRUMemoryRegionMake(data.mutableBytes, data.length);
+    [self measureBlock:^{
+        uint64_t sum = 0;
+        for (ptrdiff_t offset = 0; (size_t)offset < region.length; offset += (ptrdiff_t)kRecordSize) {
+            BRUMemoryRegion tag, length, value;
+            if (!BRUMemoryRegionSubRegionWithOffset(region, offset, 4, &tag) ||
+                !BRUMemoryRegionSubRegionWithOffset(region, offset + 4, 4, &length) ||
+                !BRUMemoryRegionSubRegionWithOffset(region, offset + 8, 8, &value)) {
+                XCTFail(@"out of bounds");
+                return;
+            }
+            uint32_t t;
+            uint64_t v;
+            memcpy(&t, tag.bytes, sizeof(t));
+            memcpy(&v, value.bytes, sizeof(v));
+            sum += t + v;
+        }
+        XCTAssertGreaterThan(sum, 0ull);
+    }];
+}
+
+- (void)testBenchmarkParseRecordsWithCursor
+{
+    NSMutableData *data = [self records];
+    BRUMemoryRegion region = BRUMemoryRegionMake(data.mutableBytes, data.length);
+    [self measureBlock:^{
+        uint64_t sum = 0;
+        BRUMemoryCursor cursor = BRUMemoryCursorMake(region);
+        while (BRUMemoryCursorRemaining(&cursor) > 0 && BRUMemoryCursorRequire(&cursor, kRecordSize)) {
+            uint32_t t = BRUMemoryCursorReadUInt32LEUnchecked(&cursor);
+            (void)BRUMemoryCursorReadUInt32LEUnchecked(&cursor);
+            uint64_t v = BRUMemoryCursorReadUInt64LEUnchecked(&cursor);
+            sum += t + v;
+        }
+        XCTAssertFalse(BRUMemoryCursorHasFailed(&cursor));
+        XCTAssertGreaterThan(sum, 0ull);
+    }];
+}
+
+@end
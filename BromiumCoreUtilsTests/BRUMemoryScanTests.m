@@ -0,0 +1,253 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "BRUMemoryScan.h"
+#import "BRUTimer.h"
+
+@interface BRUMemoryScanTests : XCTestCase
+
+@property (nonatomic, assign) BRUMemoryScanKernels defaultKernels;
+
+@end
+
+@implementation BRUMemoryScanTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.defaultKernels = BRUMemoryScanActiveKernels();
+}
+
+- (void)tearDown
+{
+    XCTAssertTrue(BRUMemoryScanUseKernels(self.defaultKernels));
+    [super tearDown];
+}
+
+/**
+ * Runs `block` once with every kernel set the CPU supports.
+ */
+- (void)withEachKernelSet:(void (^)(BRUMemoryScanKernels kernels))block
+{
+    for (BRUMemoryScanKernels kernels = BRUMemoryScanKernelsScalar; kernels <= BRUMemoryScanKernelsAVX2; kernels++) {
+        if (BRUMemoryScanUseKernels(kernels)) {
+            block(kernels);
+        }
+    }
+}
+
+- (void)testScalarAndSSE2AreAlwaysAvailable
+{
+    XCTAssertTrue(BRUMemoryScanUseKernels(BRUMemoryScanKernelsScalar));
+#if defined(__x86_64__)
+    XCTAssertTrue(BRUMemoryScanUseKernels(BRUMemoryScanKernelsSSE2));
+    XCTAssertNotEqual(self.defaultKernels, BRUMemoryScanKernelsScalar, @"vector kernels not picked");
+#endif
+}
+
+- (void)testFindByteAtEveryPositionAndAlignment
+{
+    uint8_t buffer[256 + 32];
+    [self withEachKernelSet:^(BRUMemoryScanKernels kernels) {
+        for (size_t alignment = 0; alignment < 32; alignment += 7) {
+            for (size_t length = 0; length <= 256; length += 5) {
+                BRUMemoryRegion region = BRUMemoryRegionMake(buffer + alignment, length);
+                memset(buffer, 'a', sizeof(buffer));
+                size_t offset = 0;
+                XCTAssertFalse(BRUMemoryRegionFindByte(region, 'x', &offset));
+                for (size_t position = 0; position < length; position++) {
+                    buffer[alignment + position] = 'x';
+                    XCTAssertTrue(BRUMemoryRegionFindByte(region, 'x', &offset));
+                    XCTAssertEqual(offset, position, @"kernels %ld, length %zu", (long)kernels, length);
+                    buffer[alignment + position] = 'a';
+                }
+                /* just behind the region mustn't be found */
+                buffer[alignment + length] = 'x';
+                XCTAssertFalse(BRUMemoryRegionFindByte(region, 'x', &offset));
+            }
+        }
+    }];
+}
+
+- (void)testFindAnyByte
+{
+    NSData *haystack = [@"GET /some/long/path/to/a/resource/that/spans/vectors?query=1 HTTP/1.1\r\n"
+                        dataUsingEncoding:NSUTF8StringEncoding];
+    BRUMemoryRegion region = BRUMemoryRegionMake((void *)haystack.bytes, haystack.length);
+    [self withEachKernelSet:^(BRUMemoryScanKernels kernels) {
+        size_t offset = 0;
+        char small[] = "?\r";
+        XCTAssertTrue(BRUMemoryRegionFindAnyByte(region, BRUMemoryRegionMake(small, 2), &offset));
+        XCTAssertEqual(offset, (size_t)52, @"kernels %ld", (long)kernels);
+
+        /* more than 8 bytes use the lookup table */
+        char large[] = "0123456789=";
+        XCTAssertTrue(BRUMemoryRegionFindAnyByte(region, BRUMemoryRegionMake(large, 11), &offset));
+        XCTAssertEqual(offset, (size_t)58, @"kernels %ld", (long)kernels);
+
+        char absent[] = "#";
+        XCTAssertFalse(BRUMemoryRegionFindAnyByte(region, BRUMemoryRegionMake(absent, 1), &offset));
+        XCTAssertFalse(BRUMemoryRegionFindAnyByte(region, BRUMemoryRegionNull, &offset));
+    }];
+}
+
+- (void)testFindFirstDifferenceAndEquality
+{
+    uint8_t bytes1[300];
+    uint8_t bytes2[300];
+    for (size_t i = 0; i < sizeof(bytes1); i++) {
+        bytes1[i] = bytes2[i] = (uint8_t)(i * 7);
+    }
+    [self withEachKernelSet:^(BRUMemoryScanKernels kernels) {
+        BRUMemoryRegion region1 = BRUMemoryRegionMake(bytes1, sizeof(bytes1));
+        BRUMemoryRegion region2 = BRUMemoryRegionMake(bytes2, sizeof(bytes2));
+        size_t offset = 0;
+        XCTAssertTrue(BRUMemoryRegionIsEqualToRegion(region1, region2));
+        XCTAssertFalse(BRUMemoryRegionFindFirstDifference(region1, region2, &offset));
+
+        for (size_t position = 0; position < sizeof(bytes2); position += 13) {
+            bytes2[position] ^= 0x10;
+            XCTAssertFalse(BRUMemoryRegionIsEqualToRegion(region1, region2));
+            XCTAssertTrue(BRUMemoryRegionFindFirstDifference(region1, region2, &offset));
+            XCTAssertEqual(offset, position, @"kernels %ld", (long)kernels);
+            bytes2[position] ^= 0x10;
+        }
+
+        /* a prefix differs at its end */
+        BRUMemoryRegion prefix = BRUMemoryRegionMake(bytes2, 100);
+        XCTAssertFalse(BRUMemoryRegionIsEqualToRegion(region1, prefix));
+        XCTAssertTrue(BRUMemoryRegionFindFirstDifference(region1, prefix, &offset));
+        XCTAssertEqual(offset, (size_t)100);
+    }];
+}
+
+- (void)testIsAllZero
+{
+    uint8_t bytes[1000];
+    memset(bytes, 0, sizeof(bytes));
+    BRUMemoryRegion region = BRUMemoryRegionMake(bytes, sizeof(bytes));
+    [self withEachKernelSet:^(BRUMemoryScanKernels kernels) {
+        XCTAssertTrue(BRUMemoryRegionIsAllZero(region));
+        XCTAssertTrue(BRUMemoryRegionIsAllZero(BRUMemoryRegionNull));
+        for (size_t position = 0; position < sizeof(bytes); position += 37) {
+            bytes[position] = 0x80;
+            XCTAssertFalse(BRUMemoryRegionIsAllZero(region), @"kernels %ld, position %zu", (long)kernels, position);
+            bytes[position] = 0;
+        }
+    }];
+}
+
+- (void)testPopulationCount
+{
+    uint8_t bytes[1000];
+    uint64_t expected = 0;
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        bytes[i] = (uint8_t)(i * 31 + 17);
+        expected += (uint64_t)__builtin_popcount(bytes[i]);
+    }
+    [self withEachKernelSet:^(BRUMemoryScanKernels kernels) {
+        XCTAssertEqual(BRUMemoryRegionPopulationCount(BRUMemoryRegionMake(bytes, sizeof(bytes))), expected,
+                       @"kernels %ld", (long)kernels);
+        XCTAssertEqual(BRUMemoryRegionPopulationCount(BRUMemoryRegionMake(bytes + 3, 5)),
+                       (uint64_t)(__builtin_popcount(bytes[3]) + __builtin_popcount(bytes[4]) +
+                                  __builtin_popcount(bytes[5]) + __builtin_popcount(bytes[6]) +
+                                  __builtin_popcount(bytes[7])));
+    }];
+}
+
+- (void)testInvalidRegionsAreNotRead
+{
+    BRUMemoryRegion invalid = BRUMemoryRegionMake((void *)(UINTPTR_MAX - 1), 16);
+    size_t offset = 0;
+    XCTAssertFalse(BRUMemoryRegionFindByte(invalid, 0, &offset));
+    XCTAssertFalse(BRUMemoryRegionFindAnyByte(invalid, invalid, &offset));
+    XCTAssertFalse(BRUMemoryRegionFindFirstDifference(invalid, invalid, &offset));
+    XCTAssertFalse(BRUMemoryRegionIsEqualToRegion(invalid, invalid));
+    XCTAssertFalse(BRUMemoryRegionIsAllZero(invalid));
+    XCTAssertEqual(BRUMemoryRegionPopulationCount(invalid), (uint64_t)0);
+}
+
+#pragma mark - Benchmarks
+
+static const size_t kBenchmarkLength = 64 * 1024 * 1024;
+
+/**
+ * Logs the throughput of `block` (which processes `kBenchmarkLength` bytes) with every kernel set and measures it
+ * with the default kernels.
+ */
+- (void)measureThroughputOfScan:(NSString *)name block:(void (^)(void))block
+{
+    [self withEachKernelSet:^(BRUMemoryScanKernels kernels) {
+        const int iterations = 10;
+        uint64_t start = BRUMonotonicNanoseconds();
+        for (int i = 0; i < iterations; i++) {
+            block();
+        }
+        double seconds = (double)(BRUMonotonicNanoseconds() - start) / NSEC_PER_SEC;
+        NSLog(@"%@ with kernels %ld: %.2f GB/s", name, (long)kernels,
+              (double)kBenchmarkLength * iterations / seconds / 1e9);
+    }];
+    XCTAssertTrue(BRUMemoryScanUseKernels(self.defaultKernels));
+    [self measureBlock:block];
+}
+
+- (void)testBenchmarkFindByte
+{
+    NSMutableData *data = [NSMutableData dataWithLength:kBenchmarkLength];
+    ((uint8_t *)data.mutableBytes)[kBenchmarkLength - 1] = '\n';
+    BRUMemoryRegion region = BRUMemoryRegionMake(data.mutableBytes, data.length);
+    [self measureThroughputOfScan:@"find byte" block:^{
+        size_t offset = 0;
+        XCTAssertTrue(BRUMemoryRegionFindByte(region, '\n', &offset));
+    }];
+}
+
+- (void)testBenchmarkFindAnyByte
+{
+    NSMutableData *data = [NSMutableData dataWithLength:kBenchmarkLength];
+    ((uint8_t *)data.mutableBytes)[kBenchmarkLength - 1] = '"';
+    BRUMemoryRegion region = BRUMemoryRegionMake(data.mutableBytes, data.length);
+    char set[] = "\"\\\r\n";
+    [self measureThroughputOfScan:@"find any byte" block:^{
+        size_t offset = 0;
+        XCTAssertTrue(BRUMemoryRegionFindAnyByte(region, BRUMemoryRegionMake(set, 4), &offset));
+    }];
+}
+
+- (void)testBenchmarkIsEqualToRegion
+{
+    NSMutableData *data1 = [NSMutableData dataWithLength:kBenchmarkLength];
+    NSMutableData *data2 = [NSMutableData dataWithLength:kBenchmarkLength];
+    BRUMemoryRegion region1 = BRUMemoryRegionMake(data1.mutableBytes, data1.length);
+    BRUMemoryRegion region2 = BRUMemoryRegionMake(data2.mutableBytes, data2.length);
+    [self measureThroughputOfScan:@"equality" block:^{
+        XCTAssertTrue(BRUMemoryRegionIsEqualToRegion(region1, region2));
+    }];
+}
+
+- (void)testBenchmarkIsAllZero
+{
+    NSMutableData *data = [NSMutableData dataWithLength:kBenchmarkLength];
+    BRUMemoryRegion region = BRUMemoryRegionMake(data.mutableBytes, data.length);
+    [self measureThroughputOfScan:@"is all zero" block:^{
+        XCTAssertTrue(BRUMemoryRegionIsAllZero(region));
+    }];
+}
+
+- (void)testBenchmarkPopulationCount
+{
+    NSMutableData *data = [NSMutableData dataWithLength:kBenchmarkLength];
+    memset(data.mutableBytes, 0xff, data.length);
+    BRUMemoryRegion region = BRUMemoryRegionMake(data.mutableBytes, data.length);
+    [self measureThroughputOfScan:@"population count" block:^{
+        XCTAssertEqual(BRUMemoryRegionPopulationCount(region), (uint64_t)kBenchmarkLength * 8);
+    }];
+}
+
+@end
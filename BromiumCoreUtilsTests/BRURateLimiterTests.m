@@ -0,0 +1,98 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "BRUDispatchUtils.h"
+#import "BRURateLimiter.h"
+
+@interface BRURateLimiterTests : XCTestCase
+
+@end
+
+@implementation BRURateLimiterTests
+
+- (void)testBatchingRateLimiterDeliversEveryResultInOrder
+{
+    dispatch_queue_t q = bru_dispatch_queue_create("com.bromium.BRURateLimiterTests", DISPATCH_QUEUE_SERIAL);
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    NSMutableArray<NSNumber *> *delivered = [NSMutableArray array]; /* synchronized on q */
+    __block NSUInteger batches = 0; /* synchronized on q */
+    BRUBatchingRateLimiter<NSNumber *> *limiter =
+        [[BRUBatchingRateLimiter alloc] initWithTargetQueue:q
+                                                resultBlock:^(NSArray *results, BRURateLimiterCompletionBlock done) {
+                                                    batches++;
+                                                    [delivered addObjectsFromArray:results];
+                                                    /* be slow so that results accumulate */
+                                                    usleep(1000);
+                                                    done();
+                                                    if (delivered.count == 1000) {
+                                                        dispatch_semaphore_signal(sem);
+                                                    }
+                                                }];
+    for (NSUInteger i = 0; i < 1000; i++) {
+        [limiter addResult:@(i)];
+    }
+    long timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(5 * NSEC_PER_SEC)));
+    XCTAssertFalse(timeout, @"not all results delivered");
+    dispatch_sync(q, ^{
+        for (NSUInteger i = 0; i < delivered.count; i++) {
+            XCTAssertEqualObjects(delivered[i], @(i));
+        }
+        XCTAssertLessThan(batches, (NSUInteger)1000, @"results not batched");
+    });
+}
+
+- (void)testBatchingRateLimiterRespectsMaxBatchSize
+{
+    dispatch_queue_t q = bru_dispatch_queue_create("com.bromium.BRURateLimiterTests", DISPATCH_QUEUE_SERIAL);
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    __block NSUInteger deliveredCount = 0; /* synchronized on q */
+    BRUBatchingRateLimiter<NSNumber *> *limiter =
+        [[BRUBatchingRateLimiter alloc] initWithTargetQueue:q
+                                               maxBatchSize:10
+                                                   maxDelay:0.01
+                                                resultBlock:^(NSArray *results, BRURateLimiterCompletionBlock done) {
+                                                    XCTAssertLessThanOrEqual(results.count, (NSUInteger)10);
+                                                    deliveredCount += results.count;
+                                                    done();
+                                                    if (deliveredCount == 100) {
+                                                        dispatch_semaphore_signal(sem);
+                                                    }
+                                                }];
+    for (NSUInteger i = 0; i < 100; i++) {
+        [limiter addResult:@(i)];
+    }
+    long timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(5 * NSEC_PER_SEC)));
+    XCTAssertFalse(timeout, @"not all results delivered");
+}
+
+- (void)testBatchingRateLimiterHoldsBackResultsForMaxDelay
+{
+    dispatch_queue_t q = bru_dispatch_queue_create("com.bromium.BRURateLimiterTests", DISPATCH_QUEUE_SERIAL);
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    __block NSUInteger batchSize = 0; /* synchronized on q */
+    BRUBatchingRateLimiter<NSNumber *> *limiter =
+        [[BRUBatchingRateLimiter alloc] initWithTargetQueue:q
+                                               maxBatchSize:0
+                                                   maxDelay:0.1
+                                                resultBlock:^(NSArray *results, BRURateLimiterCompletionBlock done) {
+                                                    batchSize = results.count;
+                                                    done();
+                                                    dispatch_semaphore_signal(sem);
+                                                }];
+    for (NSUInteger i = 0; i < 3; i++) {
+        [limiter addResult:@(i)];
+    }
+    long timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(5 * NSEC_PER_SEC)));
+    XCTAssertFalse(timeout, @"results not delivered");
+    dispatch_sync(q, ^{
+        XCTAssertEqual(batchSize, (NSUInteger)3, @"results not collected into one batch");
+    });
+}
+
+@end
@@ -13,6 +13,7 @@
 #import "BRUAsserts.h"
 #import "BRUDispatchUtils.h"
 #import "BRURetry.h"
+#import "BRUCancellationToken.h"
 
 /**
  * The time after which an asynchronous action will complete.
@@ -753,6 +754,85 @@ typedef void (^BRURetryTestsCompletionBlock)(void);
     }];
 }
 
+- (void)testCancellationTokenDuringDelayPhase
+{
+    [BRURetryTests performSoakTest:^{
+
+        dispatch_semaphore_t actionSem = dispatch_semaphore_create(0);
+        dispatch_semaphore_t completionSem = dispatch_semaphore_create(0);
+
+        BRURetryActionBlock actionBlock = ^(BRURetryContinuationBlock continuationBlock) {
+            continuationBlock(NO, [BRURetryTests transientError], BRURetryStatusTransient);
+        };
+
+        BRURetryPolicyBlock policyBlock = ^BRURetryPolicyResponse(__unused NSError *error,
+                                                                  NSUInteger attempt,
+                                                                  NSTimeInterval *delay) {
+            XCTAssertEqual(attempt, (NSUInteger)1);
+            *delay = 10.0;
+            dispatch_semaphore_signal(actionSem);
+            return BRURetryPolicyResponseRetry;
+        };
+
+        BRUCancellationToken *token = [BRUCancellationToken token];
+        BRURetry *retry = [BRURetryTests retryWithActionBlock:actionBlock
+                                                  policyBlock:policyBlock
+                                                  targetQueue:nil];
+        NSUUID *identifier =
+        [retry startWithCompletionBlock:[self completionBlockWithCancellationAndCompletionBlock:^{
+            dispatch_semaphore_signal(completionSem);
+        }] cancellationToken:token];
+        [self waitOnSemaphore:actionSem];
+        XCTAssertTrue([token cancel]);
+        [self waitOnSemaphore:completionSem];
+        XCTAssertFalse([retry cancel:identifier]);
+
+    }];
+}
+
+- (void)testCancellationTokenDuringActionPhase
+{
+    [BRURetryTests performSoakTest:^{
+
+        dispatch_semaphore_t actionSem = dispatch_semaphore_create(0);
+        dispatch_semaphore_t completionSem = dispatch_semaphore_create(0);
+
+        BRURetryActionBlock actionBlock = ^(BRURetryContinuationBlock continuationBlock) {
+            dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+                dispatch_semaphore_wait(actionSem, DISPATCH_TIME_FOREVER);
+                continuationBlock(NO, [BRURetryTests transientError], BRURetryStatusTransient);
+            });
+        };
+
+        BRUCancellationToken *token = [BRUCancellationToken token];
+        BRURetry *retry = [BRURetryTests retryWithActionBlock:actionBlock
+                                                  policyBlock:[self policyBlockWithRetries:BRURetryResultNever]
+                                                  targetQueue:nil];
+        [retry startWithCompletionBlock:[self completionBlockWithCancellationAndCompletionBlock:^{
+            dispatch_semaphore_signal(completionSem);
+        }] cancellationToken:token];
+        XCTAssertTrue([token cancel]);
+        dispatch_semaphore_signal(actionSem);
+        [self waitOnSemaphore:completionSem];
+
+    }];
+}
+
+- (void)testAlreadyCancelledTokenCancelsRetry
+{
+    dispatch_semaphore_t completionSem = dispatch_semaphore_create(0);
+    BRUCancellationToken *token = [BRUCancellationToken token];
+    [token cancel];
+
+    BRURetry *retry = [self retryWithActionBlock:[self actionBlockWithSuccessOnAttempt:BRURetryResultNever]
+                                         retries:BRURetryResultNever
+                                     targetQueue:nil];
+    [retry startWithCompletionBlock:[self completionBlockWithCancellationAndCompletionBlock:^{
+        dispatch_semaphore_signal(completionSem);
+    }] cancellationToken:token];
+    [self waitOnSemaphore:completionSem];
+}
+
 - (void)expectCancelSuccessDuringStartWithSyncQueue:(dispatch_queue_t)syncQueue
                                         targetQueue:(dispatch_queue_t)targetQueue
                                     completionBlock:(BRURetryTestsCompletionBlock)completionBlock
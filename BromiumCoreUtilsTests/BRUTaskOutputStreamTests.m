@@ -0,0 +1,140 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "BRUDispatchUtils.h"
+#import "BRUTask.h"
+#import "BRUTaskOutputStream.h"
+
+@interface BRUTaskOutputStreamTests : XCTestCase
+
+@end
+
+@implementation BRUTaskOutputStreamTests
+
+- (void)testChunksAreBoundedAndComplete
+{
+    dispatch_queue_t q = bru_dispatch_queue_create("com.bromium.BRUTaskOutputStreamTests", DISPATCH_QUEUE_SERIAL);
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    __block size_t total = 0; /* synchronized on q */
+    __block size_t biggestChunk = 0;
+    __block int completionError = -1;
+    BRUTaskOutputStream *stream =
+        [BRUTaskOutputStream outputStreamWithQueue:q
+                                         chunkSize:4096
+                                      chunkHandler:^(NSData *chunk, dispatch_block_t done) {
+                                          total += chunk.length;
+                                          biggestChunk = MAX(biggestChunk, chunk.length);
+                                          done();
+                                      }
+                                 completionHandler:^(int error) {
+                                     completionError = error;
+                                     dispatch_semaphore_signal(sem);
+                                 }];
+    BRUTask *t = [[BRUTask alloc] init];
+    t.launchPath = @"/bin/dd";
+    t.arguments = @[@"if=/dev/zero", @"bs=1048576", @"count=64"];
+    t.standardOutput = stream;
+    t.standardError = [NSFileHandle fileHandleWithNullDevice];
+    NSError *error = nil;
+    XCTAssertTrue([t launchWithError:&error], @"launch failed");
+    XCTAssertNil(error, @"error not nil");
+    long timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(30 * NSEC_PER_SEC)));
+    XCTAssertFalse(timeout, @"output didn't end");
+    dispatch_sync(q, ^{
+        XCTAssertEqual(completionError, 0);
+        XCTAssertEqual(total, (size_t)64 * 1048576, @"output lost");
+        XCTAssertLessThanOrEqual(biggestChunk, (size_t)4096, @"chunk bigger than chunk size");
+    });
+}
+
+- (void)testSlowHandlerGetsEverything
+{
+    dispatch_queue_t q = bru_dispatch_queue_create("com.bromium.BRUTaskOutputStreamTests", DISPATCH_QUEUE_SERIAL);
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    NSMutableData *output = [NSMutableData data]; /* synchronized on q */
+    BRUTaskOutputStream *stream =
+        [BRUTaskOutputStream outputStreamWithQueue:q
+                                         chunkSize:16
+                                      chunkHandler:^(NSData *chunk, dispatch_block_t done) {
+                                          [output appendData:chunk];
+                                          /* hand back the buffer later, from another queue */
+                                          dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)NSEC_PER_MSEC),
+                                                         dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+                                                         done);
+                                      }
+                                 completionHandler:^(__unused int error) {
+                                     dispatch_semaphore_signal(sem);
+                                 }];
+    BRUTask *t = [[BRUTask alloc] init];
+    t.launchPath = @"/bin/zsh";
+    t.arguments = @[@"-c", @"for i in {1..100}; do echo line $i; done"];
+    t.standardOutput = stream;
+    XCTAssertTrue([t launchWithError:nil], @"launch failed");
+    long timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(30 * NSEC_PER_SEC)));
+    XCTAssertFalse(timeout, @"output didn't end");
+    NSMutableString *expected = [NSMutableString string];
+    for (NSUInteger i = 1; i <= 100; i++) {
+        [expected appendFormat:@"line %lu\n", (unsigned long)i];
+    }
+    dispatch_sync(q, ^{
+        XCTAssertEqualObjects(output, [expected dataUsingEncoding:NSUTF8StringEncoding]);
+    });
+}
+
+- (void)testLineOutputStreamSplitsLines
+{
+    dispatch_queue_t q = bru_dispatch_queue_create("com.bromium.BRUTaskOutputStreamTests", DISPATCH_QUEUE_SERIAL);
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    NSMutableArray<NSString *> *lines = [NSMutableArray array]; /* synchronized on q */
+    BRUTaskOutputStream *stream =
+        [BRUTaskOutputStream lineOutputStreamWithQueue:q
+                                         maxLineLength:8
+                                           lineHandler:^(NSData *line) {
+                                               [lines addObject:[[NSString alloc] initWithData:line
+                                                                                      encoding:NSUTF8StringEncoding]];
+                                           }
+                                     completionHandler:^(__unused int error) {
+                                         dispatch_semaphore_signal(sem);
+                                     }];
+    BRUTask *t = [[BRUTask alloc] init];
+    t.launchPath = @"/usr/bin/printf";
+    t.arguments = @[@"one\n\ntwo\n0123456789abcdef\nlast"];
+    t.standardOutput = stream;
+    XCTAssertTrue([t launchWithError:nil], @"launch failed");
+    long timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(30 * NSEC_PER_SEC)));
+    XCTAssertFalse(timeout, @"output didn't end");
+    dispatch_sync(q, ^{
+        NSArray *expected = @[@"one", @"", @"two", @"01234567", @"89abcdef", @"last"];
+        XCTAssertEqualObjects(lines, expected);
+    });
+}
+
+- (void)testFailedLaunchCompletesStream
+{
+    dispatch_queue_t q = bru_dispatch_queue_create("com.bromium.BRUTaskOutputStreamTests", DISPATCH_QUEUE_SERIAL);
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    BRUTaskOutputStream *stream =
+        [BRUTaskOutputStream outputStreamWithQueue:q
+                                         chunkSize:4096
+                                      chunkHandler:^(__unused NSData *chunk, dispatch_block_t done) {
+                                          XCTFail(@"output from a task that didn't launch");
+                                          done();
+                                      }
+                                 completionHandler:^(__unused int error) {
+                                     dispatch_semaphore_signal(sem);
+                                 }];
+    BRUTask *t = [[BRUTask alloc] init];
+    t.launchPath = @"/This/path/will/NOT/exist/on/your/system/I/hope/:-)";
+    t.standardOutput = stream;
+    XCTAssertFalse([t launchWithError:nil], @"launch succeeded?");
+    long timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(5 * NSEC_PER_SEC)));
+    XCTAssertFalse(timeout, @"stream of failed launch didn't complete");
+}
+
+@end
@@ -0,0 +1,111 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "BRUDeferred.h"
+#import "BRUEitherErrorOrSuccess.h"
+#import "BRUTask.h"
+#import "BRUTaskPool.h"
+
+@interface BRUTaskPoolTests : XCTestCase
+
+@end
+
+@implementation BRUTaskPoolTests
+
+- (BRUEitherErrorOrSuccess *)waitForPromise:(id<BRUPromise>)promise
+{
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    __block id result = nil;
+    [promise then:^(id value) {
+        result = value;
+        dispatch_semaphore_signal(sem);
+    }];
+    long timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(30 * NSEC_PER_SEC)));
+    XCTAssertFalse(timeout, @"promise not resolved");
+    return result;
+}
+
+- (BRUTask *)taskWithLaunchPath:(NSString *)launchPath arguments:(NSArray *)arguments
+{
+    BRUTask *t = [[BRUTask alloc] init];
+    t.launchPath = launchPath;
+    t.arguments = arguments;
+    return t;
+}
+
+- (void)testPoolRunsTasksAndResolvesWithTask
+{
+    BRUTaskPool *pool = [BRUTaskPool taskPool];
+    dispatch_semaphore_t terminated = dispatch_semaphore_create(0);
+    BRUTask *t = [self taskWithLaunchPath:@"/bin/sh" arguments:@[@"-c", @"exit 3"]];
+    t.terminationHandler = ^(__unused BRUTask *task) {
+        dispatch_semaphore_signal(terminated);
+    };
+    BRUEitherErrorOrSuccess *result = [self waitForPromise:[pool submitTask:t]];
+    NSError *error = nil;
+    BRUTask *exited = [result returnComputationSuccessObjectAndSetError:&error];
+    XCTAssertEqual(exited, t, @"promise not resolved with the task");
+    XCTAssertNil(error, @"error not nil");
+    XCTAssertFalse(exited.running);
+    XCTAssertEqual(3, exited.terminationStatus, @"wrong exit status");
+    XCTAssertEqual(NSTaskTerminationReasonExit, exited.terminationReason, @"wrong termination reason");
+    XCTAssertEqual(0, dispatch_semaphore_wait(terminated, DISPATCH_TIME_NOW), @"termination handler didn't run");
+}
+
+- (void)testPoolRecordsResourceUsage
+{
+    BRUTaskPool *pool = [BRUTaskPool taskPool];
+    BRUTask *t = [self taskWithLaunchPath:@"/bin/sleep" arguments:@[@"0.2"]];
+    t.accountsResourceUsage = YES;
+    BRUEitherErrorOrSuccess *result = [self waitForPromise:[pool submitTask:t]];
+    XCTAssertTrue(result.success, @"task failed");
+    XCTAssertGreaterThanOrEqual(t.resourceUsage.wallTime, 0.2, @"wall time not recorded");
+    XCTAssertGreaterThan(t.resourceUsage.maxResidentSetSize, (uint64_t)0, @"max RSS not recorded");
+}
+
+- (void)testPoolRespectsConcurrencyCap
+{
+    BRUTaskPool *pool = [[BRUTaskPool alloc] initWithMaxConcurrentTasks:2];
+    NSMutableArray<id<BRUPromise>> *promises = [NSMutableArray array];
+    NSDate *start = [NSDate date];
+    for (NSUInteger i = 0; i < 6; i++) {
+        [promises addObject:[pool submitTask:[self taskWithLaunchPath:@"/bin/sleep" arguments:@[@"0.2"]]]];
+    }
+    [NSThread sleepForTimeInterval:0.1];
+    BRUTaskPoolStatistics statistics = [pool statistics];
+    XCTAssertEqual(statistics.runningTasks, (NSUInteger)2, @"wrong number of running tasks");
+    XCTAssertEqual(statistics.queueDepth, (NSUInteger)4, @"wrong queue depth");
+
+    BRUEitherErrorOrSuccess *result = [self waitForPromise:[BRUDeferred all:promises]];
+    XCTAssertTrue(result.success, @"tasks failed");
+    XCTAssertGreaterThanOrEqual(-[start timeIntervalSinceNow], 0.6, @"more than 2 tasks ran concurrently");
+
+    statistics = [pool statistics];
+    XCTAssertEqual(statistics.queueDepth, (NSUInteger)0);
+    XCTAssertEqual(statistics.runningTasks, (NSUInteger)0);
+    XCTAssertEqual(statistics.launchedTasks, (NSUInteger)6);
+    XCTAssertGreaterThanOrEqual(statistics.maxWaitTime, 0.35, @"queued tasks didn't wait");
+    XCTAssertGreaterThanOrEqual(statistics.totalWaitTime, statistics.maxWaitTime);
+}
+
+- (void)testPoolReportsLaunchFailure
+{
+    BRUTaskPool *pool = [[BRUTaskPool alloc] initWithMaxConcurrentTasks:1];
+    BRUTask *t = [self taskWithLaunchPath:@"/This/path/will/NOT/exist/on/your/system/I/hope/:-)" arguments:@[]];
+    BRUEitherErrorOrSuccess *result = [self waitForPromise:[pool submitTask:t]];
+    NSError *error = nil;
+    XCTAssertNil([result returnComputationSuccessObjectAndSetError:&error]);
+    XCTAssertEqual(error.code, (NSInteger)ENOENT, @"wrong error");
+
+    /* the failed launch mustn't block the pool */
+    result = [self waitForPromise:[pool submitTask:[self taskWithLaunchPath:@"/usr/bin/true" arguments:@[]]]];
+    XCTAssertTrue(result.success);
+}
+
+@end
@@ -0,0 +1,115 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "BRUTask.h"
+#import "BRUTaskTemplate.h"
+
+@interface BRUTaskTemplateTests : XCTestCase
+
+@end
+
+@implementation BRUTaskTemplateTests
+
+- (NSString *)outputOfTask:(BRUTask *)t
+{
+    NSPipe *p = [NSPipe pipe];
+    t.standardOutput = p;
+    NSError *error = nil;
+    BOOL suc = [t launchWithError:&error];
+    XCTAssertTrue(suc, @"launch failed: %@", error);
+    NSData *output = [p.fileHandleForReading readDataToEndOfFile];
+    [t waitUntilExit];
+    return [[NSString alloc] initWithData:output encoding:NSUTF8StringEncoding];
+}
+
+- (void)testTemplateProvidesLaunchPathEnvironmentAndDirectory
+{
+    BRUTaskTemplate *taskTemplate = [[BRUTaskTemplate alloc] initWithLaunchPath:@"/bin/sh"
+                                                                    environment:@{@"FOO" : @"bär", @"EMPTY" : @""}
+                                                           currentDirectoryPath:@"/usr"];
+    for (NSString *arg in @[@"1", @"two", @"drei"]) {
+        BRUTask *t = [[BRUTask alloc] initWithTemplate:taskTemplate];
+        XCTAssertEqual(t.taskTemplate, taskTemplate);
+        XCTAssertEqualObjects(t.launchPath, @"/bin/sh");
+        t.arguments = @[@"-c", @"echo \"$FOO|$EMPTY|$(pwd)|$1\"", @"sh", arg];
+        XCTAssertEqualObjects([self outputOfTask:t], ([NSString stringWithFormat:@"bär||/usr|%@\n", arg]));
+    }
+}
+
+- (void)testTemplateWithoutEnvironmentAndDirectory
+{
+    BRUTaskTemplate *taskTemplate = [[BRUTaskTemplate alloc] initWithLaunchPath:@"/bin/echo"
+                                                                    environment:nil
+                                                           currentDirectoryPath:nil];
+    BRUTask *t = [[BRUTask alloc] initWithTemplate:taskTemplate];
+    XCTAssertNil(t.environment);
+    XCTAssertNil(t.currentDirectoryPath);
+    t.arguments = @[@"hello", @"", @"world"];
+    XCTAssertEqualObjects([self outputOfTask:t], @"hello  world\n");
+}
+
+- (void)testChangedPropertiesOverrideTemplate
+{
+    BRUTaskTemplate *taskTemplate = [[BRUTaskTemplate alloc] initWithLaunchPath:@"/bin/sh"
+                                                                    environment:@{@"FOO" : @"template"}
+                                                           currentDirectoryPath:@"/usr"];
+    BRUTask *t = [[BRUTask alloc] initWithTemplate:taskTemplate];
+    t.environment = @{@"FOO" : @"task"};
+    t.currentDirectoryPath = @"/";
+    t.arguments = @[@"-c", @"echo \"$FOO|$(pwd)\""];
+    XCTAssertEqualObjects([self outputOfTask:t], @"task|/\n");
+}
+
+#pragma mark - Benchmarks
+
+- (NSDictionary *)bigEnvironment
+{
+    NSMutableDictionary *environment = [NSMutableDictionary dictionary];
+    for (NSUInteger i = 0; i < 200; i++) {
+        environment[[NSString stringWithFormat:@"VARIABLE_%lu", (unsigned long)i]] =
+            [NSString stringWithFormat:@"some fairly long value number %lu", (unsigned long)i];
+    }
+    return environment;
+}
+
+- (void)testBenchmarkLaunchWithoutTemplate
+{
+    NSDictionary *environment = [self bigEnvironment];
+    [self measureBlock:^{
+        for (int i = 0; i < 100; i++) {
+            BRUTask *t = [[BRUTask alloc] init];
+            t.launchMethod = BRUTaskLaunchMethodPosixSpawn;
+            t.launchPath = @"/usr/bin/true";
+            t.environment = environment;
+            t.arguments = @[[NSString stringWithFormat:@"%d", i]];
+            BOOL suc = [t launchWithError:nil];
+            XCTAssertTrue(suc, @"launch failed");
+            [t waitUntilExit];
+        }
+    }];
+}
+
+- (void)testBenchmarkLaunchWithTemplate
+{
+    BRUTaskTemplate *taskTemplate = [[BRUTaskTemplate alloc] initWithLaunchPath:@"/usr/bin/true"
+                                                                    environment:[self bigEnvironment]
+                                                           currentDirectoryPath:nil];
+    [self measureBlock:^{
+        for (int i = 0; i < 100; i++) {
+            BRUTask *t = [[BRUTask alloc] initWithTemplate:taskTemplate];
+            t.launchMethod = BRUTaskLaunchMethodPosixSpawn;
+            t.arguments = @[[NSString stringWithFormat:@"%d", i]];
+            BOOL suc = [t launchWithError:nil];
+            XCTAssertTrue(suc, @"launch failed");
+            [t waitUntilExit];
+        }
+    }];
+}
+
+@end
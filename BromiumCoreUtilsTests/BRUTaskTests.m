@@ -16,6 +16,7 @@
 #import <BRUSetDiffFormatter.h>
 #import <BRUTemporaryFiles.h>
 #import <BRUConcurrentBox.h>
+#import <BRUDeferred.h>
 #import <BRUTask.h>
 
 static void __attribute__((noinline)) noop() {} /* for signal handling */
@@ -792,4 +793,248 @@ static void __attribute__((noinline)) noop() {} /* for signal handling */
     XCTAssertNil(n, @"n != nil, just random code here that runs after t has been dealloced");
 }
 
+- (void)assertInheritedFileDescriptorWorksWithLaunchMethod:(BRUTaskLaunchMethod)launchMethod
+{
+    NSError *error = nil;
+    NSPipe *inherited = [NSPipe pipe];
+    NSPipe *notInherited = [NSPipe pipe];
+    int inheritedFD = inherited.fileHandleForWriting.fileDescriptor;
+    int notInheritedFD = notInherited.fileHandleForWriting.fileDescriptor;
+    BRUTask *t = [[BRUTask alloc] init];
+    t.launchMethod = launchMethod;
+    t.launchPath = @"/bin/zsh";
+    t.arguments = @[@"-c", [NSString stringWithFormat:@"echo inherited >&%d; echo leaked >&%d",
+                            inheritedFD, notInheritedFD]];
+    t.inheritedFileDescriptors = [NSIndexSet indexSetWithIndex:(NSUInteger)inheritedFD];
+    BOOL suc = [t launchWithError:&error];
+    XCTAssertTrue(suc, @"launch failed");
+    XCTAssertNil(error, @"error not nil");
+    [t waitUntilExit];
+    [inherited.fileHandleForWriting closeFile];
+    [notInherited.fileHandleForWriting closeFile];
+    XCTAssertEqualObjects([@"inherited\n" dataUsingEncoding:NSUTF8StringEncoding],
+                          [inherited.fileHandleForReading readDataToEndOfFile],
+                          @"inherited file descriptor not usable in child");
+    XCTAssertEqual((NSUInteger)0, [notInherited.fileHandleForReading readDataToEndOfFile].length,
+                   @"file descriptor not in inheritedFileDescriptors leaked into child");
+}
+
+- (void)testBRUTaskInheritedFileDescriptors
+{
+    [self assertInheritedFileDescriptorWorksWithLaunchMethod:BRUTaskLaunchMethodFork];
+}
+
+- (void)testBRUTaskPosixSpawnInheritedFileDescriptors
+{
+    [self assertInheritedFileDescriptorWorksWithLaunchMethod:BRUTaskLaunchMethodPosixSpawn];
+}
+
+#pragma mark - posix_spawn
+
+- (void)testBRUTaskPosixSpawnStdoutStderr
+{
+    NSError *error = nil;
+    NSPipe *pStdout = [NSPipe pipe];
+    NSPipe *pStderr = [NSPipe pipe];
+    BRUTask *t = [[BRUTask alloc] init];
+    t.launchMethod = BRUTaskLaunchMethodPosixSpawn;
+    t.launchPath = @"/bin/zsh";
+    t.arguments = @[@"-c", @"echo stdout; echo >&2 stderr"];
+    t.standardOutput = pStdout;
+    t.standardError = pStderr;
+    BOOL suc_launch = [t launchWithError:&error];
+    XCTAssertTrue(suc_launch, @"launch failed");
+    XCTAssertNil(error, @"error not nil");
+    NSData *actualStdout = [pStdout.fileHandleForReading readDataToEndOfFile];
+    [pStdout.fileHandleForReading closeFile];
+    XCTAssertEqualObjects([@"stdout\n" dataUsingEncoding:NSUTF8StringEncoding], actualStdout, @"wrong stdout");
+    NSData *actualStderr = [pStderr.fileHandleForReading readDataToEndOfFile];
+    [pStderr.fileHandleForReading closeFile];
+    XCTAssertEqualObjects([@"stderr\n" dataUsingEncoding:NSUTF8StringEncoding], actualStderr, @"wrong stderr");
+    [t waitUntilExit];
+    XCTAssertEqual(0, t.terminationStatus, @"didn't exit 0");
+}
+
+- (void)testBRUTaskPosixSpawnPWDAndSessionLeader
+{
+    NSError *error = nil;
+    NSPipe *p = [NSPipe pipe];
+    BRUTask *t = [[BRUTask alloc] init];
+    t.launchMethod = BRUTaskLaunchMethodPosixSpawn;
+    t.launchPath = @"/bin/zsh";
+    t.arguments = @[@"-c", @"pwd; [[ $(ps -o pgid= -p $$) -eq $$ ]] && echo leader || echo no-leader"];
+    t.currentDirectoryPath = @"/System/Library";
+    t.standardOutput = p;
+    BOOL suc_launch = [t launchWithError:&error];
+    XCTAssertTrue(suc_launch, @"launch failed");
+    XCTAssertNil(error, @"error not nil");
+    NSData *actual = [p.fileHandleForReading readDataToEndOfFile];
+    [p.fileHandleForReading closeFile];
+    NSData *expected = [@"/System/Library\nleader\n" dataUsingEncoding:NSUTF8StringEncoding];
+    XCTAssertEqualObjects(expected, actual, @"wrong pwd or not a session leader");
+}
+
+- (void)testBRUTaskPosixSpawnDoesntLeakFDs
+{
+    NSError *error = nil;
+    NSString *file = nil;
+    NSFileHandle *fh = [BRUTemporaryFiles openTemporaryFileInDirectory:nil outFilename:&file error:&error];
+    XCTAssertNotNil(fh, @"file handle nil");
+    XCTAssertNil(error, @"error not nil");
+    BRUTask *t = [[BRUTask alloc] init];
+    t.launchMethod = BRUTaskLaunchMethodPosixSpawn;
+    t.launchPath = @"/bin/zsh";
+    t.arguments = @[@"-c", @"/usr/sbin/lsof -a -d ^cwd,^txt -p $$"];
+    t.standardOutput = fh;
+    BOOL suc = [t launchWithError:&error];
+    XCTAssertTrue(suc, @"launch failed");
+    XCTAssertNil(error, @"error not nil");
+    [t waitUntilExit];
+    [fh closeFile];
+    NSString *s = [NSString stringWithContentsOfFile:file encoding:NSUTF8StringEncoding error:&error];
+    XCTAssertNotNil(s, @"file contents nil");
+    XCTAssertNil(error, @"error not nil");
+    NSArray *lines = [s componentsSeparatedByString:@"\n"];
+    XCTAssertEqual((NSUInteger)7, [lines count], @"wrong number of FDs: %@", s);
+    [[NSFileManager defaultManager] removeItemAtPath:file error:nil];
+}
+
+- (void)testBRUTaskPosixSpawnFailureWhenLaunchPathIsNonExistant
+{
+    NSError *error = nil;
+    BRUTask *t = [[BRUTask alloc] init];
+    t.launchMethod = BRUTaskLaunchMethodPosixSpawn;
+    t.launchPath = @"/This/path/will/NOT/exist/on/your/system/I/hope/:-)";
+    BOOL suc = [t launchWithError:&error];
+    XCTAssertFalse(suc, @"successful executing a non-existant file?");
+    XCTAssertEqual([error domain], NSPOSIXErrorDomain, @"Error domain should be POSIX (file not found).");
+    XCTAssertEqual([error code], (NSInteger)ENOENT, @"Error code should equal ENOENT");
+}
+
+- (void)testBRUTaskWaitForExitWithCompletion
+{
+    BRUTask *t = [[BRUTask alloc] init];
+    t.launchPath = @"/bin/zsh";
+    t.arguments = @[@"-c", @"exit 7"];
+    BRUConcurrentBox<BRUTask *> *box = [BRUConcurrentBox emptyBox];
+    BOOL suc = [t launchWithError:nil];
+    XCTAssertTrue(suc, @"launch failed");
+    [t waitForExitWithCompletion:^(BRUTask *exited) {
+        [box put:exited];
+    }];
+    BRUTask *exited = [box tryTakeUntil:[NSDate dateWithTimeIntervalSinceNow:5]];
+    XCTAssertTrue(exited == t, @"completion not called with the task");
+    XCTAssertFalse(t.running);
+    XCTAssertEqual(7, t.terminationStatus, @"wrong exit code");
+
+    /* already exited, called right away */
+    BRUConcurrentBox<BRUTask *> *lateBox = [BRUConcurrentBox emptyBox];
+    [t waitForExitWithCompletion:^(BRUTask *lateExited) {
+        [lateBox put:lateExited];
+    }];
+    XCTAssertTrue([lateBox tryTakeUntil:[NSDate dateWithTimeIntervalSinceNow:1]] == t,
+                  @"completion not called for exited task");
+}
+
+- (void)testBRUTaskExitPromise
+{
+    BRUTask *t = [[BRUTask alloc] init];
+    t.launchPath = @"/bin/zsh";
+    t.arguments = @[@"-c", @"kill -TERM $$"];
+    BRUConcurrentBox<BRUTask *> *box = [BRUConcurrentBox emptyBox];
+    [[t exitPromise] then:^(id exited) {
+        [box put:exited];
+    }];
+    BOOL suc = [t launchWithError:nil];
+    XCTAssertTrue(suc, @"launch failed");
+    BRUTask *exited = [box tryTakeUntil:[NSDate dateWithTimeIntervalSinceNow:5]];
+    XCTAssertTrue(exited == t, @"promise not resolved with the task");
+    XCTAssertEqual(NSTaskTerminationReasonUncaughtSignal, t.terminationReason, @"wrong termination reason");
+    XCTAssertEqual(SIGTERM, t.terminationStatus, @"wrong signal");
+}
+
+- (void)testBRUTaskWaitUntilExitReturnsPromptlyOnRunLoop
+{
+    BRUTask *t = [[BRUTask alloc] init];
+    t.launchPath = @"/usr/bin/true";
+    BOOL suc = [t launchWithError:nil];
+    XCTAssertTrue(suc, @"launch failed");
+    NSDate *start = [NSDate date];
+    [t waitUntilExit];
+    XCTAssertFalse(t.running);
+    XCTAssertLessThan(-[start timeIntervalSinceNow], 0.5, @"waitUntilExit didn't wake up on exit");
+}
+
+- (void)testBRUTaskResourceUsageIsZeroWithoutAccounting
+{
+    BRUTask *t = [[BRUTask alloc] init];
+    t.launchPath = @"/usr/bin/true";
+    BOOL suc = [t launchWithError:nil];
+    XCTAssertTrue(suc, @"launch failed");
+    [t waitUntilExit];
+    BRUTaskResourceUsage usage = t.resourceUsage;
+    XCTAssertEqual(usage.wallTime, 0.0);
+    XCTAssertEqual(usage.maxResidentSetSize, (uint64_t)0);
+}
+
+- (void)testBRUTaskResourceUsage
+{
+    BRUTask *t = [[BRUTask alloc] init];
+    t.accountsResourceUsage = YES;
+    t.launchPath = @"/bin/zsh";
+    t.arguments = @[@"-c", @"i=0; while (( i < 300000 )); do (( i++ )); done; sleep 0.2"];
+    BOOL suc = [t launchWithError:nil];
+    XCTAssertTrue(suc, @"launch failed");
+    [t waitUntilExit];
+    BRUTaskResourceUsage usage = t.resourceUsage;
+    XCTAssertGreaterThanOrEqual(usage.wallTime, 0.2, @"wall time too short");
+    XCTAssertGreaterThan(usage.userTime + usage.systemTime, 0.0, @"no CPU time recorded");
+    XCTAssertLessThanOrEqual(usage.userTime + usage.systemTime, usage.wallTime + 0.1, @"more CPU than wall time");
+    XCTAssertGreaterThan(usage.maxResidentSetSize, (uint64_t)0, @"no max RSS recorded");
+}
+
+- (void)testBRUTaskResourceUsageIsSampledWhileRunning
+{
+    BRUTask *t = [[BRUTask alloc] init];
+    t.accountsResourceUsage = YES;
+    t.resourceUsageSamplingInterval = 0.05;
+    t.launchPath = @"/bin/sleep";
+    t.arguments = @[@"1"];
+    BOOL suc = [t launchWithError:nil];
+    XCTAssertTrue(suc, @"launch failed");
+    [NSThread sleepForTimeInterval:0.5];
+    XCTAssertTrue(t.running);
+    BRUTaskResourceUsage usage = t.resourceUsage;
+    XCTAssertGreaterThan(usage.wallTime, 0.3, @"not sampled while running");
+    XCTAssertLessThan(usage.wallTime, 1.0, @"sampled wall time beyond now");
+    [t waitUntilExit];
+    XCTAssertGreaterThanOrEqual(t.resourceUsage.wallTime, 1.0, @"final wall time not recorded");
+}
+
+#pragma mark - Benchmarks
+
+- (void)benchmarkLaunchesWithMethod:(BRUTaskLaunchMethod)launchMethod
+{
+    [self measureBlock:^{
+        for (int i=0; i < 100; i++) {
+            BRUTask *t = [[BRUTask alloc] init];
+            t.launchMethod = launchMethod;
+            t.launchPath = @"/usr/bin/true";
+            BOOL suc = [t launchWithError:nil];
+            XCTAssertTrue(suc, @"launch failed");
+            [t waitUntilExit];
+        }
+    }];
+}
+
+- (void)testBenchmarkLaunchRateFork
+{
+    [self benchmarkLaunchesWithMethod:BRUTaskLaunchMethodFork];
+}
+
+- (void)testBenchmarkLaunchRatePosixSpawn
+{
+    [self benchmarkLaunchesWithMethod:BRUTaskLaunchMethodPosixSpawn];
+}
+
 @end
@@ -0,0 +1,147 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "BRUDispatchUtils.h"
+#import "BRUThroughputLimiter.h"
+
+@interface BRUThroughputLimiterTests : XCTestCase
+
+@end
+
+@implementation BRUThroughputLimiterTests
+
+- (BRUThroughputLimiter *)limiterWithRate:(double)rate burst:(NSUInteger)burst mode:(BRUThroughputLimiterMode)mode
+{
+    dispatch_queue_t q = bru_dispatch_queue_create("com.bromium.BRUThroughputLimiterTests", DISPATCH_QUEUE_SERIAL);
+    return [[BRUThroughputLimiter alloc] initWithRate:rate burst:burst mode:mode targetQueue:q];
+}
+
+- (void)testTokenBucketAllowsBurstThenLimits
+{
+    BRUThroughputLimiter *limiter = [self limiterWithRate:1 burst:5 mode:BRUThroughputLimiterModeTokenBucket];
+    for (NSUInteger i = 0; i < 5; i++) {
+        XCTAssertTrue([limiter tryAcquire], @"burst permit %lu not granted", (unsigned long)i);
+    }
+    XCTAssertFalse([limiter tryAcquire], @"permit granted beyond burst");
+}
+
+- (void)testTokenBucketTryAcquireMultiplePermits
+{
+    BRUThroughputLimiter *limiter = [self limiterWithRate:1 burst:5 mode:BRUThroughputLimiterModeTokenBucket];
+    XCTAssertTrue([limiter tryAcquire:3]);
+    XCTAssertFalse([limiter tryAcquire:3]);
+    XCTAssertTrue([limiter tryAcquire:2]);
+}
+
+- (void)testLeakyBucketHasNoBurst
+{
+    BRUThroughputLimiter *limiter = [self limiterWithRate:1 burst:5 mode:BRUThroughputLimiterModeLeakyBucket];
+    XCTAssertTrue([limiter tryAcquire]);
+    XCTAssertFalse([limiter tryAcquire], @"leaky bucket let a burst through");
+}
+
+- (void)testAcquireRunsBlocksAtRate
+{
+    BRUThroughputLimiter *limiter = [self limiterWithRate:100 burst:1 mode:BRUThroughputLimiterModeTokenBucket];
+    dispatch_group_t group = dispatch_group_create();
+    NSDate *start = [NSDate date];
+    for (NSUInteger i = 0; i < 11; i++) {
+        dispatch_group_enter(group);
+        XCTAssertTrue([limiter acquireWithBlock:^{
+            dispatch_group_leave(group);
+        }]);
+    }
+    XCTAssertFalse([limiter tryAcquire], @"tryAcquire overtook the waiters");
+    long timeout = dispatch_group_wait(group, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(3 * NSEC_PER_SEC)));
+    XCTAssertFalse(timeout, @"not all acquisitions granted");
+    XCTAssertGreaterThanOrEqual(-[start timeIntervalSinceNow], 0.09, @"acquisitions granted faster than the rate");
+}
+
+- (void)testAcquireRunsBlocksInOrder
+{
+    BRUThroughputLimiter *limiter = [self limiterWithRate:1000 burst:1 mode:BRUThroughputLimiterModeTokenBucket];
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    NSMutableArray<NSNumber *> *order = [NSMutableArray array]; /* synchronized on the limiter's target queue */
+    for (NSUInteger i = 0; i < 20; i++) {
+        [limiter acquireWithBlock:^{
+            [order addObject:@(i)];
+            if (order.count == 20) {
+                dispatch_semaphore_signal(sem);
+            }
+        }];
+    }
+    long timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(3 * NSEC_PER_SEC)));
+    XCTAssertFalse(timeout, @"not all acquisitions granted");
+    dispatch_sync(limiter.targetQueue, ^{
+        for (NSUInteger i = 0; i < order.count; i++) {
+            XCTAssertEqualObjects(order[i], @(i));
+        }
+    });
+}
+
+- (void)testWaitingAcquisitionsDoNotRetainLimiter
+{
+    __weak BRUThroughputLimiter *weakLimiter = nil;
+    __block BOOL ran = NO;
+    @autoreleasepool {
+        BRUThroughputLimiter *limiter = [self limiterWithRate:1 burst:1 mode:BRUThroughputLimiterModeTokenBucket];
+        weakLimiter = limiter;
+        XCTAssertTrue([limiter tryAcquire]);
+        XCTAssertTrue([limiter acquireWithBlock:^{
+            ran = YES;
+        }]);
+    }
+    /* let the acquisition get parked, the limiter must go away all the same */
+    [NSThread sleepForTimeInterval:0.1];
+    XCTAssertNil(weakLimiter, @"waiting acquisition kept the limiter alive");
+    [NSThread sleepForTimeInterval:1.5];
+    XCTAssertFalse(ran, @"block of a dropped acquisition ran");
+}
+
+- (void)testLeakyBucketOverflows
+{
+    BRUThroughputLimiter *limiter = [self limiterWithRate:10 burst:2 mode:BRUThroughputLimiterModeLeakyBucket];
+    XCTAssertTrue([limiter tryAcquire]);
+    /* the bucket is still leaking the first operation, so these two have to wait */
+    XCTAssertTrue([limiter acquireWithBlock:^{}]);
+    XCTAssertTrue([limiter acquireWithBlock:^{}]);
+    XCTAssertFalse([limiter acquireWithBlock:^{
+        XCTFail(@"overflowing acquisition ran");
+    }]);
+}
+
+#pragma mark - Benchmarks
+
+- (void)testBenchmarkTryAcquireThroughput
+{
+    BRUThroughputLimiter *limiter = [self limiterWithRate:1e12 burst:1000 mode:BRUThroughputLimiterModeTokenBucket];
+    [self measureBlock:^{
+        dispatch_apply(1000000, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(__unused size_t i) {
+            [limiter tryAcquire];
+        });
+    }];
+}
+
+- (void)testBenchmarkAcquireThroughput
+{
+    BRUThroughputLimiter *limiter = [self limiterWithRate:1e12 burst:1000 mode:BRUThroughputLimiterModeTokenBucket];
+    [self measureBlock:^{
+        dispatch_group_t group = dispatch_group_create();
+        for (NSUInteger i = 0; i < 100000; i++) {
+            dispatch_group_enter(group);
+            [limiter acquireWithBlock:^{
+                dispatch_group_leave(group);
+            }];
+        }
+        long timeout = dispatch_group_wait(group, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(60 * NSEC_PER_SEC)));
+        XCTAssertFalse(timeout, @"not all acquisitions granted");
+    }];
+}
+
+@end
@@ -11,7 +11,9 @@
 
 #import "BRUConcurrentBox.h"
 #import "BRUDispatchUtils.h"
+#import "BRUCancellationToken.h"
 #import "BRUTimer.h"
+#import "BRUTimerWheel.h"
 
 @interface BRUTimerTests : XCTestCase
 
@@ -410,5 +412,256 @@
     XCTAssertFalse(mSuc.success, @"timer fired again but it really shouldn't have");
 }
 
+- (void)testInvalidateStopsFiringAndReleasesBlock
+{
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    __weak NSObject *weakCaptured = nil;
+    BRUTimer *timer = nil;
+    @autoreleasepool {
+        NSObject *captured = [NSObject new];
+        weakCaptured = captured;
+        timer = [BRUTimer scheduledTimerWithInterval:0.01
+                                               block:^(__unused BRUTimer *t, __unused NSDate *d) {
+                                                   (void)captured;
+                                                   dispatch_semaphore_signal(sem);
+                                               }
+                                             repeats:YES];
+    }
+    long timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(3 * NSEC_PER_SEC)));
+    XCTAssertFalse(timeout, @"timer didn't fire");
+
+    [timer invalidate];
+    [timer resume];
+    /* let a fire which might have been in flight drain */
+    [NSThread sleepForTimeInterval:0.1];
+    while (!dispatch_semaphore_wait(sem, DISPATCH_TIME_NOW)) {
+    }
+    timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.2 * NSEC_PER_SEC)));
+    XCTAssertTrue(timeout, @"invalidated timer fired");
+    XCTAssertNil(weakCaptured, @"invalidated timer still holds on to its block");
+}
+
+- (void)testCancellationTokenInvalidatesTimer
+{
+    BRUCancellationToken *token = [BRUCancellationToken token];
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    BRUTimer *timer = [[BRUTimer alloc] initWithInterval:0.05
+                                                   block:^(__unused BRUTimer *t, __unused NSDate *d) {
+                                                       dispatch_semaphore_signal(sem);
+                                                   }
+                                                 onQueue:nil
+                                                 repeats:YES
+                                          adjustInterval:nil];
+    [timer invalidateWhenCancelled:token];
+    [timer start];
+    [token cancel];
+    long timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.3 * NSEC_PER_SEC)));
+    XCTAssertTrue(timeout, @"timer fired after its token got cancelled");
+}
+
+- (void)testTimerWithLeewayFires
+{
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    BRUTimer *timer = [[BRUTimer alloc] initWithInterval:0.05
+                                                   block:^(__unused BRUTimer *t, __unused NSDate *d) {
+                                                       dispatch_semaphore_signal(sem);
+                                                   }
+                                                 onQueue:nil
+                                                 repeats:NO
+                                          adjustInterval:nil];
+    timer.leeway = 0.05;
+    NSDate *start = [NSDate date];
+    [timer start];
+    long timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(3 * NSEC_PER_SEC)));
+    XCTAssertFalse(timeout, @"timer with leeway didn't fire");
+    XCTAssertGreaterThanOrEqual(-[start timeIntervalSinceNow], 0.05, @"timer with leeway fired early");
+}
+
+- (void)testCoalescingTimersFireTogether
+{
+    dispatch_queue_t serialQ = bru_dispatch_queue_create("some-test-q", DISPATCH_QUEUE_SERIAL);
+    dispatch_group_t group = dispatch_group_create();
+    NSMutableArray<NSNumber *> *fireTimes = [NSMutableArray array]; /* synchronized on serialQ */
+    NSMutableArray<BRUTimer *> *timers = [NSMutableArray array];
+    const NSTimeInterval leeway = 0.2;
+    for (NSUInteger i = 0; i < 10; i++) {
+        dispatch_group_enter(group);
+        BRUTimer *timer = [[BRUTimer alloc] initWithInterval:0.01 + 0.001 * i
+                                                       block:^(__unused BRUTimer *t, __unused NSDate *d) {
+                                                           [fireTimes addObject:@(BRUMonotonicNanoseconds())];
+                                                           dispatch_group_leave(group);
+                                                       }
+                                                     onQueue:serialQ
+                                                     repeats:NO
+                                              adjustInterval:nil];
+        timer.leeway = leeway;
+        timer.coalescing = YES;
+        [timers addObject:timer];
+    }
+
+    /* start just after a bucket boundary so that all deadlines round up to the same one */
+    uint64_t bucket = (uint64_t)(leeway / 2 * NSEC_PER_SEC);
+    uint64_t now = BRUMonotonicNanoseconds();
+    usleep((useconds_t)((bucket - now % bucket) / NSEC_PER_USEC + 1000));
+    uint64_t deadline = (BRUMonotonicNanoseconds() / bucket + 1) * bucket;
+    for (BRUTimer *timer in timers) {
+        [timer start];
+    }
+
+    long timeout = dispatch_group_wait(group, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(3 * NSEC_PER_SEC)));
+    XCTAssertFalse(timeout, @"coalescing timers didn't fire");
+    dispatch_sync(serialQ, ^{
+        for (NSNumber *fireTime in fireTimes) {
+            XCTAssertGreaterThanOrEqual(fireTime.unsignedLongLongValue, deadline, @"timer didn't fire on the bucket");
+        }
+        NSArray<NSNumber *> *sorted = [fireTimes sortedArrayUsingSelector:@selector(compare:)];
+        /* all share one deadline and each may be deferred by half the leeway, the other half is slack */
+        XCTAssertLessThan(sorted.lastObject.unsignedLongLongValue - sorted.firstObject.unsignedLongLongValue,
+                          2 * bucket, @"coalescing timers didn't fire together");
+    });
+}
+
+#pragma mark - Fixed rate
+
+- (void)testFixedRateTimerFiresOnEvenlySpacedDeadlines
+{
+    dispatch_queue_t serialQ = bru_dispatch_queue_create("some-test-q", DISPATCH_QUEUE_SERIAL);
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    NSMutableArray<NSNumber *> *deadlines = [NSMutableArray array]; /* synchronized on serialQ */
+    BRUTimer *timer = [[BRUTimer alloc] initWithInterval:0.01
+                                          monotonicBlock:^(BRUTimer *t, uint64_t deadline, NSUInteger missedTicks) {
+                                              XCTAssertEqual(missedTicks, (NSUInteger)0);
+                                              XCTAssertGreaterThanOrEqual(BRUMonotonicNanoseconds(), deadline);
+                                              [deadlines addObject:@(deadline)];
+                                              if (deadlines.count == 5) {
+                                                  [t suspend];
+                                                  dispatch_semaphore_signal(sem);
+                                              }
+                                          }
+                                                 onQueue:serialQ
+                                                 repeats:YES
+                                              timerWheel:nil];
+    [timer start];
+    long timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(3 * NSEC_PER_SEC)));
+    XCTAssertFalse(timeout, @"fixed rate timer didn't fire");
+    dispatch_sync(serialQ, ^{
+        for (NSUInteger i = 1; i < deadlines.count; i++) {
+            XCTAssertEqual(deadlines[i].unsignedLongLongValue - deadlines[i - 1].unsignedLongLongValue,
+                           10 * NSEC_PER_MSEC, @"deadlines drifted");
+        }
+    });
+}
+
+- (void)testFixedRateTimerReportsMissedTicksWhenBlockOverruns
+{
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    __block NSUInteger fires = 0; /* only accessed on the timer's serial target queue */
+    __block NSUInteger missed = 0;
+    BRUTimer *timer = [[BRUTimer alloc] initWithInterval:0.01
+                                          monotonicBlock:^(BRUTimer *t, __unused uint64_t d, NSUInteger missedTicks) {
+                                              missed += missedTicks;
+                                              if (++fires == 3) {
+                                                  [t suspend];
+                                                  dispatch_semaphore_signal(sem);
+                                              } else {
+                                                  usleep(55 * 1000);
+                                              }
+                                          }
+                                                 onQueue:nil
+                                                 repeats:YES
+                                              timerWheel:[BRUTimerWheel sharedTimerWheel]];
+    [timer start];
+    long timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(3 * NSEC_PER_SEC)));
+    XCTAssertFalse(timeout, @"fixed rate timer didn't fire");
+    XCTAssertGreaterThanOrEqual(missed, (NSUInteger)6, @"overrunning fires not reported as missed ticks");
+}
+
+#pragma mark - Timer wheel
+
+- (void)testTimerWheelRepeatingTimerFires
+{
+    BRUConcurrentBox<NSDate *> *box = [BRUConcurrentBox emptyBox];
+    BRUTimer *timer = [[BRUTimer alloc] initWithInterval:0.01
+                                                   block:^(__unused BRUTimer *t, NSDate *d) {
+                                                       [box trySwapWithValue:d];
+                                                   }
+                                                 onQueue:nil
+                                                 repeats:YES
+                                                    mode:BRUTimerModeIntervalClockedOnWallClockTime
+                                          adjustInterval:nil
+                                              timerWheel:[BRUTimerWheel sharedTimerWheel]];
+    [timer start];
+    for (NSUInteger i = 0; i < 3; i++) {
+        NSDate *fireDate = [box tryTakeUntil:[NSDate dateWithTimeIntervalSinceNow:10]];
+        XCTAssertNotNil(fireDate, @"timer wheel timer didn't fire");
+    }
+    [timer suspend];
+    /* let a fire which might have been in flight drain */
+    [NSThread sleepForTimeInterval:0.05];
+    [box tryTake];
+    XCTAssertNil([box tryTakeUntil:[NSDate dateWithTimeIntervalSinceNow:0.1]], @"suspended timer wheel timer fired");
+}
+
+- (void)testTimerWheelRestartCancelsPreviouslyRegisteredFireDates
+{
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    BRUTimer *timer = [[BRUTimer alloc] initWithInterval:0.05
+                                                   block:^(__unused BRUTimer *t, __unused NSDate *d) {
+                                                       dispatch_semaphore_signal(sem);
+                                                   }
+                                                 onQueue:nil
+                                                 repeats:NO
+                                                    mode:BRUTimerModeIntervalBetweenBlockExecutions
+                                          adjustInterval:nil
+                                              timerWheel:[BRUTimerWheel sharedTimerWheel]];
+    [timer start];
+    [timer restartWithInterval:0.3];
+    long timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.15 * NSEC_PER_SEC)));
+    XCTAssertTrue(timeout, @"fire of the previous generation not cancelled");
+    timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(3 * NSEC_PER_SEC)));
+    XCTAssertFalse(timeout, @"restarted timer didn't fire");
+    timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.3 * NSEC_PER_SEC)));
+    XCTAssertTrue(timeout, @"non-repeating timer fired twice");
+}
+
+#pragma mark - Benchmarks
+
+- (void)benchmarkTimers:(NSUInteger)count timerWheel:(BRUTimerWheel *)timerWheel
+{
+    dispatch_queue_t targetQ = bru_dispatch_queue_create("com.bromium.BRUTimerTests.benchmark",
+                                                         DISPATCH_QUEUE_SERIAL);
+    [self measureBlock:^{
+        dispatch_semaphore_t done = dispatch_semaphore_create(0);
+        __block NSUInteger fired = 0; /* synchronized on targetQ */
+        NSMutableArray<BRUTimer *> *timers = [NSMutableArray arrayWithCapacity:count];
+        for (NSUInteger i = 0; i < count; i++) {
+            BRUTimer *timer = [[BRUTimer alloc] initWithInterval:0.05 + 0.05 * (double)(i % 100) / 100.0
+                                                           block:^(__unused BRUTimer *t, __unused NSDate *d) {
+                                                               if (++fired == count) {
+                                                                   dispatch_semaphore_signal(done);
+                                                               }
+                                                           }
+                                                         onQueue:targetQ
+                                                         repeats:NO
+                                                            mode:BRUTimerModeIntervalBetweenBlockExecutions
+                                                  adjustInterval:nil
+                                                      timerWheel:timerWheel];
+            [timer start];
+            [timers addObject:timer];
+        }
+        long timeout = dispatch_semaphore_wait(done, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(60 * NSEC_PER_SEC)));
+        XCTAssertFalse(timeout, @"not all timers fired");
+    }];
+}
+
+- (void)testBenchmark100kTimersDispatchAfter
+{
+    [self benchmarkTimers:100000 timerWheel:nil];
+}
+
+- (void)testBenchmark100kTimersTimerWheel
+{
+    [self benchmarkTimers:100000 timerWheel:[BRUTimerWheel sharedTimerWheel]];
+}
 
 @end
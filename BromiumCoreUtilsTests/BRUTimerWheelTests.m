@@ -0,0 +1,126 @@
+//
+//  Copyright (C) 2013-2016, Bromium Inc.
+//
+//  This software may be modified and distributed under the terms
+//  of the BSD license.  See the LICENSE file for details.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "BRUDispatchUtils.h"
+#import "BRUTimer.h"
+#import "BRUTimerWheel.h"
+
+@interface BRUTimerWheelTests : XCTestCase
+
+@end
+
+@implementation BRUTimerWheelTests
+
+- (void)testEntriesExpireInOrderAndNotEarly
+{
+    /* with 0.1ms ticks these intervals cover the first three levels of the wheel */
+    BRUTimerWheel *wheel = [BRUTimerWheel timerWheelWithResolution:0.0001];
+    NSArray<NSNumber *> *intervals = @[@0.5, @0.0005, @0.02, @0.001, @0.25, @0.0001];
+    NSMutableArray<NSNumber *> *fired = [NSMutableArray array];
+    NSMutableArray<BRUTimerWheelEntry *> *entries = [NSMutableArray array];
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+
+    dispatch_sync(wheel.queue, ^{
+        for (NSNumber *interval in intervals) {
+            uint64_t intervalNanoseconds = (uint64_t)(interval.doubleValue * 1e9);
+            /* taken before scheduling, on the wheel's clock, so the lateness can't be negative by chance */
+            uint64_t scheduled = BRUMonotonicNanoseconds();
+            BRUTimerWheelEntry *entry = [BRUTimerWheelEntry entryWithBlock:^{
+                int64_t lateness = (int64_t)(BRUMonotonicNanoseconds() - scheduled - intervalNanoseconds);
+                XCTAssertGreaterThanOrEqual(lateness, 0, @"entry expired early");
+                [fired addObject:interval];
+                if (fired.count == intervals.count) {
+                    dispatch_semaphore_signal(sem);
+                }
+            }];
+            [entries addObject:entry];
+            [wheel scheduleEntry:entry afterInterval:interval.doubleValue];
+            XCTAssertTrue(entry.isScheduled);
+        }
+    });
+
+    long timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(5 * NSEC_PER_SEC)));
+    XCTAssertFalse(timeout, @"not all entries expired");
+    dispatch_sync(wheel.queue, ^{
+        XCTAssertEqualObjects(fired, [intervals sortedArrayUsingSelector:@selector(compare:)]);
+        for (BRUTimerWheelEntry *entry in entries) {
+            XCTAssertFalse(entry.isScheduled);
+        }
+    });
+}
+
+- (void)testUnscheduledEntryDoesNotExpire
+{
+    BRUTimerWheel *wheel = [BRUTimerWheel timerWheelWithResolution:0.001];
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    BRUTimerWheelEntry *entry = [BRUTimerWheelEntry entryWithBlock:^{
+        dispatch_semaphore_signal(sem);
+    }];
+    dispatch_sync(wheel.queue, ^{
+        [wheel scheduleEntry:entry afterInterval:0.01];
+        [wheel unscheduleEntry:entry];
+        XCTAssertFalse(entry.isScheduled);
+        [wheel unscheduleEntry:entry];
+    });
+    long timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.1 * NSEC_PER_SEC)));
+    XCTAssertTrue(timeout, @"unscheduled entry expired");
+}
+
+- (void)testRescheduleMovesEntry
+{
+    BRUTimerWheel *wheel = [BRUTimerWheel timerWheelWithResolution:0.001];
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    __block NSUInteger fires = 0;
+    BRUTimerWheelEntry *entry = [BRUTimerWheelEntry entryWithBlock:^{
+        fires++;
+        dispatch_semaphore_signal(sem);
+    }];
+    dispatch_sync(wheel.queue, ^{
+        [wheel scheduleEntry:entry afterInterval:100];
+        [wheel scheduleEntry:entry afterInterval:0.01];
+    });
+    long timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(2 * NSEC_PER_SEC)));
+    XCTAssertFalse(timeout, @"rescheduled entry didn't expire");
+    dispatch_sync(wheel.queue, ^{
+        XCTAssertEqual(fires, (NSUInteger)1);
+        XCTAssertFalse(entry.isScheduled);
+    });
+}
+
+- (void)testEntryCanRescheduleItselfAndOthers
+{
+    /* coarse ticks so that both entries end up in the same slot */
+    BRUTimerWheel *wheel = [BRUTimerWheel timerWheelWithResolution:0.05];
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    __block NSUInteger fires = 0;
+    __block BRUTimerWheelEntry *other = nil;
+    __block BRUTimerWheelEntry *entry = nil;
+    other = [BRUTimerWheelEntry entryWithBlock:^{
+        XCTFail(@"unscheduled entry expired");
+    }];
+    entry = [BRUTimerWheelEntry entryWithBlock:^{
+        /* `entry` was scheduled last so it's expired first, unscheduling `other` from the slot being expired */
+        [wheel unscheduleEntry:other];
+        if (++fires < 3) {
+            [wheel scheduleEntry:entry afterInterval:0.05];
+        } else {
+            dispatch_semaphore_signal(sem);
+        }
+    }];
+    dispatch_sync(wheel.queue, ^{
+        [wheel scheduleEntry:other afterInterval:0.05];
+        [wheel scheduleEntry:entry afterInterval:0.05];
+    });
+    long timeout = dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(2 * NSEC_PER_SEC)));
+    XCTAssertFalse(timeout, @"entry didn't expire three times");
+    entry = nil;
+    other = nil;
+}
+
+@end